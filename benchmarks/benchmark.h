@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Monotonic time in nanoseconds for timing benchmark loops
+ */
+static inline int64_t benchmark_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Prints one result line: time per iteration and throughput in megabytes of input per second
+ */
+static inline void benchmark_report(const char* name, int width, int height, int iterations, int64_t elapsed_ns,
+                                    size_t bytes_per_iteration) {
+    double ns_per_iteration = (double) elapsed_ns / iterations;
+    double megabytes_per_second = bytes_per_iteration / ns_per_iteration * 1000.0;
+    printf("%-40s %4dx%-4d %10.1f us/frame %10.1f MB/s\n", name, width, height, ns_per_iteration / 1000.0,
+           megabytes_per_second);
+}
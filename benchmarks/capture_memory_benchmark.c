@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "benchmark.h"
+#include "apriltag/common/image_u8.h"
+#include "camera.h"
+#include "frame_arena.h"
+#include "frame_conversion.h"
+
+// Compares the driver mmap buffer layout (one mapping per buffer, default image_u8 allocations) against the
+// USERPTR layout (capture buffers and images carved from one hugepage-backed arena). Frames are converted
+// round-robin across all buffers like a live capture would, so TLB and cache behaviour is part of the result.
+
+#define BUFFER_COUNT 20
+#define ITERATIONS 400
+
+static void fill_yuyv(uint8_t* buffer, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        buffer[i] = (uint8_t) (i * 7);
+    }
+}
+
+static int64_t convert_round_robin(struct buffer* buffers, struct image_u8** images,
+                                   const struct camera_format* format) {
+    // Touch every image once so page faults aren't part of the measurement
+    for (int i = 0; i < BUFFER_COUNT; ++i) {
+        convert_yuyv_to_luma(buffers[i].start, format->sizeimage, format, images[i]);
+    }
+
+    int64_t start = benchmark_now_ns();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        int index = i % BUFFER_COUNT;
+        convert_yuyv_to_luma(buffers[index].start, format->sizeimage, format, images[index]);
+    }
+    return benchmark_now_ns() - start;
+}
+
+static void benchmark_mmap_layout(const struct camera_format* format) {
+    struct buffer buffers[BUFFER_COUNT];
+    struct image_u8* images[BUFFER_COUNT];
+
+    for (int i = 0; i < BUFFER_COUNT; ++i) {
+        buffers[i].length = format->sizeimage;
+        buffers[i].start = mmap(NULL, format->sizeimage, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        fill_yuyv(buffers[i].start, buffers[i].length);
+        images[i] = image_u8_create(format->width, format->height);
+    }
+
+    int64_t elapsed_ns = convert_round_robin(buffers, images, format);
+    benchmark_report("mmap buffers + image_u8_create", format->width, format->height, ITERATIONS, elapsed_ns,
+                     format->sizeimage);
+
+    for (int i = 0; i < BUFFER_COUNT; ++i) {
+        munmap(buffers[i].start, buffers[i].length);
+        image_u8_destroy(images[i]);
+    }
+}
+
+static void benchmark_arena_layout(const struct camera_format* format, bool use_hugepages) {
+    size_t image_length = (format->width + FRAME_ARENA_ALIGNMENT) * format->height;
+    struct frame_arena* arena = frame_arena_create(BUFFER_COUNT * (userptr_buffer_size(format) + image_length),
+                                                   use_hugepages);
+
+    struct v4l2_requestbuffers request_buffers = { .count = BUFFER_COUNT };
+    struct buffer* buffers = allocate_userptr_buffers(arena, &request_buffers, format);
+    struct image_u8* images[BUFFER_COUNT];
+
+    for (int i = 0; i < BUFFER_COUNT; ++i) {
+        fill_yuyv(buffers[i].start, buffers[i].length);
+        images[i] = frame_arena_create_image(arena, format->width, format->height);
+    }
+
+    int64_t elapsed_ns = convert_round_robin(buffers, images, format);
+    benchmark_report(arena->uses_hugepages ? "userptr arena (MAP_HUGETLB)" :
+                     use_hugepages ? "userptr arena (transparent hugepages)" : "userptr arena (4K pages)",
+                     format->width, format->height, ITERATIONS, elapsed_ns, format->sizeimage);
+
+    for (int i = 0; i < BUFFER_COUNT; ++i) {
+        free(images[i]);
+    }
+    free(buffers);
+    frame_arena_destroy(arena);
+}
+
+int main(void) {
+    const int resolutions[][2] = { { 640, 480 }, { 800, 600 }, { 1280, 720 }, { 1920, 1080 } };
+
+    for (int i = 0; i < sizeof(resolutions) / sizeof(resolutions[0]); ++i) {
+        struct camera_format format = {
+            .pixelformat = V4L2_PIX_FMT_YUYV,
+            .width = resolutions[i][0],
+            .height = resolutions[i][1],
+            .bytesperline = resolutions[i][0] * 2,
+            .sizeimage = resolutions[i][0] * resolutions[i][1] * 2,
+            .buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+            .num_planes = 1,
+            .plane_sizes = { resolutions[i][0] * resolutions[i][1] * 2 }
+        };
+
+        benchmark_mmap_layout(&format);
+        benchmark_arena_layout(&format, false);
+        benchmark_arena_layout(&format, true);
+    }
+
+    return 0;
+}
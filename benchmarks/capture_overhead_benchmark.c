@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "benchmark.h"
+#include "camera.h"
+#include "fake_v4l2.h"
+
+// Measures what the capture path itself costs per frame (epoll wakeups, VIDIOC_DQBUF/QBUF and the bookkeeping in
+// capture_frames) against the fake device of libfake_v4l2.so at fps 0, where buffers are ready as soon as they are
+// queued, so nothing but the capture path is timed.
+
+#define FAKE_DEVICE_PATH "/dev/video-fake"
+#define BUFFER_COUNT 8
+#define FRAMES 200000
+
+struct frame_counter {
+    int frames;
+    int max_frames;
+};
+
+static enum capture_action count_frame(const struct frame* frame, void* user_data) {
+    struct frame_counter* counter = user_data;
+    return ++counter->frames == counter->max_frames ? CAPTURE_STOP : CAPTURE_CONTINUE;
+}
+
+static void benchmark_capture_mode(const char* name, enum capture_mode mode) {
+    struct camera_format format;
+    int fd = setup_camera(FAKE_DEVICE_PATH, 640, 480, &format);
+    if (fd == -1)
+        return;
+
+    struct v4l2_requestbuffers* request_buffers = request_mmap_buffers(fd, BUFFER_COUNT, format.buffer_type);
+    struct buffer_queue queue = {
+        .fd = fd,
+        .type = request_buffers->type,
+        .memory = request_buffers->memory,
+        .buffers = map_buffers(fd, request_buffers),
+        .count = request_buffers->count,
+        .num_planes = format.num_planes
+    };
+    queue_buffers(&queue);
+    start_stream(fd, format.buffer_type);
+
+    struct frame_counter counter = { .frames = 0, .max_frames = FRAMES };
+    struct capture_options options = { .timeout_ms = 1000, .mode = mode, .min_bytesused = format.sizeimage };
+    struct capture_stats stats = { 0 };
+
+    int64_t start = benchmark_now_ns();
+    capture_frames(&queue, &options, count_frame, &counter, &stats);
+    int64_t elapsed_ns = benchmark_now_ns() - start;
+
+    unsigned long frames_dequeued = stats.frames_processed + stats.frames_skipped + stats.frames_rejected;
+    printf("%-40s %10.1f ns/frame handled %10.1f ns/buffer dequeued\n", name, (double) elapsed_ns / counter.frames,
+           (double) elapsed_ns / frames_dequeued);
+
+    stop_stream(fd, format.buffer_type);
+    cleanup_buffers(queue.buffers, queue.count);
+    free(request_buffers);
+    close(fd);
+}
+
+int main(void) {
+    struct fake_v4l2_config config;
+    fake_v4l2_default_config(&config);
+    config.device_path = FAKE_DEVICE_PATH;
+    config.fps = 0;
+    fake_v4l2_configure(&config);
+
+    benchmark_capture_mode("capture_frames, all frames", CAPTURE_ALL_FRAMES);
+    benchmark_capture_mode("capture_frames, latest frame", CAPTURE_LATEST_FRAME);
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark.h"
+#include "apriltag/common/image_u8.h"
+#include "apriltag/common/workerpool.h"
+#include "camera.h"
+#include "frame_conversion.h"
+#include "luma_kernels.h"
+
+// Runs convert_yuyv_to_luma with the kernels of every instruction set level the CPU supports. One frame is
+// converted over and over, so this measures the kernels with warm caches, not memory bandwidth
+// (see capture_memory_benchmark for that). Also compares converting and then decimating with image_u8_decimate, as
+// the detector does with quad_decimate, against convert_to_luma_and_decimate, and runs both in row bands on worker
+// pools of increasing size, also while gathering luma statistics and stretching contrast. Finally every supported
+// pixel format is converted with the scalar and the best kernels.
+
+#define ITERATIONS 500
+
+static void benchmark_level(const struct luma_kernels* kernels, const struct camera_format* format,
+                            const uint8_t* frame, struct image_u8* image, double scalar_ns) {
+    set_luma_kernels(kernels->level);
+    convert_yuyv_to_luma(frame, format->sizeimage, format, image);
+
+    int64_t start = benchmark_now_ns();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        convert_yuyv_to_luma(frame, format->sizeimage, format, image);
+    }
+    int64_t elapsed_ns = benchmark_now_ns() - start;
+
+    char name[64];
+    if (scalar_ns > 0)
+        snprintf(name, sizeof(name), "yuyv to luma, %s (%.1fx)", kernels->name, scalar_ns / elapsed_ns);
+    else
+        snprintf(name, sizeof(name), "yuyv to luma, %s", kernels->name);
+    benchmark_report(name, format->width, format->height, ITERATIONS, elapsed_ns, format->sizeimage);
+}
+
+static void benchmark_decimation(const struct camera_format* format, const uint8_t* frame, struct image_u8* image,
+                                 int decimation) {
+    int64_t start = benchmark_now_ns();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        convert_yuyv_to_luma(frame, format->sizeimage, format, image);
+        image_u8_destroy(image_u8_decimate(image, decimation));
+    }
+    int64_t elapsed_ns = benchmark_now_ns() - start;
+
+    char name[64];
+    snprintf(name, sizeof(name), "convert, then image_u8_decimate(%d)", decimation);
+    benchmark_report(name, format->width, format->height, ITERATIONS, elapsed_ns, format->sizeimage);
+
+    struct image_u8* decimated = image_u8_create(decimated_size(format->width, decimation),
+                                                 decimated_size(format->height, decimation));
+    start = benchmark_now_ns();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        convert_to_luma_and_decimate(convert_yuyv_to_luma, frame, format->sizeimage, format, image, decimated,
+                                     decimation);
+    }
+    elapsed_ns = benchmark_now_ns() - start;
+
+    snprintf(name, sizeof(name), "convert_to_luma_and_decimate(%d)", decimation);
+    benchmark_report(name, format->width, format->height, ITERATIONS, elapsed_ns, format->sizeimage);
+    image_u8_destroy(decimated);
+}
+
+static void benchmark_bands(const struct camera_format* format, const uint8_t* frame, struct image_u8* image,
+                            int threads) {
+    workerpool_t* wp = workerpool_create(threads);
+    struct image_u8* decimated = image_u8_create(decimated_size(format->width, 2), decimated_size(format->height, 2));
+
+    int64_t start = benchmark_now_ns();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        convert_to_luma_in_bands(wp, convert_yuyv_to_luma, frame, format->sizeimage, format, image,
+                                 NULL, 0, NULL, NULL);
+    }
+    int64_t elapsed_ns = benchmark_now_ns() - start;
+
+    char name[64];
+    snprintf(name, sizeof(name), "yuyv to luma, %d thread bands", threads);
+    benchmark_report(name, format->width, format->height, ITERATIONS, elapsed_ns, format->sizeimage);
+
+    start = benchmark_now_ns();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        convert_to_luma_in_bands(wp, convert_yuyv_to_luma, frame, format->sizeimage, format, image,
+                                 decimated, 2, NULL, NULL);
+    }
+    elapsed_ns = benchmark_now_ns() - start;
+
+    snprintf(name, sizeof(name), "decimate(2), %d thread bands", threads);
+    benchmark_report(name, format->width, format->height, ITERATIONS, elapsed_ns, format->sizeimage);
+
+    struct luma_stats stats;
+    start = benchmark_now_ns();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        convert_to_luma_in_bands(wp, convert_yuyv_to_luma, frame, format->sizeimage, format, image,
+                                 NULL, 0, &stats, NULL);
+    }
+    elapsed_ns = benchmark_now_ns() - start;
+
+    snprintf(name, sizeof(name), "luma stats, %d thread bands", threads);
+    benchmark_report(name, format->width, format->height, ITERATIONS, elapsed_ns, format->sizeimage);
+
+    struct contrast_stretch stretch;
+    contrast_stretch_from_stats(&stats, 0.2, 4, &stretch);
+    stretch.enabled = true;
+    start = benchmark_now_ns();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        convert_to_luma_in_bands(wp, convert_yuyv_to_luma, frame, format->sizeimage, format, image, decimated, 2,
+                                 &stats, &stretch);
+    }
+    elapsed_ns = benchmark_now_ns() - start;
+
+    snprintf(name, sizeof(name), "stats, stretch, decimate(2), %d thread bands", threads);
+    benchmark_report(name, format->width, format->height, ITERATIONS, elapsed_ns, format->sizeimage);
+
+    image_u8_destroy(decimated);
+    workerpool_destroy(wp);
+}
+
+static const struct {
+    uint32_t pixelformat;
+    int bytes_per_pixel;
+} FORMATS[] = {
+    { V4L2_PIX_FMT_GREY, 1 }, { V4L2_PIX_FMT_NV12, 1 }, { V4L2_PIX_FMT_NV21, 1 }, { V4L2_PIX_FMT_YUYV, 2 },
+    { V4L2_PIX_FMT_YVYU, 2 }, { V4L2_PIX_FMT_UYVY, 2 }, { V4L2_PIX_FMT_VYUY, 2 }, { V4L2_PIX_FMT_Y10, 2 },
+    { V4L2_PIX_FMT_Y16, 2 }, { V4L2_PIX_FMT_RGB24, 3 }, { V4L2_PIX_FMT_BGR24, 3 }
+};
+
+static void benchmark_formats(int width, int height, struct image_u8* image) {
+    for (int i = 0; i < sizeof(FORMATS) / sizeof(FORMATS[0]); ++i) {
+        struct camera_format format = {
+            .pixelformat = FORMATS[i].pixelformat,
+            .width = width,
+            .height = height,
+            .bytesperline = width * FORMATS[i].bytes_per_pixel,
+            .sizeimage = width * height * FORMATS[i].bytes_per_pixel
+        };
+        uint8_t* frame = malloc(format.sizeimage);
+        for (size_t j = 0; j < format.sizeimage; ++j) {
+            frame[j] = (uint8_t) (j * 7);
+        }
+        luma_converter convert = select_luma_converter(format.pixelformat);
+        char fourcc[5];
+        fourcc_to_string(format.pixelformat, fourcc);
+
+        enum simd_level levels[] = { SIMD_SCALAR, detect_simd_level() };
+        for (int j = 0; j < 2; ++j) {
+            set_luma_kernels(levels[j]);
+            convert(frame, format.sizeimage, &format, image);
+
+            int64_t start = benchmark_now_ns();
+            for (int k = 0; k < ITERATIONS; ++k) {
+                convert(frame, format.sizeimage, &format, image);
+            }
+            int64_t elapsed_ns = benchmark_now_ns() - start;
+
+            char name[64];
+            snprintf(name, sizeof(name), "%s to luma, %s", fourcc, get_luma_kernels(levels[j])->name);
+            benchmark_report(name, width, height, ITERATIONS, elapsed_ns, format.sizeimage);
+        }
+        free(frame);
+    }
+    set_luma_kernels(detect_simd_level());
+}
+
+int main(void) {
+    const int resolutions[][2] = { { 640, 480 }, { 800, 600 }, { 1280, 720 }, { 1920, 1080 } };
+    printf("Detected instruction set: %s\n", get_luma_kernels(detect_simd_level())->name);
+
+    for (int i = 0; i < sizeof(resolutions) / sizeof(resolutions[0]); ++i) {
+        struct camera_format format = {
+            .pixelformat = V4L2_PIX_FMT_YUYV,
+            .width = resolutions[i][0],
+            .height = resolutions[i][1],
+            .bytesperline = resolutions[i][0] * 2,
+            .sizeimage = resolutions[i][0] * resolutions[i][1] * 2
+        };
+
+        uint8_t* frame = malloc(format.sizeimage);
+        for (size_t j = 0; j < format.sizeimage; ++j) {
+            frame[j] = (uint8_t) (j * 7);
+        }
+        struct image_u8* image = image_u8_create(format.width, format.height);
+
+        // Time the scalar reference first so every other level can be reported as a speedup over it
+        set_luma_kernels(SIMD_SCALAR);
+        convert_yuyv_to_luma(frame, format.sizeimage, &format, image);
+        int64_t start = benchmark_now_ns();
+        for (int j = 0; j < ITERATIONS; ++j) {
+            convert_yuyv_to_luma(frame, format.sizeimage, &format, image);
+        }
+        double scalar_ns = benchmark_now_ns() - start;
+
+        for (int level = SIMD_SCALAR; level < SIMD_LEVEL_COUNT; ++level) {
+            const struct luma_kernels* kernels = get_luma_kernels(level);
+            if (kernels != NULL)
+                benchmark_level(kernels, &format, frame, image, level == SIMD_SCALAR ? 0 : scalar_ns);
+        }
+
+        set_luma_kernels(detect_simd_level());
+        for (int decimation = 2; decimation <= 4; ++decimation) {
+            benchmark_decimation(&format, frame, image, decimation);
+        }
+        for (int threads = 1; threads <= workerpool_get_nprocs(); threads *= 2) {
+            benchmark_bands(&format, frame, image, threads);
+        }
+        benchmark_formats(format.width, format.height, image);
+
+        image_u8_destroy(image);
+        free(frame);
+    }
+
+    return 0;
+}
@@ -0,0 +1,301 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark.h"
+#include "apriltag/common/image_u8.h"
+#include "camera.h"
+#include "frame_conversion.h"
+#include "jpeg_luma.h"
+
+// Compares what it costs to get a luma image out of an MJPEG frame against converting a YUYV frame of the same scene:
+// the full decode with pjpeg and the 1/8 scale DC-only decode. The frames are encoded here the way UVC cameras send
+// them (baseline, 4:2:2, no Huffman tables, quality 75), from a scene of tag-sized squares over a textured gradient
+// so the blocks carry a realistic amount of AC data.
+
+#define ITERATIONS 100
+#define QUALITY 75
+
+// Quantization tables of the JPEG specification (Annex K.1) in row major order, scaled to QUALITY
+static const uint8_t LUMA_QUANTIZATION[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24, 40, 57, 69, 56,
+    14, 17, 22, 29, 51, 87, 80, 62, 18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+};
+static const uint8_t CHROMA_QUANTIZATION[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+};
+
+struct huffman_code {
+    uint16_t code[256];
+    uint8_t length[256];
+};
+
+struct jpeg_writer {
+    uint8_t* data;
+    size_t length;
+    uint32_t bits;
+    int bit_count;
+};
+
+static void build_huffman_code(const uint8_t counts[16], const uint8_t* symbols, struct huffman_code* huffman) {
+    memset(huffman, 0, sizeof(*huffman));
+    uint16_t code = 0;
+    int symbol_index = 0;
+    for (int length = 1; length <= 16; ++length) {
+        for (int i = 0; i < counts[length - 1]; ++i) {
+            huffman->code[symbols[symbol_index]] = code++;
+            huffman->length[symbols[symbol_index]] = length;
+            symbol_index++;
+        }
+        code <<= 1;
+    }
+}
+
+static void write_bytes(struct jpeg_writer* writer, const uint8_t* bytes, size_t count) {
+    memcpy(writer->data + writer->length, bytes, count);
+    writer->length += count;
+}
+
+static void write_bits(struct jpeg_writer* writer, uint32_t value, int count) {
+    writer->bits = (writer->bits << count) | (value & ((1u << count) - 1));
+    writer->bit_count += count;
+    while (writer->bit_count >= 8) {
+        uint8_t byte = (uint8_t) (writer->bits >> (writer->bit_count - 8));
+        writer->data[writer->length++] = byte;
+        // A 0xff in entropy coded data is followed by a stuffed zero so it isn't taken for a marker
+        if (byte == 0xff)
+            writer->data[writer->length++] = 0;
+        writer->bit_count -= 8;
+    }
+}
+
+/**
+ * Number of bits of the magnitude of a coefficient, the category JPEG codes it with
+ */
+static int magnitude_bits(int value) {
+    int magnitude = value < 0 ? -value : value;
+    int bits = 0;
+    while (magnitude > 0) {
+        bits++;
+        magnitude >>= 1;
+    }
+    return bits;
+}
+
+static void write_coefficient(struct jpeg_writer* writer, int value, int bits) {
+    write_bits(writer, value < 0 ? value - 1 : value, bits);
+}
+
+/**
+ * Transforms, quantizes and entropy codes one block of level shifted samples
+ */
+static void encode_block(struct jpeg_writer* writer, const float samples[64], const uint8_t quantization[64],
+                         const struct huffman_code* dc_code, const struct huffman_code* ac_code, int* previous_dc) {
+    // Basis functions of the DCT, scaled so the 2D transform is a product of two of them
+    static float basis[8][8];
+    if (basis[0][0] == 0) {
+        for (int u = 0; u < 8; ++u) {
+            for (int x = 0; x < 8; ++x) {
+                basis[u][x] = cosf((2 * x + 1) * u * M_PI / 16) * (u == 0 ? M_SQRT1_2 : 1) / 2;
+            }
+        }
+    }
+
+    // Separable transform, the rows first
+    float rows[64];
+    for (int y = 0; y < 8; ++y) {
+        for (int u = 0; u < 8; ++u) {
+            float sum = 0;
+            for (int x = 0; x < 8; ++x) {
+                sum += samples[y * 8 + x] * basis[u][x];
+            }
+            rows[y * 8 + u] = sum;
+        }
+    }
+    int coefficients[64];
+    for (int v = 0; v < 8; ++v) {
+        for (int u = 0; u < 8; ++u) {
+            float sum = 0;
+            for (int y = 0; y < 8; ++y) {
+                sum += rows[y * 8 + u] * basis[v][y];
+            }
+            coefficients[v * 8 + u] = (int) lroundf(sum / quantization[v * 8 + u]);
+        }
+    }
+
+    int dc_difference = coefficients[0] - *previous_dc;
+    *previous_dc = coefficients[0];
+    int bits = magnitude_bits(dc_difference);
+    write_bits(writer, dc_code->code[bits], dc_code->length[bits]);
+    write_coefficient(writer, dc_difference, bits);
+
+    int zero_run = 0;
+    for (int k = 1; k < 64; ++k) {
+        int value = coefficients[JPEG_ZIGZAG[k]];
+        if (value == 0) {
+            zero_run++;
+            continue;
+        }
+        while (zero_run >= 16) {
+            write_bits(writer, ac_code->code[0xf0], ac_code->length[0xf0]);
+            zero_run -= 16;
+        }
+        bits = magnitude_bits(value);
+        int symbol = zero_run << 4 | bits;
+        write_bits(writer, ac_code->code[symbol], ac_code->length[symbol]);
+        write_coefficient(writer, value, bits);
+        zero_run = 0;
+    }
+    if (zero_run > 0)
+        write_bits(writer, ac_code->code[0x00], ac_code->length[0x00]);
+}
+
+static void write_marker_segment(struct jpeg_writer* writer, uint8_t marker, const uint8_t* payload, int length) {
+    uint8_t header[4] = { 0xff, marker, (uint8_t) ((length + 2) >> 8), (uint8_t) (length + 2) };
+    write_bytes(writer, header, sizeof(header));
+    write_bytes(writer, payload, length);
+}
+
+/**
+ * Encodes a YUYV frame as a baseline 4:2:2 JPEG without Huffman tables, like the MJPEG frames of a UVC camera
+ * @return - Number of bytes written to jpeg, which needs room for at least the size of the YUYV frame
+ */
+static size_t encode_yuyv_as_mjpeg(const uint8_t* yuyv, int width, int height, uint8_t* jpeg) {
+    struct jpeg_writer writer = { .data = jpeg };
+    write_bytes(&writer, (const uint8_t[]) { 0xff, 0xd8 }, 2);
+
+    uint8_t quantization[2][64];
+    uint8_t dqt[2 * 65];
+    for (int table = 0; table < 2; ++table) {
+        const uint8_t* base = table == 0 ? LUMA_QUANTIZATION : CHROMA_QUANTIZATION;
+        dqt[table * 65] = table;
+        for (int k = 0; k < 64; ++k) {
+            int value = (base[k] * (200 - 2 * QUALITY) + 50) / 100;
+            quantization[table][k] = value < 1 ? 1 : value > 255 ? 255 : value;
+        }
+        for (int k = 0; k < 64; ++k) {
+            dqt[table * 65 + 1 + k] = quantization[table][JPEG_ZIGZAG[k]];
+        }
+    }
+    write_marker_segment(&writer, 0xdb, dqt, sizeof(dqt));
+
+    uint8_t sof[] = { 8, (uint8_t) (height >> 8), (uint8_t) height, (uint8_t) (width >> 8), (uint8_t) width, 3,
+                      1, 0x21, 0, 2, 0x11, 1, 3, 0x11, 1 };
+    write_marker_segment(&writer, 0xc0, sof, sizeof(sof));
+    uint8_t sos[] = { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+    write_marker_segment(&writer, 0xda, sos, sizeof(sos));
+
+    struct huffman_code dc_codes[2], ac_codes[2];
+    build_huffman_code(JPEG_DC_LUMA_COUNTS, JPEG_DC_SYMBOLS, &dc_codes[0]);
+    build_huffman_code(JPEG_DC_CHROMA_COUNTS, JPEG_DC_SYMBOLS, &dc_codes[1]);
+    build_huffman_code(JPEG_AC_LUMA_COUNTS, JPEG_AC_LUMA_SYMBOLS, &ac_codes[0]);
+    build_huffman_code(JPEG_AC_CHROMA_COUNTS, JPEG_AC_CHROMA_SYMBOLS, &ac_codes[1]);
+
+    // Every MCU is two luma blocks side by side and one block of each chroma component, edges are replicated
+    int previous_dc[3] = { 0, 0, 0 };
+    float samples[64];
+    for (int mcu_y = 0; mcu_y < height; mcu_y += 8) {
+        for (int mcu_x = 0; mcu_x < width; mcu_x += 16) {
+            for (int block = 0; block < 4; ++block) {
+                for (int y = 0; y < 8; ++y) {
+                    int source_y = mcu_y + y < height ? mcu_y + y : height - 1;
+                    const uint8_t* row = &yuyv[source_y * width * 2];
+                    for (int x = 0; x < 8; ++x) {
+                        int source_x = block < 2 ? mcu_x + block * 8 + x : mcu_x + x * 2;
+                        source_x = source_x < width ? source_x : width - 1;
+                        uint8_t value = block < 2 ? row[source_x * 2] : row[(source_x & ~1) * 2 + (block == 2 ? 1 : 3)];
+                        samples[y * 8 + x] = value - 128.0f;
+                    }
+                }
+                int component = block < 2 ? 0 : block - 1;
+                int table = component == 0 ? 0 : 1;
+                encode_block(&writer, samples, quantization[table], &dc_codes[table], &ac_codes[table],
+                             &previous_dc[component]);
+            }
+        }
+    }
+
+    // Pad the last byte with ones
+    if (writer.bit_count > 0)
+        write_bits(&writer, 0x7f, 8 - writer.bit_count);
+    write_bytes(&writer, (const uint8_t[]) { 0xff, 0xd9 }, 2);
+    return writer.length;
+}
+
+/**
+ * Fills a YUYV frame with dark squares on a bright grid over a gradient, with a little noise as sensors add
+ */
+static void render_scene(uint8_t* yuyv, int width, int height) {
+    uint32_t noise = 1;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            noise = noise * 1103515245 + 12345;
+            int luma = 60 + (x + y) * 120 / (width + height) + (int) ((noise >> 16) % 9) - 4;
+            if ((x / 40 + y / 40) % 2 == 0 && (x % 40) > 4 && (y % 40) > 4)
+                luma = (x / 8 + y / 8) % 3 == 0 ? 230 : 25;
+            uint8_t* pixel = &yuyv[(y * width + x) * 2];
+            pixel[0] = (uint8_t) luma;
+            pixel[1] = (uint8_t) (x % 2 == 0 ? 128 + x * 40 / width : 110 + y * 30 / height);
+        }
+    }
+}
+
+int main(void) {
+    const int resolutions[][2] = { { 640, 480 }, { 800, 600 }, { 1280, 720 }, { 1920, 1080 } };
+
+    for (int i = 0; i < sizeof(resolutions) / sizeof(resolutions[0]); ++i) {
+        int width = resolutions[i][0];
+        int height = resolutions[i][1];
+        struct camera_format format = {
+            .pixelformat = V4L2_PIX_FMT_YUYV,
+            .width = width,
+            .height = height,
+            .bytesperline = width * 2,
+            .sizeimage = width * height * 2
+        };
+        uint8_t* yuyv = malloc(format.sizeimage);
+        render_scene(yuyv, width, height);
+        uint8_t* jpeg = malloc(format.sizeimage);
+        size_t jpeg_length = encode_yuyv_as_mjpeg(yuyv, width, height, jpeg);
+        printf("%dx%d MJPEG frame of %zu bytes, %.1f%% of YUYV\n", width, height, jpeg_length,
+               100.0 * jpeg_length / format.sizeimage);
+
+        struct image_u8* image = image_u8_create(width, height);
+        struct image_u8* dc_image = image_u8_create(decimated_size(width, JPEG_BLOCK_SIZE),
+                                                    decimated_size(height, JPEG_BLOCK_SIZE));
+
+        int64_t start = benchmark_now_ns();
+        for (int j = 0; j < ITERATIONS; ++j) {
+            convert_yuyv_to_luma(yuyv, format.sizeimage, &format, image);
+        }
+        benchmark_report("yuyv to luma", width, height, ITERATIONS, benchmark_now_ns() - start, format.sizeimage);
+
+        format.pixelformat = V4L2_PIX_FMT_MJPEG;
+        start = benchmark_now_ns();
+        for (int j = 0; j < ITERATIONS; ++j) {
+            if (convert_mjpeg_to_luma(jpeg, jpeg_length, &format, image) == -1) {
+                printf("Unable to decode the frame\n");
+                return 1;
+            }
+        }
+        benchmark_report("mjpeg, pjpeg decode and luma copy", width, height, ITERATIONS, benchmark_now_ns() - start,
+                         jpeg_length);
+
+        start = benchmark_now_ns();
+        for (int j = 0; j < ITERATIONS; ++j) {
+            convert_mjpeg_to_dc_luma(jpeg, jpeg_length, &format, dc_image);
+        }
+        benchmark_report("mjpeg, 1/8 scale dc only decode", width, height, ITERATIONS, benchmark_now_ns() - start,
+                         jpeg_length);
+
+        image_u8_destroy(dc_image);
+        image_u8_destroy(image);
+        free(jpeg);
+        free(yuyv);
+    }
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "benchmark.h"
+#include "apriltag/common/image_u8.h"
+#include "apriltag_detection.h"
+#include "frame_conversion.h"
+#include "frame_source.h"
+
+// Replays a recording through luma conversion and tag detection and reports throughput and per-frame latency
+// (time from a frame becoming due until detection on it finished). Usage:
+//   replay_benchmark                                  synthetic YUYV recording
+//   replay_benchmark <recording> <width> <height>     raw YUYV recording
+//   replay_benchmark <directory>                      directory of .pgm images
+// Add --realtime <fps> to pace the replay like a camera instead of replaying as fast as possible.
+
+#define SYNTHETIC_WIDTH 1280
+#define SYNTHETIC_HEIGHT 720
+#define SYNTHETIC_FRAMES 60
+
+static struct camera_format yuyv_format(uint32_t width, uint32_t height) {
+    return (struct camera_format) {
+        .pixelformat = V4L2_PIX_FMT_YUYV,
+        .width = width,
+        .height = height,
+        .bytesperline = width * 2,
+        .sizeimage = width * 2 * height,
+        .buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .num_planes = 1,
+        .plane_sizes = { width * 2 * height }
+    };
+}
+
+/**
+ * Writes a recording of moving gradients to a temporary file so the benchmark runs without any input
+ */
+static int write_synthetic_recording(char* path, const struct camera_format* format) {
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("Unable to create synthetic recording");
+        return -1;
+    }
+
+    uint8_t* frame = malloc(format->sizeimage);
+    for (int i = 0; i < SYNTHETIC_FRAMES; ++i) {
+        for (uint32_t y = 0; y < format->height; ++y) {
+            for (uint32_t x = 0; x < format->bytesperline; ++x) {
+                frame[y * format->bytesperline + x] = (uint8_t) (x + y * 3 + i * 5);
+            }
+        }
+        if (write(fd, frame, format->sizeimage) != (ssize_t) format->sizeimage) {
+            perror("Unable to write synthetic recording");
+            free(frame);
+            close(fd);
+            return -1;
+        }
+    }
+
+    free(frame);
+    close(fd);
+    return 0;
+}
+
+static int run_replay(struct frame_source* source, apriltag_detector_t* detector) {
+    luma_converter convert_to_luma = select_luma_converter(source->format.pixelformat);
+    if (convert_to_luma == NULL) {
+        printf("%s: No luma converter for the recording format\n", source->name);
+        return -1;
+    }
+
+    struct image_u8* luma_image = image_u8_create(source->format.width, source->format.height);
+    int64_t total_latency_us = 0;
+    int64_t max_latency_us = 0;
+    int frames = 0;
+
+    frame_source_start(source);
+    int64_t start = benchmark_now_ns();
+
+    struct source_frame frame;
+    int result;
+    while ((result = frame_source_next_frame(source, 1000, &frame)) != -ENODATA) {
+        if (result < 0) {
+            errno = -result;
+            perror("frame_source_next_frame");
+            break;
+        }
+
+        convert_to_luma(frame.data, frame.frame.bytesused, &source->format, luma_image);
+        detect_april_tag(luma_image, detector);
+
+        int64_t latency_us = frame_age_us(&frame.frame);
+        total_latency_us += latency_us;
+        if (latency_us > max_latency_us)
+            max_latency_us = latency_us;
+
+        frame_source_release_frame(source, &frame);
+        frames++;
+    }
+
+    int64_t elapsed_ns = benchmark_now_ns() - start;
+    frame_source_stop(source);
+    image_u8_destroy(luma_image);
+
+    if (frames == 0)
+        return -1;
+
+    benchmark_report(source->name, source->format.width, source->format.height, frames, elapsed_ns,
+                     source->format.sizeimage);
+    printf("%d frames, %.1f fps, latency avg %lld us, max %lld us\n", frames, frames * 1e9 / elapsed_ns,
+           (long long) (total_latency_us / frames), (long long) max_latency_us);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    struct replay_options options = { .pacing = REPLAY_AS_FAST_AS_POSSIBLE, .fps = 0, .loop = false };
+    if (argc >= 3 && strcmp(argv[argc - 2], "--realtime") == 0) {
+        options.pacing = REPLAY_REALTIME;
+        options.fps = atof(argv[argc - 1]);
+        argc -= 2;
+    }
+
+    char synthetic_path[] = "/tmp/replay_benchmark_XXXXXX";
+    bool synthetic = argc == 1;
+    struct frame_source* source;
+
+    if (synthetic) {
+        struct camera_format format = yuyv_format(SYNTHETIC_WIDTH, SYNTHETIC_HEIGHT);
+        if (write_synthetic_recording(synthetic_path, &format) == -1)
+            return 1;
+        source = frame_source_open_raw_recording(synthetic_path, &format, &options);
+        if (source != NULL)
+            source->name = "synthetic YUYV recording";
+    } else if (argc == 4) {
+        struct camera_format format = yuyv_format(atoi(argv[2]), atoi(argv[3]));
+        source = frame_source_open_raw_recording(argv[1], &format, &options);
+    } else if (argc == 2) {
+        source = frame_source_open_pgm_directory(argv[1], &options);
+    } else {
+        printf("Usage: %s [<recording> <width> <height> | <pgm directory>] [--realtime <fps>]\n", argv[0]);
+        return 1;
+    }
+
+    if (source == NULL) {
+        if (synthetic)
+            unlink(synthetic_path);
+        return 1;
+    }
+
+    apriltag_family_t* apriltag_family = tag16h5_create();
+    apriltag_detector_t* apriltag_detector = apriltag_detector_create();
+    apriltag_detector_add_family(apriltag_detector, apriltag_family);
+
+    int result = run_replay(source, apriltag_detector);
+
+    apriltag_detector_destroy(apriltag_detector);
+    tag16h5_destroy(apriltag_family);
+    frame_source_close(source);
+    if (synthetic)
+        unlink(synthetic_path);
+    return result == 0 ? 0 : 1;
+}
@@ -4,5 +4,52 @@
 #include "apriltag/common/image_types.h"
 #include "camera.h"
 
+/**
+ * Where a detected tag's corners are, in full resolution pixel coordinates of the searched image
+ * corners - The corners, counter-clockwise around the tag in the order apriltag reports them
+ * center - The tag's center
+ */
+struct tag_corners {
+    double corners[4][2];
+    double center[2];
+};
+
 int detect_april_tag(struct image_u8* image, apriltag_detector_t* detector);
-void prepare_frame_for_processing(struct buffer* buffer, struct image_u8* apriltag_image);
+
+/**
+ * The detector's worker pool, (re)created with the detector's nthreads the same way apriltag_detector_detect does, so
+ * work that runs before the first detection (ex: conversion) can share the pool
+ * @param detector - The detector that owns the pool
+ * @return - The pool or NULL if it could not be created
+ */
+workerpool_t* detector_workerpool(apriltag_detector_t* detector);
+
+/**
+ * Same as detect_april_tag but also reports where the tag is
+ * @param image - The image to search
+ * @param detector - The detector to use
+ * @param bounds - Filled with the bounding box of the tag's corners (clipped to the image) when a tag is found
+ * @param corners - Filled with the tag's corners when a tag is found, may be NULL
+ * @return - The id of the detected tag or -1 if no tag was found
+ */
+int detect_april_tag_with_bounds(struct image_u8* image, apriltag_detector_t* detector,
+                                 struct region_of_interest* bounds, struct tag_corners* corners);
+
+/**
+ * Searches an image that was decimated while it was converted (see convert_to_luma_and_decimate), so quad search
+ * starts right away instead of the detector decimating a full resolution copy first. The detector's quad_decimate is
+ * ignored for the call. Unlike the detector's own decimation, tags are also decoded on the decimated image, so small
+ * or distant tags are found less reliably than by detect_april_tag on the full image
+ * @param decimated_image - The decimated image to search
+ * @param decimation - Factor the image was decimated by
+ * @param width - Width of the full resolution image
+ * @param height - Height of the full resolution image
+ * @param detector - The detector to use
+ * @param bounds - Filled with the bounding box of the tag's corners in full resolution coordinates when a tag is
+ *                 found, may be NULL
+ * @param corners - Filled with the tag's corners in full resolution coordinates when a tag is found, may be NULL
+ * @return - The id of the detected tag or -1 if no tag was found
+ */
+int detect_april_tag_in_decimated(struct image_u8* decimated_image, int decimation, uint32_t width, uint32_t height,
+                                  apriltag_detector_t* detector, struct region_of_interest* bounds,
+                                  struct tag_corners* corners);
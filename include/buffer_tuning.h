@@ -0,0 +1,63 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * Smallest number of buffers that lets the driver keep capturing while a frame is processed
+ * @param processing_us - How long the application holds on to a frame
+ * @param frame_interval_us - Time between two frames
+ * @return - One buffer for every frame completed during processing plus the one being processed
+ */
+int buffer_count_for_processing_time(int64_t processing_us, double frame_interval_us);
+
+/**
+ * Picks the smallest buffer count that keeps the driver from dropping frames.
+ *
+ * Processing times and driver drops are collected over windows of window_frames frames. A window with drops grows the
+ * count to at least what the slowest frame of the window needed. After SHRINK_AFTER_CLEAN_WINDOWS windows without
+ * drops the count shrinks one buffer at a time towards what the slowest frame needed. A count that dropped frames
+ * becomes the floor, so the tuner settles instead of shrinking into drops again.
+ *
+ * frame_interval_us - Time between two frames at the configured frame rate
+ * min_count, max_count - Range of buffer counts the tuner picks from
+ * count - The buffer count currently in use
+ */
+struct buffer_count_tuner {
+    double frame_interval_us;
+    int min_count;
+    int max_count;
+    int count;
+    uint32_t window_frames;
+    uint32_t frames_in_window;
+    int64_t max_processing_us;
+    unsigned long dropped_at_window_start;
+    uint32_t clean_windows;
+};
+
+/**
+ * Sets up a tuner
+ * @param tuner - The tuner to set up
+ * @param frame_interval_us - Time between two frames at the configured frame rate
+ * @param count - The buffer count currently in use
+ * @param min_count - Fewest buffers the tuner picks, at least 2
+ * @param max_count - Most buffers the tuner picks
+ * @param window_frames - Number of frames measured before the count is reconsidered
+ */
+void buffer_count_tuner_init(struct buffer_count_tuner* tuner, double frame_interval_us, int count, int min_count,
+                             int max_count, uint32_t window_frames);
+
+/**
+ * Records a processed frame and reconsiders the buffer count at the end of every window
+ * @param tuner - The tuner
+ * @param processing_us - How long the frame was held before its buffer was re-queued
+ * @param frames_dropped - Total number of frames the driver dropped so far (capture_stats.frames_dropped)
+ * @return - The buffer count to switch to (see resize_buffer_queue) or 0 to keep the current one
+ */
+int buffer_count_tuner_record(struct buffer_count_tuner* tuner, int64_t processing_us, unsigned long frames_dropped);
+
+/**
+ * Tells the tuner the buffer queue was resized, the next window starts from scratch
+ * @param tuner - The tuner
+ * @param count - The number of buffers the driver granted
+ * @param frames_dropped - Total number of frames the driver dropped so far
+ */
+void buffer_count_tuner_resized(struct buffer_count_tuner* tuner, int count, unsigned long frames_dropped);
@@ -1,29 +1,149 @@
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
 #include <linux/videodev2.h>
+#include "frame_arena.h"
 
 /**
- * Setup the camera in YUYV format
+ * The capture format the camera agreed to, as reported by VIDIOC_G_FMT
+ * For multi-planar formats bytesperline and sizeimage describe the first (luma) plane
+ * buffer_type - V4L2_BUF_TYPE_VIDEO_CAPTURE or V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+ * num_planes - Number of separately allocated planes per buffer (1 for single-planar formats)
+ * plane_sizes - sizeimage of every plane
+ */
+struct camera_format {
+    uint32_t pixelformat;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesperline;
+    uint32_t sizeimage;
+    uint32_t buffer_type;
+    uint32_t num_planes;
+    uint32_t plane_sizes[VIDEO_MAX_PLANES];
+};
+
+/**
+ * Converts a V4L2 fourCC code into a printable, null-terminated string
+ * @param pixelformat - The V4L2_PIX_FMT_* code
+ * @param fourcc - Output buffer for the 4 characters and the terminator
+ */
+void fourcc_to_string(uint32_t pixelformat, char fourcc[5]);
+
+/**
+ * Picks the most preferred pixel format offered by the camera (VIDIOC_ENUM_FMT).
+ * Preference order: GREY, NV12, NV12M, NV21, YUYV, UYVY, YVYU, VYUY, Y16, Y10, RGB24, BGR24, MJPEG, unless a format
+ * was preferred with set_preferred_pixel_format
+ * @param fd - File descriptor to open device
+ * @param buffer_type - V4L2_BUF_TYPE_VIDEO_CAPTURE or V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+ * @return - The chosen V4L2_PIX_FMT_* code or 0 if the camera offers none of them
+ */
+uint32_t negotiate_pixel_format(int fd, uint32_t buffer_type);
+
+/**
+ * Makes negotiate_pixel_format choose a format whenever the camera offers it, ahead of the preference order
+ * (ex: MJPEG, which fits higher resolutions and frame rates through USB2 than any uncompressed format)
+ * @param pixelformat - One of the supported V4L2_PIX_FMT_* codes, 0 to go back to the preference order
+ */
+void set_preferred_pixel_format(uint32_t pixelformat);
+
+/**
+ * Adjusts the requested frame size to the closest size the camera offers for a pixel format (VIDIOC_ENUM_FRAMESIZES).
+ * Leaves the size untouched if the driver doesn't enumerate frame sizes
+ * @param fd - File descriptor to open device
+ * @param pixelformat - The V4L2_PIX_FMT_* code the sizes are enumerated for
+ * @param width - Requested width, replaced by the chosen width
+ * @param height - Requested height, replaced by the chosen height
+ */
+void choose_frame_size(int fd, uint32_t pixelformat, uint32_t* width, uint32_t* height);
+
+/**
+ * Setup the camera in the most preferred pixel format it supports (see negotiate_pixel_format). Devices that only
+ * offer the multi-planar API are set up with V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
  * @param camera_file_path - File path to the camera (ex: /dev/video0)
  * @param width - Desired width of image from camera
  * @param height - Desired height of image from camera
+ * @param format - Filled with the format the camera actually agreed to
  * @return fd - The file descriptor to the camera in use or -1 if an error occurred
  */
-int setup_camera(char* camera_file_path, int width, int height);
+int setup_camera(char* camera_file_path, int width, int height, struct camera_format* format);
+
+/**
+ * A rectangle of the full sensor image in pixels
+ */
+struct region_of_interest {
+    uint32_t left;
+    uint32_t top;
+    uint32_t width;
+    uint32_t height;
+};
+
+/**
+ * Asks the driver to crop the captured image to a region (VIDIOC_S_SELECTION with V4L2_SEL_TGT_CROP) so only the region
+ * is transferred. Must be called before buffers are requested. If the driver can't deliver exactly the region
+ * unscaled the crop is reset and the caller should crop in software instead
+ * @param fd - File descriptor to open device
+ * @param format - The format returned by setup_camera, updated with the cropped size on success
+ * @param region - The region to capture
+ * @return - 0 if the camera now delivers exactly the region, -1 otherwise
+ */
+int set_hardware_crop(int fd, struct camera_format* format, const struct region_of_interest* region);
+
+/**
+ * Converts a V4L2 frame interval (seconds per frame) into frames per second
+ * @param interval - The frame interval
+ * @return - Frames per second or 0 for an invalid interval
+ */
+double frame_interval_to_fps(struct v4l2_fract interval);
+
+/**
+ * Picks the frame interval closest to the requested frame rate among those the camera offers for the current format
+ * (VIDIOC_ENUM_FRAMEINTERVALS) and applies it with VIDIOC_S_PARM
+ * @param fd - File descriptor to open device
+ * @param format - The format returned by setup_camera
+ * @param fps - Requested frames per second (ex: 30, 60 or 90)
+ * @param achieved_interval - Filled with the interval the driver reports through VIDIOC_G_PARM afterwards
+ * @return - 0 for success, -1 if the driver doesn't support setting the frame interval or an error occurred
+ */
+int set_frame_rate(int fd, const struct camera_format* format, uint32_t fps, struct v4l2_fract* achieved_interval);
 
 /**
  * Get mmap buffer information
  * @param camera_fd - An open file descriptor to be used
+ * @param buffer_count - The requested number of buffers, the driver may grant more or fewer
+ * @param buffer_type - The buffer_type of the format returned by setup_camera
+ * @return request_buffers - a pointer to a v4l2_requestbuffers struct (count holds the granted number of buffers) or
+ *                           null if an error occurred
+ */
+struct v4l2_requestbuffers* request_mmap_buffers(int camera_file_descriptor, int buffer_count, uint32_t buffer_type);
+
+/**
+ * Get userptr buffer information, the buffers themselves are provided by the caller (see allocate_userptr_buffers)
+ * @param camera_fd - An open file descriptor to be used
  * @param buffer_count - The requested number of buffers
+ * @param buffer_type - The buffer_type of the format returned by setup_camera
  * @return request_buffers - a pointer to a v4l2_requestbuffers struct or null if an error occurred
  */
-struct v4l2_requestbuffers* request_mmap_buffers(int camera_file_descriptor, int buffer_count);
+struct v4l2_requestbuffers* request_userptr_buffers(int camera_file_descriptor, int buffer_count,
+                                                    uint32_t buffer_type);
+
+/**
+ * One separately allocated plane of a capture buffer
+ */
+struct buffer_plane {
+    void *start;
+    size_t length;
+};
 
 /**
- * A struct containing a pointer to a mmapped buffer (mapped during map_buffers)
+ * A struct containing a pointer to a capture buffer (mapped during map_buffers or carved from a frame arena during
+ * allocate_userptr_buffers). start and length always describe the first plane, which holds the luma samples
  */
 struct buffer {
     void *start;
     size_t length;
+    unsigned int num_planes;
+    struct buffer_plane planes[VIDEO_MAX_PLANES];
 };
 
 /**
@@ -34,6 +154,24 @@ struct buffer {
  */
 struct buffer* map_buffers(int fd, struct v4l2_requestbuffers* request_buffers);
 
+/**
+ * Carves one page-aligned capture buffer (one block per plane) per requested buffer out of a frame arena
+ * @param arena - The arena the buffers are allocated from, it owns the memory of the buffers
+ * @param request_buffers - The result from a call to request_userptr_buffers
+ * @param format - The format returned by setup_camera, its plane sizes determine the buffer sizes
+ * @return - A pointer to an array of buffer structs (release it with free, not cleanup_buffers) or null if the arena
+ *           is too small
+ */
+struct buffer* allocate_userptr_buffers(struct frame_arena* arena, struct v4l2_requestbuffers* request_buffers,
+                                        const struct camera_format* format);
+
+/**
+ * Arena space taken by one buffer allocated with allocate_userptr_buffers
+ * @param format - The format returned by setup_camera
+ * @return - Size in bytes, every plane rounded up to whole pages
+ */
+size_t userptr_buffer_size(const struct camera_format* format);
+
 /**
  * Unmaps and frees an array of buffer structs
  * @param buffers - a pointer to an array of buffer structs
@@ -42,37 +180,206 @@ struct buffer* map_buffers(int fd, struct v4l2_requestbuffers* request_buffers);
 void cleanup_buffers(struct buffer* buffers, size_t buffers_length);
 
 /**
- * Queue buffers 0 through num_buffers
- * @param fd - Open file descriptor to the device
- * @param num_buffers - The total number of buffers to queue
+ * Exports every single-planar mmap buffer as a dmabuf file descriptor (VIDIOC_EXPBUF) so it can be shared with other
+ * processes
+ * @param fd - The file descriptor of the open device
+ * @param request_buffers - The result from a call to request_mmap_buffers
+ * @return - A pointer to an array of request_buffers->count dmabuf file descriptors or null if an error occurred
+ */
+int* export_buffers(int fd, struct v4l2_requestbuffers* request_buffers);
+
+/**
+ * Closes and frees an array of dmabuf file descriptors returned by export_buffers
+ * @param dmabuf_fds - a pointer to an array of dmabuf file descriptors
+ * @param dmabuf_fds_length - Number of file descriptors in the array
  */
-void queue_buffers(int fd, size_t num_buffers);
+void close_exported_buffers(int* dmabuf_fds, size_t dmabuf_fds_length);
+
+/**
+ * Everything needed to move capture buffers between the application and the driver
+ * fd - Open file descriptor to the device
+ * type - V4L2_BUF_TYPE_* of the buffers (request_buffers->type)
+ * memory - V4L2_MEMORY_MMAP or V4L2_MEMORY_USERPTR (request_buffers->memory)
+ * buffers - The result of map_buffers or allocate_userptr_buffers
+ * count - Number of buffers in the array
+ * num_planes - Planes per buffer (format->num_planes)
+ */
+struct buffer_queue {
+    int fd;
+    uint32_t type;
+    uint32_t memory;
+    struct buffer* buffers;
+    size_t count;
+    uint32_t num_planes;
+};
+
+/**
+ * Queue every buffer of the queue
+ * @param queue - The buffers to queue
+ */
+void queue_buffers(struct buffer_queue* queue);
+
+/**
+ * Describes a dequeued buffer, filled from the struct v4l2_buffer returned by VIDIOC_DQBUF
+ * index - Index of the buffer in the array returned by map_buffers
+ * bytesused - Number of bytes of image data the driver wrote into the buffer (into the first plane for multi-planar
+ *             formats)
+ * timestamp - Time the driver captured the frame (CLOCK_MONOTONIC when flags has V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+ * sequence - Frame counter maintained by the driver, gaps mean the driver dropped frames
+ * flags - V4L2_BUF_FLAG_* flags, V4L2_BUF_FLAG_ERROR marks frames with corrupted data
+ */
+struct frame {
+    int index;
+    uint32_t bytesused;
+    struct timeval timestamp;
+    uint32_t sequence;
+    uint32_t flags;
+};
 
 /**
  * Tries to dequeue a buffer
- * @param fd - File descriptor to open device
- * @return The index of the dequeued buffer or < 0 for an error
+ * @param queue - The buffer queue of the open device
+ * @param frame - Filled with the descriptor of the dequeued buffer on success
+ * @return 0 on success or a negated errno value for an error (-EAGAIN means no buffer was ready yet)
+ */
+int dequeue_buffer(struct buffer_queue* queue, struct frame* frame);
+
+/**
+ * Checks whether a dequeued frame is worth spending detector time on
+ * @param frame - Descriptor returned by dequeue_buffer
+ * @param min_bytesused - Smallest bytesused value a complete frame can have
+ * @return - false if the driver flagged the frame as corrupted or delivered a short frame
+ */
+bool is_frame_usable(const struct frame* frame, uint32_t min_bytesused);
+
+/**
+ * Time elapsed since the driver captured the frame
+ * @param frame - Descriptor returned by dequeue_buffer
+ * @return - Age of the frame in microseconds or -1 if the driver doesn't use monotonic timestamps
  */
-int dequeue_buffer(int fd);
+int64_t frame_age_us(const struct frame* frame);
 
 /**
  * Re-queues a buffer (identified by its index) so that it can be used again
- * @param fd - File descriptor to open device
+ * @param queue - The buffer queue of the open device
  * @param buffer_index - Index of the buffer to re-queue
- * @return
+ * @return - 0 for success, -1 for failure (passes return value from ioctl VIDIOC_QBUF call)
  */
-int requeue_buffer(int fd, int buffer_index);
+int requeue_buffer(struct buffer_queue* queue, int buffer_index);
 
 /**
  * Starts the camera stream
  * @param fd - The file descriptor for the open video capture device
+ * @param buffer_type - The buffer_type of the format returned by setup_camera
  * @return - 0 for success, -1 for failure (passes return value from ioctl VIDIOC_STREAMON call )
  */
-int start_stream(int fd);
+int start_stream(int fd, uint32_t buffer_type);
 
 /**
  * Stops the camera stream
  * @param fd - The file descriptor for the open video capture device
+ * @param buffer_type - The buffer_type of the format returned by setup_camera
  * @return - 0 for success, -1 for failure (passes return value from ioctl VIDIOC_STREAMOFF call )
  */
-int stop_stream(int fd);
\ No newline at end of file
+int stop_stream(int fd, uint32_t buffer_type);
+
+/**
+ * Replaces the buffers of a streaming mmap queue with a different number of buffers. The stream is stopped, the old
+ * buffers are unmapped and released, the new ones are mapped, queued and the stream is started again. Frames the
+ * camera captures in between are lost and drivers usually restart their sequence numbers
+ * @param queue - The buffer queue of the open device, updated with the new buffers
+ * @param buffer_count - The requested number of buffers, the driver may grant a different number
+ * @return request_buffers - The new v4l2_requestbuffers or null if an error occurred, the queue then holds no buffers
+ */
+struct v4l2_requestbuffers* resize_buffer_queue(struct buffer_queue* queue, int buffer_count);
+
+/**
+ * Return value of a frame_handler, tells capture_frames what to do next
+ */
+enum capture_action {
+    CAPTURE_CONTINUE,
+    CAPTURE_STOP,
+    // Keep capturing but don't re-queue the buffer, whoever holds it calls requeue_buffer when done
+    CAPTURE_HOLD,
+    // Leave the capture loop without re-queuing the buffer, like CAPTURE_HOLD for the last frame
+    CAPTURE_STOP_HOLD
+};
+
+/**
+ * Called by capture_frames for every usable buffer the driver completes. The buffer is re-queued once the handler
+ * returns unless it returns CAPTURE_HOLD or CAPTURE_STOP_HOLD
+ * @param frame - Descriptor of the dequeued buffer
+ * @param user_data - The pointer passed to capture_frames
+ * @return CAPTURE_CONTINUE to keep capturing, CAPTURE_HOLD to keep capturing without re-queuing the buffer,
+ *         CAPTURE_STOP to leave the capture loop or CAPTURE_STOP_HOLD to leave it without re-queuing the buffer
+ */
+typedef enum capture_action (*frame_handler)(const struct frame* frame, void* user_data);
+
+/**
+ * How capture_frames picks buffers when more than one has completed since the last wakeup
+ * CAPTURE_ALL_FRAMES - Hand every completed buffer to the handler, oldest first
+ * CAPTURE_LATEST_FRAME - Re-queue all but the newest completed buffer right away and only hand over the newest
+ */
+enum capture_mode {
+    CAPTURE_ALL_FRAMES,
+    CAPTURE_LATEST_FRAME
+};
+
+/**
+ * Settings for capture_frames
+ */
+struct capture_options {
+    int timeout_ms;
+    enum capture_mode mode;
+    // Frames with fewer bytes than this are re-queued without being handed to the handler
+    uint32_t min_bytesused;
+    // Optional descriptor watched alongside the camera (ex: frame_broker_fd), only used when auxiliary_handler is set
+    int auxiliary_fd;
+    // Called with the user_data of capture_frames whenever auxiliary_fd becomes readable
+    void (*auxiliary_handler)(void* user_data);
+};
+
+/**
+ * Counters maintained by capture_frames
+ * frames_processed - Frames handed to the frame handler
+ * frames_skipped - Stale frames re-queued by CAPTURE_LATEST_FRAME
+ * frames_rejected - Frames flagged with V4L2_BUF_FLAG_ERROR or shorter than min_bytesused
+ * frames_dropped - Frames the driver dropped, counted from gaps in the sequence numbers
+ */
+struct capture_stats {
+    unsigned long frames_processed;
+    unsigned long frames_skipped;
+    unsigned long frames_rejected;
+    unsigned long frames_dropped;
+    bool has_sequence;
+    uint32_t last_sequence;
+};
+
+/**
+ * Updates frames_dropped from the gap between the frame's sequence number and the previous one
+ * @param stats - Counters to update
+ * @param frame - Descriptor of a dequeued buffer, must be called for every dequeued buffer in order
+ */
+void record_frame_sequence(struct capture_stats* stats, const struct frame* frame);
+
+/**
+ * Dequeues every buffer the driver has completed, re-queues all but the newest and returns the newest
+ * @param queue - The buffer queue of the open device
+ * @param frame - Filled with the descriptor of the newest dequeued buffer on success
+ * @param stats - frames_skipped is incremented for every stale buffer re-queued without processing
+ * @return 0 on success or a negated errno value for an error (-EAGAIN means no buffer was ready yet)
+ */
+int dequeue_latest_buffer(struct buffer_queue* queue, struct frame* frame, struct capture_stats* stats);
+
+/**
+ * Waits on the device with epoll and hands completed buffers to the handler as soon as the driver signals them.
+ * Spurious wakeups (EAGAIN) and timeouts are absorbed, device errors such as EIO or ENODEV end the loop
+ * @param queue - The buffer queue of an open device that is already streaming
+ * @param options - Timeout (-1 waits forever) and capture mode to use
+ * @param handler - Function called with each dequeued buffer
+ * @param user_data - Passed through to the handler
+ * @param stats - Optional frame counters, may be NULL
+ * @return - 0 if the handler stopped the loop, -1 if the device reported an error
+ */
+int capture_frames(struct buffer_queue* queue, const struct capture_options* options, frame_handler handler,
+                   void* user_data, struct capture_stats* stats);
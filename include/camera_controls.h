@@ -0,0 +1,140 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "apriltag/common/image_types.h"
+#include "camera.h"
+#include "luma_stats.h"
+
+/**
+ * Range of a camera control as reported by VIDIOC_QUERYCTRL
+ * id - The V4L2_CID_* of the control
+ * available - false if the camera doesn't have the control or it is disabled
+ */
+struct camera_control {
+    uint32_t id;
+    bool available;
+    int32_t minimum;
+    int32_t maximum;
+    int32_t step;
+    int32_t default_value;
+};
+
+/**
+ * Looks up the range of a control
+ * @param fd - File descriptor to open device
+ * @param id - The V4L2_CID_* of the control
+ * @param control - Filled with the range, available is false if the control doesn't exist
+ * @return - 0 if the control is available, -1 otherwise
+ */
+int query_camera_control(int fd, uint32_t id, struct camera_control* control);
+
+/**
+ * Reads the current value of a control (VIDIOC_G_EXT_CTRLS)
+ * @param fd - File descriptor to open device
+ * @param id - The V4L2_CID_* of the control
+ * @param value - Filled with the current value
+ * @return - 0 for success, -1 for failure
+ */
+int get_camera_control(int fd, uint32_t id, int32_t* value);
+
+/**
+ * Sets several controls in one VIDIOC_S_EXT_CTRLS call, the driver applies them in order
+ * @param fd - File descriptor to open device
+ * @param ids - The V4L2_CID_* of every control
+ * @param values - The new value of every control
+ * @param count - Number of controls
+ * @return - 0 for success, -1 for failure
+ */
+int set_camera_controls(int fd, const uint32_t* ids, const int32_t* values, int count);
+
+/**
+ * Longest exposure that keeps motion blur within a budget
+ * @param max_blur_pixels - How far a tag edge may smear during the exposure (ex: 1.5)
+ * @param image_speed_pixels_per_second - Fastest expected motion of a tag across the image
+ * @return - The exposure limit in microseconds
+ */
+uint32_t motion_blur_exposure_limit_us(double max_blur_pixels, double image_speed_pixels_per_second);
+
+/**
+ * Settings of the exposure controller
+ * max_exposure_us - Exposure time is never raised above this, gain makes up for the rest (see
+ *                   motion_blur_exposure_limit_us)
+ * target_luma - Mean luma the controller steers the metered region towards
+ * tag_lock_frames - Frames a region passed to exposure_controller_lock_region keeps being metered
+ * update_interval - Frames between two control changes, controls take a few frames to show in the image
+ */
+struct exposure_control_options {
+    uint32_t max_exposure_us;
+    uint8_t target_luma;
+    uint32_t tag_lock_frames;
+    uint32_t update_interval;
+};
+
+/**
+ * Manual exposure and gain driven by the luma histogram of the frames being detected on.
+ *
+ * Brightening raises exposure up to the blur limit before touching gain, darkening lowers gain first, so exposure
+ * stays as long as the blur budget allows and noise is only added when the scene is too dark for it. Once a tag is
+ * found its region is metered instead of the whole image so the tag itself stays well exposed against a bright or
+ * dark background.
+ */
+struct exposure_controller {
+    int fd;
+    struct exposure_control_options options;
+    struct camera_control exposure;
+    struct camera_control gain;
+    int32_t exposure_value;
+    int32_t gain_value;
+    int32_t max_exposure_value;
+    // Auto exposure mode before the controller took over, restored by exposure_controller_destroy
+    bool has_auto_exposure;
+    int32_t original_auto_exposure;
+    struct region_of_interest locked_region;
+    uint32_t locked_frames_left;
+    uint32_t frames_since_update;
+};
+
+/**
+ * Switches the camera to manual exposure and caps the exposure time
+ * @param fd - File descriptor to open device
+ * @param options - Settings of the controller
+ * @return - The controller or null if the camera has no absolute exposure control
+ */
+struct exposure_controller* exposure_controller_create(int fd, const struct exposure_control_options* options);
+
+/**
+ * Meters a region (ex: the bounds of a detected tag) for the next tag_lock_frames frames
+ * @param controller - The controller
+ * @param region - Region in the coordinates of the images passed to exposure_controller_update
+ */
+void exposure_controller_lock_region(struct exposure_controller* controller, const struct region_of_interest* region);
+
+/**
+ * Meters a frame and adjusts exposure and gain if it is too dark or too bright
+ * @param controller - The controller
+ * @param luma_image - Luma of the latest frame
+ * @param frame_stats - Statistics of the whole frame if conversion gathered them, metered instead of sampling the
+ *                      image while no region is locked. May be NULL
+ * @param image_stretch - Contrast stretch applied to luma_image, undone before metering it so exposure follows the
+ *                        light the camera actually captured. May be NULL
+ * @return - 0 for success, -1 if the camera rejected the new values
+ */
+int exposure_controller_update(struct exposure_controller* controller, const struct image_u8* luma_image,
+                               const struct luma_stats* frame_stats, const struct contrast_stretch* image_stretch);
+
+/**
+ * Restores the camera's auto exposure mode and frees the controller
+ * @param controller - The controller to destroy
+ */
+void exposure_controller_destroy(struct exposure_controller* controller);
+
+/**
+ * Counts the luma values of a region of an image, sampling every sample_step-th pixel of every sample_step-th row
+ * @param image - The luma image
+ * @param region - Region to count, NULL for the whole image
+ * @param sample_step - Distance between two samples in both directions
+ * @param histogram - Filled with the count of every luma value
+ * @return - Number of samples counted
+ */
+uint32_t compute_luma_histogram(const struct image_u8* image, const struct region_of_interest* region,
+                                int sample_step, uint32_t histogram[256]);
@@ -0,0 +1,92 @@
+#pragma once
+#include <stdint.h>
+#include "apriltag/apriltag.h"
+#include "camera.h"
+#include "frame_conversion.h"
+
+/**
+ * Captures from several cameras in one epoll loop and runs detection for all of them on one shared apriltag detector,
+ * so every camera uses the same tag tables and the same detector worker pool.
+ *
+ * Each camera is captured in latest-frame mode and keeps at most one pending frame. Every round converts the pending
+ * frames of all cameras in parallel on the detector's worker pool, then detects on them one camera at a time, starting
+ * with a different camera each round so no camera is starved when detection can't keep up.
+ */
+
+/**
+ * State and statistics of one camera owned by the manager
+ */
+struct managed_camera {
+    char* device_path;
+    int fd;
+    struct camera_format format;
+    luma_converter convert_to_luma;
+    struct v4l2_requestbuffers* request_buffers;
+    struct buffer_queue queue;
+    struct image_u8* luma_image;
+    bool has_pending_frame;
+    bool pending_frame_converted;
+    struct frame pending_frame;
+    bool failed;
+    // frames_processed counts frames that went through detection, frames_skipped also counts pending frames
+    // replaced by a newer one before detection got to them
+    struct capture_stats stats;
+    unsigned long detections;
+    int64_t detection_time_us;
+};
+
+struct capture_manager {
+    int epoll_fd;
+    struct managed_camera* cameras;
+    int camera_count;
+    int next_camera;
+    apriltag_detector_t* detector;
+};
+
+/**
+ * Called once per detected frame
+ * @param camera_index - Index of the camera in the device_paths passed to capture_manager_create
+ * @param frame - Descriptor of the frame
+ * @param tag_id - The result of detect_april_tag (-1 when no tag was found)
+ * @param user_data - The pointer passed to capture_manager_run
+ * @return - CAPTURE_CONTINUE to keep capturing or CAPTURE_STOP to leave capture_manager_run
+ */
+typedef enum capture_action (*detection_handler)(int camera_index, const struct frame* frame, int tag_id,
+                                                 void* user_data);
+
+/**
+ * Opens and starts streaming every camera
+ * @param device_paths - File paths of the cameras (ex: /dev/video0)
+ * @param camera_count - Number of paths
+ * @param width - Desired width of the images
+ * @param height - Desired height of the images
+ * @param fps - Desired frame rate of every camera
+ * @param buffer_count - Number of mmap buffers per camera
+ * @param detector - The detector shared by all cameras, its nthreads sets the size of the shared worker pool
+ * @return - The manager or null if any camera could not be set up
+ */
+struct capture_manager* capture_manager_create(char** device_paths, int camera_count, int width, int height,
+                                               int fps, int buffer_count, apriltag_detector_t* detector);
+
+/**
+ * Runs the capture and detection loop until the handler stops it or every camera failed. A camera reporting a
+ * device error is dropped while the others keep running
+ * @param manager - The manager
+ * @param timeout_ms - How long to wait for any frame before reporting a stall
+ * @param handler - Called with the result of every detection
+ * @param user_data - Passed through to the handler
+ * @return - 0 if the handler stopped the loop, -1 if no camera is left
+ */
+int capture_manager_run(struct capture_manager* manager, int timeout_ms, detection_handler handler, void* user_data);
+
+/**
+ * Prints the per-camera statistics
+ * @param manager - The manager
+ */
+void capture_manager_print_stats(struct capture_manager* manager);
+
+/**
+ * Stops every stream and releases the cameras. The detector is not destroyed
+ * @param manager - The manager to destroy
+ */
+void capture_manager_destroy(struct capture_manager* manager);
@@ -0,0 +1,56 @@
+#pragma once
+#include "camera.h"
+
+/**
+ * Runs VIDIOC_DQBUF and VIDIOC_QBUF on a thread of its own so driver latency stays off the processing thread.
+ *
+ * The capture thread dequeues completed buffers and publishes their descriptors through a lock-free single-producer
+ * single-consumer ring. The processing thread takes them with capture_thread_next_frame and hands every buffer back
+ * with capture_thread_release_frame, which pushes the index onto a second ring that the capture thread re-queues
+ * from. Neither side makes a system call while the other keeps up: the capture thread only wakes the processing
+ * thread when it is waiting for a frame, and the processing thread only wakes the capture thread when the driver is
+ * about to run out of queued buffers.
+ *
+ * Exactly one thread may call capture_thread_next_frame and capture_thread_release_frame.
+ */
+struct capture_thread;
+
+/**
+ * Starts the capture thread on a streaming buffer queue
+ * @param queue - The buffer queue of an open device that is already streaming, only the capture thread touches it
+ *                until capture_thread_stop
+ * @param options - Timeout, capture mode and min_bytesused as for capture_frames, the auxiliary descriptor is ignored
+ * @return - The capture thread or null if it couldn't be started
+ */
+struct capture_thread* capture_thread_start(struct buffer_queue* queue, const struct capture_options* options);
+
+/**
+ * Waits for the next usable frame. With CAPTURE_LATEST_FRAME every older waiting frame is released on the way
+ * @param thread - The capture thread
+ * @param frame - Filled with the descriptor of the frame, its buffer belongs to the caller until released
+ * @param timeout_ms - Longest time to wait, -1 waits forever
+ * @return - 0 on success, -EAGAIN if no frame arrived in time or -EIO if the capture thread ended on a device error
+ */
+int capture_thread_next_frame(struct capture_thread* thread, struct frame* frame, int timeout_ms);
+
+/**
+ * Hands a buffer back to the capture thread for re-queuing
+ * @param thread - The capture thread
+ * @param buffer_index - Index of a buffer returned by capture_thread_next_frame
+ */
+void capture_thread_release_frame(struct capture_thread* thread, int buffer_index);
+
+/**
+ * Reads the frame counters. frames_dropped and frames_rejected are counted by the capture thread and may lag behind
+ * by a frame
+ * @param thread - The capture thread
+ * @param stats - Filled with the counters
+ */
+void capture_thread_get_stats(struct capture_thread* thread, struct capture_stats* stats);
+
+/**
+ * Stops and joins the capture thread and re-queues every buffer it still holds. Buffers the caller didn't release
+ * stay dequeued. The stream itself keeps running
+ * @param thread - The capture thread, freed by the call
+ */
+void capture_thread_stop(struct capture_thread* thread);
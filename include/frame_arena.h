@@ -0,0 +1,69 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "apriltag/common/image_types.h"
+
+/**
+ * Alignment of every allocation made from a frame arena, wide enough for aligned SIMD loads
+ */
+#define FRAME_ARENA_ALIGNMENT 64
+
+/**
+ * One anonymous mapping that capture buffers and images are carved from. Allocations are never freed individually,
+ * everything is released at once by frame_arena_destroy
+ * base - Start of the mapping
+ * size - Size of the mapping in bytes
+ * used - Bytes handed out so far
+ * uses_hugepages - true if the mapping is backed by explicit hugepages (MAP_HUGETLB)
+ */
+struct frame_arena {
+    uint8_t* base;
+    size_t size;
+    size_t used;
+    bool uses_hugepages;
+};
+
+/**
+ * Maps a new arena
+ * @param size - Minimum size of the arena in bytes
+ * @param use_hugepages - Try MAP_HUGETLB first and fall back to transparent hugepages (MADV_HUGEPAGE) if no
+ *                        hugepages are reserved
+ * @return - The arena or null if the mapping failed
+ */
+struct frame_arena* frame_arena_create(size_t size, bool use_hugepages);
+
+/**
+ * Unmaps the arena, every buffer and image allocated from it becomes invalid
+ * @param arena - The arena to destroy
+ */
+void frame_arena_destroy(struct frame_arena* arena);
+
+/**
+ * Hands out the next block of the arena
+ * @param arena - The arena to allocate from
+ * @param size - Size of the block in bytes
+ * @param alignment - Power of two alignment of the block, raised to FRAME_ARENA_ALIGNMENT if smaller
+ * @return - Start of the block or null if the arena is full
+ */
+void* frame_arena_alloc(struct frame_arena* arena, size_t size, size_t alignment);
+
+/**
+ * Wraps pixels that are owned elsewhere in an image_u8, which has const dimensions and so can't be filled in after
+ * malloc
+ * @param width - Width of the image
+ * @param height - Height of the image
+ * @param stride - Bytes from one row to the next
+ * @param pixels - The pixels, they are neither copied nor owned by the image
+ * @return - The image (release it with free, which leaves the pixels alone) or null if it could not be allocated
+ */
+struct image_u8* wrap_image_pixels(int width, int height, int stride, uint8_t* pixels);
+
+/**
+ * Creates an image_u8 whose pixels live in the arena, with the stride rounded up to FRAME_ARENA_ALIGNMENT
+ * @param arena - The arena to allocate the pixels from
+ * @param width - Width of the image
+ * @param height - Height of the image
+ * @return - The image (release the struct with free, the pixels belong to the arena) or null if the arena is full
+ */
+struct image_u8* frame_arena_create_image(struct frame_arena* arena, int width, int height);
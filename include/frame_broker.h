@@ -0,0 +1,98 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "camera.h"
+
+/**
+ * Shares capture buffers with local processes without copying them.
+ *
+ * Consumers connect to a SOCK_SEQPACKET Unix socket. Right after connecting they receive one FRAME_BROKER_BUFFER
+ * message per capture buffer with its dmabuf file descriptor attached (SCM_RIGHTS). After that they receive a
+ * FRAME_BROKER_FRAME message every time a buffer holds a new frame. A consumer must answer every FRAME_BROKER_FRAME
+ * message with a struct frame_broker_release naming the buffer index once it is done reading it. A buffer is only
+ * re-queued to the driver after every consumer (and the local holder) released it. Disconnecting releases every
+ * buffer the consumer still holds.
+ */
+
+#define FRAME_BROKER_MAX_CONSUMERS 8
+
+enum frame_broker_message_type {
+    FRAME_BROKER_BUFFER = 1,
+    FRAME_BROKER_FRAME = 2
+};
+
+/**
+ * Message sent from the broker to consumers
+ * type - FRAME_BROKER_BUFFER or FRAME_BROKER_FRAME
+ * index - Index of the capture buffer the message is about
+ * length - FRAME_BROKER_BUFFER only, size of the dmabuf in bytes
+ * format - FRAME_BROKER_BUFFER only, capture format of the frames stored in the buffer
+ * bytesused, sequence, flags, timestamp_us - FRAME_BROKER_FRAME only, metadata of the frame now in the buffer
+ */
+struct frame_broker_message {
+    uint32_t type;
+    uint32_t index;
+    uint32_t length;
+    struct camera_format format;
+    uint32_t bytesused;
+    uint32_t sequence;
+    uint32_t flags;
+    int64_t timestamp_us;
+};
+
+/**
+ * Message sent from a consumer to the broker once it no longer reads a buffer
+ */
+struct frame_broker_release {
+    uint32_t index;
+};
+
+struct frame_broker;
+
+/**
+ * Creates the broker and starts listening for consumers
+ * @param socket_path - Path of the Unix socket to create (an existing file at that path is replaced)
+ * @param queue - The mmap buffer queue of the open device (at most 64 buffers), buffers are re-queued on it once
+ *                released
+ * @param format - Capture format sent to consumers
+ * @param dmabuf_fds - The result of export_buffers
+ * @return - The broker or null if an error occurred
+ */
+struct frame_broker* frame_broker_create(const char* socket_path, struct buffer_queue* queue,
+                                         const struct camera_format* format, const int* dmabuf_fds);
+
+/**
+ * Disconnects all consumers, removes the socket and frees the broker. Buffers still held are not re-queued
+ * @param broker - The broker to destroy
+ */
+void frame_broker_destroy(struct frame_broker* broker);
+
+/**
+ * A single descriptor that becomes readable whenever the broker has work to do, meant to be watched with epoll
+ * (ex: as capture_options.auxiliary_fd)
+ * @param broker - The broker
+ * @return - The file descriptor
+ */
+int frame_broker_fd(struct frame_broker* broker);
+
+/**
+ * Accepts new consumers and processes their release messages without blocking
+ * @param broker - The broker
+ */
+void frame_broker_handle_events(struct frame_broker* broker);
+
+/**
+ * Announces a frame to every consumer. The buffer is held with one reference for every consumer that received the
+ * message plus one for the caller, which must give it back with frame_broker_release
+ * @param broker - The broker
+ * @param frame - Descriptor of the dequeued buffer
+ * @return - The number of consumers that received the frame
+ */
+int frame_broker_publish(struct frame_broker* broker, const struct frame* frame);
+
+/**
+ * Drops the caller's reference to a published buffer, re-queuing it if no consumer holds it anymore
+ * @param broker - The broker
+ * @param buffer_index - Index of the published buffer
+ */
+void frame_broker_release(struct frame_broker* broker, int buffer_index);
@@ -0,0 +1,181 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "apriltag/common/image_types.h"
+#include "apriltag/common/workerpool.h"
+#include "camera.h"
+#include "luma_stats.h"
+
+/**
+ * Extracts the luma (Y) plane of a captured frame into an apriltag image. Only the first width bytes of every image
+ * row are written, the padding up to the stride is left alone
+ * @param source - Start of the captured frame data
+ * @param bytesused - Number of valid bytes in source
+ * @param format - Capture format of the frame, bytesperline is used as the source row stride
+ * @param luma_image - Destination image, must have the same width and height as the format
+ * @return - 0 on success, -1 if the frame could not be converted
+ */
+typedef int (*luma_converter)(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                              struct image_u8* luma_image);
+
+/**
+ * Picks the converter for a capture pixel format, meant to be called once after setup_camera
+ * @param pixelformat - The V4L2_PIX_FMT_* code of the capture format
+ * @return - The matching converter or NULL if the format is not supported
+ */
+luma_converter select_luma_converter(uint32_t pixelformat);
+
+/**
+ * Copies the Y plane of formats that store it first as 8-bit samples (GREY, NV12, NV12M, NV21). For NV12M the
+ * source is the first plane of the buffer, the chroma plane is never touched
+ */
+int convert_luma_plane(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                       struct image_u8* luma_image);
+
+/**
+ * Extracts luma from packed YUYV (Y0 U Y1 V) and YVYU (Y0 V Y1 U)
+ */
+int convert_yuyv_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                         struct image_u8* luma_image);
+
+/**
+ * Extracts luma from packed UYVY (U Y0 V Y1) and VYUY (V Y0 U Y1)
+ */
+int convert_uyvy_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                         struct image_u8* luma_image);
+
+/**
+ * Shifts 10-bit grey samples (Y10, little endian 16-bit words) down to 8 bits
+ */
+int convert_y10_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                        struct image_u8* luma_image);
+
+/**
+ * Takes the high byte of 16-bit grey samples (Y16, little endian)
+ */
+int convert_y16_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                        struct image_u8* luma_image);
+
+/**
+ * Computes BT.601 luma from packed RGB24 (R G B)
+ */
+int convert_rgb24_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                          struct image_u8* luma_image);
+
+/**
+ * Computes BT.601 luma from packed BGR24 (B G R)
+ */
+int convert_bgr24_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                          struct image_u8* luma_image);
+
+/**
+ * Decodes an MJPEG frame with pjpeg and copies its luma
+ */
+int convert_mjpeg_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                          struct image_u8* luma_image);
+
+/**
+ * Decodes an MJPEG frame at 1/8 scale from the DC coefficients of its luma blocks, skipping the inverse DCT. Every
+ * pixel is the mean luma of an 8x8 block, so the image is a box filtered quad search image for free
+ * @param source - Start of the captured frame data
+ * @param bytesused - Number of valid bytes in source
+ * @param format - Capture format of the frame
+ * @param dc_image - Destination image, decimated_size of the format by JPEG_BLOCK_SIZE in both dimensions
+ * @return - 0 on success, -1 if the frame could not be decoded (including JPEGs that aren't baseline)
+ */
+int convert_mjpeg_to_dc_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                             struct image_u8* dc_image);
+
+/**
+ * Size of one dimension of an image decimated by an integer factor, the same as image_u8_decimate produces
+ * @param size - Width or height of the full resolution image
+ * @param decimation - The decimation factor
+ * @return - Width or height of the decimated image
+ */
+uint32_t decimated_size(uint32_t size, int decimation);
+
+/**
+ * Extracts luma into a full resolution image and a decimated copy of it in one pass over the frame. The decimated
+ * image holds every decimation-th pixel of every decimation-th row, the same pixels image_u8_decimate picks, taken
+ * from each converted row while it is still in the cache. Works with every converter except MJPEG
+ * @param convert - The converter returned by select_luma_converter
+ * @param source - Start of the captured frame data
+ * @param bytesused - Number of valid bytes in source
+ * @param format - Capture format of the frame
+ * @param luma_image - Full resolution destination image, same size as the format
+ * @param decimated_image - Decimated destination image, decimated_size of the luma image in both dimensions
+ * @param decimation - 2, 3 or 4
+ * @return - 0 on success, -1 if the frame could not be converted
+ */
+int convert_to_luma_and_decimate(luma_converter convert, const uint8_t* source, uint32_t bytesused,
+                                 const struct camera_format* format, struct image_u8* luma_image,
+                                 struct image_u8* decimated_image, int decimation);
+
+/**
+ * Converts a frame in cache-sized row bands that run in parallel on a workerpool (see row_bands.h), optionally
+ * decimating it like convert_to_luma_and_decimate. Every band writes its own rows of both images, so the result is the
+ * same as converting on one thread. MJPEG frames can't be split into rows, they are converted on the calling
+ * thread and can't be decimated
+ * @param wp - The workerpool to convert on (ex: from detector_workerpool), NULL converts on the calling thread
+ * @param convert - The converter returned by select_luma_converter
+ * @param source - Start of the captured frame data
+ * @param bytesused - Number of valid bytes in source
+ * @param format - Capture format of the frame
+ * @param luma_image - Full resolution destination image, same size as the format
+ * @param decimated_image - Decimated destination image as for convert_to_luma_and_decimate, NULL to only convert
+ * @param decimation - 2, 3 or 4, ignored without a decimated image
+ * @param stats - Filled with the statistics of the full resolution image, sampled from each row right after it was
+ *                converted, NULL to skip them
+ * @param contrast - Stretch applied to each row after it was counted and before it is decimated (ex: built from the
+ *                   previous frame's statistics), NULL or disabled to keep the luma as converted
+ * @return - 0 on success, -1 if the frame could not be converted
+ */
+int convert_to_luma_in_bands(workerpool_t* wp, luma_converter convert, const uint8_t* source, uint32_t bytesused,
+                             const struct camera_format* format, struct image_u8* luma_image,
+                             struct image_u8* decimated_image, int decimation, struct luma_stats* stats,
+                             const struct contrast_stretch* contrast);
+
+/**
+ * Converts only a region of the frame by offsetting into the source and keeping its bytesperline as the stride, so
+ * conversion and detection work shrink with the region. Works with every converter except MJPEG
+ * @param convert - The converter returned by select_luma_converter
+ * @param source - Start of the captured frame data
+ * @param bytesused - Number of valid bytes in source
+ * @param format - Capture format of the whole frame
+ * @param region - Region of the frame to convert, must lie inside the frame
+ * @param luma_image - Destination image with the size of the region (ex: from create_image_view)
+ * @return - 0 on success, -1 if the region could not be converted
+ */
+int convert_region_to_luma(luma_converter convert, const uint8_t* source, uint32_t bytesused,
+                           const struct camera_format* format, const struct region_of_interest* region,
+                           struct image_u8* luma_image);
+
+/**
+ * Creates an image struct that refers to a region of another image's pixels, nothing is copied
+ * @param image - The image that owns the pixels
+ * @param region - The region of the image covered by the view (only width and height are used, the view starts at
+ *                 the first pixel so the region can be converted straight into it)
+ * @return - The view (release it with free, the pixels still belong to image) or null if the region doesn't fit
+ */
+struct image_u8* create_image_view(struct image_u8* image, const struct region_of_interest* region);
+
+/**
+ * Checks whether frames of a pixel format start with a Y plane that already has the image_u8 layout (8-bit samples,
+ * bytesperline as the stride): GREY, NV12, NV12M and NV21
+ * @param pixelformat - The V4L2_PIX_FMT_* code of the capture format
+ * @return - true if create_luma_view can wrap the format's buffers
+ */
+bool has_luma_plane(uint32_t pixelformat);
+
+/**
+ * Wraps the Y plane of a capture buffer in an image without copying it, so detection can run on the buffer itself.
+ * The view stays valid while the buffer is mapped, but the driver overwrites its pixels once the buffer is queued
+ * again, so the buffer must only be requeued after detection on the view finished
+ * @param buffer - The capture buffer
+ * @param format - Capture format of the buffer, its pixel format must have a luma plane (see has_luma_plane)
+ * @param region - Region of the frame the view covers or NULL for the whole frame
+ * @return - The view (release it with free, the pixels belong to the buffer) or null if the format has no luma plane,
+ *           the region is outside the frame or the buffer is too short
+ */
+struct image_u8* create_luma_view(const struct buffer* buffer, const struct camera_format* format,
+                                  const struct region_of_interest* region);
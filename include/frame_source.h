@@ -0,0 +1,145 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "camera.h"
+
+/**
+ * Where frames come from, hidden behind one interface so the conversion and detection code downstream can be run
+ * against a live camera or against a recording and produce repeatable numbers.
+ *
+ * Every backend hands out frames as a pointer to their first plane plus a struct frame descriptor, described by the
+ * camera_format of the source, so the same luma_converter works for all of them:
+ * - V4L2: an mmap streaming capture device, release_frame re-queues the buffer
+ * - Raw recording: a file of back to back frames of one fixed format (ex: YUYV dumped from a camera), mmap'd read-only
+ * - PGM directory: every .pgm file of a directory in name order, loaded up front and served as GREY frames
+ */
+
+/**
+ * How replay backends hand out frames
+ * REPLAY_REALTIME - Frame n is not handed out before n / fps seconds after frame_source_start, like a camera would
+ * REPLAY_AS_FAST_AS_POSSIBLE - Every call to frame_source_next_frame returns the next frame immediately
+ */
+enum replay_pacing {
+    REPLAY_REALTIME,
+    REPLAY_AS_FAST_AS_POSSIBLE
+};
+
+/**
+ * Settings of the replay backends
+ * pacing - See enum replay_pacing
+ * fps - Frame rate used for REPLAY_REALTIME
+ * loop - Start over at the first frame instead of ending the stream after the last one
+ */
+struct replay_options {
+    enum replay_pacing pacing;
+    double fps;
+    bool loop;
+};
+
+/**
+ * A frame handed out by frame_source_next_frame, valid until it is passed to frame_source_release_frame
+ * frame - Descriptor of the frame. Replay backends number the frames in sequence and stamp them with the
+ *         CLOCK_MONOTONIC time they became due, so frame_age_us measures the latency of the consumer
+ * data - Start of the frame data (the first plane for multi-planar formats)
+ */
+struct source_frame {
+    struct frame frame;
+    const uint8_t* data;
+};
+
+struct frame_source;
+
+/**
+ * Backend implementation of the frame_source_* functions
+ */
+struct frame_source_ops {
+    int (*start)(struct frame_source* source);
+    int (*next_frame)(struct frame_source* source, int timeout_ms, struct source_frame* frame);
+    int (*release_frame)(struct frame_source* source, const struct source_frame* frame);
+    int (*stop)(struct frame_source* source);
+    void (*close)(struct frame_source* source);
+};
+
+/**
+ * An open frame source
+ * name - Device path, file or directory the source was opened from
+ * format - Format of every frame the source hands out
+ * frame_count - Number of frames of a replay source, 0 for a camera
+ * state - Backend specific state
+ */
+struct frame_source {
+    const struct frame_source_ops* ops;
+    const char* name;
+    struct camera_format format;
+    size_t frame_count;
+    void* state;
+};
+
+/**
+ * Opens a camera and sets it up for mmap streaming
+ * @param device_path - File path to the camera (ex: /dev/video0)
+ * @param width - Desired width of the frames
+ * @param height - Desired height of the frames
+ * @param fps - Desired frame rate, the camera default is kept if it can't be set
+ * @param buffer_count - Number of mmap buffers to request
+ * @return - The source or null if the camera could not be set up
+ */
+struct frame_source* frame_source_open_v4l2(char* device_path, int width, int height, uint32_t fps,
+                                            int buffer_count);
+
+/**
+ * Opens a raw recording, a file holding nothing but complete frames of one format back to back
+ * @param file_path - Path of the recording
+ * @param format - Format of the recorded frames, sizeimage is the size of one frame in the file
+ * @param options - Pacing of the replay
+ * @return - The source or null if the file could not be mapped or holds no complete frame
+ */
+struct frame_source* frame_source_open_raw_recording(const char* file_path, const struct camera_format* format,
+                                                     const struct replay_options* options);
+
+/**
+ * Loads every .pgm file of a directory (sorted by name) with image_u8_create_from_pnm
+ * @param directory_path - Path of the directory
+ * @param options - Pacing of the replay
+ * @return - The source or null if the directory holds no image or the images differ in size
+ */
+struct frame_source* frame_source_open_pgm_directory(const char* directory_path,
+                                                     const struct replay_options* options);
+
+/**
+ * Starts the stream, for replay sources this is the time realtime pacing counts from
+ * @param source - The source
+ * @return - 0 for success, -1 for failure
+ */
+int frame_source_start(struct frame_source* source);
+
+/**
+ * Waits for the next frame
+ * @param source - A started source
+ * @param timeout_ms - How long to wait at most, -1 waits forever
+ * @param frame - Filled with the next frame on success
+ * @return - 0 on success, -EAGAIN if no frame was ready within the timeout, -ENODATA when a replay without loop
+ *           is over or another negated errno value for a device error
+ */
+int frame_source_next_frame(struct frame_source* source, int timeout_ms, struct source_frame* frame);
+
+/**
+ * Hands a frame back to the source once the consumer is done with it
+ * @param source - The source
+ * @param frame - A frame returned by frame_source_next_frame
+ * @return - 0 for success, -1 for failure
+ */
+int frame_source_release_frame(struct frame_source* source, const struct source_frame* frame);
+
+/**
+ * Stops the stream, frames that were not released yet become invalid
+ * @param source - The source
+ * @return - 0 for success, -1 for failure
+ */
+int frame_source_stop(struct frame_source* source);
+
+/**
+ * Releases the source and everything it allocated
+ * @param source - The source to close
+ */
+void frame_source_close(struct frame_source* source);
@@ -0,0 +1,63 @@
+#pragma once
+#include <stdint.h>
+#include "apriltag/common/image_types.h"
+#include "frame_arena.h"
+
+/**
+ * Luma images of one size that are acquired for a frame and released once the frame is processed, so there are only
+ * as many images as frames are processed at once rather than one per capture buffer. Released images wait on a
+ * free list for the next frame, a new image is only created when the free list is empty. Strides and pixels are
+ * aligned to FRAME_ARENA_ALIGNMENT. Not thread safe.
+ *
+ * width, height, stride - Size of every image of the pool
+ * arena - Arena the pixels are allocated from while it has room, the heap is used after that or without an arena
+ * free_images - The free list, the image released last is handed out next since its pixels are most likely cached
+ * free_count - Number of images on the free list
+ * capacity - Room on the free list, enough for every image of the pool
+ * image_count - Images created so far, each of them is either on the free list or acquired
+ * acquired_count - Images acquired and not released yet
+ * high_water_mark - Most images that were ever acquired at once, the pipeline depth the pool had to serve
+ */
+struct image_pool {
+    int width;
+    int height;
+    int stride;
+    struct frame_arena* arena;
+    struct image_u8** free_images;
+    int free_count;
+    int capacity;
+    int image_count;
+    int acquired_count;
+    int high_water_mark;
+};
+
+/**
+ * Creates a pool
+ * @param width - Width of every image
+ * @param height - Height of every image
+ * @param initial_count - Images created right away, so the first frames don't wait for allocations
+ * @param arena - Arena to allocate the pixels from, may be NULL
+ * @return - The pool or null if the initial images could not be created
+ */
+struct image_pool* image_pool_create(int width, int height, int initial_count, struct frame_arena* arena);
+
+/**
+ * Destroys the pool and its images, every acquired image must have been released
+ * @param pool - The pool to destroy
+ */
+void image_pool_destroy(struct image_pool* pool);
+
+/**
+ * Hands out an image from the free list, or creates one if the list is empty. Its pixels still hold whatever the
+ * previous user left in them
+ * @param pool - The pool
+ * @return - The image or null if a new image could not be allocated
+ */
+struct image_u8* image_pool_acquire(struct image_pool* pool);
+
+/**
+ * Returns an image to the free list
+ * @param pool - The pool the image was acquired from
+ * @param image - The image, NULL is ignored
+ */
+void image_pool_release(struct image_pool* pool, struct image_u8* image);
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+#include "apriltag/common/image_types.h"
+
+/**
+ * Decodes the luma of a baseline JPEG at 1/8 scale from the DC coefficient of every luma block, meant for MJPEG frames.
+ * A full decode (pjpeg) transforms every block of every component, while the DC coefficient alone is the mean of a
+ * block. Every block still has to be Huffman decoded to find where the next one starts, but nothing is dequantized
+ * past the DC coefficient or transformed.
+ *
+ * Streams without Huffman tables (MJPEG as most UVC cameras send it) are decoded with the standard tables of the
+ * JPEG specification (Annex K.3). Progressive, arithmetic coded and 12-bit JPEGs are not supported.
+ */
+
+// Width and height of a JPEG block, a DC image holds one pixel per block
+#define JPEG_BLOCK_SIZE 8
+
+// Returned by decode_jpeg_dc_luma for valid JPEGs that use a coding it doesn't support
+#define JPEG_LUMA_UNSUPPORTED -2
+
+// Row major index of every coefficient in the zigzag order blocks are coded in
+extern const uint8_t JPEG_ZIGZAG[64];
+
+// Standard Huffman tables (Annex K.3): the number of codes of every length from 1 to 16 bits, then the symbols in code
+// order
+extern const uint8_t JPEG_DC_LUMA_COUNTS[16];
+extern const uint8_t JPEG_DC_CHROMA_COUNTS[16];
+extern const uint8_t JPEG_DC_SYMBOLS[12];
+extern const uint8_t JPEG_AC_LUMA_COUNTS[16];
+extern const uint8_t JPEG_AC_LUMA_SYMBOLS[162];
+extern const uint8_t JPEG_AC_CHROMA_COUNTS[16];
+extern const uint8_t JPEG_AC_CHROMA_SYMBOLS[162];
+
+/**
+ * Decodes the luma of a JPEG at 1/8 scale
+ * @param jpeg - The JPEG data, from the SOI marker on (ex: a captured MJPEG frame)
+ * @param length - Number of valid bytes in jpeg
+ * @param dc_image - Destination with one pixel per block (width and height of the JPEG divided by JPEG_BLOCK_SIZE,
+ *                   rounded up), every pixel the mean luma of its block
+ * @return - 0 on success, -1 if the JPEG is corrupt or doesn't match the image, JPEG_LUMA_UNSUPPORTED if the JPEG
+ *           isn't baseline
+ */
+int decode_jpeg_dc_luma(const uint8_t* jpeg, uint32_t length, struct image_u8* dc_image);
@@ -0,0 +1,93 @@
+#pragma once
+#include "apriltag_detection.h"
+
+/**
+ * Pinhole intrinsics of a camera in pixels, as calibration (ex: OpenCV's calibrateCamera) reports them
+ * fx, fy - Focal lengths
+ * cx, cy - Principal point
+ */
+struct camera_intrinsics {
+    double fx;
+    double fy;
+    double cx;
+    double cy;
+};
+
+/**
+ * Radial (k1, k2, k3) and tangential (p1, p2) distortion of the lens in the Brown-Conrady model OpenCV calibrates
+ */
+struct lens_distortion {
+    double k1;
+    double k2;
+    double p1;
+    double p2;
+    double k3;
+};
+
+/**
+ * Where the pixels of a grid over the distorted image land once the distortion is removed. Inverting the distortion
+ * takes an iterative solve per point, which the table does once for every grid node when it is created, so correcting
+ * a point afterwards is a bilinear interpolation between the 4 nodes around it. Points are corrected into the same
+ * pixel coordinates an undistorted image with the same intrinsics would have.
+ *
+ * width, height - Size of the distorted image the table covers
+ * cell_size - Pixels between two neighboring grid nodes
+ * columns, rows - Number of grid nodes in each direction, the last ones lie on or past the image's edge
+ * points - Undistorted x and y of every node, row by row
+ */
+struct undistortion_table {
+    int width;
+    int height;
+    int cell_size;
+    int columns;
+    int rows;
+    float* points;
+};
+
+/**
+ * Builds the table of a lens
+ * @param intrinsics - Intrinsics of the camera at width x height
+ * @param distortion - Distortion of the lens
+ * @param width - Width of the images
+ * @param height - Height of the images
+ * @param cell_size - Pixels between grid nodes, smaller cells are more accurate where distortion is strong
+ * @return - The table or NULL if it could not be allocated
+ */
+struct undistortion_table* undistortion_table_create(const struct camera_intrinsics* intrinsics,
+                                                     const struct lens_distortion* distortion, int width, int height,
+                                                     int cell_size);
+
+/**
+ * Destroys the table
+ * @param table - The table to destroy
+ */
+void undistortion_table_destroy(struct undistortion_table* table);
+
+/**
+ * Removes the distortion of a point exactly, iterating the inverse of the distortion model. This is what the table is
+ * built from, too slow to run per frame
+ * @param intrinsics - Intrinsics of the camera
+ * @param distortion - Distortion of the lens
+ * @param x, y - The point in the distorted image
+ * @param undistorted_x, undistorted_y - Filled with the point in the undistorted image
+ */
+void undistort_point_exact(const struct camera_intrinsics* intrinsics, const struct lens_distortion* distortion,
+                           double x, double y, double* undistorted_x, double* undistorted_y);
+
+/**
+ * Removes the distortion of a point by interpolating the table. Points outside the image are extrapolated from the
+ * cell at the edge
+ * @param table - The table of the lens
+ * @param x, y - The point in the distorted image
+ * @param undistorted_x, undistorted_y - Filled with the point in the undistorted image
+ */
+void undistort_point(const struct undistortion_table* table, double x, double y, double* undistorted_x,
+                     double* undistorted_y);
+
+/**
+ * Removes the distortion of a tag's corners and center in place, which is all pose estimation looks at, so the rest of
+ * the image never has to be remapped
+ * @param table - The table of the lens
+ * @param corners - Corners and center of the tag in the coordinates of the image the table covers
+ */
+void undistort_tag_corners(const struct undistortion_table* table, struct tag_corners* corners);
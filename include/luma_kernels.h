@@ -0,0 +1,80 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * Instruction set levels the luma kernels are written for. x86 levels include every lower x86 level
+ */
+enum simd_level {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_SSSE3,
+    SIMD_AVX2,
+    SIMD_NEON,
+    SIMD_LEVEL_COUNT
+};
+
+/**
+ * Extracts width luma samples from one row of a captured frame
+ * @param source_row - Start of the captured row
+ * @param luma_row - Destination row, width bytes are written and nothing past them
+ * @param width - Number of pixels in the row
+ */
+typedef void (*luma_row_kernel)(const uint8_t* source_row, uint8_t* luma_row, int width);
+
+/**
+ * Stretches the luma of a row in place: luma = min(255, (max(luma - low, 0) * gain) >> 8)
+ * @param luma_row - The row
+ * @param width - Number of pixels in the row
+ * @param low - Luma that becomes 0
+ * @param gain - Scale in 1/256 steps, at most 16 * 256
+ */
+typedef void (*luma_stretch_kernel)(uint8_t* luma_row, int width, uint8_t low, uint16_t gain);
+
+/**
+ * Row kernels of one instruction set level. The scalar set is the reference the others must match byte for byte
+ * plane_row - 8-bit luma plane (GREY and the Y plane of NV12, NV21), copied as is
+ * yuyv_row - Packed 4:2:2 with luma in the even bytes (YUYV, YVYU)
+ * uyvy_row - Packed 4:2:2 with luma in the odd bytes (UYVY, VYUY), also the high byte of little endian Y16
+ * y10_row - 10-bit grey in little endian 16-bit words, shifted down to 8 bits
+ * rgb24_row - Packed R, G, B bytes, weighted with the BT.601 luma coefficients
+ * bgr24_row - Packed B, G, R bytes, weighted like rgb24_row
+ * stretch_row - Contrast stretch of a converted row (see struct contrast_stretch)
+ */
+struct luma_kernels {
+    enum simd_level level;
+    const char* name;
+    luma_row_kernel plane_row;
+    luma_row_kernel yuyv_row;
+    luma_row_kernel uyvy_row;
+    luma_row_kernel y10_row;
+    luma_row_kernel rgb24_row;
+    luma_row_kernel bgr24_row;
+    luma_stretch_kernel stretch_row;
+};
+
+/**
+ * Finds the best level the build and the CPU running it support (CPUID on x86, NEON is part of every AArch64 CPU)
+ * @return - The highest supported level
+ */
+enum simd_level detect_simd_level(void);
+
+/**
+ * Looks up the kernels of a level
+ * @param level - The instruction set level
+ * @return - The kernels or null if the level isn't built in or the CPU lacks it
+ */
+const struct luma_kernels* get_luma_kernels(enum simd_level level);
+
+/**
+ * The kernels used by the converters, the best supported level unless set_luma_kernels picked another one. The level
+ * is detected on the first call, select_luma_converter makes that call at startup
+ * @return - The active kernels
+ */
+const struct luma_kernels* active_luma_kernels(void);
+
+/**
+ * Makes the converters use the kernels of a specific level (ex: to compare levels in a benchmark)
+ * @param level - The instruction set level
+ * @return - 0 for success, -1 if the level isn't supported
+ */
+int set_luma_kernels(enum simd_level level);
@@ -0,0 +1,125 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "apriltag/common/image_types.h"
+
+// Statistics sample every LUMA_STATS_SAMPLE_STEP-th pixel of every LUMA_STATS_SAMPLE_STEP-th row. Counting every
+// pixel cost several times the conversion itself, while shares of a 1/16 sample (still 19200 samples at 640x480) are
+// as good for metering, percentiles and blank frame rejection
+#define LUMA_STATS_SAMPLE_STEP 4
+
+/**
+ * Luma statistics of one frame, the numbers exposure control, blank frame rejection and contrast normalization work
+ * from. The converters gather them from each row while it is still in the cache (see convert_to_luma_in_bands), so
+ * they cost no extra pass over the frame. Only a sample of the pixels is counted (see LUMA_STATS_SAMPLE_STEP), so
+ * consumers work with shares of sample_count rather than pixel counts, and min and max may miss isolated pixels.
+ *
+ * histogram - Count of every sampled luma value
+ * sample_count - Number of pixels sampled
+ * min, max - Darkest and brightest luma value
+ * mean, variance - Mean and variance of the luma values
+ */
+struct luma_stats {
+    uint32_t histogram[256];
+    uint32_t sample_count;
+    uint8_t min;
+    uint8_t max;
+    double mean;
+    double variance;
+};
+
+/**
+ * Per-thread counters rows are counted into before they are merged, counting into 4 interleaved histograms keeps
+ * neighboring pixels of the same value from waiting on each other's increment
+ */
+struct luma_counts {
+    uint32_t histograms[4][256];
+};
+
+/**
+ * Clears counters before the first row
+ * @param counts - The counters
+ */
+void luma_counts_reset(struct luma_counts* counts);
+
+/**
+ * Counts every LUMA_STATS_SAMPLE_STEP-th luma value of one row, callers only pass rows that luma_stats_samples_row
+ * picks
+ * @param counts - The counters
+ * @param luma_row - The row
+ * @param width - Number of pixels in the row
+ */
+void luma_counts_add_row(struct luma_counts* counts, const uint8_t* luma_row, int width);
+
+/**
+ * Whether a row is part of the sample the statistics count
+ * @param y - Index of the row in the image
+ * @return - true if the row is counted
+ */
+static inline bool luma_stats_samples_row(int y) {
+    return y % LUMA_STATS_SAMPLE_STEP == 0;
+}
+
+/**
+ * Clears statistics before counts are merged into them
+ * @param stats - The statistics
+ */
+void luma_stats_reset(struct luma_stats* stats);
+
+/**
+ * Adds counters to the histogram of the statistics (ex: the counts of one row band)
+ * @param stats - The statistics
+ * @param counts - The counters to add
+ */
+void luma_stats_merge(struct luma_stats* stats, const struct luma_counts* counts);
+
+/**
+ * Derives sample_count, min, max, mean and variance from the histogram once every count was merged
+ * @param stats - The statistics
+ */
+void luma_stats_finish(struct luma_stats* stats);
+
+/**
+ * Gathers the statistics of an image that wasn't converted (ex: a zero-copy view) in a pass of its own
+ * @param image - The luma image
+ * @param stats - Filled with the statistics of the sampled pixels of the image
+ */
+void compute_luma_stats(const struct image_u8* image, struct luma_stats* stats);
+
+/**
+ * A contrast stretch of the luma range, built from the histogram of one frame and applied to the next one while it is
+ * converted. Dim scenes only use a narrow band of luma values, which can leave the black and white cells of a tag
+ * closer than the detector's min_white_black_diff. The stretch maps the band onto the full range:
+ * luma = min(255, (max(luma - low, 0) * gain) >> 8), also available as a 256-entry table.
+ *
+ * enabled - false when the frame already used most of the range, the luma is then left as is
+ * low - Luma that becomes 0
+ * gain - Scale in 1/256 steps
+ * table - The stretched value of every luma value
+ */
+struct contrast_stretch {
+    bool enabled;
+    uint8_t low;
+    uint16_t gain;
+    uint8_t table[256];
+};
+
+/**
+ * Builds a percentile stretch: the darkest and brightest clip_share of the samples are clipped to 0 and 255 and the
+ * range between them is stretched linearly, by at most max_gain so noise in a nearly blank frame isn't amplified
+ * @param stats - Statistics of the previous frame
+ * @param clip_share - Share of samples clipped at each end (ex: 0.01)
+ * @param max_gain - Largest stretch, between 1 and 16
+ * @param stretch - Filled with the stretch
+ */
+void contrast_stretch_from_stats(const struct luma_stats* stats, double clip_share, double max_gain,
+                                 struct contrast_stretch* stretch);
+
+/**
+ * Moves the counts of a histogram of stretched luma back to the luma values they were stretched from, so luma that
+ * went through the stretch can be metered like the camera delivered it. Clipped values all land on the clipping
+ * points
+ * @param stretch - The stretch that was applied
+ * @param histogram - Histogram of stretched luma, replaced by the histogram of the original luma
+ */
+void contrast_stretch_unmap_histogram(const struct contrast_stretch* stretch, uint32_t histogram[256]);
@@ -0,0 +1,40 @@
+#pragma once
+#include <stddef.h>
+#include "apriltag/common/workerpool.h"
+
+/**
+ * Splits per-pixel passes over an image (conversion, decimation, ...) into bands of whole rows that run as tasks on a
+ * workerpool. Bands are sized so the rows a task reads and writes fit in a core's private cache, which keeps every
+ * core streaming its own part of the frame and leaves enough bands to balance the load between cores.
+ */
+
+// Bytes of source and destination rows one band should touch, half of a typical 256 KiB L2 cache
+#define ROW_BAND_CACHE_BYTES (128 * 1024)
+
+/**
+ * Processes rows first_row up to (not including) end_row. Bands run concurrently, so a band must only write the rows
+ * it was given
+ * @param user_data - The user_data passed to run_in_row_bands
+ * @param first_row - First row of the band
+ * @param end_row - Row after the last row of the band
+ */
+typedef void (*row_band_function)(void* user_data, int first_row, int end_row);
+
+/**
+ * Number of rows in a band that fits ROW_BAND_CACHE_BYTES
+ * @param bytes_per_row - Bytes read and written for every row (ex: source bytesperline plus destination stride)
+ * @param row_alignment - Band heights are kept a multiple of this (ex: a decimation factor), 1 for none
+ * @return - The band height, at least row_alignment
+ */
+int row_band_height(size_t bytes_per_row, int row_alignment);
+
+/**
+ * Runs a function over every row of an image, one task per band. Runs on the calling thread in a single call when
+ * there is no pool, the pool has a single thread or the image fits one band
+ * @param wp - The workerpool to run the bands on (ex: from detector_workerpool), may be NULL
+ * @param height - Number of rows in the image
+ * @param band_rows - Rows per band (ex: from row_band_height)
+ * @param function - The function to run on each band
+ * @param user_data - Passed to every call of function
+ */
+void run_in_row_bands(workerpool_t* wp, int height, int band_rows, row_band_function function, void* user_data);
@@ -0,0 +1,62 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Alignment of the producer and consumer positions, keeps them on separate cache lines so the two threads don't
+ * invalidate each other's line on every push and pop
+ */
+#define SPSC_RING_CACHE_LINE 64
+
+/**
+ * Lock-free ring of fixed-size elements for exactly one producer thread and one consumer thread.
+ *
+ * The producer only writes tail and the consumer only writes head, each reads the other's position with acquire
+ * ordering, so an element is fully written before the consumer can see it and fully read before the producer can
+ * overwrite it. Positions count up forever and are masked into the slots, which is why the capacity is a power of two.
+ */
+struct spsc_ring {
+    _Alignas(SPSC_RING_CACHE_LINE) atomic_size_t head;
+    _Alignas(SPSC_RING_CACHE_LINE) atomic_size_t tail;
+    _Alignas(SPSC_RING_CACHE_LINE) size_t mask;
+    size_t element_size;
+    unsigned char* slots;
+};
+
+/**
+ * Allocates a ring
+ * @param minimum_capacity - Number of elements the ring must hold, rounded up to a power of two
+ * @param element_size - Size of one element in bytes
+ * @return - The ring or null if the allocation failed
+ */
+struct spsc_ring* spsc_ring_create(size_t minimum_capacity, size_t element_size);
+
+/**
+ * Frees a ring, neither thread may use it anymore
+ * @param ring - The ring to free
+ */
+void spsc_ring_destroy(struct spsc_ring* ring);
+
+/**
+ * Copies an element into the ring, only called by the producer thread
+ * @param ring - The ring
+ * @param element - element_size bytes to copy
+ * @return - false if the ring is full
+ */
+bool spsc_ring_push(struct spsc_ring* ring, const void* element);
+
+/**
+ * Copies the oldest element out of the ring, only called by the consumer thread
+ * @param ring - The ring
+ * @param element - Filled with the element
+ * @return - false if the ring is empty
+ */
+bool spsc_ring_pop(struct spsc_ring* ring, void* element);
+
+/**
+ * Checks whether the ring holds no elements, exact from the consumer thread, a snapshot from any other thread
+ * @param ring - The ring
+ * @return - true if the ring is empty
+ */
+bool spsc_ring_is_empty(struct spsc_ring* ring);
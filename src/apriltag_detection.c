@@ -1,3 +1,4 @@
+#include <math.h>
 #include "apriltag_detection.h"
 
 int is_valid_id(int id) {
@@ -5,6 +6,70 @@ int is_valid_id(int id) {
 }
 
 int detect_april_tag(struct image_u8* image, apriltag_detector_t* detector) {
+    return detect_april_tag_with_bounds(image, detector, NULL, NULL);
+}
+
+workerpool_t* detector_workerpool(apriltag_detector_t* detector) {
+    if (detector->wp == NULL || workerpool_get_nthreads(detector->wp) != detector->nthreads) {
+        workerpool_destroy(detector->wp);
+        detector->wp = workerpool_create(detector->nthreads);
+    }
+    return detector->wp;
+}
+
+/**
+ * Full resolution coordinate of a coordinate in an image decimated by a factor, the way apriltag maps decimated quads
+ * to the full image (pixel centers stay centers)
+ */
+static double full_resolution(double coordinate, int decimation) {
+    return (coordinate - 0.5) * decimation + 0.5;
+}
+
+/**
+ * Bounding box of the corners in an image of width x height pixels. Corners found in an image decimated by a factor
+ * are scaled back to the full image
+ */
+static void corner_bounds(const apriltag_detection_t* detection, int decimation, uint32_t width, uint32_t height,
+                          struct region_of_interest* bounds) {
+    double min_x = width, min_y = height, max_x = 0, max_y = 0;
+    for (int i = 0; i < 4; ++i) {
+        double x = full_resolution(detection->p[i][0], decimation);
+        double y = full_resolution(detection->p[i][1], decimation);
+        min_x = fmin(min_x, x);
+        min_y = fmin(min_y, y);
+        max_x = fmax(max_x, x);
+        max_y = fmax(max_y, y);
+    }
+
+    min_x = fmax(min_x, 0);
+    min_y = fmax(min_y, 0);
+    max_x = fmin(max_x, width);
+    max_y = fmin(max_y, height);
+
+    bounds->left = (uint32_t) min_x;
+    bounds->top = (uint32_t) min_y;
+    bounds->width = max_x > min_x ? (uint32_t) ceil(max_x - bounds->left) : 0;
+    bounds->height = max_y > min_y ? (uint32_t) ceil(max_y - bounds->top) : 0;
+}
+
+/**
+ * Corners and center of a detection, scaled back to the full image like the bounds
+ */
+static void copy_corners(const apriltag_detection_t* detection, int decimation, struct tag_corners* corners) {
+    for (int i = 0; i < 4; ++i) {
+        corners->corners[i][0] = full_resolution(detection->p[i][0], decimation);
+        corners->corners[i][1] = full_resolution(detection->p[i][1], decimation);
+    }
+    corners->center[0] = full_resolution(detection->c[0], decimation);
+    corners->center[1] = full_resolution(detection->c[1], decimation);
+}
+
+/**
+ * Runs the detector and returns the first valid tag, bounds and corners are scaled up by decimation and bounds are
+ * clipped to width x height
+ */
+static int find_tag(struct image_u8* image, apriltag_detector_t* detector, int decimation, uint32_t width,
+                    uint32_t height, struct region_of_interest* bounds, struct tag_corners* corners) {
     int detected_tag_id = -1;
     zarray_t* detections = apriltag_detector_detect(detector, image);
     for (int i = 0; i < zarray_size(detections); ++i) {
@@ -14,32 +79,30 @@ int detect_april_tag(struct image_u8* image, apriltag_detector_t* detector) {
         // TODO: Can the hamming value be negative?
         if (detection->hamming == 0 || detection->hamming == 1 && is_valid_id(detection->id)) {
             detected_tag_id = detection->id;
+            if (bounds != NULL)
+                corner_bounds(detection, decimation, width, height, bounds);
+            if (corners != NULL)
+                copy_corners(detection, decimation, corners);
             break;
         }
     }
 
+    apriltag_detections_destroy(detections);
     return detected_tag_id;
 }
 
-void prepare_frame_for_processing(struct buffer* buffer, struct image_u8* apriltag_image) {
-    uint32_t apriltag_image_size = apriltag_image->stride * apriltag_image->height;
-    int32_t apriltag_image_padding_size = apriltag_image->stride - apriltag_image->width;
-    uint8_t* yuyv_buffer = (uint8_t*)buffer->start;
-    size_t yuyv_buffer_length = buffer->length;
-
-    if (yuyv_buffer_length != apriltag_image->width * apriltag_image->height * 2) {
-        printf("Could not process frame because of improper buffer lengths\n"
-               "Actual YUYV Buffer Length: %zu\nExpected YUYV Buffer Length: %d\nAprilTag Image Buffer Length: %d\n",
-               yuyv_buffer_length, apriltag_image->width * apriltag_image->height * 2, apriltag_image_size);
-        return;
-    }
+int detect_april_tag_with_bounds(struct image_u8* image, apriltag_detector_t* detector,
+                                 struct region_of_interest* bounds, struct tag_corners* corners) {
+    return find_tag(image, detector, 1, image->width, image->height, bounds, corners);
+}
 
-    for (size_t i = 0, j = 0; i < apriltag_image->height; ++i) {
-        size_t k = 0 + (apriltag_image->stride * i);
-        for (; k < (apriltag_image->width + apriltag_image->stride * i) ; j += 4, k += 2) {
-            apriltag_image->buf[k] = yuyv_buffer[j];
-            apriltag_image->buf[k+1] = yuyv_buffer[j+2];
-        }
-        memset(&apriltag_image->buf[k+2], 0, apriltag_image_padding_size);
-    }
-}
\ No newline at end of file
+int detect_april_tag_in_decimated(struct image_u8* decimated_image, int decimation, uint32_t width, uint32_t height,
+                                  apriltag_detector_t* detector, struct region_of_interest* bounds,
+                                  struct tag_corners* corners) {
+    // The image is already decimated, so the detector must not decimate it again
+    float quad_decimate = detector->quad_decimate;
+    detector->quad_decimate = 1;
+    int detected_tag_id = find_tag(decimated_image, detector, decimation, width, height, bounds, corners);
+    detector->quad_decimate = quad_decimate;
+    return detected_tag_id;
+}
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <math.h>
+
+#include "buffer_tuning.h"
+
+// Clean windows needed before a buffer is given back, a single quiet window may just have been a quiet scene
+#define SHRINK_AFTER_CLEAN_WINDOWS 3
+
+int buffer_count_for_processing_time(int64_t processing_us, double frame_interval_us) {
+    if (frame_interval_us <= 0)
+        return 2;
+
+    // While a frame is processed the driver fills one buffer per frame interval, the processed buffer is on top
+    int count = (int) ceil(processing_us / frame_interval_us) + 1;
+    return count < 2 ? 2 : count;
+}
+
+static int clamp_count(const struct buffer_count_tuner* tuner, int count) {
+    if (count < tuner->min_count)
+        return tuner->min_count;
+    if (count > tuner->max_count)
+        return tuner->max_count;
+    return count;
+}
+
+void buffer_count_tuner_init(struct buffer_count_tuner* tuner, double frame_interval_us, int count, int min_count,
+                             int max_count, uint32_t window_frames) {
+    tuner->frame_interval_us = frame_interval_us;
+    tuner->min_count = min_count < 2 ? 2 : min_count;
+    tuner->max_count = max_count < tuner->min_count ? tuner->min_count : max_count;
+    tuner->window_frames = window_frames > 0 ? window_frames : 1;
+    tuner->clean_windows = 0;
+    buffer_count_tuner_resized(tuner, count, 0);
+}
+
+void buffer_count_tuner_resized(struct buffer_count_tuner* tuner, int count, unsigned long frames_dropped) {
+    tuner->count = count;
+    tuner->frames_in_window = 0;
+    tuner->max_processing_us = 0;
+    tuner->dropped_at_window_start = frames_dropped;
+}
+
+int buffer_count_tuner_record(struct buffer_count_tuner* tuner, int64_t processing_us, unsigned long frames_dropped) {
+    if (processing_us > tuner->max_processing_us)
+        tuner->max_processing_us = processing_us;
+
+    if (++tuner->frames_in_window < tuner->window_frames)
+        return 0;
+
+    int needed_count = buffer_count_for_processing_time(tuner->max_processing_us, tuner->frame_interval_us);
+    unsigned long dropped = frames_dropped - tuner->dropped_at_window_start;
+    int count = tuner->count;
+
+    if (dropped > 0) {
+        // Never go back to a count that dropped frames
+        tuner->min_count = clamp_count(tuner, tuner->count + 1);
+        count = needed_count > count + 1 ? needed_count : count + 1;
+        tuner->clean_windows = 0;
+    } else if (needed_count < count && ++tuner->clean_windows >= SHRINK_AFTER_CLEAN_WINDOWS) {
+        count--;
+        tuner->clean_windows = 0;
+    }
+    count = clamp_count(tuner, count);
+
+#if DEBUG
+    printf("Buffer tuning: %lu dropped, slowest frame %lld us, needs %d buffers, using %d\n", dropped,
+           (long long) tuner->max_processing_us, needed_count, count);
+#endif
+
+    tuner->frames_in_window = 0;
+    tuner->max_processing_us = 0;
+    tuner->dropped_at_window_start = frames_dropped;
+    return count != tuner->count ? count : 0;
+}
@@ -6,10 +6,119 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <time.h>
 
 #include "camera.h"
 
-int setup_camera(char* camera_file_path, int width, int height) {
+// Capture formats in order of preference, formats with a native Y plane need no per-pixel conversion and the
+// packed formats are ordered by how much work each pixel takes
+static const uint32_t PREFERRED_PIXEL_FORMATS[] = {
+    V4L2_PIX_FMT_GREY,
+    V4L2_PIX_FMT_NV12,
+    V4L2_PIX_FMT_NV12M,
+    V4L2_PIX_FMT_NV21,
+    V4L2_PIX_FMT_YUYV,
+    V4L2_PIX_FMT_UYVY,
+    V4L2_PIX_FMT_YVYU,
+    V4L2_PIX_FMT_VYUY,
+    V4L2_PIX_FMT_Y16,
+    V4L2_PIX_FMT_Y10,
+    V4L2_PIX_FMT_RGB24,
+    V4L2_PIX_FMT_BGR24,
+    V4L2_PIX_FMT_MJPEG
+};
+static const int PREFERRED_PIXEL_FORMAT_COUNT = sizeof(PREFERRED_PIXEL_FORMATS) / sizeof(PREFERRED_PIXEL_FORMATS[0]);
+
+// Chosen ahead of every other format when the camera offers it, 0 for none
+static uint32_t preferred_pixel_format = 0;
+
+void set_preferred_pixel_format(uint32_t pixelformat) {
+    preferred_pixel_format = pixelformat;
+}
+
+void fourcc_to_string(uint32_t pixelformat, char fourcc[5]) {
+    memcpy(fourcc, &pixelformat, 4);
+    fourcc[4] = '\0';
+}
+
+uint32_t negotiate_pixel_format(int fd, uint32_t buffer_type) {
+    int best_rank = PREFERRED_PIXEL_FORMAT_COUNT;
+
+    struct v4l2_fmtdesc format_description;
+    memset(&format_description, 0, sizeof(format_description));
+    format_description.type = buffer_type;
+
+    for (; ioctl(fd, VIDIOC_ENUM_FMT, &format_description) == 0; format_description.index++) {
+#if DEBUG
+        printf("Camera offers pixel format: %s\n", format_description.description);
+#endif
+        if (preferred_pixel_format != 0 && format_description.pixelformat == preferred_pixel_format)
+            return preferred_pixel_format;
+
+        for (int rank = 0; rank < best_rank; ++rank) {
+            if (PREFERRED_PIXEL_FORMATS[rank] == format_description.pixelformat) {
+                best_rank = rank;
+                break;
+            }
+        }
+    }
+
+    if (best_rank == PREFERRED_PIXEL_FORMAT_COUNT) {
+        printf("Camera does not offer any of the supported pixel formats\n");
+        return 0;
+    }
+
+    return PREFERRED_PIXEL_FORMATS[best_rank];
+}
+
+void choose_frame_size(int fd, uint32_t pixelformat, uint32_t* width, uint32_t* height) {
+    struct v4l2_frmsizeenum frame_size;
+    memset(&frame_size, 0, sizeof(frame_size));
+    frame_size.pixel_format = pixelformat;
+
+    if (ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frame_size) == -1) {
+        // Driver doesn't enumerate frame sizes, let VIDIOC_S_FMT adjust the requested size
+        return;
+    }
+
+    if (frame_size.type != V4L2_FRMSIZE_TYPE_DISCRETE) {
+        struct v4l2_frmsize_stepwise* stepwise = &frame_size.stepwise;
+        uint32_t step_width = stepwise->step_width > 0 ? stepwise->step_width : 1;
+        uint32_t step_height = stepwise->step_height > 0 ? stepwise->step_height : 1;
+        uint32_t clamped_width = *width < stepwise->min_width ? stepwise->min_width :
+                                 *width > stepwise->max_width ? stepwise->max_width : *width;
+        uint32_t clamped_height = *height < stepwise->min_height ? stepwise->min_height :
+                                  *height > stepwise->max_height ? stepwise->max_height : *height;
+
+        *width = stepwise->min_width + (clamped_width - stepwise->min_width) / step_width * step_width;
+        *height = stepwise->min_height + (clamped_height - stepwise->min_height) / step_height * step_height;
+        return;
+    }
+
+    // Pick the discrete size whose pixel count is closest to the requested one
+    uint64_t requested_area = (uint64_t) *width * *height;
+    uint64_t best_difference = UINT64_MAX;
+    uint32_t best_width = *width;
+    uint32_t best_height = *height;
+
+    for (; ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frame_size) == 0; frame_size.index++) {
+        uint64_t area = (uint64_t) frame_size.discrete.width * frame_size.discrete.height;
+        uint64_t difference = area > requested_area ? area - requested_area : requested_area - area;
+
+        if (difference < best_difference) {
+            best_difference = difference;
+            best_width = frame_size.discrete.width;
+            best_height = frame_size.discrete.height;
+        }
+    }
+
+    *width = best_width;
+    *height = best_height;
+}
+
+int setup_camera(char* camera_file_path, int width, int height, struct camera_format* format) {
     struct v4l2_capability device_capabilities;
     int video_device_fd = open(camera_file_path, O_RDWR | O_NONBLOCK);
 
@@ -20,106 +129,399 @@ int setup_camera(char* camera_file_path, int width, int height) {
 
     if (ioctl(video_device_fd, VIDIOC_QUERYCAP, &device_capabilities) == -1) {
         perror("VIDIOC_QUERYCAP");
+        close(video_device_fd);
         return -1;
     }
 
     printf("Video card: %s\n", device_capabilities.card);
-    printf("Device Capabilities Flags: %x\n", device_capabilities.capabilities);
-    printf("Supports single-planar API: %s\n", device_capabilities.capabilities & 0x1 ? "true" : "false");
-    printf("Supports multi-planar API: %s\n", device_capabilities.capabilities & 0x1000 ? "true" : "false");
 
-    bool isMMappedStreamingSupported = device_capabilities.capabilities & 0x04000000;
+    // Drivers that expose several device nodes report the capabilities of this node separately
+    uint32_t capabilities = device_capabilities.capabilities;
+    if (capabilities & V4L2_CAP_DEVICE_CAPS)
+        capabilities = device_capabilities.device_caps;
+
+    printf("Device Capabilities Flags: %x\n", capabilities);
+    printf("Supports single-planar API: %s\n", capabilities & V4L2_CAP_VIDEO_CAPTURE ? "true" : "false");
+    printf("Supports multi-planar API: %s\n", capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE ? "true" : "false");
+
+    bool isMMappedStreamingSupported = capabilities & V4L2_CAP_STREAMING;
     printf("Supports memory mapped streaming: %s\n", isMMappedStreamingSupported ? "true" : "false");
 
     if (!isMMappedStreamingSupported) {
         printf("This video device does not support memory mapped streaming. exiting...\n");
+        close(video_device_fd);
+        return -1;
+    }
+
+    uint32_t buffer_type;
+    if (capabilities & V4L2_CAP_VIDEO_CAPTURE) {
+        buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    } else if (capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+        buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    } else {
+        printf("This video device does not support video capture. exiting...\n");
+        close(video_device_fd);
         return -1;
     }
+    bool is_multiplanar = buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+
+    uint32_t pixelformat = negotiate_pixel_format(video_device_fd, buffer_type);
+    if (pixelformat == 0) {
+        close(video_device_fd);
+        return -1;
+    }
+
+    uint32_t frame_width = width;
+    uint32_t frame_height = height;
+    choose_frame_size(video_device_fd, pixelformat, &frame_width, &frame_height);
 
     struct v4l2_format set_format_command;
     memset(&set_format_command, 0, sizeof(set_format_command));
-    set_format_command.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    set_format_command.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
-    set_format_command.fmt.pix.width = width;
-    set_format_command.fmt.pix.height = height;
-    set_format_command.fmt.pix.field = V4L2_FIELD_NONE;
+    set_format_command.type = buffer_type;
+    if (is_multiplanar) {
+        set_format_command.fmt.pix_mp.pixelformat = pixelformat;
+        set_format_command.fmt.pix_mp.width = frame_width;
+        set_format_command.fmt.pix_mp.height = frame_height;
+        set_format_command.fmt.pix_mp.field = V4L2_FIELD_NONE;
+    } else {
+        set_format_command.fmt.pix.pixelformat = pixelformat;
+        set_format_command.fmt.pix.width = frame_width;
+        set_format_command.fmt.pix.height = frame_height;
+        set_format_command.fmt.pix.field = V4L2_FIELD_NONE;
+    }
 
     if (ioctl(video_device_fd, VIDIOC_S_FMT, &set_format_command) == -1) {
         perror("VIDIOC_S_FMT");
+        close(video_device_fd);
         return -1;
     }
 
     struct v4l2_format get_format_command;
     memset(&get_format_command, 0, sizeof(get_format_command));
-    get_format_command.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    get_format_command.type = buffer_type;
 
     if (ioctl(video_device_fd, VIDIOC_G_FMT, &get_format_command) == -1) {
         perror("VIDIOC_G_FMT");
+        close(video_device_fd);
         return -1;
     }
 
-    // Convert fourCC to readable string
-    char fourCC[5];
-    strncpy(fourCC, (char*) &get_format_command.fmt.pix.pixelformat, 4);
-    fourCC[4] = '\n';
+    memset(format, 0, sizeof(*format));
+    format->buffer_type = buffer_type;
+    if (is_multiplanar) {
+        struct v4l2_pix_format_mplane* pix_mp = &get_format_command.fmt.pix_mp;
+        format->pixelformat = pix_mp->pixelformat;
+        format->width = pix_mp->width;
+        format->height = pix_mp->height;
+        format->bytesperline = pix_mp->plane_fmt[0].bytesperline;
+        format->sizeimage = pix_mp->plane_fmt[0].sizeimage;
+        format->num_planes = pix_mp->num_planes;
+        for (int i = 0; i < pix_mp->num_planes && i < VIDEO_MAX_PLANES; ++i) {
+            format->plane_sizes[i] = pix_mp->plane_fmt[i].sizeimage;
+        }
+    } else {
+        format->pixelformat = get_format_command.fmt.pix.pixelformat;
+        format->width = get_format_command.fmt.pix.width;
+        format->height = get_format_command.fmt.pix.height;
+        format->bytesperline = get_format_command.fmt.pix.bytesperline;
+        format->sizeimage = get_format_command.fmt.pix.sizeimage;
+        format->num_planes = 1;
+        format->plane_sizes[0] = format->sizeimage;
+    }
 
-    printf("Video capture format info [width: %d, height: %d, pixelformat: %s]\n",
-           get_format_command.fmt.pix.width,
-           get_format_command.fmt.pix.height,
-           fourCC);
+    char fourCC[5];
+    fourcc_to_string(format->pixelformat, fourCC);
+
+    printf("Video capture format info [width: %d, height: %d, pixelformat: %s, planes: %u]\n",
+           format->width,
+           format->height,
+           fourCC,
+           format->num_planes);
+
+    if (format->pixelformat != pixelformat) {
+        char requested_fourCC[5];
+        fourcc_to_string(pixelformat, requested_fourCC);
+        printf("Camera switched the pixel format from %s to %s\n", requested_fourCC, fourCC);
+        close(video_device_fd);
+        return -1;
+    }
 
     return video_device_fd;
 }
 
-struct v4l2_requestbuffers* request_mmap_buffers(int camera_fd, int buffer_count){
+/**
+ * Sets the crop rectangle and returns what the driver actually applied
+ */
+static int apply_crop_selection(int fd, uint32_t target, struct v4l2_rect* rectangle) {
+    struct v4l2_selection selection;
+    memset(&selection, 0, sizeof(selection));
+    // The selection API takes the single-planar type for multi-planar devices too
+    selection.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    selection.target = target;
+
+    if (target == V4L2_SEL_TGT_CROP_DEFAULT) {
+        if (ioctl(fd, VIDIOC_G_SELECTION, &selection) == -1)
+            return -1;
+        selection.target = V4L2_SEL_TGT_CROP;
+    } else {
+        selection.r = *rectangle;
+    }
+
+    if (ioctl(fd, VIDIOC_S_SELECTION, &selection) == -1)
+        return -1;
+
+    selection.target = V4L2_SEL_TGT_CROP;
+    if (ioctl(fd, VIDIOC_G_SELECTION, &selection) == -1)
+        return -1;
+
+    *rectangle = selection.r;
+    return 0;
+}
+
+/**
+ * Reads the current format back into a camera_format after the driver may have changed it
+ */
+static int refresh_format(int fd, struct camera_format* format) {
+    struct v4l2_format get_format_command;
+    memset(&get_format_command, 0, sizeof(get_format_command));
+    get_format_command.type = format->buffer_type;
+
+    if (ioctl(fd, VIDIOC_G_FMT, &get_format_command) == -1) {
+        perror("VIDIOC_G_FMT");
+        return -1;
+    }
+
+    if (format->buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        struct v4l2_pix_format_mplane* pix_mp = &get_format_command.fmt.pix_mp;
+        format->width = pix_mp->width;
+        format->height = pix_mp->height;
+        format->bytesperline = pix_mp->plane_fmt[0].bytesperline;
+        format->sizeimage = pix_mp->plane_fmt[0].sizeimage;
+        for (int i = 0; i < pix_mp->num_planes && i < VIDEO_MAX_PLANES; ++i) {
+            format->plane_sizes[i] = pix_mp->plane_fmt[i].sizeimage;
+        }
+    } else {
+        format->width = get_format_command.fmt.pix.width;
+        format->height = get_format_command.fmt.pix.height;
+        format->bytesperline = get_format_command.fmt.pix.bytesperline;
+        format->sizeimage = get_format_command.fmt.pix.sizeimage;
+        format->plane_sizes[0] = format->sizeimage;
+    }
+
+    return 0;
+}
+
+int set_hardware_crop(int fd, struct camera_format* format, const struct region_of_interest* region) {
+    struct v4l2_rect rectangle = {
+        .left = region->left,
+        .top = region->top,
+        .width = region->width,
+        .height = region->height
+    };
+
+    if (apply_crop_selection(fd, V4L2_SEL_TGT_CROP, &rectangle) == -1) {
+        printf("Camera does not support cropping, falling back to software cropping\n");
+        return -1;
+    }
+
+    if (refresh_format(fd, format) == -1)
+        return -1;
+
+    bool is_exact_crop = rectangle.left == region->left && rectangle.top == region->top &&
+                         rectangle.width == region->width && rectangle.height == region->height &&
+                         format->width == region->width && format->height == region->height;
+
+    if (!is_exact_crop) {
+        printf("Camera adjusted the crop to %ux%u at (%d, %d) with a %ux%u output, falling back to software cropping\n",
+               rectangle.width, rectangle.height, rectangle.left, rectangle.top, format->width, format->height);
+        apply_crop_selection(fd, V4L2_SEL_TGT_CROP_DEFAULT, &rectangle);
+        refresh_format(fd, format);
+        return -1;
+    }
+
+    printf("Camera crops to %ux%u at (%u, %u)\n", region->width, region->height, region->left, region->top);
+    return 0;
+}
+
+double frame_interval_to_fps(struct v4l2_fract interval) {
+    if (interval.numerator == 0)
+        return 0;
+
+    return (double) interval.denominator / interval.numerator;
+}
+
+/**
+ * Finds the offered frame interval closest to 1 / fps
+ */
+static struct v4l2_fract choose_frame_interval(int fd, const struct camera_format* format, uint32_t fps) {
+    struct v4l2_fract requested_interval = { .numerator = 1, .denominator = fps };
+
+    struct v4l2_frmivalenum frame_interval;
+    memset(&frame_interval, 0, sizeof(frame_interval));
+    frame_interval.pixel_format = format->pixelformat;
+    frame_interval.width = format->width;
+    frame_interval.height = format->height;
+
+    if (ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &frame_interval) == -1) {
+        // Driver doesn't enumerate intervals, let VIDIOC_S_PARM adjust the requested one
+        return requested_interval;
+    }
+
+    double requested_seconds = 1.0 / fps;
+
+    if (frame_interval.type != V4L2_FRMIVAL_TYPE_DISCRETE) {
+        struct v4l2_frmival_stepwise* stepwise = &frame_interval.stepwise;
+        double min_seconds = (double) stepwise->min.numerator / stepwise->min.denominator;
+        double max_seconds = (double) stepwise->max.numerator / stepwise->max.denominator;
+
+        if (requested_seconds < min_seconds)
+            return stepwise->min;
+        if (requested_seconds > max_seconds)
+            return stepwise->max;
+        return requested_interval;
+    }
+
+    struct v4l2_fract best_interval = requested_interval;
+    double best_difference = -1;
+
+    for (; ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &frame_interval) == 0; frame_interval.index++) {
+        double seconds = (double) frame_interval.discrete.numerator / frame_interval.discrete.denominator;
+        double difference = seconds > requested_seconds ? seconds - requested_seconds : requested_seconds - seconds;
+
+        if (best_difference < 0 || difference < best_difference) {
+            best_difference = difference;
+            best_interval = frame_interval.discrete;
+        }
+    }
+
+    return best_interval;
+}
+
+int set_frame_rate(int fd, const struct camera_format* format, uint32_t fps, struct v4l2_fract* achieved_interval) {
+    struct v4l2_streamparm stream_parameters;
+    memset(&stream_parameters, 0, sizeof(stream_parameters));
+    stream_parameters.type = format->buffer_type;
+
+    if (ioctl(fd, VIDIOC_G_PARM, &stream_parameters) == -1) {
+        perror("VIDIOC_G_PARM");
+        return -1;
+    }
+
+    if (!(stream_parameters.parm.capture.capability & V4L2_CAP_TIMEPERFRAME)) {
+        printf("Camera does not support setting the frame interval\n");
+        *achieved_interval = stream_parameters.parm.capture.timeperframe;
+        return -1;
+    }
+
+    stream_parameters.parm.capture.timeperframe = choose_frame_interval(fd, format, fps);
+
+    if (ioctl(fd, VIDIOC_S_PARM, &stream_parameters) == -1) {
+        perror("VIDIOC_S_PARM");
+        return -1;
+    }
+
+    memset(&stream_parameters, 0, sizeof(stream_parameters));
+    stream_parameters.type = format->buffer_type;
+
+    if (ioctl(fd, VIDIOC_G_PARM, &stream_parameters) == -1) {
+        perror("VIDIOC_G_PARM");
+        return -1;
+    }
+
+    *achieved_interval = stream_parameters.parm.capture.timeperframe;
+    return 0;
+}
+
+static struct v4l2_requestbuffers* request_buffers_of_type(int camera_fd, int buffer_count, uint32_t buffer_type,
+                                                           enum v4l2_memory memory) {
     struct v4l2_requestbuffers* request_buffers = (struct v4l2_requestbuffers*) malloc(sizeof(struct v4l2_requestbuffers));
     memset(request_buffers, 0, sizeof(*request_buffers));
     request_buffers->count = buffer_count;
-    request_buffers->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    request_buffers->memory = V4L2_MEMORY_MMAP;
+    request_buffers->type = buffer_type;
+    request_buffers->memory = memory;
 
     if (ioctl(camera_fd, VIDIOC_REQBUFS, request_buffers) == -1) {
         if (errno == EINVAL) {
-            printf("Video capturing or mmap-streaming is not supported\n");
+            printf("Video capturing or %s-streaming is not supported\n",
+                   memory == V4L2_MEMORY_USERPTR ? "userptr" : "mmap");
         } else {
             perror("VIDIOC_REQBUFS");
         }
+        free(request_buffers);
         return NULL;
     }
 
-    if (request_buffers->count != buffer_count) {
-        printf("Requested %d buffers but received %d\n", buffer_count, request_buffers->count);
+    // Drivers are free to grant more or fewer buffers than requested, only none at all is unusable
+    if (request_buffers->count == 0) {
+        printf("Requested %d buffers but the driver granted none\n", buffer_count);
+        free(request_buffers);
         return NULL;
     }
 
+    if (request_buffers->count != buffer_count)
+        printf("Requested %d buffers but received %d\n", buffer_count, request_buffers->count);
+
     return request_buffers;
 }
 
+struct v4l2_requestbuffers* request_mmap_buffers(int camera_fd, int buffer_count, uint32_t buffer_type) {
+    return request_buffers_of_type(camera_fd, buffer_count, buffer_type, V4L2_MEMORY_MMAP);
+}
+
+struct v4l2_requestbuffers* request_userptr_buffers(int camera_fd, int buffer_count, uint32_t buffer_type) {
+    return request_buffers_of_type(camera_fd, buffer_count, buffer_type, V4L2_MEMORY_USERPTR);
+}
+
 struct buffer* map_buffers(int fd, struct v4l2_requestbuffers* request_buffers) {
     struct buffer *buffers;
     buffers = calloc(request_buffers->count, sizeof(*buffers));
+    bool is_multiplanar = request_buffers->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
 
     for (int i = 0; i < request_buffers->count; ++i) {
+        struct v4l2_plane planes[VIDEO_MAX_PLANES];
+        memset(planes, 0, sizeof(planes));
+
         struct v4l2_buffer buffer;
         memset(&buffer, 0, sizeof(buffer));
         buffer.type = request_buffers->type;
         buffer.memory = V4L2_MEMORY_MMAP;
         buffer.index = i;
+        if (is_multiplanar) {
+            buffer.m.planes = planes;
+            buffer.length = VIDEO_MAX_PLANES;
+        }
 
         if (ioctl(fd, VIDIOC_QUERYBUF, &buffer) == -1) {
             perror("VIDIOC_QUERYBUF");
+            cleanup_buffers(buffers, request_buffers->count);
             return NULL;
         }
 
-        buffers[i].length = buffer.length;
-        buffers[i].start = mmap(NULL, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED,
-                                fd, buffer.m.offset);
+        if (is_multiplanar) {
+            buffers[i].num_planes = buffer.length;
+            for (int plane = 0; plane < buffer.length; ++plane) {
+                buffers[i].planes[plane].length = planes[plane].length;
+                buffers[i].planes[plane].start = mmap(NULL, planes[plane].length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                                      fd, planes[plane].m.mem_offset);
+            }
+        } else {
+            buffers[i].num_planes = 1;
+            buffers[i].planes[0].length = buffer.length;
+            buffers[i].planes[0].start = mmap(NULL, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                              fd, buffer.m.offset);
+        }
 
-        if (buffers[i].start == MAP_FAILED) {
-            cleanup_buffers(buffers, request_buffers->count);
-            return NULL;
+        for (int plane = 0; plane < buffers[i].num_planes; ++plane) {
+            if (buffers[i].planes[plane].start == MAP_FAILED) {
+                perror("mmap");
+                buffers[i].planes[plane].start = NULL;
+                cleanup_buffers(buffers, request_buffers->count);
+                return NULL;
+            }
         }
 
+        buffers[i].start = buffers[i].planes[0].start;
+        buffers[i].length = buffers[i].planes[0].length;
     }
 
     return buffers;
@@ -127,56 +529,384 @@ struct buffer* map_buffers(int fd, struct v4l2_requestbuffers* request_buffers)
 
 void cleanup_buffers(struct buffer* buffers, size_t buffers_length) {
     for (int i = 0; i < buffers_length; ++i) {
-        if (buffers[i].start > 0)
-            munmap(buffers[i].start, buffers[i].length);
+        for (int plane = 0; plane < buffers[i].num_planes; ++plane) {
+            if (buffers[i].planes[plane].start != NULL)
+                munmap(buffers[i].planes[plane].start, buffers[i].planes[plane].length);
+        }
     }
     free(buffers);
 }
 
-void queue_buffers(int fd, size_t num_buffers) {
+struct buffer* allocate_userptr_buffers(struct frame_arena* arena, struct v4l2_requestbuffers* request_buffers,
+                                        const struct camera_format* format) {
+    struct buffer *buffers = calloc(request_buffers->count, sizeof(*buffers));
+    size_t page_size = sysconf(_SC_PAGESIZE);
+
+    for (int i = 0; i < request_buffers->count; ++i) {
+        buffers[i].num_planes = format->num_planes;
+
+        for (int plane = 0; plane < format->num_planes; ++plane) {
+            size_t plane_length = (format->plane_sizes[plane] + page_size - 1) / page_size * page_size;
+
+            // Page alignment keeps the buffers usable for drivers that DMA straight into user memory
+            buffers[i].planes[plane].start = frame_arena_alloc(arena, plane_length, page_size);
+            buffers[i].planes[plane].length = plane_length;
+
+            if (buffers[i].planes[plane].start == NULL) {
+                printf("Frame arena is too small for %d buffers of %zu bytes\n", request_buffers->count,
+                       userptr_buffer_size(format));
+                free(buffers);
+                return NULL;
+            }
+        }
+
+        buffers[i].start = buffers[i].planes[0].start;
+        buffers[i].length = buffers[i].planes[0].length;
+    }
+
+    return buffers;
+}
+
+size_t userptr_buffer_size(const struct camera_format* format) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t buffer_size = 0;
+
+    for (int plane = 0; plane < format->num_planes; ++plane) {
+        buffer_size += (format->plane_sizes[plane] + page_size - 1) / page_size * page_size;
+    }
+    return buffer_size;
+}
+
+int* export_buffers(int fd, struct v4l2_requestbuffers* request_buffers) {
+    // Consumers get one dmabuf per buffer, which only covers the whole image for single-plane formats
+    if (request_buffers->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        printf("Only single-planar capture buffers can be exported\n");
+        return NULL;
+    }
+
+    int* dmabuf_fds = malloc(request_buffers->count * sizeof(*dmabuf_fds));
+
+    for (int i = 0; i < request_buffers->count; ++i) {
+        struct v4l2_exportbuffer export_buffer;
+        memset(&export_buffer, 0, sizeof(export_buffer));
+        export_buffer.type = request_buffers->type;
+        export_buffer.index = i;
+        export_buffer.flags = O_RDONLY | O_CLOEXEC;
+
+        if (ioctl(fd, VIDIOC_EXPBUF, &export_buffer) == -1) {
+            perror("VIDIOC_EXPBUF");
+            close_exported_buffers(dmabuf_fds, i);
+            return NULL;
+        }
+
+        dmabuf_fds[i] = export_buffer.fd;
+    }
+
+    return dmabuf_fds;
+}
+
+void close_exported_buffers(int* dmabuf_fds, size_t dmabuf_fds_length) {
+    for (int i = 0; i < dmabuf_fds_length; ++i) {
+        close(dmabuf_fds[i]);
+    }
+    free(dmabuf_fds);
+}
+
+/**
+ * Fills the fields of a v4l2_buffer that identify a buffer of the queue to the driver. Multi-planar buffers point
+ * into the caller's planes array
+ */
+static void prepare_v4l2_buffer(const struct buffer_queue* queue, int buffer_index, struct v4l2_buffer* buffer,
+                                struct v4l2_plane planes[VIDEO_MAX_PLANES]) {
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->type = queue->type;
+    buffer->memory = queue->memory;
+    buffer->index = buffer_index;
+
+    if (queue->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        memset(planes, 0, sizeof(struct v4l2_plane) * VIDEO_MAX_PLANES);
+        buffer->m.planes = planes;
+        buffer->length = queue->num_planes;
+
+        if (queue->memory == V4L2_MEMORY_USERPTR && buffer_index >= 0) {
+            for (int plane = 0; plane < queue->num_planes; ++plane) {
+                planes[plane].m.userptr = (unsigned long) queue->buffers[buffer_index].planes[plane].start;
+                planes[plane].length = queue->buffers[buffer_index].planes[plane].length;
+            }
+        }
+    } else if (queue->memory == V4L2_MEMORY_USERPTR && buffer_index >= 0) {
+        buffer->m.userptr = (unsigned long) queue->buffers[buffer_index].start;
+        buffer->length = queue->buffers[buffer_index].length;
+    }
+}
+
+void queue_buffers(struct buffer_queue* queue) {
     struct v4l2_buffer buffer;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
 
-    for (int i = 0; i < num_buffers; ++i) {
-        memset(&buffer, 0, sizeof(buffer));
-        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buffer.memory = V4L2_MEMORY_MMAP;
-        buffer.index = i;
+    for (int i = 0; i < queue->count; ++i) {
+        prepare_v4l2_buffer(queue, i, &buffer, planes);
 
-        if (-1 == ioctl(fd, VIDIOC_QBUF, &buffer))
+        if (-1 == ioctl(queue->fd, VIDIOC_QBUF, &buffer))
             perror("VIDIOC_QBUF");
     }
 }
 
-int dequeue_buffer(int fd) {
+int dequeue_buffer(struct buffer_queue* queue, struct frame* frame) {
     struct v4l2_buffer buffer;
-    memset(&buffer, 0, sizeof(buffer));
-    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buffer.memory = V4L2_MEMORY_MMAP;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    prepare_v4l2_buffer(queue, -1, &buffer, planes);
 
-    if (ioctl(fd, VIDIOC_DQBUF, &buffer) == -1) {
-        return -1;
+    if (ioctl(queue->fd, VIDIOC_DQBUF, &buffer) == -1) {
+        return -errno;
     }
 
-    // TODO
-    return buffer.index;
+    frame->index = buffer.index;
+    // The luma plane comes first, so that's the one checked for short frames
+    frame->bytesused = queue->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? planes[0].bytesused : buffer.bytesused;
+    frame->timestamp = buffer.timestamp;
+    frame->sequence = buffer.sequence;
+    frame->flags = buffer.flags;
+    return 0;
+}
+
+bool is_frame_usable(const struct frame* frame, uint32_t min_bytesused) {
+    if (frame->flags & V4L2_BUF_FLAG_ERROR)
+        return false;
+
+    return frame->bytesused >= min_bytesused;
 }
 
-int requeue_buffer(int fd, int buffer_index) {
+int64_t frame_age_us(const struct frame* frame) {
+    if ((frame->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) != V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+        return -1;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int64_t now_us = (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    int64_t captured_us = (int64_t) frame->timestamp.tv_sec * 1000000 + frame->timestamp.tv_usec;
+    return now_us - captured_us;
+}
+
+void record_frame_sequence(struct capture_stats* stats, const struct frame* frame) {
+    if (stats->has_sequence && frame->sequence > stats->last_sequence + 1)
+        stats->frames_dropped += frame->sequence - stats->last_sequence - 1;
+
+    stats->has_sequence = true;
+    stats->last_sequence = frame->sequence;
+}
+
+int dequeue_latest_buffer(struct buffer_queue* queue, struct frame* frame, struct capture_stats* stats) {
+    int result = dequeue_buffer(queue, frame);
+    if (result < 0)
+        return result;
+    record_frame_sequence(stats, frame);
+
+    while (true) {
+        struct frame newer_frame;
+        result = dequeue_buffer(queue, &newer_frame);
+
+        if (result == -EINTR)
+            continue;
+
+        if (result < 0) {
+            // -EAGAIN means the queue is drained, anything else is reported on the next call
+            return 0;
+        }
+        record_frame_sequence(stats, &newer_frame);
+
+        if (requeue_buffer(queue, frame->index) == -1) {
+            int requeue_error = errno;
+            requeue_buffer(queue, newer_frame.index);
+            return -requeue_error;
+        }
+
+        stats->frames_skipped++;
+        *frame = newer_frame;
+    }
+}
+
+int requeue_buffer(struct buffer_queue* queue, int buffer_index) {
     struct v4l2_buffer buffer;
-    memset(&buffer, 0, sizeof(buffer));
-    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buffer.memory = V4L2_MEMORY_MMAP;
-    buffer.index = buffer_index;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    prepare_v4l2_buffer(queue, buffer_index, &buffer, planes);
 
-    return ioctl(fd, VIDIOC_QBUF, &buffer);
+    return ioctl(queue->fd, VIDIOC_QBUF, &buffer);
 }
 
-int start_stream(int fd) {
-    int stream_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+int start_stream(int fd, uint32_t buffer_type) {
+    int stream_type = buffer_type;
     return ioctl(fd, VIDIOC_STREAMON, &stream_type);
 }
 
-int stop_stream(int fd) {
-    int stream_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+int stop_stream(int fd, uint32_t buffer_type) {
+    int stream_type = buffer_type;
     return ioctl(fd, VIDIOC_STREAMOFF, &stream_type);
-}
\ No newline at end of file
+}
+
+struct v4l2_requestbuffers* resize_buffer_queue(struct buffer_queue* queue, int buffer_count) {
+    if (queue->memory != V4L2_MEMORY_MMAP) {
+        printf("Only mmap buffer queues can be resized\n");
+        return NULL;
+    }
+
+    if (stop_stream(queue->fd, queue->type) == -1) {
+        perror("VIDIOC_STREAMOFF");
+        return NULL;
+    }
+
+    // The driver only frees its buffers once they are unmapped and a count of 0 is requested
+    cleanup_buffers(queue->buffers, queue->count);
+    queue->buffers = NULL;
+    queue->count = 0;
+
+    struct v4l2_requestbuffers release_request;
+    memset(&release_request, 0, sizeof(release_request));
+    release_request.type = queue->type;
+    release_request.memory = queue->memory;
+    if (ioctl(queue->fd, VIDIOC_REQBUFS, &release_request) == -1) {
+        perror("VIDIOC_REQBUFS");
+        return NULL;
+    }
+
+    struct v4l2_requestbuffers* request_buffers = request_mmap_buffers(queue->fd, buffer_count, queue->type);
+    if (request_buffers == NULL)
+        return NULL;
+
+    queue->buffers = map_buffers(queue->fd, request_buffers);
+    if (queue->buffers == NULL) {
+        free(request_buffers);
+        return NULL;
+    }
+    queue->count = request_buffers->count;
+
+    queue_buffers(queue);
+    if (start_stream(queue->fd, queue->type) == -1) {
+        perror("VIDIOC_STREAMON");
+        free(request_buffers);
+        return NULL;
+    }
+
+    return request_buffers;
+}
+
+int capture_frames(struct buffer_queue* queue, const struct capture_options* options, frame_handler handler,
+                   void* user_data, struct capture_stats* stats) {
+    struct capture_stats local_stats = { 0 };
+    if (stats == NULL)
+        stats = &local_stats;
+    int fd = queue->fd;
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    struct epoll_event camera_event;
+    memset(&camera_event, 0, sizeof(camera_event));
+    camera_event.events = EPOLLIN;
+    camera_event.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &camera_event) == -1) {
+        perror("epoll_ctl");
+        close(epoll_fd);
+        return -1;
+    }
+
+    if (options->auxiliary_handler != NULL) {
+        struct epoll_event auxiliary_event;
+        memset(&auxiliary_event, 0, sizeof(auxiliary_event));
+        auxiliary_event.events = EPOLLIN;
+        auxiliary_event.data.fd = options->auxiliary_fd;
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, options->auxiliary_fd, &auxiliary_event) == -1) {
+            perror("epoll_ctl");
+            close(epoll_fd);
+            return -1;
+        }
+    }
+
+    int result = 0;
+    bool running = true;
+    while (running) {
+        struct epoll_event ready_events[2];
+        int ready_count = epoll_wait(epoll_fd, ready_events, 2, options->timeout_ms);
+
+        if (ready_count == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            result = -1;
+            break;
+        }
+
+        if (ready_count == 0) {
+            printf("WARN: No frame received from the camera within %d ms\n", options->timeout_ms);
+            continue;
+        }
+
+        bool camera_ready = false;
+        for (int i = 0; i < ready_count; ++i) {
+            if (ready_events[i].data.fd == fd)
+                camera_ready = true;
+            else
+                options->auxiliary_handler(user_data);
+        }
+
+        if (!camera_ready)
+            continue;
+
+        // Keep dequeuing until the driver has nothing left so frames completed during processing aren't delayed
+        while (running) {
+            struct frame frame;
+            int dequeue_result;
+            if (options->mode == CAPTURE_LATEST_FRAME) {
+                dequeue_result = dequeue_latest_buffer(queue, &frame, stats);
+            } else {
+                dequeue_result = dequeue_buffer(queue, &frame);
+                if (dequeue_result == 0)
+                    record_frame_sequence(stats, &frame);
+            }
+
+            if (dequeue_result == -EAGAIN)
+                break;
+
+            if (dequeue_result == -EINTR)
+                continue;
+
+            if (dequeue_result < 0) {
+                errno = -dequeue_result;
+                perror("VIDIOC_DQBUF");
+                result = -1;
+                running = false;
+                break;
+            }
+
+            if (!is_frame_usable(&frame, options->min_bytesused)) {
+#if DEBUG
+                printf("Rejected frame %u (flags: %x, bytesused: %u)\n", frame.sequence, frame.flags, frame.bytesused);
+#endif
+                stats->frames_rejected++;
+            } else {
+                enum capture_action action = handler(&frame, user_data);
+                stats->frames_processed++;
+
+                if (action == CAPTURE_STOP || action == CAPTURE_STOP_HOLD)
+                    running = false;
+                if (action == CAPTURE_HOLD || action == CAPTURE_STOP_HOLD)
+                    continue;
+            }
+
+            if (requeue_buffer(queue, frame.index) == -1) {
+                perror("VIDIOC_QBUF");
+                result = -1;
+                running = false;
+            }
+        }
+    }
+
+    close(epoll_fd);
+    return result;
+}
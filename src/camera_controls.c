@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/ioctl.h>
+
+#include "camera_controls.h"
+
+// Luma values at or above this are treated as clipped highlights
+#define SATURATED_LUMA 250
+// Share of clipped samples above which the metered region is considered overexposed whatever its mean
+#define MAX_SATURATED_SHARE 0.05
+// Mean luma within this share of the target leaves the controls alone so they don't oscillate
+#define LUMA_DEADBAND 0.1
+// Exposure units of V4L2_CID_EXPOSURE_ABSOLUTE
+#define EXPOSURE_UNIT_US 100
+
+int query_camera_control(int fd, uint32_t id, struct camera_control* control) {
+    memset(control, 0, sizeof(*control));
+    control->id = id;
+
+    struct v4l2_queryctrl query;
+    memset(&query, 0, sizeof(query));
+    query.id = id;
+
+    if (ioctl(fd, VIDIOC_QUERYCTRL, &query) == -1 || (query.flags & V4L2_CTRL_FLAG_DISABLED))
+        return -1;
+
+    control->available = true;
+    control->minimum = query.minimum;
+    control->maximum = query.maximum;
+    control->step = query.step > 0 ? query.step : 1;
+    control->default_value = query.default_value;
+    return 0;
+}
+
+int get_camera_control(int fd, uint32_t id, int32_t* value) {
+    struct v4l2_ext_control control;
+    memset(&control, 0, sizeof(control));
+    control.id = id;
+
+    struct v4l2_ext_controls controls;
+    memset(&controls, 0, sizeof(controls));
+    controls.which = V4L2_CTRL_WHICH_CUR_VAL;
+    controls.count = 1;
+    controls.controls = &control;
+
+    if (ioctl(fd, VIDIOC_G_EXT_CTRLS, &controls) == -1)
+        return -1;
+
+    *value = control.value;
+    return 0;
+}
+
+int set_camera_controls(int fd, const uint32_t* ids, const int32_t* values, int count) {
+    struct v4l2_ext_control control_values[count];
+    memset(control_values, 0, sizeof(control_values));
+    for (int i = 0; i < count; ++i) {
+        control_values[i].id = ids[i];
+        control_values[i].value = values[i];
+    }
+
+    struct v4l2_ext_controls controls;
+    memset(&controls, 0, sizeof(controls));
+    controls.which = V4L2_CTRL_WHICH_CUR_VAL;
+    controls.count = count;
+    controls.controls = control_values;
+
+    if (ioctl(fd, VIDIOC_S_EXT_CTRLS, &controls) == -1) {
+        perror("VIDIOC_S_EXT_CTRLS");
+        return -1;
+    }
+    return 0;
+}
+
+uint32_t motion_blur_exposure_limit_us(double max_blur_pixels, double image_speed_pixels_per_second) {
+    if (image_speed_pixels_per_second <= 0)
+        return UINT32_MAX;
+
+    return (uint32_t) (max_blur_pixels / image_speed_pixels_per_second * 1e6);
+}
+
+static int32_t clamp_to_control(const struct camera_control* control, int64_t value) {
+    if (value < control->minimum)
+        return control->minimum;
+    if (value > control->maximum)
+        return control->maximum;
+
+    // Drivers round to the step anyway, doing it here keeps exposure_value in sync with the camera
+    return control->minimum + (int32_t) ((value - control->minimum) / control->step * control->step);
+}
+
+struct exposure_controller* exposure_controller_create(int fd, const struct exposure_control_options* options) {
+    struct exposure_controller* controller = calloc(1, sizeof(*controller));
+    controller->fd = fd;
+    controller->options = *options;
+
+    if (query_camera_control(fd, V4L2_CID_EXPOSURE_ABSOLUTE, &controller->exposure) == -1) {
+        printf("The camera has no absolute exposure control\n");
+        free(controller);
+        return NULL;
+    }
+
+    // Webcams usually name it GAIN, sensor drivers ANALOGUE_GAIN
+    if (query_camera_control(fd, V4L2_CID_GAIN, &controller->gain) == -1)
+        query_camera_control(fd, V4L2_CID_ANALOGUE_GAIN, &controller->gain);
+
+    struct camera_control auto_exposure;
+    if (query_camera_control(fd, V4L2_CID_EXPOSURE_AUTO, &auto_exposure) == 0 &&
+        get_camera_control(fd, V4L2_CID_EXPOSURE_AUTO, &controller->original_auto_exposure) == 0) {
+        controller->has_auto_exposure = true;
+
+        // Some drivers refuse exposure changes until auto exposure is off, so it is switched off on its own first
+        uint32_t id = V4L2_CID_EXPOSURE_AUTO;
+        int32_t manual = V4L2_EXPOSURE_MANUAL;
+        if (set_camera_controls(fd, &id, &manual, 1) == -1) {
+            free(controller);
+            return NULL;
+        }
+    }
+
+    struct camera_control auto_gain;
+    if (controller->gain.available && query_camera_control(fd, V4L2_CID_AUTOGAIN, &auto_gain) == 0) {
+        uint32_t id = V4L2_CID_AUTOGAIN;
+        int32_t off = 0;
+        set_camera_controls(fd, &id, &off, 1);
+    }
+
+    controller->max_exposure_value = clamp_to_control(&controller->exposure,
+                                                      options->max_exposure_us / EXPOSURE_UNIT_US);
+
+    int32_t exposure_value = controller->exposure.default_value;
+    get_camera_control(fd, V4L2_CID_EXPOSURE_ABSOLUTE, &exposure_value);
+    controller->exposure_value = exposure_value < controller->max_exposure_value ?
+                                 exposure_value : controller->max_exposure_value;
+
+    controller->gain_value = controller->gain.default_value;
+    if (controller->gain.available)
+        get_camera_control(fd, controller->gain.id, &controller->gain_value);
+
+    uint32_t id = V4L2_CID_EXPOSURE_ABSOLUTE;
+    if (set_camera_controls(fd, &id, &controller->exposure_value, 1) == -1) {
+        exposure_controller_destroy(controller);
+        return NULL;
+    }
+
+    printf("Exposure control: exposure %d (limit %d) x %u us, gain %d [%d, %d]\n", controller->exposure_value,
+           controller->max_exposure_value, EXPOSURE_UNIT_US, controller->gain_value, controller->gain.minimum,
+           controller->gain.maximum);
+    return controller;
+}
+
+void exposure_controller_destroy(struct exposure_controller* controller) {
+    if (controller->has_auto_exposure) {
+        uint32_t id = V4L2_CID_EXPOSURE_AUTO;
+        set_camera_controls(controller->fd, &id, &controller->original_auto_exposure, 1);
+    }
+    free(controller);
+}
+
+void exposure_controller_lock_region(struct exposure_controller* controller, const struct region_of_interest* region) {
+    controller->locked_region = *region;
+    controller->locked_frames_left = controller->options.tag_lock_frames;
+}
+
+uint32_t compute_luma_histogram(const struct image_u8* image, const struct region_of_interest* region,
+                                int sample_step, uint32_t histogram[256]) {
+    memset(histogram, 0, 256 * sizeof(uint32_t));
+
+    uint32_t left = 0, top = 0, width = image->width, height = image->height;
+    if (region != NULL) {
+        left = region->left < width ? region->left : width;
+        top = region->top < height ? region->top : height;
+        width = region->width < width - left ? region->width : width - left;
+        height = region->height < height - top ? region->height : height - top;
+    }
+
+    uint32_t sample_count = 0;
+    for (uint32_t y = top; y < top + height; y += sample_step) {
+        const uint8_t* row = image->buf + y * image->stride;
+        for (uint32_t x = left; x < left + width; x += sample_step) {
+            histogram[row[x]]++;
+            sample_count++;
+        }
+    }
+    return sample_count;
+}
+
+/**
+ * Moves gain by a share of its range proportional to how far off the brightness is. Gain units are driver specific
+ * and rarely linear, so unlike exposure it isn't scaled by the ratio directly
+ */
+static int32_t adjust_gain(const struct camera_control* gain, int32_t value, double ratio) {
+    double range = gain->maximum - gain->minimum;
+    double change = range * (ratio > 1 ? ratio - 1 : 1 - ratio) / 4;
+    if (change < gain->step)
+        change = gain->step;
+
+    return clamp_to_control(gain, ratio > 1 ? value + (int64_t) change : value - (int64_t) change);
+}
+
+int exposure_controller_update(struct exposure_controller* controller, const struct image_u8* luma_image,
+                               const struct luma_stats* frame_stats, const struct contrast_stretch* image_stretch) {
+    const struct region_of_interest* region = NULL;
+    if (controller->locked_frames_left > 0) {
+        region = &controller->locked_region;
+        controller->locked_frames_left--;
+    }
+
+    if (++controller->frames_since_update < controller->options.update_interval)
+        return 0;
+    controller->frames_since_update = 0;
+
+    // Tag regions are small, so every pixel counts there, the whole image is sampled sparsely unless conversion
+    // already counted all of it
+    uint32_t sampled_histogram[256];
+    const uint32_t* histogram = sampled_histogram;
+    uint32_t sample_count;
+    if (region == NULL && frame_stats != NULL) {
+        histogram = frame_stats->histogram;
+        sample_count = frame_stats->sample_count;
+    } else {
+        sample_count = compute_luma_histogram(luma_image, region, region != NULL ? 1 : 4, sampled_histogram);
+        if (image_stretch != NULL)
+            contrast_stretch_unmap_histogram(image_stretch, sampled_histogram);
+    }
+    if (sample_count == 0)
+        return 0;
+
+    uint64_t luma_sum = 0;
+    uint32_t saturated_count = 0;
+    for (int value = 0; value < 256; ++value) {
+        luma_sum += (uint64_t) value * histogram[value];
+        if (value >= SATURATED_LUMA)
+            saturated_count += histogram[value];
+    }
+
+    double mean_luma = (double) luma_sum / sample_count;
+    double ratio = controller->options.target_luma / (mean_luma > 1 ? mean_luma : 1);
+    // A bright background can clip the white cells of a tag while the mean still looks fine
+    if ((double) saturated_count / sample_count > MAX_SATURATED_SHARE && ratio > 0.8)
+        ratio = 0.8;
+
+    if (fabs(ratio - 1) < LUMA_DEADBAND)
+        return 0;
+    ratio = ratio > 2 ? 2 : ratio < 0.5 ? 0.5 : ratio;
+
+    int32_t exposure_value = controller->exposure_value;
+    int32_t gain_value = controller->gain_value;
+
+    if (ratio > 1) {
+        // Exposure first, up to the blur limit, gain covers what is left
+        double wanted_exposure = ceil(exposure_value * ratio);
+        exposure_value = wanted_exposure > controller->max_exposure_value ? controller->max_exposure_value :
+                         clamp_to_control(&controller->exposure, (int64_t) wanted_exposure);
+
+        double remaining_ratio = wanted_exposure / (exposure_value > 0 ? exposure_value : 1);
+        if (controller->gain.available && remaining_ratio > 1 + LUMA_DEADBAND)
+            gain_value = adjust_gain(&controller->gain, gain_value, remaining_ratio);
+    } else if (controller->gain.available && gain_value > controller->gain.minimum) {
+        gain_value = adjust_gain(&controller->gain, gain_value, ratio);
+    } else {
+        exposure_value = clamp_to_control(&controller->exposure, (int64_t) floor(exposure_value * ratio));
+    }
+
+    uint32_t ids[2];
+    int32_t values[2];
+    int count = 0;
+    if (exposure_value != controller->exposure_value) {
+        ids[count] = V4L2_CID_EXPOSURE_ABSOLUTE;
+        values[count++] = exposure_value;
+    }
+    if (gain_value != controller->gain_value) {
+        ids[count] = controller->gain.id;
+        values[count++] = gain_value;
+    }
+    if (count == 0)
+        return 0;
+
+#if DEBUG
+    printf("Mean luma %.1f, exposure %d -> %d, gain %d -> %d\n", mean_luma, controller->exposure_value,
+           exposure_value, controller->gain_value, gain_value);
+#endif
+
+    if (set_camera_controls(controller->fd, ids, values, count) == -1)
+        return -1;
+
+    controller->exposure_value = exposure_value;
+    controller->gain_value = gain_value;
+    return 0;
+}
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "apriltag/common/image_u8.h"
+#include "apriltag_detection.h"
+#include "capture_manager.h"
+
+static int64_t monotonic_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int open_managed_camera(struct managed_camera* camera, int width, int height, int fps, int buffer_count) {
+    camera->fd = setup_camera(camera->device_path, width, height, &camera->format);
+    if (camera->fd == -1)
+        return -1;
+
+    camera->convert_to_luma = select_luma_converter(camera->format.pixelformat);
+    if (camera->convert_to_luma == NULL) {
+        printf("%s: No luma converter for the negotiated pixel format\n", camera->device_path);
+        return -1;
+    }
+
+    struct v4l2_fract frame_interval = { 0 };
+    if (set_frame_rate(camera->fd, &camera->format, fps, &frame_interval) == -1)
+        printf("WARN: %s: Unable to set the frame rate, using the camera default\n", camera->device_path);
+
+    camera->request_buffers = request_mmap_buffers(camera->fd, buffer_count, camera->format.buffer_type);
+    if (camera->request_buffers == NULL)
+        return -1;
+
+    struct buffer* buffers = map_buffers(camera->fd, camera->request_buffers);
+    if (buffers == NULL)
+        return -1;
+
+    camera->queue = (struct buffer_queue) {
+        .fd = camera->fd,
+        .type = camera->request_buffers->type,
+        .memory = camera->request_buffers->memory,
+        .buffers = buffers,
+        .count = camera->request_buffers->count,
+        .num_planes = camera->format.num_planes
+    };
+    camera->luma_image = image_u8_create(camera->format.width, camera->format.height);
+
+    queue_buffers(&camera->queue);
+    if (start_stream(camera->fd, camera->format.buffer_type) == -1) {
+        perror("VIDIOC_STREAMON");
+        return -1;
+    }
+
+    return 0;
+}
+
+struct capture_manager* capture_manager_create(char** device_paths, int camera_count, int width, int height,
+                                               int fps, int buffer_count, apriltag_detector_t* detector) {
+    struct capture_manager* manager = calloc(1, sizeof(*manager));
+    manager->camera_count = camera_count;
+    manager->detector = detector;
+    manager->cameras = calloc(camera_count, sizeof(*manager->cameras));
+    for (int i = 0; i < camera_count; ++i) {
+        manager->cameras[i].fd = -1;
+        manager->cameras[i].device_path = device_paths[i];
+    }
+
+    manager->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (manager->epoll_fd == -1) {
+        perror("epoll_create1");
+        capture_manager_destroy(manager);
+        return NULL;
+    }
+
+    for (int i = 0; i < camera_count; ++i) {
+        struct managed_camera* camera = &manager->cameras[i];
+
+        if (open_managed_camera(camera, width, height, fps, buffer_count) == -1) {
+            printf("Unable to set up camera %s\n", camera->device_path);
+            capture_manager_destroy(manager);
+            return NULL;
+        }
+
+        struct epoll_event camera_event;
+        memset(&camera_event, 0, sizeof(camera_event));
+        camera_event.events = EPOLLIN;
+        camera_event.data.ptr = camera;
+
+        if (epoll_ctl(manager->epoll_fd, EPOLL_CTL_ADD, camera->fd, &camera_event) == -1) {
+            perror("epoll_ctl");
+            capture_manager_destroy(manager);
+            return NULL;
+        }
+    }
+
+    return manager;
+}
+
+void capture_manager_destroy(struct capture_manager* manager) {
+    for (int i = 0; i < manager->camera_count; ++i) {
+        struct managed_camera* camera = &manager->cameras[i];
+
+        if (camera->fd != -1) {
+            stop_stream(camera->fd, camera->format.buffer_type);
+            close(camera->fd);
+        }
+        if (camera->queue.buffers != NULL)
+            cleanup_buffers(camera->queue.buffers, camera->queue.count);
+        if (camera->luma_image != NULL)
+            image_u8_destroy(camera->luma_image);
+        free(camera->request_buffers);
+    }
+
+    if (manager->epoll_fd != -1)
+        close(manager->epoll_fd);
+
+    free(manager->cameras);
+    free(manager);
+}
+
+static void drop_camera(struct capture_manager* manager, struct managed_camera* camera, int error) {
+    errno = error;
+    perror(camera->device_path);
+    printf("Dropping camera %s\n", camera->device_path);
+
+    epoll_ctl(manager->epoll_fd, EPOLL_CTL_DEL, camera->fd, NULL);
+    camera->failed = true;
+    camera->has_pending_frame = false;
+}
+
+/**
+ * Takes the newest frame of a camera that signalled readiness, replacing an older pending frame if detection
+ * hasn't reached it yet
+ */
+static void collect_frame(struct capture_manager* manager, struct managed_camera* camera) {
+    struct frame frame;
+    int result = dequeue_latest_buffer(&camera->queue, &frame, &camera->stats);
+
+    if (result == -EAGAIN || result == -EINTR)
+        return;
+
+    if (result < 0) {
+        drop_camera(manager, camera, -result);
+        return;
+    }
+
+    if (!is_frame_usable(&frame, camera->format.pixelformat == V4L2_PIX_FMT_MJPEG ? 0 : camera->format.sizeimage)) {
+        camera->stats.frames_rejected++;
+        requeue_buffer(&camera->queue, frame.index);
+        return;
+    }
+
+    if (camera->has_pending_frame) {
+        camera->stats.frames_skipped++;
+        requeue_buffer(&camera->queue, camera->pending_frame.index);
+    }
+
+    camera->pending_frame = frame;
+    camera->has_pending_frame = true;
+}
+
+static void convert_pending_frame(void* p) {
+    struct managed_camera* camera = p;
+    struct buffer* buffer = &camera->queue.buffers[camera->pending_frame.index];
+
+    camera->pending_frame_converted = camera->convert_to_luma(buffer->start, camera->pending_frame.bytesused,
+                                                              &camera->format, camera->luma_image) == 0;
+}
+
+/**
+ * Converts the pending frames of all cameras in parallel on the detector's worker pool
+ */
+static void convert_pending_frames(struct capture_manager* manager) {
+    workerpool_t* wp = detector_workerpool(manager->detector);
+
+    for (int i = 0; i < manager->camera_count; ++i) {
+        if (manager->cameras[i].has_pending_frame)
+            workerpool_add_task(wp, convert_pending_frame, &manager->cameras[i]);
+    }
+    workerpool_run(wp);
+}
+
+/**
+ * Detects on every pending frame, starting with a different camera every round
+ */
+static enum capture_action detect_pending_frames(struct capture_manager* manager, detection_handler handler,
+                                                 void* user_data) {
+    enum capture_action action = CAPTURE_CONTINUE;
+    int first_camera = manager->next_camera;
+    manager->next_camera = (manager->next_camera + 1) % manager->camera_count;
+
+    for (int k = 0; k < manager->camera_count; ++k) {
+        int camera_index = (first_camera + k) % manager->camera_count;
+        struct managed_camera* camera = &manager->cameras[camera_index];
+        if (!camera->has_pending_frame)
+            continue;
+
+        if (camera->pending_frame_converted && action != CAPTURE_STOP) {
+            int64_t start_us = monotonic_now_us();
+            int tag_id = detect_april_tag(camera->luma_image, manager->detector);
+            camera->detection_time_us += monotonic_now_us() - start_us;
+            camera->stats.frames_processed++;
+            if (tag_id != -1)
+                camera->detections++;
+
+            action = handler(camera_index, &camera->pending_frame, tag_id, user_data);
+        }
+
+        requeue_buffer(&camera->queue, camera->pending_frame.index);
+        camera->has_pending_frame = false;
+    }
+
+    return action;
+}
+
+int capture_manager_run(struct capture_manager* manager, int timeout_ms, detection_handler handler, void* user_data) {
+    struct epoll_event ready_events[manager->camera_count];
+
+    while (true) {
+        int active_cameras = 0;
+        for (int i = 0; i < manager->camera_count; ++i) {
+            if (!manager->cameras[i].failed)
+                active_cameras++;
+        }
+
+        if (active_cameras == 0) {
+            printf("No camera left to capture from\n");
+            return -1;
+        }
+
+        int ready_count = epoll_wait(manager->epoll_fd, ready_events, manager->camera_count, timeout_ms);
+
+        if (ready_count == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return -1;
+        }
+
+        if (ready_count == 0) {
+            printf("WARN: No frame received from any camera within %d ms\n", timeout_ms);
+            continue;
+        }
+
+        for (int i = 0; i < ready_count; ++i) {
+            collect_frame(manager, ready_events[i].data.ptr);
+        }
+
+        convert_pending_frames(manager);
+
+        if (detect_pending_frames(manager, handler, user_data) == CAPTURE_STOP)
+            return 0;
+    }
+}
+
+void capture_manager_print_stats(struct capture_manager* manager) {
+    for (int i = 0; i < manager->camera_count; ++i) {
+        struct managed_camera* camera = &manager->cameras[i];
+        struct capture_stats* stats = &camera->stats;
+
+        printf("%s: processed %lu, skipped %lu, rejected %lu, driver dropped %lu, detections %lu, "
+               "average detection %lld us%s\n",
+               camera->device_path, stats->frames_processed, stats->frames_skipped, stats->frames_rejected,
+               stats->frames_dropped, camera->detections,
+               stats->frames_processed > 0 ? (long long) (camera->detection_time_us / stats->frames_processed) : 0LL,
+               camera->failed ? " (failed)" : "");
+    }
+}
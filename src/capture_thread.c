@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "capture_thread.h"
+#include "spsc_ring.h"
+
+struct capture_thread {
+    struct buffer_queue* queue;
+    struct capture_options options;
+    pthread_t thread;
+    bool started;
+    // Descriptors of dequeued frames, pushed by the capture thread
+    struct spsc_ring* frames;
+    // Indices of processed buffers, pushed by the processing thread
+    struct spsc_ring* returned_indices;
+    // Wakes the processing thread while it waits in capture_thread_next_frame
+    int frame_event_fd;
+    // Wakes the capture thread while it waits for returned buffers
+    int return_event_fd;
+    atomic_bool processing_waiting;
+    atomic_bool capture_waiting;
+    atomic_bool running;
+    atomic_bool failed;
+    atomic_ulong frames_dropped;
+    atomic_ulong frames_rejected;
+    // Only touched by the processing thread
+    unsigned long frames_processed;
+    unsigned long frames_skipped;
+};
+
+static void signal_event(int event_fd) {
+    uint64_t value = 1;
+    if (write(event_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+        perror("eventfd write");
+}
+
+static void clear_event(int event_fd) {
+    uint64_t value;
+    if (read(event_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+        perror("eventfd read");
+}
+
+static int requeue_returned_buffers(struct capture_thread* thread, int* queued_count) {
+    int buffer_index;
+    while (spsc_ring_pop(thread->returned_indices, &buffer_index)) {
+        if (requeue_buffer(thread->queue, buffer_index) == -1) {
+            perror("VIDIOC_QBUF");
+            return -1;
+        }
+        (*queued_count)++;
+    }
+    return 0;
+}
+
+/**
+ * Dequeues everything the driver has completed and publishes the usable frames
+ * @return - 0 once the driver has nothing left, -1 on a device error
+ */
+static int publish_completed_frames(struct capture_thread* thread, struct capture_stats* stats, int* queued_count) {
+    while (true) {
+        struct frame frame;
+        int result = dequeue_buffer(thread->queue, &frame);
+        if (result == -EAGAIN)
+            return 0;
+        if (result == -EINTR)
+            continue;
+        if (result < 0) {
+            errno = -result;
+            perror("VIDIOC_DQBUF");
+            return -1;
+        }
+
+        (*queued_count)--;
+        record_frame_sequence(stats, &frame);
+        atomic_store_explicit(&thread->frames_dropped, stats->frames_dropped, memory_order_relaxed);
+
+        if (!is_frame_usable(&frame, thread->options.min_bytesused)) {
+#if DEBUG
+            printf("Rejected frame %u (flags: %x, bytesused: %u)\n", frame.sequence, frame.flags, frame.bytesused);
+#endif
+            atomic_fetch_add_explicit(&thread->frames_rejected, 1, memory_order_relaxed);
+            if (requeue_buffer(thread->queue, frame.index) == -1) {
+                perror("VIDIOC_QBUF");
+                return -1;
+            }
+            (*queued_count)++;
+            continue;
+        }
+
+        // The ring holds every buffer of the queue, so it can't be full
+        spsc_ring_push(thread->frames, &frame);
+
+        // Pairs with the fence in capture_thread_next_frame, either it sees the frame or we see it waiting
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_exchange(&thread->processing_waiting, false))
+            signal_event(thread->frame_event_fd);
+    }
+}
+
+static void* run_capture_thread(void* argument) {
+    struct capture_thread* thread = argument;
+    int camera_fd = thread->queue->fd;
+    struct capture_stats stats = { 0 };
+    int queued_count = thread->queue->count;
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event camera_event = { .events = EPOLLIN, .data.fd = camera_fd };
+    struct epoll_event return_event = { .events = EPOLLIN, .data.fd = thread->return_event_fd };
+    if (epoll_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, camera_fd, &camera_event) == -1 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, thread->return_event_fd, &return_event) == -1) {
+        perror("epoll");
+        atomic_store(&thread->failed, true);
+    }
+
+    while (atomic_load(&thread->running) && !atomic_load(&thread->failed)) {
+        if (requeue_returned_buffers(thread, &queued_count) == -1) {
+            atomic_store(&thread->failed, true);
+            break;
+        }
+
+        // Only ask for a wakeup once the driver is about to run dry, otherwise returns are picked up with the next frame
+        if (queued_count <= 1) {
+            atomic_store(&thread->capture_waiting, true);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (requeue_returned_buffers(thread, &queued_count) == -1) {
+                atomic_store(&thread->failed, true);
+                break;
+            }
+        }
+
+        struct epoll_event ready_events[2];
+        int ready_count = epoll_wait(epoll_fd, ready_events, 2, thread->options.timeout_ms);
+        atomic_store(&thread->capture_waiting, false);
+
+        if (ready_count == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            atomic_store(&thread->failed, true);
+            break;
+        }
+
+        // Without queued buffers the camera can't deliver, that's the processing thread holding on to them
+        if (ready_count == 0 && queued_count > 0) {
+            printf("WARN: No frame received from the camera within %d ms\n", thread->options.timeout_ms);
+            continue;
+        }
+
+        for (int i = 0; i < ready_count; ++i) {
+            if (ready_events[i].data.fd == thread->return_event_fd) {
+                clear_event(thread->return_event_fd);
+            } else if (publish_completed_frames(thread, &stats, &queued_count) == -1) {
+                atomic_store(&thread->failed, true);
+                break;
+            }
+        }
+    }
+
+    if (epoll_fd != -1)
+        close(epoll_fd);
+
+    atomic_store(&thread->running, false);
+    signal_event(thread->frame_event_fd);
+    return NULL;
+}
+
+struct capture_thread* capture_thread_start(struct buffer_queue* queue, const struct capture_options* options) {
+    struct capture_thread* thread = calloc(1, sizeof(*thread));
+    thread->queue = queue;
+    thread->options = *options;
+    thread->frames = spsc_ring_create(queue->count, sizeof(struct frame));
+    thread->returned_indices = spsc_ring_create(queue->count, sizeof(int));
+    thread->frame_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    thread->return_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    atomic_init(&thread->processing_waiting, false);
+    atomic_init(&thread->capture_waiting, false);
+    atomic_init(&thread->running, true);
+    atomic_init(&thread->failed, false);
+    atomic_init(&thread->frames_dropped, 0);
+    atomic_init(&thread->frames_rejected, 0);
+
+    if (thread->frames == NULL || thread->returned_indices == NULL || thread->frame_event_fd == -1 ||
+        thread->return_event_fd == -1) {
+        perror("Unable to set up the capture thread");
+        capture_thread_stop(thread);
+        return NULL;
+    }
+
+    if (pthread_create(&thread->thread, NULL, run_capture_thread, thread) != 0) {
+        printf("Unable to start the capture thread\n");
+        capture_thread_stop(thread);
+        return NULL;
+    }
+    thread->started = true;
+
+    return thread;
+}
+
+int capture_thread_next_frame(struct capture_thread* thread, struct frame* frame, int timeout_ms) {
+    while (true) {
+        if (spsc_ring_pop(thread->frames, frame)) {
+            if (thread->options.mode == CAPTURE_LATEST_FRAME) {
+                struct frame newer_frame;
+                while (spsc_ring_pop(thread->frames, &newer_frame)) {
+                    capture_thread_release_frame(thread, frame->index);
+                    thread->frames_skipped++;
+                    *frame = newer_frame;
+                }
+            }
+            thread->frames_processed++;
+            return 0;
+        }
+
+        if (!atomic_load(&thread->running))
+            return atomic_load(&thread->failed) ? -EIO : -EAGAIN;
+
+        // Pairs with the fence in publish_completed_frames
+        atomic_store(&thread->processing_waiting, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!spsc_ring_is_empty(thread->frames) || !atomic_load(&thread->running)) {
+            atomic_store(&thread->processing_waiting, false);
+            continue;
+        }
+
+        struct pollfd poll_fd = { .fd = thread->frame_event_fd, .events = POLLIN };
+        int ready_count = poll(&poll_fd, 1, timeout_ms);
+        if (ready_count == -1 && errno != EINTR) {
+            perror("poll");
+            atomic_store(&thread->processing_waiting, false);
+            return -EIO;
+        }
+        if (ready_count == 0) {
+            atomic_store(&thread->processing_waiting, false);
+            return -EAGAIN;
+        }
+        if (ready_count > 0)
+            clear_event(thread->frame_event_fd);
+    }
+}
+
+void capture_thread_release_frame(struct capture_thread* thread, int buffer_index) {
+    // The ring holds every buffer of the queue, so it can't be full
+    spsc_ring_push(thread->returned_indices, &buffer_index);
+
+    // Pairs with the fence in run_capture_thread, either it sees the index or we see it waiting
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&thread->capture_waiting, false))
+        signal_event(thread->return_event_fd);
+}
+
+void capture_thread_get_stats(struct capture_thread* thread, struct capture_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->frames_processed = thread->frames_processed;
+    stats->frames_skipped = thread->frames_skipped;
+    stats->frames_rejected = atomic_load_explicit(&thread->frames_rejected, memory_order_relaxed);
+    stats->frames_dropped = atomic_load_explicit(&thread->frames_dropped, memory_order_relaxed);
+}
+
+void capture_thread_stop(struct capture_thread* thread) {
+    if (thread->started) {
+        atomic_store(&thread->running, false);
+        signal_event(thread->return_event_fd);
+        pthread_join(thread->thread, NULL);
+    }
+
+    // With the capture thread gone this thread may touch the queue and pop from both rings
+    if (thread->frames != NULL) {
+        struct frame frame;
+        while (spsc_ring_pop(thread->frames, &frame)) {
+            requeue_buffer(thread->queue, frame.index);
+        }
+        spsc_ring_destroy(thread->frames);
+    }
+    if (thread->returned_indices != NULL) {
+        int buffer_index;
+        while (spsc_ring_pop(thread->returned_indices, &buffer_index)) {
+            requeue_buffer(thread->queue, buffer_index);
+        }
+        spsc_ring_destroy(thread->returned_indices);
+    }
+
+    if (thread->frame_event_fd != -1)
+        close(thread->frame_event_fd);
+    if (thread->return_event_fd != -1)
+        close(thread->return_event_fd);
+    free(thread);
+}
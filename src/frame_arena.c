@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "frame_arena.h"
+
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+static size_t round_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+struct frame_arena* frame_arena_create(size_t size, bool use_hugepages) {
+    struct frame_arena* arena = calloc(1, sizeof(*arena));
+    void* mapping = MAP_FAILED;
+
+    if (use_hugepages) {
+        arena->size = round_up(size, HUGEPAGE_SIZE);
+        mapping = mmap(NULL, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        arena->uses_hugepages = mapping != MAP_FAILED;
+    }
+
+    if (mapping == MAP_FAILED) {
+        arena->size = round_up(size, use_hugepages ? HUGEPAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE));
+        mapping = mmap(NULL, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (mapping == MAP_FAILED) {
+            perror("Unable to map frame arena");
+            free(arena);
+            return NULL;
+        }
+
+        if (use_hugepages)
+            madvise(mapping, arena->size, MADV_HUGEPAGE);
+    }
+
+    arena->base = mapping;
+    arena->used = 0;
+    return arena;
+}
+
+void frame_arena_destroy(struct frame_arena* arena) {
+    munmap(arena->base, arena->size);
+    free(arena);
+}
+
+void* frame_arena_alloc(struct frame_arena* arena, size_t size, size_t alignment) {
+    if (alignment < FRAME_ARENA_ALIGNMENT)
+        alignment = FRAME_ARENA_ALIGNMENT;
+
+    size_t offset = round_up(arena->used, alignment);
+    if (offset + size > arena->size)
+        return NULL;
+
+    arena->used = offset + size;
+    return arena->base + offset;
+}
+
+struct image_u8* wrap_image_pixels(int width, int height, int stride, uint8_t* pixels) {
+    // image_u8 has const dimensions, so build it on the stack and copy it into place
+    struct image_u8 image = { .width = width, .height = height, .stride = stride, .buf = pixels };
+    struct image_u8* wrapped_image = malloc(sizeof(*wrapped_image));
+    if (wrapped_image == NULL) {
+        perror("Unable to allocate an image");
+        return NULL;
+    }
+    memcpy(wrapped_image, &image, sizeof(image));
+    return wrapped_image;
+}
+
+struct image_u8* frame_arena_create_image(struct frame_arena* arena, int width, int height) {
+    int stride = round_up(width, FRAME_ARENA_ALIGNMENT);
+    uint8_t* pixels = frame_arena_alloc(arena, (size_t) stride * height, FRAME_ARENA_ALIGNMENT);
+    if (pixels == NULL)
+        return NULL;
+
+    return wrap_image_pixels(width, height, stride, pixels);
+}
@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "frame_broker.h"
+
+struct frame_broker_consumer {
+    int fd;
+    uint64_t held_buffers;
+};
+
+struct frame_broker {
+    int epoll_fd;
+    int listen_fd;
+    struct buffer_queue* queue;
+    char socket_path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    struct camera_format format;
+    const int* dmabuf_fds;
+    int* reference_counts;
+    struct frame_broker_consumer consumers[FRAME_BROKER_MAX_CONSUMERS];
+};
+
+static void release_reference(struct frame_broker* broker, int buffer_index) {
+    if (--broker->reference_counts[buffer_index] > 0)
+        return;
+
+    if (requeue_buffer(broker->queue, buffer_index) == -1)
+        perror("VIDIOC_QBUF");
+}
+
+static void disconnect_consumer(struct frame_broker* broker, struct frame_broker_consumer* consumer) {
+    for (int i = 0; i < broker->queue->count; ++i) {
+        if (consumer->held_buffers & (1ULL << i))
+            release_reference(broker, i);
+    }
+
+    epoll_ctl(broker->epoll_fd, EPOLL_CTL_DEL, consumer->fd, NULL);
+    close(consumer->fd);
+    consumer->fd = -1;
+    consumer->held_buffers = 0;
+}
+
+static int send_buffer(struct frame_broker* broker, int consumer_fd, int buffer_index) {
+    struct frame_broker_message message;
+    memset(&message, 0, sizeof(message));
+    message.type = FRAME_BROKER_BUFFER;
+    message.index = buffer_index;
+    message.length = broker->queue->buffers[buffer_index].length;
+    message.format = broker->format;
+
+    struct iovec payload = { .iov_base = &message, .iov_len = sizeof(message) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &payload;
+    header.msg_iovlen = 1;
+    header.msg_control = control.buf;
+    header.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr* control_message = CMSG_FIRSTHDR(&header);
+    control_message->cmsg_level = SOL_SOCKET;
+    control_message->cmsg_type = SCM_RIGHTS;
+    control_message->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(control_message), &broker->dmabuf_fds[buffer_index], sizeof(int));
+
+    return sendmsg(consumer_fd, &header, MSG_NOSIGNAL) == -1 ? -1 : 0;
+}
+
+static void accept_consumer(struct frame_broker* broker) {
+    int consumer_fd = accept4(broker->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (consumer_fd == -1) {
+        if (errno != EAGAIN)
+            perror("accept4");
+        return;
+    }
+
+    struct frame_broker_consumer* consumer = NULL;
+    for (int i = 0; i < FRAME_BROKER_MAX_CONSUMERS; ++i) {
+        if (broker->consumers[i].fd == -1) {
+            consumer = &broker->consumers[i];
+            break;
+        }
+    }
+
+    if (consumer == NULL) {
+        printf("WARN: Frame broker already has %d consumers, rejecting new consumer\n", FRAME_BROKER_MAX_CONSUMERS);
+        close(consumer_fd);
+        return;
+    }
+
+    for (int i = 0; i < broker->queue->count; ++i) {
+        if (send_buffer(broker, consumer_fd, i) == -1) {
+            perror("Unable to send capture buffer to frame broker consumer");
+            close(consumer_fd);
+            return;
+        }
+    }
+
+    struct epoll_event consumer_event;
+    memset(&consumer_event, 0, sizeof(consumer_event));
+    consumer_event.events = EPOLLIN;
+    consumer_event.data.ptr = consumer;
+
+    if (epoll_ctl(broker->epoll_fd, EPOLL_CTL_ADD, consumer_fd, &consumer_event) == -1) {
+        perror("epoll_ctl");
+        close(consumer_fd);
+        return;
+    }
+
+    consumer->fd = consumer_fd;
+    consumer->held_buffers = 0;
+}
+
+static void receive_releases(struct frame_broker* broker, struct frame_broker_consumer* consumer) {
+    while (true) {
+        struct frame_broker_release release;
+        ssize_t received = recv(consumer->fd, &release, sizeof(release), 0);
+
+        if (received == -1 && errno == EAGAIN)
+            return;
+
+        if (received <= 0) {
+            disconnect_consumer(broker, consumer);
+            return;
+        }
+
+        // The index is only known to fit in the bit mask once the whole message arrived and the index was checked
+        bool is_valid = received == sizeof(release) && release.index < broker->queue->count &&
+                        (consumer->held_buffers & (1ULL << release.index));
+        if (!is_valid) {
+            printf("WARN: Frame broker consumer sent an invalid release message\n");
+            continue;
+        }
+
+        consumer->held_buffers &= ~(1ULL << release.index);
+        release_reference(broker, release.index);
+    }
+}
+
+struct frame_broker* frame_broker_create(const char* socket_path, struct buffer_queue* queue,
+                                         const struct camera_format* format, const int* dmabuf_fds) {
+    if (queue->count > 64) {
+        printf("Frame broker supports at most 64 buffers but the queue has %zu\n", queue->count);
+        return NULL;
+    }
+
+    struct frame_broker* broker = calloc(1, sizeof(*broker));
+    broker->queue = queue;
+    broker->format = *format;
+    broker->dmabuf_fds = dmabuf_fds;
+    broker->reference_counts = calloc(queue->count, sizeof(*broker->reference_counts));
+    for (int i = 0; i < FRAME_BROKER_MAX_CONSUMERS; ++i) {
+        broker->consumers[i].fd = -1;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    strncpy(broker->socket_path, socket_path, sizeof(broker->socket_path) - 1);
+
+    broker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    broker->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (broker->epoll_fd == -1 || broker->listen_fd == -1) {
+        perror("Unable to create frame broker socket");
+        frame_broker_destroy(broker);
+        return NULL;
+    }
+
+    unlink(socket_path);
+    if (bind(broker->listen_fd, (struct sockaddr*) &address, sizeof(address)) == -1 ||
+        listen(broker->listen_fd, FRAME_BROKER_MAX_CONSUMERS) == -1) {
+        perror("Unable to listen on frame broker socket");
+        frame_broker_destroy(broker);
+        return NULL;
+    }
+
+    struct epoll_event listen_event;
+    memset(&listen_event, 0, sizeof(listen_event));
+    listen_event.events = EPOLLIN;
+    listen_event.data.ptr = NULL;
+
+    if (epoll_ctl(broker->epoll_fd, EPOLL_CTL_ADD, broker->listen_fd, &listen_event) == -1) {
+        perror("epoll_ctl");
+        frame_broker_destroy(broker);
+        return NULL;
+    }
+
+    return broker;
+}
+
+void frame_broker_destroy(struct frame_broker* broker) {
+    for (int i = 0; i < FRAME_BROKER_MAX_CONSUMERS; ++i) {
+        if (broker->consumers[i].fd != -1)
+            close(broker->consumers[i].fd);
+    }
+
+    if (broker->listen_fd >= 0) {
+        close(broker->listen_fd);
+        unlink(broker->socket_path);
+    }
+
+    if (broker->epoll_fd >= 0)
+        close(broker->epoll_fd);
+
+    free(broker->reference_counts);
+    free(broker);
+}
+
+int frame_broker_fd(struct frame_broker* broker) {
+    return broker->epoll_fd;
+}
+
+void frame_broker_handle_events(struct frame_broker* broker) {
+    struct epoll_event ready_events[FRAME_BROKER_MAX_CONSUMERS + 1];
+    int ready_count = epoll_wait(broker->epoll_fd, ready_events, FRAME_BROKER_MAX_CONSUMERS + 1, 0);
+
+    for (int i = 0; i < ready_count; ++i) {
+        struct frame_broker_consumer* consumer = ready_events[i].data.ptr;
+
+        if (consumer == NULL)
+            accept_consumer(broker);
+        else if (consumer->fd != -1)
+            receive_releases(broker, consumer);
+    }
+}
+
+int frame_broker_publish(struct frame_broker* broker, const struct frame* frame) {
+    struct frame_broker_message message;
+    memset(&message, 0, sizeof(message));
+    message.type = FRAME_BROKER_FRAME;
+    message.index = frame->index;
+    message.bytesused = frame->bytesused;
+    message.sequence = frame->sequence;
+    message.flags = frame->flags;
+    message.timestamp_us = (int64_t) frame->timestamp.tv_sec * 1000000 + frame->timestamp.tv_usec;
+
+    // The caller's reference
+    broker->reference_counts[frame->index] = 1;
+
+    int receivers = 0;
+    for (int i = 0; i < FRAME_BROKER_MAX_CONSUMERS; ++i) {
+        struct frame_broker_consumer* consumer = &broker->consumers[i];
+        if (consumer->fd == -1)
+            continue;
+
+        if (send(consumer->fd, &message, sizeof(message), MSG_NOSIGNAL) == -1) {
+            // A consumer that can't keep up misses this frame instead of stalling the capture
+            if (errno != EAGAIN)
+                disconnect_consumer(broker, consumer);
+            continue;
+        }
+
+        consumer->held_buffers |= 1ULL << frame->index;
+        broker->reference_counts[frame->index]++;
+        receivers++;
+    }
+
+    return receivers;
+}
+
+void frame_broker_release(struct frame_broker* broker, int buffer_index) {
+    release_reference(broker, buffer_index);
+}
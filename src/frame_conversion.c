@@ -0,0 +1,410 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apriltag/common/image_u8.h"
+#include "apriltag/common/pjpeg.h"
+#include "frame_arena.h"
+#include "frame_conversion.h"
+#include "jpeg_luma.h"
+#include "luma_kernels.h"
+#include "row_bands.h"
+
+/**
+ * Checks that a raw frame covers every row of the image with the given bytes per pixel
+ */
+static int check_frame_size(uint32_t bytesused, const struct camera_format* format, int bytes_per_pixel,
+                            const struct image_u8* luma_image) {
+    if (format->width != luma_image->width || format->height != luma_image->height) {
+        printf("Could not process frame because the image is %dx%d but the capture format is %ux%u\n",
+               luma_image->width, luma_image->height, format->width, format->height);
+        return -1;
+    }
+
+    size_t required_length = (size_t) format->bytesperline * (format->height - 1) + format->width * bytes_per_pixel;
+    if (bytesused < required_length) {
+        printf("Could not process frame because of improper buffer lengths\n"
+               "Actual Buffer Length: %u\nExpected Buffer Length: %zu\n", bytesused, required_length);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Offset of a row kernel in struct luma_kernels, so the table can pick it from whichever level is active
+#define ROW_KERNEL(name) offsetof(struct luma_kernels, name)
+#define NO_ROW_KERNEL ((size_t) -1)
+
+/**
+ * Every supported capture format with its converter. Formats converted row by row also name their row kernel and
+ * the bytes per pixel of a source row
+ */
+static const struct luma_format {
+    uint32_t pixelformat;
+    luma_converter convert;
+    size_t row_kernel;
+    int bytes_per_pixel;
+} LUMA_FORMATS[] = {
+    { V4L2_PIX_FMT_GREY, convert_luma_plane, ROW_KERNEL(plane_row), 1 },
+    { V4L2_PIX_FMT_NV12, convert_luma_plane, ROW_KERNEL(plane_row), 1 },
+    { V4L2_PIX_FMT_NV12M, convert_luma_plane, ROW_KERNEL(plane_row), 1 },
+    { V4L2_PIX_FMT_NV21, convert_luma_plane, ROW_KERNEL(plane_row), 1 },
+    { V4L2_PIX_FMT_YUYV, convert_yuyv_to_luma, ROW_KERNEL(yuyv_row), 2 },
+    { V4L2_PIX_FMT_YVYU, convert_yuyv_to_luma, ROW_KERNEL(yuyv_row), 2 },
+    { V4L2_PIX_FMT_UYVY, convert_uyvy_to_luma, ROW_KERNEL(uyvy_row), 2 },
+    { V4L2_PIX_FMT_VYUY, convert_uyvy_to_luma, ROW_KERNEL(uyvy_row), 2 },
+    { V4L2_PIX_FMT_Y10, convert_y10_to_luma, ROW_KERNEL(y10_row), 2 },
+    { V4L2_PIX_FMT_Y16, convert_y16_to_luma, ROW_KERNEL(uyvy_row), 2 },
+    { V4L2_PIX_FMT_RGB24, convert_rgb24_to_luma, ROW_KERNEL(rgb24_row), 3 },
+    { V4L2_PIX_FMT_BGR24, convert_bgr24_to_luma, ROW_KERNEL(bgr24_row), 3 },
+    { V4L2_PIX_FMT_MJPEG, convert_mjpeg_to_luma, NO_ROW_KERNEL, 0 },
+};
+static const int LUMA_FORMAT_COUNT = sizeof(LUMA_FORMATS) / sizeof(LUMA_FORMATS[0]);
+
+luma_converter select_luma_converter(uint32_t pixelformat) {
+    // Detects the CPU features here so the first frame doesn't pay for it
+    active_luma_kernels();
+
+    for (int i = 0; i < LUMA_FORMAT_COUNT; ++i) {
+        if (LUMA_FORMATS[i].pixelformat == pixelformat)
+            return LUMA_FORMATS[i].convert;
+    }
+    return NULL;
+}
+
+/**
+ * Finds the row kernel behind one of the converters in the active luma kernels
+ * @return - The kernel or NULL for converters that don't work row by row (MJPEG)
+ */
+static luma_row_kernel row_kernel_of(luma_converter convert, int* bytes_per_pixel) {
+    for (int i = 0; i < LUMA_FORMAT_COUNT; ++i) {
+        if (LUMA_FORMATS[i].convert != convert)
+            continue;
+        if (LUMA_FORMATS[i].row_kernel == NO_ROW_KERNEL)
+            return NULL;
+
+        *bytes_per_pixel = LUMA_FORMATS[i].bytes_per_pixel;
+        return *(const luma_row_kernel*) ((const char*) active_luma_kernels() + LUMA_FORMATS[i].row_kernel);
+    }
+    return NULL;
+}
+
+int convert_mjpeg_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                          struct image_u8* luma_image) {
+    int error = 0;
+    pjpeg_t* jpeg = pjpeg_create_from_buffer((uint8_t*) source, bytesused, PJPEG_MJPEG, &error);
+    if (jpeg == NULL) {
+        printf("Could not decode MJPEG frame (pjpeg error %d)\n", error);
+        return -1;
+    }
+
+    image_u8_t* decoded_image = pjpeg_to_u8_baseline(jpeg);
+    pjpeg_destroy(jpeg);
+    if (decoded_image == NULL) {
+        printf("Could not convert MJPEG frame to grayscale\n");
+        return -1;
+    }
+
+    int result = 0;
+    if (decoded_image->width != luma_image->width || decoded_image->height != luma_image->height) {
+        printf("Could not process frame because the decoded MJPEG frame is %dx%d but the image is %dx%d\n",
+               decoded_image->width, decoded_image->height, luma_image->width, luma_image->height);
+        result = -1;
+    } else {
+        for (int y = 0; y < luma_image->height; ++y) {
+            memcpy(&luma_image->buf[y * luma_image->stride], &decoded_image->buf[y * decoded_image->stride],
+                   luma_image->width);
+        }
+    }
+
+    image_u8_destroy(decoded_image);
+    return result;
+}
+
+int convert_mjpeg_to_dc_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                             struct image_u8* dc_image) {
+    return decode_jpeg_dc_luma(source, bytesused, dc_image) == 0 ? 0 : -1;
+}
+
+uint32_t decimated_size(uint32_t size, int decimation) {
+    return size == 0 ? 0 : 1 + (size - 1) / decimation;
+}
+
+/**
+ * Point-samples every decimation-th pixel of a luma row, the pixels image_u8_decimate keeps
+ */
+static void decimate_luma_row(const uint8_t* luma_row, uint8_t* decimated_row, int decimated_width, int decimation) {
+    if (decimation == 2) {
+        // Taking every other byte is what the YUYV kernel does. The last sample is left to the loop below so the
+        // kernel never reads past the end of an odd width row
+        active_luma_kernels()->yuyv_row(luma_row, decimated_row, decimated_width - 1);
+        decimated_row[decimated_width - 1] = luma_row[(decimated_width - 1) * 2];
+        return;
+    }
+
+    for (int x = 0; x < decimated_width; ++x) {
+        decimated_row[x] = luma_row[x * decimation];
+    }
+}
+
+/**
+ * One frame being converted, shared by all bands of it
+ */
+struct conversion_job {
+    luma_row_kernel convert_row;
+    const uint8_t* source;
+    uint32_t bytesperline;
+    struct image_u8* luma_image;
+    // NULL when only the full resolution image is wanted
+    struct image_u8* decimated_image;
+    int decimation;
+    // NULL when no statistics are wanted, bands merge their counts into it under the lock
+    struct luma_stats* stats;
+    pthread_mutex_t stats_lock;
+    // NULL when the luma is kept as converted
+    const struct contrast_stretch* contrast;
+    luma_stretch_kernel stretch_row;
+};
+
+/**
+ * Converts a band of rows, a row_band_function
+ */
+static void convert_rows(void* user_data, int first_row, int end_row) {
+    struct conversion_job* job = user_data;
+    struct image_u8* luma_image = job->luma_image;
+    struct image_u8* decimated_image = job->decimated_image;
+    struct luma_counts counts;
+    if (job->stats != NULL)
+        luma_counts_reset(&counts);
+
+    for (int y = first_row; y < end_row; ++y) {
+        uint8_t* luma_row = &luma_image->buf[y * luma_image->stride];
+        job->convert_row(&job->source[y * job->bytesperline], luma_row, luma_image->width);
+
+        // The row was just written, so everything below reads it from the L1 cache instead of another pass over the
+        // frame. Statistics count the luma as the camera delivered it, the stretch is built from them
+        if (job->stats != NULL && luma_stats_samples_row(y))
+            luma_counts_add_row(&counts, luma_row, luma_image->width);
+        if (job->contrast != NULL)
+            job->stretch_row(luma_row, luma_image->width, job->contrast->low, job->contrast->gain);
+        if (decimated_image != NULL && y % job->decimation == 0) {
+            decimate_luma_row(luma_row, &decimated_image->buf[y / job->decimation * decimated_image->stride],
+                              decimated_image->width, job->decimation);
+        }
+    }
+
+    if (job->stats != NULL) {
+        pthread_mutex_lock(&job->stats_lock);
+        luma_stats_merge(job->stats, &counts);
+        pthread_mutex_unlock(&job->stats_lock);
+    }
+}
+
+/**
+ * Validates the arguments of a fused or banded conversion and fills in the job for it
+ */
+static int prepare_conversion_job(luma_converter convert, const uint8_t* source, uint32_t bytesused,
+                                  const struct camera_format* format, struct image_u8* luma_image,
+                                  struct image_u8* decimated_image, int decimation, struct conversion_job* job) {
+    int bytes_per_pixel;
+    luma_row_kernel convert_row = row_kernel_of(convert, &bytes_per_pixel);
+    if (convert_row == NULL) {
+        printf("Row by row conversion is not supported for this pixel format\n");
+        return -1;
+    }
+
+    if (decimated_image != NULL && (decimation < 2 || decimation > 4 ||
+                                    decimated_image->width != decimated_size(luma_image->width, decimation) ||
+                                    decimated_image->height != decimated_size(luma_image->height, decimation))) {
+        printf("Could not decimate by %d into a %dx%d image\n", decimation, decimated_image->width,
+               decimated_image->height);
+        return -1;
+    }
+
+    if (check_frame_size(bytesused, format, bytes_per_pixel, luma_image) == -1)
+        return -1;
+
+    *job = (struct conversion_job) {
+        .convert_row = convert_row,
+        .source = source,
+        .bytesperline = format->bytesperline,
+        .luma_image = luma_image,
+        .decimated_image = decimated_image,
+        .decimation = decimated_image != NULL ? decimation : 1,
+        .stats = NULL,
+        .stats_lock = PTHREAD_MUTEX_INITIALIZER,
+        .contrast = NULL,
+        .stretch_row = active_luma_kernels()->stretch_row
+    };
+    return 0;
+}
+
+/**
+ * Converts a whole frame on the calling thread with the row kernel of a converter
+ */
+static int convert_row_by_row(luma_converter convert, const uint8_t* source, uint32_t bytesused,
+                              const struct camera_format* format, struct image_u8* luma_image) {
+    struct conversion_job job;
+    if (prepare_conversion_job(convert, source, bytesused, format, luma_image, NULL, 0, &job) == -1)
+        return -1;
+
+    convert_rows(&job, 0, luma_image->height);
+    return 0;
+}
+
+int convert_luma_plane(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                       struct image_u8* luma_image) {
+    return convert_row_by_row(convert_luma_plane, source, bytesused, format, luma_image);
+}
+
+int convert_yuyv_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                         struct image_u8* luma_image) {
+    return convert_row_by_row(convert_yuyv_to_luma, source, bytesused, format, luma_image);
+}
+
+int convert_uyvy_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                         struct image_u8* luma_image) {
+    return convert_row_by_row(convert_uyvy_to_luma, source, bytesused, format, luma_image);
+}
+
+int convert_y10_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                        struct image_u8* luma_image) {
+    return convert_row_by_row(convert_y10_to_luma, source, bytesused, format, luma_image);
+}
+
+int convert_y16_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                        struct image_u8* luma_image) {
+    return convert_row_by_row(convert_y16_to_luma, source, bytesused, format, luma_image);
+}
+
+int convert_rgb24_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                          struct image_u8* luma_image) {
+    return convert_row_by_row(convert_rgb24_to_luma, source, bytesused, format, luma_image);
+}
+
+int convert_bgr24_to_luma(const uint8_t* source, uint32_t bytesused, const struct camera_format* format,
+                          struct image_u8* luma_image) {
+    return convert_row_by_row(convert_bgr24_to_luma, source, bytesused, format, luma_image);
+}
+
+int convert_to_luma_and_decimate(luma_converter convert, const uint8_t* source, uint32_t bytesused,
+                                 const struct camera_format* format, struct image_u8* luma_image,
+                                 struct image_u8* decimated_image, int decimation) {
+    struct conversion_job job;
+    if (decimated_image == NULL ||
+        prepare_conversion_job(convert, source, bytesused, format, luma_image, decimated_image, decimation,
+                               &job) == -1) {
+        return -1;
+    }
+
+    convert_rows(&job, 0, luma_image->height);
+    return 0;
+}
+
+int convert_to_luma_in_bands(workerpool_t* wp, luma_converter convert, const uint8_t* source, uint32_t bytesused,
+                             const struct camera_format* format, struct image_u8* luma_image,
+                             struct image_u8* decimated_image, int decimation, struct luma_stats* stats,
+                             const struct contrast_stretch* contrast) {
+    if (contrast != NULL && !contrast->enabled)
+        contrast = NULL;
+
+    int bytes_per_pixel;
+    if (decimated_image == NULL && row_kernel_of(convert, &bytes_per_pixel) == NULL) {
+        if (convert(source, bytesused, format, luma_image) == -1)
+            return -1;
+        if (stats != NULL)
+            compute_luma_stats(luma_image, stats);
+        for (int y = 0; contrast != NULL && y < luma_image->height; ++y) {
+            active_luma_kernels()->stretch_row(&luma_image->buf[y * luma_image->stride], luma_image->width,
+                                               contrast->low, contrast->gain);
+        }
+        return 0;
+    }
+
+    struct conversion_job job;
+    if (prepare_conversion_job(convert, source, bytesused, format, luma_image, decimated_image, decimation,
+                               &job) == -1) {
+        return -1;
+    }
+
+    if (stats != NULL) {
+        luma_stats_reset(stats);
+        job.stats = stats;
+    }
+    job.contrast = contrast;
+
+    int band_rows = row_band_height((size_t) format->bytesperline + luma_image->stride, job.decimation);
+    run_in_row_bands(wp, luma_image->height, band_rows, convert_rows, &job);
+
+    if (stats != NULL)
+        luma_stats_finish(stats);
+    return 0;
+}
+
+int convert_region_to_luma(luma_converter convert, const uint8_t* source, uint32_t bytesused,
+                           const struct camera_format* format, const struct region_of_interest* region,
+                           struct image_u8* luma_image) {
+    int bytes_per_pixel;
+    if (row_kernel_of(convert, &bytes_per_pixel) == NULL) {
+        printf("Software cropping is not supported for this pixel format\n");
+        return -1;
+    }
+
+    if (region->left + region->width > format->width || region->top + region->height > format->height) {
+        printf("Region of interest %ux%u at (%u, %u) is outside of the %ux%u frame\n",
+               region->width, region->height, region->left, region->top, format->width, format->height);
+        return -1;
+    }
+
+    size_t region_offset = (size_t) region->top * format->bytesperline + (size_t) region->left * bytes_per_pixel;
+    if (bytesused < region_offset) {
+        printf("Could not process frame because it ends before the region of interest\n");
+        return -1;
+    }
+
+    struct camera_format region_format = *format;
+    region_format.width = region->width;
+    region_format.height = region->height;
+    region_format.sizeimage = bytesused - region_offset;
+
+    return convert(source + region_offset, bytesused - region_offset, &region_format, luma_image);
+}
+
+struct image_u8* create_image_view(struct image_u8* image, const struct region_of_interest* region) {
+    if (region->width > image->width || region->height > image->height)
+        return NULL;
+
+    return wrap_image_pixels(region->width, region->height, image->stride, image->buf);
+}
+
+bool has_luma_plane(uint32_t pixelformat) {
+    return select_luma_converter(pixelformat) == convert_luma_plane;
+}
+
+struct image_u8* create_luma_view(const struct buffer* buffer, const struct camera_format* format,
+                                  const struct region_of_interest* region) {
+    if (!has_luma_plane(format->pixelformat))
+        return NULL;
+
+    struct region_of_interest whole_frame = { .width = format->width, .height = format->height };
+    if (region == NULL)
+        region = &whole_frame;
+
+    if (region->width == 0 || region->height == 0 || region->left + region->width > format->width ||
+        region->top + region->height > format->height) {
+        return NULL;
+    }
+
+    size_t offset = (size_t) region->top * format->bytesperline + region->left;
+    size_t required_length = offset + (size_t) format->bytesperline * (region->height - 1) + region->width;
+    if (buffer->start == NULL || buffer->length < required_length)
+        return NULL;
+
+    struct image_u8 view = { .width = region->width, .height = region->height, .stride = format->bytesperline,
+                             .buf = (uint8_t*) buffer->start + offset };
+    struct image_u8* luma_view = malloc(sizeof(*luma_view));
+    memcpy(luma_view, &view, sizeof(view));
+    return luma_view;
+}
@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "apriltag/common/image_u8.h"
+#include "frame_source.h"
+
+static struct frame_source* create_frame_source(const struct frame_source_ops* ops, const char* name, void* state) {
+    struct frame_source* source = calloc(1, sizeof(*source));
+    source->ops = ops;
+    source->name = name;
+    source->state = state;
+    return source;
+}
+
+int frame_source_start(struct frame_source* source) {
+    return source->ops->start(source);
+}
+
+int frame_source_next_frame(struct frame_source* source, int timeout_ms, struct source_frame* frame) {
+    return source->ops->next_frame(source, timeout_ms, frame);
+}
+
+int frame_source_release_frame(struct frame_source* source, const struct source_frame* frame) {
+    return source->ops->release_frame(source, frame);
+}
+
+int frame_source_stop(struct frame_source* source) {
+    return source->ops->stop(source);
+}
+
+void frame_source_close(struct frame_source* source) {
+    source->ops->close(source);
+    free(source);
+}
+
+/*
+ * V4L2 backend
+ */
+
+struct v4l2_source_state {
+    int fd;
+    struct v4l2_requestbuffers* request_buffers;
+    struct buffer_queue queue;
+    bool streaming;
+};
+
+static int v4l2_source_start(struct frame_source* source) {
+    struct v4l2_source_state* state = source->state;
+
+    queue_buffers(&state->queue);
+    if (start_stream(state->fd, source->format.buffer_type) == -1) {
+        perror("VIDIOC_STREAMON");
+        return -1;
+    }
+
+    state->streaming = true;
+    return 0;
+}
+
+static int v4l2_source_next_frame(struct frame_source* source, int timeout_ms, struct source_frame* frame) {
+    struct v4l2_source_state* state = source->state;
+
+    int result = dequeue_buffer(&state->queue, &frame->frame);
+    if (result == -EAGAIN) {
+        struct pollfd camera_poll = { .fd = state->fd, .events = POLLIN };
+        int ready = poll(&camera_poll, 1, timeout_ms);
+        if (ready == -1)
+            return errno == EINTR ? -EAGAIN : -errno;
+        if (ready == 0)
+            return -EAGAIN;
+
+        result = dequeue_buffer(&state->queue, &frame->frame);
+    }
+    if (result < 0)
+        return result;
+
+    frame->data = state->queue.buffers[frame->frame.index].start;
+    return 0;
+}
+
+static int v4l2_source_release_frame(struct frame_source* source, const struct source_frame* frame) {
+    struct v4l2_source_state* state = source->state;
+    return requeue_buffer(&state->queue, frame->frame.index);
+}
+
+static int v4l2_source_stop(struct frame_source* source) {
+    struct v4l2_source_state* state = source->state;
+    if (!state->streaming)
+        return 0;
+
+    state->streaming = false;
+    return stop_stream(state->fd, source->format.buffer_type);
+}
+
+static void v4l2_source_close(struct frame_source* source) {
+    struct v4l2_source_state* state = source->state;
+
+    v4l2_source_stop(source);
+    if (state->queue.buffers != NULL)
+        cleanup_buffers(state->queue.buffers, state->queue.count);
+    free(state->request_buffers);
+    if (state->fd != -1)
+        close(state->fd);
+    free(state);
+}
+
+static const struct frame_source_ops v4l2_source_ops = {
+    .start = v4l2_source_start,
+    .next_frame = v4l2_source_next_frame,
+    .release_frame = v4l2_source_release_frame,
+    .stop = v4l2_source_stop,
+    .close = v4l2_source_close
+};
+
+struct frame_source* frame_source_open_v4l2(char* device_path, int width, int height, uint32_t fps,
+                                            int buffer_count) {
+    struct v4l2_source_state* state = calloc(1, sizeof(*state));
+    struct frame_source* source = create_frame_source(&v4l2_source_ops, device_path, state);
+
+    state->fd = setup_camera(device_path, width, height, &source->format);
+    if (state->fd == -1) {
+        frame_source_close(source);
+        return NULL;
+    }
+
+    struct v4l2_fract frame_interval = { 0 };
+    if (set_frame_rate(state->fd, &source->format, fps, &frame_interval) == -1)
+        printf("WARN: %s: Unable to set the frame rate, using the camera default\n", device_path);
+
+    state->request_buffers = request_mmap_buffers(state->fd, buffer_count, source->format.buffer_type);
+    if (state->request_buffers == NULL) {
+        frame_source_close(source);
+        return NULL;
+    }
+
+    struct buffer* buffers = map_buffers(state->fd, state->request_buffers);
+    if (buffers == NULL) {
+        frame_source_close(source);
+        return NULL;
+    }
+
+    state->queue = (struct buffer_queue) {
+        .fd = state->fd,
+        .type = state->request_buffers->type,
+        .memory = state->request_buffers->memory,
+        .buffers = buffers,
+        .count = state->request_buffers->count,
+        .num_planes = source->format.num_planes
+    };
+
+    return source;
+}
+
+/*
+ * Replay pacing shared by the recording backends
+ */
+
+struct replay_state {
+    struct replay_options options;
+    int64_t start_ns;
+    size_t next_frame;
+    uint32_t sequence;
+};
+
+static int64_t monotonic_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void sleep_until_ns(int64_t deadline_ns) {
+    struct timespec deadline = {
+        .tv_sec = deadline_ns / 1000000000,
+        .tv_nsec = deadline_ns % 1000000000
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
+
+static void replay_start(struct replay_state* replay) {
+    replay->start_ns = monotonic_now_ns();
+    replay->next_frame = 0;
+    replay->sequence = 0;
+}
+
+/**
+ * Picks the recorded frame to hand out next and waits until it is due
+ * @return - Index of the recorded frame, -EAGAIN if it isn't due within the timeout or -ENODATA if the replay is over
+ */
+static int replay_next_frame(struct replay_state* replay, size_t frame_count, int timeout_ms,
+                             struct frame* frame) {
+    if (replay->next_frame == frame_count) {
+        if (!replay->options.loop)
+            return -ENODATA;
+        replay->next_frame = 0;
+    }
+
+    int64_t now_ns = monotonic_now_ns();
+    int64_t timestamp_ns = now_ns;
+
+    if (replay->options.pacing == REPLAY_REALTIME && replay->options.fps > 0) {
+        // Counted from the sequence rather than the frame index so pacing carries on across loops
+        int64_t due_ns = replay->start_ns + (int64_t) (replay->sequence * 1e9 / replay->options.fps);
+        if (due_ns > now_ns) {
+            if (timeout_ms >= 0 && due_ns - now_ns > (int64_t) timeout_ms * 1000000) {
+                sleep_until_ns(now_ns + (int64_t) timeout_ms * 1000000);
+                return -EAGAIN;
+            }
+            sleep_until_ns(due_ns);
+        }
+        timestamp_ns = due_ns;
+    }
+
+    frame->index = (int) replay->next_frame;
+    frame->timestamp.tv_sec = timestamp_ns / 1000000000;
+    frame->timestamp.tv_usec = (timestamp_ns % 1000000000) / 1000;
+    frame->sequence = replay->sequence++;
+    frame->flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    return (int) replay->next_frame++;
+}
+
+static int replay_source_start(struct frame_source* source) {
+    replay_start(source->state);
+    return 0;
+}
+
+static int replay_source_release_frame(struct frame_source* source, const struct source_frame* frame) {
+    // Recorded frames are never written, there is nothing to hand back
+    return 0;
+}
+
+static int replay_source_stop(struct frame_source* source) {
+    return 0;
+}
+
+/*
+ * Raw recording backend
+ */
+
+struct raw_recording_state {
+    struct replay_state replay;
+    uint8_t* data;
+    size_t length;
+};
+
+static int raw_recording_next_frame(struct frame_source* source, int timeout_ms, struct source_frame* frame) {
+    struct raw_recording_state* state = source->state;
+
+    int index = replay_next_frame(&state->replay, source->frame_count, timeout_ms, &frame->frame);
+    if (index < 0)
+        return index;
+
+    frame->frame.bytesused = source->format.sizeimage;
+    frame->data = state->data + (size_t) index * source->format.sizeimage;
+    return 0;
+}
+
+static void raw_recording_close(struct frame_source* source) {
+    struct raw_recording_state* state = source->state;
+    if (state->data != NULL)
+        munmap(state->data, state->length);
+    free(state);
+}
+
+static const struct frame_source_ops raw_recording_ops = {
+    .start = replay_source_start,
+    .next_frame = raw_recording_next_frame,
+    .release_frame = replay_source_release_frame,
+    .stop = replay_source_stop,
+    .close = raw_recording_close
+};
+
+struct frame_source* frame_source_open_raw_recording(const char* file_path, const struct camera_format* format,
+                                                     const struct replay_options* options) {
+    if (format->sizeimage == 0) {
+        printf("%s: The recording format has no frame size\n", file_path);
+        return NULL;
+    }
+
+    int fd = open(file_path, O_RDONLY);
+    if (fd == -1) {
+        perror("Unable to open recording");
+        return NULL;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1) {
+        perror("Unable to stat recording");
+        close(fd);
+        return NULL;
+    }
+
+    size_t frame_count = file_stat.st_size / format->sizeimage;
+    if (frame_count == 0) {
+        printf("%s: The recording doesn't hold a complete frame\n", file_path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t length = frame_count * format->sizeimage;
+    uint8_t* data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Unable to map recording");
+        return NULL;
+    }
+    madvise(data, length, MADV_SEQUENTIAL);
+
+    struct raw_recording_state* state = calloc(1, sizeof(*state));
+    state->replay.options = *options;
+    state->data = data;
+    state->length = length;
+
+    struct frame_source* source = create_frame_source(&raw_recording_ops, file_path, state);
+    source->format = *format;
+    source->frame_count = frame_count;
+    return source;
+}
+
+/*
+ * PGM directory backend
+ */
+
+struct pgm_directory_state {
+    struct replay_state replay;
+    struct image_u8** images;
+};
+
+static int pgm_directory_next_frame(struct frame_source* source, int timeout_ms, struct source_frame* frame) {
+    struct pgm_directory_state* state = source->state;
+
+    int index = replay_next_frame(&state->replay, source->frame_count, timeout_ms, &frame->frame);
+    if (index < 0)
+        return index;
+
+    frame->frame.bytesused = source->format.sizeimage;
+    frame->data = state->images[index]->buf;
+    return 0;
+}
+
+static void pgm_directory_close(struct frame_source* source) {
+    struct pgm_directory_state* state = source->state;
+    for (size_t i = 0; i < source->frame_count; ++i) {
+        image_u8_destroy(state->images[i]);
+    }
+    free(state->images);
+    free(state);
+}
+
+static const struct frame_source_ops pgm_directory_ops = {
+    .start = replay_source_start,
+    .next_frame = pgm_directory_next_frame,
+    .release_frame = replay_source_release_frame,
+    .stop = replay_source_stop,
+    .close = pgm_directory_close
+};
+
+static int is_pgm_file(const struct dirent* entry) {
+    size_t length = strlen(entry->d_name);
+    return length > 4 && strcmp(entry->d_name + length - 4, ".pgm") == 0;
+}
+
+struct frame_source* frame_source_open_pgm_directory(const char* directory_path,
+                                                     const struct replay_options* options) {
+    struct dirent** entries;
+    int entry_count = scandir(directory_path, &entries, is_pgm_file, alphasort);
+    if (entry_count == -1) {
+        perror("Unable to read image directory");
+        return NULL;
+    }
+
+    struct pgm_directory_state* state = calloc(1, sizeof(*state));
+    state->replay.options = *options;
+    state->images = calloc(entry_count > 0 ? entry_count : 1, sizeof(*state->images));
+    struct frame_source* source = create_frame_source(&pgm_directory_ops, directory_path, state);
+
+    // Everything is loaded up front so disk reads never show up in the replay timings
+    bool failed = false;
+    for (int i = 0; i < entry_count; ++i) {
+        if (!failed) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", directory_path, entries[i]->d_name);
+
+            struct image_u8* image = image_u8_create_from_pnm(path);
+            if (image == NULL) {
+                printf("Unable to load %s\n", path);
+                failed = true;
+            } else if (source->frame_count > 0 &&
+                       (image->width != state->images[0]->width || image->height != state->images[0]->height ||
+                        image->stride != state->images[0]->stride)) {
+                printf("%s: %dx%d doesn't match the %dx%d of the first image\n", path, image->width,
+                       image->height, state->images[0]->width, state->images[0]->height);
+                image_u8_destroy(image);
+                failed = true;
+            } else {
+                state->images[source->frame_count++] = image;
+            }
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    if (failed || source->frame_count == 0) {
+        if (source->frame_count == 0 && !failed)
+            printf("%s: No .pgm images found\n", directory_path);
+        frame_source_close(source);
+        return NULL;
+    }
+
+    struct image_u8* first = state->images[0];
+    source->format = (struct camera_format) {
+        .pixelformat = V4L2_PIX_FMT_GREY,
+        .width = first->width,
+        .height = first->height,
+        .bytesperline = first->stride,
+        .sizeimage = first->stride * first->height,
+        .buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .num_planes = 1,
+        .plane_sizes = { first->stride * first->height }
+    };
+    return source;
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image_pool.h"
+
+static bool is_arena_memory(const struct frame_arena* arena, const uint8_t* pixels) {
+    return arena != NULL && pixels >= arena->base && pixels < arena->base + arena->size;
+}
+
+static struct image_u8* create_pool_image(struct image_pool* pool) {
+    if (pool->arena != NULL) {
+        struct image_u8* image = frame_arena_create_image(pool->arena, pool->width, pool->height);
+        if (image != NULL)
+            return image;
+    }
+
+    // The stride is a multiple of the alignment, so the size is one as well, as aligned_alloc wants
+    size_t size = (size_t) pool->stride * pool->height;
+    uint8_t* pixels = aligned_alloc(FRAME_ARENA_ALIGNMENT, size);
+    if (pixels == NULL) {
+        perror("Unable to allocate a pooled image");
+        return NULL;
+    }
+    memset(pixels, 0, size);
+
+    struct image_u8* image = wrap_image_pixels(pool->width, pool->height, pool->stride, pixels);
+    if (image == NULL)
+        free(pixels);
+    return image;
+}
+
+static void destroy_pool_image(struct image_pool* pool, struct image_u8* image) {
+    if (!is_arena_memory(pool->arena, image->buf))
+        free(image->buf);
+    free(image);
+}
+
+/**
+ * Makes room on the free list for one more image, the list must be able to hold every image of the pool
+ */
+static int grow_free_list(struct image_pool* pool) {
+    if (pool->image_count < pool->capacity)
+        return 0;
+
+    int capacity = pool->capacity > 0 ? pool->capacity * 2 : 4;
+    struct image_u8** free_images = realloc(pool->free_images, capacity * sizeof(struct image_u8*));
+    if (free_images == NULL)
+        return -1;
+
+    pool->free_images = free_images;
+    pool->capacity = capacity;
+    return 0;
+}
+
+struct image_pool* image_pool_create(int width, int height, int initial_count, struct frame_arena* arena) {
+    struct image_pool* pool = calloc(1, sizeof(*pool));
+    pool->width = width;
+    pool->height = height;
+    pool->stride = (width + FRAME_ARENA_ALIGNMENT - 1) & ~(FRAME_ARENA_ALIGNMENT - 1);
+    pool->arena = arena;
+
+    for (int i = 0; i < initial_count; ++i) {
+        if (grow_free_list(pool) == -1) {
+            image_pool_destroy(pool);
+            return NULL;
+        }
+        struct image_u8* image = create_pool_image(pool);
+        if (image == NULL) {
+            image_pool_destroy(pool);
+            return NULL;
+        }
+        pool->free_images[pool->free_count++] = image;
+        pool->image_count++;
+    }
+    return pool;
+}
+
+void image_pool_destroy(struct image_pool* pool) {
+    if (pool->acquired_count > 0)
+        printf("WARN: Destroying an image pool with %d images still acquired, they are leaked\n", pool->acquired_count);
+
+    for (int i = 0; i < pool->free_count; ++i) {
+        destroy_pool_image(pool, pool->free_images[i]);
+    }
+    free(pool->free_images);
+    free(pool);
+}
+
+struct image_u8* image_pool_acquire(struct image_pool* pool) {
+    struct image_u8* image;
+    if (pool->free_count > 0) {
+        image = pool->free_images[--pool->free_count];
+    } else {
+        // Room on the free list is made now, so releasing the image can't fail
+        if (grow_free_list(pool) == -1)
+            return NULL;
+        image = create_pool_image(pool);
+        if (image == NULL)
+            return NULL;
+        pool->image_count++;
+    }
+
+    pool->acquired_count++;
+    if (pool->acquired_count > pool->high_water_mark)
+        pool->high_water_mark = pool->acquired_count;
+    return image;
+}
+
+void image_pool_release(struct image_pool* pool, struct image_u8* image) {
+    if (image == NULL)
+        return;
+
+    pool->free_images[pool->free_count++] = image;
+    pool->acquired_count--;
+}
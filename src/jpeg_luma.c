@@ -0,0 +1,591 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "jpeg_luma.h"
+
+#define MAX_COMPONENTS 4
+#define MAX_TABLES 4
+// Dequantized DC coefficients of 8-bit samples stay well within this, only corrupt streams reach it
+#define COEFFICIENT_LIMIT 4095
+// Huffman codes up to this many bits long are decoded with a single table lookup, longer ones bit length by length
+#define HUFFMAN_LOOKUP_BITS 9
+
+// Marker codes, each follows a 0xFF byte
+#define MARKER_SOF0 0xc0
+#define MARKER_SOF1 0xc1
+#define MARKER_DHT 0xc4
+#define MARKER_RST0 0xd0
+#define MARKER_SOI 0xd8
+#define MARKER_EOI 0xd9
+#define MARKER_SOS 0xda
+#define MARKER_DQT 0xdb
+#define MARKER_DRI 0xdd
+
+const uint8_t JPEG_ZIGZAG[64] = {
+    0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21,
+    28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61,
+    54, 47, 55, 62, 63
+};
+
+const uint8_t JPEG_DC_LUMA_COUNTS[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+const uint8_t JPEG_DC_CHROMA_COUNTS[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+const uint8_t JPEG_DC_SYMBOLS[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+const uint8_t JPEG_AC_LUMA_COUNTS[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+const uint8_t JPEG_AC_LUMA_SYMBOLS[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+const uint8_t JPEG_AC_CHROMA_COUNTS[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+const uint8_t JPEG_AC_CHROMA_SYMBOLS[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+/**
+ * A canonical Huffman table
+ * lookup - Indexed by the next HUFFMAN_LOOKUP_BITS bits of the stream: code length << 8 | symbol, 0 for longer codes
+ * end_code - For every code length, one past the last code of that length
+ * symbol_offset - For every code length, what to add to a code to get the index of its symbol
+ */
+struct huffman_table {
+    uint16_t lookup[1 << HUFFMAN_LOOKUP_BITS];
+    int32_t end_code[17];
+    int32_t symbol_offset[17];
+    uint8_t symbols[256];
+};
+
+/**
+ * A component of the frame, the first one is the luma
+ */
+struct jpeg_component {
+    uint8_t id;
+    uint8_t horizontal_sampling;
+    uint8_t vertical_sampling;
+    uint8_t quantization_table;
+    // Set by the scan that codes the component
+    uint8_t dc_table;
+    uint8_t ac_table;
+    int dc_prediction;
+};
+
+/**
+ * Reads the entropy coded data of a scan. Stuffed zero bytes are dropped, and once a marker is reached only zero
+ * bits are fed in, counted as padding so a truncated frame can be told from a complete one
+ */
+struct bit_reader {
+    const uint8_t* next;
+    const uint8_t* end;
+    // Bits read ahead but not consumed, left aligned
+    uint64_t bits;
+    int count;
+    int padding_bytes;
+};
+
+struct jpeg_decoder {
+    // The first entry of every quantization table, the only one the DC coefficients need
+    uint16_t dc_quantization[MAX_TABLES];
+    struct huffman_table dc_tables[MAX_TABLES];
+    struct huffman_table ac_tables[MAX_TABLES];
+    int width;
+    int height;
+    int component_count;
+    struct jpeg_component components[MAX_COMPONENTS];
+    int max_horizontal_sampling;
+    int max_vertical_sampling;
+    // MCUs between two restart markers, 0 without restart markers
+    int restart_interval;
+};
+
+static int build_huffman_table(struct huffman_table* table, const uint8_t counts[16], const uint8_t* symbols) {
+    memset(table->lookup, 0, sizeof(table->lookup));
+
+    int code = 0;
+    int index = 0;
+    for (int length = 1; length <= 16; ++length) {
+        table->symbol_offset[length] = index - code;
+        for (int i = 0; i < counts[length - 1]; ++i, ++code, ++index) {
+            // More codes than there are bit patterns of this length
+            if (code >= 1 << length)
+                return -1;
+
+            table->symbols[index] = symbols[index];
+            if (length <= HUFFMAN_LOOKUP_BITS) {
+                int shift = HUFFMAN_LOOKUP_BITS - length;
+                for (int j = 0; j < 1 << shift; ++j) {
+                    table->lookup[code << shift | j] = (uint16_t) (length << 8 | symbols[index]);
+                }
+            }
+        }
+        table->end_code[length] = code;
+        code <<= 1;
+    }
+    return 0;
+}
+
+static inline void fill_bits(struct bit_reader* reader) {
+    // A code and the magnitude bits that follow it are at most 27 bits, refill in bulk only once fewer are left
+    if (reader->count >= 32)
+        return;
+
+    while (reader->count <= 56) {
+        uint64_t byte = 0;
+        if (reader->next < reader->end && (reader->next[0] != 0xff ||
+                                           (reader->next + 1 < reader->end && reader->next[1] == 0x00))) {
+            byte = reader->next[0];
+            reader->next += byte == 0xff ? 2 : 1;
+        } else {
+            reader->padding_bytes++;
+        }
+        reader->bits |= byte << (56 - reader->count);
+        reader->count += 8;
+    }
+}
+
+static inline uint32_t peek_bits(const struct bit_reader* reader, int count) {
+    return (uint32_t) (reader->bits >> (64 - count));
+}
+
+static inline void skip_bits(struct bit_reader* reader, int count) {
+    reader->bits <<= count;
+    reader->count -= count;
+}
+
+/**
+ * @return - The next symbol or -1 if the bits are no code of the table
+ */
+static inline int decode_huffman(struct bit_reader* reader, const struct huffman_table* table) {
+    uint16_t entry = table->lookup[peek_bits(reader, HUFFMAN_LOOKUP_BITS)];
+    if (entry != 0) {
+        skip_bits(reader, entry >> 8);
+        return entry & 0xff;
+    }
+
+    for (int length = HUFFMAN_LOOKUP_BITS + 1; length <= 16; ++length) {
+        int32_t code = (int32_t) peek_bits(reader, length);
+        if (code < table->end_code[length]) {
+            skip_bits(reader, length);
+            return table->symbols[code + table->symbol_offset[length]];
+        }
+    }
+    return -1;
+}
+
+/**
+ * Reads a size-bit magnitude and extends it to the signed value it codes
+ */
+static inline int32_t receive_extended(struct bit_reader* reader, int size) {
+    if (size == 0)
+        return 0;
+
+    int32_t value = (int32_t) peek_bits(reader, size);
+    skip_bits(reader, size);
+    return value < 1 << (size - 1) ? value - (1 << size) + 1 : value;
+}
+
+static inline int32_t clamp_to_limit(int64_t value, int32_t limit) {
+    return value < -limit ? -limit : value > limit ? limit : (int32_t) value;
+}
+
+/**
+ * Decodes one block and reads past its AC coefficients
+ * @return - The dequantized DC coefficient or INT32_MIN if the block is corrupt
+ */
+static int32_t decode_block(struct bit_reader* reader, const struct huffman_table* dc_table,
+                            const struct huffman_table* ac_table, uint16_t dc_quantization, int* dc_prediction) {
+    fill_bits(reader);
+    int size = decode_huffman(reader, dc_table);
+    if (size < 0 || size > 11)
+        return INT32_MIN;
+    *dc_prediction += receive_extended(reader, size);
+
+    for (int k = 1; k < 64; ++k) {
+        fill_bits(reader);
+        int symbol = decode_huffman(reader, ac_table);
+        if (symbol < 0)
+            return INT32_MIN;
+
+        int run = symbol >> 4;
+        size = symbol & 0x0f;
+        if (size == 0) {
+            // A run of 16 zeros, anything else ends the block
+            if (run != 15)
+                break;
+            k += 15;
+            continue;
+        }
+
+        k += run;
+        if (k > 63)
+            return INT32_MIN;
+        skip_bits(reader, size);
+    }
+    return clamp_to_limit((int64_t) *dc_prediction * dc_quantization, COEFFICIENT_LIMIT);
+}
+
+/**
+ * Mean luma of a block from its dequantized DC coefficient, what the inverse DCT would compute for a block without AC
+ * coefficients
+ */
+static inline uint8_t dc_sample(int32_t dc_coefficient) {
+    int32_t value = ((dc_coefficient + 4) >> 3) + 128;
+    return value < 0 ? 0 : value > 255 ? 255 : (uint8_t) value;
+}
+
+/**
+ * Moves the reader past the restart marker that ends an interval
+ */
+static int read_restart_marker(struct bit_reader* reader) {
+    // Whatever is left of the last byte of the interval is padding
+    reader->bits = 0;
+    reader->count = 0;
+    reader->padding_bytes = 0;
+
+    while (reader->next + 1 < reader->end && reader->next[0] == 0xff && reader->next[1] == 0xff) {
+        reader->next++;
+    }
+    if (reader->next + 1 >= reader->end || reader->next[0] != 0xff || (reader->next[1] & 0xf8) != MARKER_RST0) {
+        printf("Could not decode JPEG, a restart marker is missing\n");
+        return -1;
+    }
+    reader->next += 2;
+    return 0;
+}
+
+static int decode_scan(struct jpeg_decoder* decoder, const uint8_t* data, const uint8_t* end,
+                       const int* scan_components, int scan_component_count, struct image_u8* dc_image) {
+    struct bit_reader reader = { .next = data, .end = end, .bits = 0, .count = 0, .padding_bytes = 0 };
+
+    // Interleaved scans code whole MCUs, a scan of a single component just its blocks in raster order. The luma has
+    // the highest sampling factors, so a luma block covers 8x8 pixels either way
+    bool interleaved = scan_component_count > 1;
+    int mcu_width = JPEG_BLOCK_SIZE * (interleaved ? decoder->max_horizontal_sampling : 1);
+    int mcu_height = JPEG_BLOCK_SIZE * (interleaved ? decoder->max_vertical_sampling : 1);
+    if (!interleaved) {
+        const struct jpeg_component* component = &decoder->components[scan_components[0]];
+        mcu_width = mcu_width * decoder->max_horizontal_sampling / component->horizontal_sampling;
+        mcu_height = mcu_height * decoder->max_vertical_sampling / component->vertical_sampling;
+    }
+    int mcu_columns = (decoder->width + mcu_width - 1) / mcu_width;
+    int mcu_rows = (decoder->height + mcu_height - 1) / mcu_height;
+
+    for (int i = 0; i < scan_component_count; ++i) {
+        decoder->components[scan_components[i]].dc_prediction = 0;
+    }
+
+    int mcus_until_restart = decoder->restart_interval;
+    for (int mcu_y = 0; mcu_y < mcu_rows; ++mcu_y) {
+        for (int mcu_x = 0; mcu_x < mcu_columns; ++mcu_x) {
+            if (decoder->restart_interval > 0) {
+                if (mcus_until_restart == 0) {
+                    if (read_restart_marker(&reader) == -1)
+                        return -1;
+                    for (int i = 0; i < scan_component_count; ++i) {
+                        decoder->components[scan_components[i]].dc_prediction = 0;
+                    }
+                    mcus_until_restart = decoder->restart_interval;
+                }
+                mcus_until_restart--;
+            }
+
+            for (int i = 0; i < scan_component_count; ++i) {
+                struct jpeg_component* component = &decoder->components[scan_components[i]];
+                bool is_luma = scan_components[i] == 0;
+                int blocks_across = interleaved ? component->horizontal_sampling : 1;
+                int blocks_down = interleaved ? component->vertical_sampling : 1;
+
+                for (int block_y = 0; block_y < blocks_down; ++block_y) {
+                    for (int block_x = 0; block_x < blocks_across; ++block_x) {
+                        int32_t dc_coefficient = decode_block(&reader, &decoder->dc_tables[component->dc_table],
+                                                              &decoder->ac_tables[component->ac_table],
+                                                              decoder->dc_quantization[component->quantization_table],
+                                                              &component->dc_prediction);
+                        if (dc_coefficient == INT32_MIN) {
+                            printf("Could not decode JPEG, corrupt block in MCU %d, %d\n", mcu_x, mcu_y);
+                            return -1;
+                        }
+                        if (!is_luma)
+                            continue;
+
+                        // Blocks that pad the image to whole MCUs are left out
+                        int x = mcu_x * blocks_across + block_x;
+                        int y = mcu_y * blocks_down + block_y;
+                        if (x < dc_image->width && y < dc_image->height)
+                            dc_image->buf[y * dc_image->stride + x] = dc_sample(dc_coefficient);
+                    }
+                }
+            }
+        }
+    }
+
+    if (reader.padding_bytes * 8 > reader.count) {
+        printf("Could not decode JPEG, the frame is truncated\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int read_frame_header(struct jpeg_decoder* decoder, const uint8_t* segment, uint32_t size,
+                             const struct image_u8* dc_image) {
+    if (size < 6 || size < 6 + segment[5] * 3u) {
+        printf("Could not decode JPEG, invalid frame header\n");
+        return -1;
+    }
+    if (segment[0] != 8) {
+        printf("Could not decode JPEG, %d-bit samples are not supported\n", segment[0]);
+        return JPEG_LUMA_UNSUPPORTED;
+    }
+
+    decoder->height = segment[1] << 8 | segment[2];
+    decoder->width = segment[3] << 8 | segment[4];
+    decoder->component_count = segment[5];
+    if (decoder->width == 0 || decoder->height == 0 || decoder->component_count == 0 ||
+        decoder->component_count > MAX_COMPONENTS) {
+        printf("Could not decode JPEG, invalid frame header\n");
+        return -1;
+    }
+
+    decoder->max_horizontal_sampling = 1;
+    decoder->max_vertical_sampling = 1;
+    for (int i = 0; i < decoder->component_count; ++i) {
+        struct jpeg_component* component = &decoder->components[i];
+        const uint8_t* parameters = &segment[6 + i * 3];
+        component->id = parameters[0];
+        component->horizontal_sampling = parameters[1] >> 4;
+        component->vertical_sampling = parameters[1] & 0x0f;
+        component->quantization_table = parameters[2];
+        if (component->horizontal_sampling < 1 || component->horizontal_sampling > 4 ||
+            component->vertical_sampling < 1 || component->vertical_sampling > 4 ||
+            component->quantization_table >= MAX_TABLES) {
+            printf("Could not decode JPEG, invalid frame header\n");
+            return -1;
+        }
+        if (component->horizontal_sampling > decoder->max_horizontal_sampling)
+            decoder->max_horizontal_sampling = component->horizontal_sampling;
+        if (component->vertical_sampling > decoder->max_vertical_sampling)
+            decoder->max_vertical_sampling = component->vertical_sampling;
+    }
+
+    // Luma at a lower resolution than chroma would have to be upsampled
+    if (decoder->components[0].horizontal_sampling != decoder->max_horizontal_sampling ||
+        decoder->components[0].vertical_sampling != decoder->max_vertical_sampling) {
+        printf("Could not decode JPEG, the luma is subsampled\n");
+        return JPEG_LUMA_UNSUPPORTED;
+    }
+
+    int dc_width = (decoder->width + JPEG_BLOCK_SIZE - 1) / JPEG_BLOCK_SIZE;
+    int dc_height = (decoder->height + JPEG_BLOCK_SIZE - 1) / JPEG_BLOCK_SIZE;
+    if ((dc_image->width != dc_width || dc_image->height != dc_height)) {
+        printf("Could not decode JPEG, the DC image of a %dx%d frame is %dx%d but the image is %dx%d\n",
+               decoder->width, decoder->height, dc_width, dc_height, dc_image->width, dc_image->height);
+        return -1;
+    }
+    return 0;
+}
+
+static int read_huffman_tables(struct jpeg_decoder* decoder, const uint8_t* segment, uint32_t size) {
+    uint32_t position = 0;
+    while (position < size) {
+        if (position + 17 > size)
+            break;
+
+        int table_class = segment[position] >> 4;
+        int table_index = segment[position] & 0x0f;
+        const uint8_t* counts = &segment[position + 1];
+        int symbol_count = 0;
+        for (int i = 0; i < 16; ++i) {
+            symbol_count += counts[i];
+        }
+        position += 17;
+        if (table_class > 1 || table_index >= MAX_TABLES || symbol_count > 256 || position + symbol_count > size)
+            break;
+
+        struct huffman_table* table = table_class == 0 ? &decoder->dc_tables[table_index]
+                                                       : &decoder->ac_tables[table_index];
+        if (build_huffman_table(table, counts, &segment[position]) == -1)
+            break;
+        position += symbol_count;
+    }
+
+    if (position != size) {
+        printf("Could not decode JPEG, invalid Huffman table\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int read_quantization_tables(struct jpeg_decoder* decoder, const uint8_t* segment, uint32_t size) {
+    uint32_t position = 0;
+    while (position < size) {
+        int precision = segment[position] >> 4;
+        int table_index = segment[position] & 0x0f;
+        uint32_t table_size = precision == 0 ? 64 : 128;
+        position++;
+        if (precision > 1 || table_index >= MAX_TABLES || position + table_size > size)
+            break;
+
+        decoder->dc_quantization[table_index] = precision == 0 ? segment[position]
+                                                               : segment[position] << 8 | segment[position + 1];
+        position += table_size;
+    }
+
+    if (position != size) {
+        printf("Could not decode JPEG, invalid quantization table\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Reads a scan header into the indices of the components the scan codes
+ * @return - Number of components in the scan or -1 if the header is invalid
+ */
+static int read_scan_header(struct jpeg_decoder* decoder, const uint8_t* segment, uint32_t size,
+                            int scan_components[MAX_COMPONENTS]) {
+    int count = size > 0 ? segment[0] : 0;
+    if (decoder->component_count == 0 || count == 0 || count > decoder->component_count || size != 4 + count * 2u) {
+        printf("Could not decode JPEG, invalid scan header\n");
+        return -1;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        const uint8_t* parameters = &segment[1 + i * 2];
+        scan_components[i] = -1;
+        for (int j = 0; j < decoder->component_count; ++j) {
+            if (decoder->components[j].id == parameters[0])
+                scan_components[i] = j;
+        }
+        if (scan_components[i] == -1 || parameters[1] >> 4 >= MAX_TABLES || (parameters[1] & 0x0f) >= MAX_TABLES) {
+            printf("Could not decode JPEG, invalid scan header\n");
+            return -1;
+        }
+        decoder->components[scan_components[i]].dc_table = parameters[1] >> 4;
+        decoder->components[scan_components[i]].ac_table = parameters[1] & 0x0f;
+    }
+    return count;
+}
+
+/**
+ * Finds the end of the entropy coded data of a scan: the first marker that is neither a stuffed zero byte nor a
+ * restart marker
+ */
+static uint32_t skip_entropy_coded_data(const uint8_t* jpeg, uint32_t length, uint32_t position) {
+    while (position + 1 < length && (jpeg[position] != 0xff || jpeg[position + 1] == 0x00 ||
+                                     (jpeg[position + 1] & 0xf8) == MARKER_RST0)) {
+        position++;
+    }
+    return position;
+}
+
+static bool is_unsupported_frame_marker(uint8_t marker) {
+    // SOF2 to SOF15 except DHT (0xc4), JPG (0xc8) and DAC (0xcc): progressive, lossless, hierarchical and arithmetic
+    return marker >= 0xc2 && marker <= 0xcf && marker != MARKER_DHT && marker != 0xc8 && marker != 0xcc;
+}
+
+int decode_jpeg_dc_luma(const uint8_t* jpeg, uint32_t length, struct image_u8* dc_image) {
+    if (length < 4 || jpeg[0] != 0xff || jpeg[1] != MARKER_SOI) {
+        printf("Could not decode JPEG, the frame doesn't start with an SOI marker\n");
+        return -1;
+    }
+
+    struct jpeg_decoder decoder;
+    memset(&decoder, 0, sizeof(decoder));
+    build_huffman_table(&decoder.dc_tables[0], JPEG_DC_LUMA_COUNTS, JPEG_DC_SYMBOLS);
+    build_huffman_table(&decoder.dc_tables[1], JPEG_DC_CHROMA_COUNTS, JPEG_DC_SYMBOLS);
+    build_huffman_table(&decoder.ac_tables[0], JPEG_AC_LUMA_COUNTS, JPEG_AC_LUMA_SYMBOLS);
+    build_huffman_table(&decoder.ac_tables[1], JPEG_AC_CHROMA_COUNTS, JPEG_AC_CHROMA_SYMBOLS);
+
+    uint32_t position = 2;
+    while (true) {
+        if (position + 1 >= length || jpeg[position] != 0xff) {
+            printf("Could not decode JPEG, expected a marker at byte %u of %u\n", position, length);
+            return -1;
+        }
+        // Any number of 0xff fill bytes may come before the marker code
+        while (position + 2 < length && jpeg[position + 1] == 0xff) {
+            position++;
+        }
+        uint8_t marker = jpeg[position + 1];
+        position += 2;
+
+        if (marker == MARKER_EOI) {
+            printf("Could not decode JPEG, there is no luma scan\n");
+            return -1;
+        }
+        if (is_unsupported_frame_marker(marker)) {
+            printf("Could not decode JPEG, only baseline JPEGs are supported\n");
+            return JPEG_LUMA_UNSUPPORTED;
+        }
+
+        if (position + 2 > length || (jpeg[position] << 8 | jpeg[position + 1]) < 2 ||
+            position + (jpeg[position] << 8 | jpeg[position + 1]) > length) {
+            printf("Could not decode JPEG, the frame is truncated\n");
+            return -1;
+        }
+        uint32_t segment_size = (jpeg[position] << 8 | jpeg[position + 1]) - 2;
+        const uint8_t* segment = &jpeg[position + 2];
+        position += 2 + segment_size;
+
+        int result = 0;
+        switch (marker) {
+            case MARKER_SOF0:
+            case MARKER_SOF1:
+                result = read_frame_header(&decoder, segment, segment_size, dc_image);
+                break;
+            case MARKER_DHT:
+                result = read_huffman_tables(&decoder, segment, segment_size);
+                break;
+            case MARKER_DQT:
+                result = read_quantization_tables(&decoder, segment, segment_size);
+                break;
+            case MARKER_DRI:
+                if (segment_size < 2) {
+                    printf("Could not decode JPEG, invalid restart interval\n");
+                    return -1;
+                }
+                decoder.restart_interval = segment[0] << 8 | segment[1];
+                break;
+            case MARKER_SOS: {
+                int scan_components[MAX_COMPONENTS];
+                int scan_component_count = read_scan_header(&decoder, segment, segment_size, scan_components);
+                if (scan_component_count == -1)
+                    return -1;
+
+                // Only the scan with the luma matters, scans of chroma alone are skipped without decoding them
+                for (int i = 0; i < scan_component_count; ++i) {
+                    if (scan_components[i] == 0) {
+                        return decode_scan(&decoder, &jpeg[position], &jpeg[length], scan_components,
+                                           scan_component_count, dc_image);
+                    }
+                }
+                position = skip_entropy_coded_data(jpeg, length, position);
+                break;
+            }
+            default:
+                // APPn, COM and the other segments carry nothing the luma needs
+                break;
+        }
+        if (result != 0)
+            return result;
+    }
+}
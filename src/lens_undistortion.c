@@ -0,0 +1,105 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lens_undistortion.h"
+
+// Fixed point iterations of the inverse, enough to settle well below a hundredth of a pixel for webcam lenses
+#define UNDISTORTION_ITERATIONS 20
+
+void undistort_point_exact(const struct camera_intrinsics* intrinsics, const struct lens_distortion* distortion,
+                           double x, double y, double* undistorted_x, double* undistorted_y) {
+    double distorted_x = (x - intrinsics->cx) / intrinsics->fx;
+    double distorted_y = (y - intrinsics->cy) / intrinsics->fy;
+
+    // Distortion moves a point by an amount that depends on where it is, so guess it is where it was seen and refine
+    double ideal_x = distorted_x;
+    double ideal_y = distorted_y;
+    for (int i = 0; i < UNDISTORTION_ITERATIONS; ++i) {
+        double r2 = ideal_x * ideal_x + ideal_y * ideal_y;
+        double radial = 1 + r2 * (distortion->k1 + r2 * (distortion->k2 + r2 * distortion->k3));
+        double tangential_x = 2 * distortion->p1 * ideal_x * ideal_y + distortion->p2 * (r2 + 2 * ideal_x * ideal_x);
+        double tangential_y = distortion->p1 * (r2 + 2 * ideal_y * ideal_y) + 2 * distortion->p2 * ideal_x * ideal_y;
+        ideal_x = (distorted_x - tangential_x) / radial;
+        ideal_y = (distorted_y - tangential_y) / radial;
+    }
+
+    *undistorted_x = ideal_x * intrinsics->fx + intrinsics->cx;
+    *undistorted_y = ideal_y * intrinsics->fy + intrinsics->cy;
+}
+
+struct undistortion_table* undistortion_table_create(const struct camera_intrinsics* intrinsics,
+                                                     const struct lens_distortion* distortion, int width, int height,
+                                                     int cell_size) {
+    if (width <= 0 || height <= 0 || cell_size <= 0) {
+        printf("Invalid undistortion table of %dx%d pixels with cells of %d pixels\n", width, height, cell_size);
+        return NULL;
+    }
+
+    struct undistortion_table* table = malloc(sizeof(*table));
+    if (table == NULL)
+        return NULL;
+
+    table->width = width;
+    table->height = height;
+    table->cell_size = cell_size;
+    // Nodes reach past the last pixel on both axes, so every point of the image lies inside a cell
+    table->columns = (width + cell_size - 1) / cell_size + 1;
+    table->rows = (height + cell_size - 1) / cell_size + 1;
+    table->points = malloc((size_t) table->columns * table->rows * 2 * sizeof(float));
+    if (table->points == NULL) {
+        perror("Unable to allocate the undistortion table");
+        free(table);
+        return NULL;
+    }
+
+    for (int row = 0; row < table->rows; ++row) {
+        for (int column = 0; column < table->columns; ++column) {
+            double x, y;
+            undistort_point_exact(intrinsics, distortion, column * cell_size, row * cell_size, &x, &y);
+            float* point = &table->points[(row * table->columns + column) * 2];
+            point[0] = (float) x;
+            point[1] = (float) y;
+        }
+    }
+    return table;
+}
+
+void undistortion_table_destroy(struct undistortion_table* table) {
+    free(table->points);
+    free(table);
+}
+
+/**
+ * Bilinear interpolation of one coordinate of the 4 nodes of a cell, the right nodes follow the left ones
+ */
+static double interpolate(const float* top_left, const float* bottom_left, int coordinate, double weight_x,
+                          double weight_y) {
+    double top = top_left[coordinate] + (top_left[coordinate + 2] - top_left[coordinate]) * weight_x;
+    double bottom = bottom_left[coordinate] + (bottom_left[coordinate + 2] - bottom_left[coordinate]) * weight_x;
+    return top + (bottom - top) * weight_y;
+}
+
+void undistort_point(const struct undistortion_table* table, double x, double y, double* undistorted_x,
+                     double* undistorted_y) {
+    double grid_x = x / table->cell_size;
+    double grid_y = y / table->cell_size;
+    // Points past the edge use the edge cell with weights outside [0, 1], which extrapolates linearly
+    int column = (int) fmin(fmax(floor(grid_x), 0), table->columns - 2);
+    int row = (int) fmin(fmax(floor(grid_y), 0), table->rows - 2);
+    double weight_x = grid_x - column;
+    double weight_y = grid_y - row;
+
+    const float* top_left = &table->points[(row * table->columns + column) * 2];
+    const float* bottom_left = top_left + table->columns * 2;
+    *undistorted_x = interpolate(top_left, bottom_left, 0, weight_x, weight_y);
+    *undistorted_y = interpolate(top_left, bottom_left, 1, weight_x, weight_y);
+}
+
+void undistort_tag_corners(const struct undistortion_table* table, struct tag_corners* corners) {
+    for (int i = 0; i < 4; ++i) {
+        undistort_point(table, corners->corners[i][0], corners->corners[i][1], &corners->corners[i][0],
+                        &corners->corners[i][1]);
+    }
+    undistort_point(table, corners->center[0], corners->center[1], &corners->center[0], &corners->center[1]);
+}
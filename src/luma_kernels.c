@@ -0,0 +1,436 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "luma_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LUMA_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#define LUMA_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+// BT.601 luma weights in 1/256 steps. They add up to 256, so white stays 255 and every sum fits 16 bits
+#define RED_WEIGHT 77
+#define GREEN_WEIGHT 150
+#define BLUE_WEIGHT 29
+
+// Y10 keeps its samples in the low 10 bits of each 16-bit word
+#define Y10_MASK 0x03ff
+
+/**
+ * The 8-bit planes need no conversion, memcpy is already vectorized by libc, so every level shares this kernel
+ */
+static void plane_row(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    memcpy(luma_row, source_row, width);
+}
+
+static void yuyv_row_scalar(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    for (int x = 0; x < width; ++x) {
+        luma_row[x] = source_row[x * 2];
+    }
+}
+
+static void uyvy_row_scalar(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    for (int x = 0; x < width; ++x) {
+        luma_row[x] = source_row[x * 2 + 1];
+    }
+}
+
+static void y10_row_scalar(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    for (int x = 0; x < width; ++x) {
+        uint16_t sample = source_row[x * 2] | source_row[x * 2 + 1] << 8;
+        luma_row[x] = (sample & Y10_MASK) >> 2;
+    }
+}
+
+static inline uint8_t weighted_luma(uint8_t red, uint8_t green, uint8_t blue) {
+    return (RED_WEIGHT * red + GREEN_WEIGHT * green + BLUE_WEIGHT * blue + 128) >> 8;
+}
+
+static void rgb24_row_scalar(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    for (int x = 0; x < width; ++x) {
+        luma_row[x] = weighted_luma(source_row[x * 3], source_row[x * 3 + 1], source_row[x * 3 + 2]);
+    }
+}
+
+static void bgr24_row_scalar(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    for (int x = 0; x < width; ++x) {
+        luma_row[x] = weighted_luma(source_row[x * 3 + 2], source_row[x * 3 + 1], source_row[x * 3]);
+    }
+}
+
+static void stretch_row_scalar(uint8_t* luma_row, int width, uint8_t low, uint16_t gain) {
+    for (int x = 0; x < width; ++x) {
+        uint32_t stretched = (uint32_t) (luma_row[x] > low ? luma_row[x] - low : 0) * gain >> 8;
+        luma_row[x] = stretched > 255 ? 255 : stretched;
+    }
+}
+
+#if LUMA_KERNELS_X86
+// The vector kernels are compiled for their instruction set with target attributes and only called once
+// detect_simd_level saw the CPU support it, so the rest of the build keeps the baseline instruction set.
+// Every kernel finishes the last pixels that don't fill a vector with the scalar kernel.
+
+__attribute__((target("sse2")))
+static void yuyv_row_sse2(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i first = _mm_loadu_si128((const __m128i*) (source_row + x * 2));
+        __m128i second = _mm_loadu_si128((const __m128i*) (source_row + x * 2 + 16));
+        __m128i luma = _mm_packus_epi16(_mm_and_si128(first, low_bytes), _mm_and_si128(second, low_bytes));
+        _mm_storeu_si128((__m128i*) (luma_row + x), luma);
+    }
+    yuyv_row_scalar(source_row + x * 2, luma_row + x, width - x);
+}
+
+__attribute__((target("sse2")))
+static void uyvy_row_sse2(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i first = _mm_loadu_si128((const __m128i*) (source_row + x * 2));
+        __m128i second = _mm_loadu_si128((const __m128i*) (source_row + x * 2 + 16));
+        __m128i luma = _mm_packus_epi16(_mm_srli_epi16(first, 8), _mm_srli_epi16(second, 8));
+        _mm_storeu_si128((__m128i*) (luma_row + x), luma);
+    }
+    uyvy_row_scalar(source_row + x * 2, luma_row + x, width - x);
+}
+
+__attribute__((target("sse2")))
+static void y10_row_sse2(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    const __m128i sample_bits = _mm_set1_epi16(Y10_MASK);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i first = _mm_and_si128(_mm_loadu_si128((const __m128i*) (source_row + x * 2)), sample_bits);
+        __m128i second = _mm_and_si128(_mm_loadu_si128((const __m128i*) (source_row + x * 2 + 16)), sample_bits);
+        __m128i luma = _mm_packus_epi16(_mm_srli_epi16(first, 2), _mm_srli_epi16(second, 2));
+        _mm_storeu_si128((__m128i*) (luma_row + x), luma);
+    }
+    y10_row_scalar(source_row + x * 2, luma_row + x, width - x);
+}
+
+/**
+ * Unpacking luma into the high byte of 16-bit lanes makes mulhi compute (luma * gain) >> 8. With gain at most 16 * 256
+ * the products stay below 32768, so the signed saturation of packus only clips at 255
+ */
+__attribute__((target("sse2")))
+static void stretch_row_sse2(uint8_t* luma_row, int width, uint8_t low, uint16_t gain) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lows = _mm_set1_epi8((char) low);
+    const __m128i gains = _mm_set1_epi16((short) gain);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i luma = _mm_subs_epu8(_mm_loadu_si128((const __m128i*) (luma_row + x)), lows);
+        __m128i first = _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, luma), gains);
+        __m128i second = _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, luma), gains);
+        _mm_storeu_si128((__m128i*) (luma_row + x), _mm_packus_epi16(first, second));
+    }
+    stretch_row_scalar(luma_row + x, width - x, low, gain);
+}
+
+/**
+ * Gathers the bytes selected by the shuffle from two vectors of 8 pixels into one vector of 16 luma samples
+ */
+__attribute__((target("ssse3")))
+static void packed_422_row_ssse3(const uint8_t* source_row, uint8_t* luma_row, int width, __m128i shuffle) {
+    for (int x = 0; x + 16 <= width; x += 16) {
+        __m128i first = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (source_row + x * 2)), shuffle);
+        __m128i second = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (source_row + x * 2 + 16)), shuffle);
+        _mm_storeu_si128((__m128i*) (luma_row + x), _mm_unpacklo_epi64(first, second));
+    }
+}
+
+__attribute__((target("ssse3")))
+static void yuyv_row_ssse3(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    const __m128i even_bytes = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    packed_422_row_ssse3(source_row, luma_row, width, even_bytes);
+    int x = width / 16 * 16;
+    yuyv_row_scalar(source_row + x * 2, luma_row + x, width - x);
+}
+
+__attribute__((target("ssse3")))
+static void uyvy_row_ssse3(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    const __m128i odd_bytes = _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+    packed_422_row_ssse3(source_row, luma_row, width, odd_bytes);
+    int x = width / 16 * 16;
+    uyvy_row_scalar(source_row + x * 2, luma_row + x, width - x);
+}
+
+/**
+ * Weighted sum of the three channels of 8 packed 24-bit pixels as 16-bit luma. The 24 bytes are read as two
+ * overlapping vectors (bytes 0-15 and 8-23) and each channel is shuffled out of both into 16-bit lanes
+ */
+__attribute__((target("ssse3")))
+static __m128i weighted_luma_8_ssse3(const uint8_t* pixels, __m128i first_weight, __m128i second_weight,
+                                     __m128i third_weight) {
+    const __m128i first_low = _mm_setr_epi8(0, -1, 3, -1, 6, -1, 9, -1, 12, -1, 15, -1, -1, -1, -1, -1);
+    const __m128i first_high = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 10, -1, 13, -1);
+    const __m128i second_low = _mm_setr_epi8(1, -1, 4, -1, 7, -1, 10, -1, 13, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i second_high = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 8, -1, 11, -1, 14, -1);
+    const __m128i third_low = _mm_setr_epi8(2, -1, 5, -1, 8, -1, 11, -1, 14, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i third_high = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 9, -1, 12, -1, 15, -1);
+
+    __m128i low = _mm_loadu_si128((const __m128i*) pixels);
+    __m128i high = _mm_loadu_si128((const __m128i*) (pixels + 8));
+    __m128i first = _mm_or_si128(_mm_shuffle_epi8(low, first_low), _mm_shuffle_epi8(high, first_high));
+    __m128i second = _mm_or_si128(_mm_shuffle_epi8(low, second_low), _mm_shuffle_epi8(high, second_high));
+    __m128i third = _mm_or_si128(_mm_shuffle_epi8(low, third_low), _mm_shuffle_epi8(high, third_high));
+
+    // The sums stay below 65536, so the wrapping 16-bit arithmetic and the logical shift give the exact result
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(first, first_weight), _mm_mullo_epi16(second, second_weight));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(third, third_weight));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+}
+
+__attribute__((target("ssse3")))
+static void packed_24_row_ssse3(const uint8_t* source_row, uint8_t* luma_row, int width, int first_weight,
+                                int second_weight, int third_weight) {
+    const __m128i first = _mm_set1_epi16(first_weight);
+    const __m128i second = _mm_set1_epi16(second_weight);
+    const __m128i third = _mm_set1_epi16(third_weight);
+    for (int x = 0; x + 16 <= width; x += 16) {
+        __m128i low = weighted_luma_8_ssse3(source_row + x * 3, first, second, third);
+        __m128i high = weighted_luma_8_ssse3(source_row + x * 3 + 24, first, second, third);
+        _mm_storeu_si128((__m128i*) (luma_row + x), _mm_packus_epi16(low, high));
+    }
+}
+
+__attribute__((target("ssse3")))
+static void rgb24_row_ssse3(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    packed_24_row_ssse3(source_row, luma_row, width, RED_WEIGHT, GREEN_WEIGHT, BLUE_WEIGHT);
+    int x = width / 16 * 16;
+    rgb24_row_scalar(source_row + x * 3, luma_row + x, width - x);
+}
+
+__attribute__((target("ssse3")))
+static void bgr24_row_ssse3(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    packed_24_row_ssse3(source_row, luma_row, width, BLUE_WEIGHT, GREEN_WEIGHT, RED_WEIGHT);
+    int x = width / 16 * 16;
+    bgr24_row_scalar(source_row + x * 3, luma_row + x, width - x);
+}
+
+// packus works within 128-bit lanes, the permute puts the four 8-byte groups back in pixel order
+#define AVX2_LANE_ORDER 0xd8
+
+__attribute__((target("avx2")))
+static void yuyv_row_avx2(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    const __m256i low_bytes = _mm256_set1_epi16(0x00ff);
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i first = _mm256_loadu_si256((const __m256i*) (source_row + x * 2));
+        __m256i second = _mm256_loadu_si256((const __m256i*) (source_row + x * 2 + 32));
+        __m256i luma = _mm256_packus_epi16(_mm256_and_si256(first, low_bytes), _mm256_and_si256(second, low_bytes));
+        _mm256_storeu_si256((__m256i*) (luma_row + x), _mm256_permute4x64_epi64(luma, AVX2_LANE_ORDER));
+    }
+    yuyv_row_sse2(source_row + x * 2, luma_row + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void uyvy_row_avx2(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i first = _mm256_loadu_si256((const __m256i*) (source_row + x * 2));
+        __m256i second = _mm256_loadu_si256((const __m256i*) (source_row + x * 2 + 32));
+        __m256i luma = _mm256_packus_epi16(_mm256_srli_epi16(first, 8), _mm256_srli_epi16(second, 8));
+        _mm256_storeu_si256((__m256i*) (luma_row + x), _mm256_permute4x64_epi64(luma, AVX2_LANE_ORDER));
+    }
+    uyvy_row_sse2(source_row + x * 2, luma_row + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void y10_row_avx2(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    const __m256i sample_bits = _mm256_set1_epi16(Y10_MASK);
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i first = _mm256_and_si256(_mm256_loadu_si256((const __m256i*) (source_row + x * 2)), sample_bits);
+        __m256i second = _mm256_and_si256(_mm256_loadu_si256((const __m256i*) (source_row + x * 2 + 32)),
+                                          sample_bits);
+        __m256i luma = _mm256_packus_epi16(_mm256_srli_epi16(first, 2), _mm256_srli_epi16(second, 2));
+        _mm256_storeu_si256((__m256i*) (luma_row + x), _mm256_permute4x64_epi64(luma, AVX2_LANE_ORDER));
+    }
+    y10_row_sse2(source_row + x * 2, luma_row + x, width - x);
+}
+
+// Unpack and packus both work within 128-bit lanes, so the pixels come out in order without a permute
+__attribute__((target("avx2")))
+static void stretch_row_avx2(uint8_t* luma_row, int width, uint8_t low, uint16_t gain) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lows = _mm256_set1_epi8((char) low);
+    const __m256i gains = _mm256_set1_epi16((short) gain);
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i luma = _mm256_subs_epu8(_mm256_loadu_si256((const __m256i*) (luma_row + x)), lows);
+        __m256i first = _mm256_mulhi_epu16(_mm256_unpacklo_epi8(zero, luma), gains);
+        __m256i second = _mm256_mulhi_epu16(_mm256_unpackhi_epi8(zero, luma), gains);
+        _mm256_storeu_si256((__m256i*) (luma_row + x), _mm256_packus_epi16(first, second));
+    }
+    stretch_row_sse2(luma_row + x, width - x, low, gain);
+}
+#endif
+
+#if LUMA_KERNELS_NEON
+// vld2 splits 16 pixels into their even and odd bytes in one load
+
+static void yuyv_row_neon(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        vst1q_u8(luma_row + x, vld2q_u8(source_row + x * 2).val[0]);
+    }
+    yuyv_row_scalar(source_row + x * 2, luma_row + x, width - x);
+}
+
+static void uyvy_row_neon(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        vst1q_u8(luma_row + x, vld2q_u8(source_row + x * 2).val[1]);
+    }
+    uyvy_row_scalar(source_row + x * 2, luma_row + x, width - x);
+}
+
+static void y10_row_neon(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        // Bits 2-9 of the sample are the top 6 bits of the low byte and the bottom 2 bits of the high byte
+        uint8x16x2_t samples = vld2q_u8(source_row + x * 2);
+        uint8x16_t high_bits = vshlq_n_u8(vandq_u8(samples.val[1], vdupq_n_u8(0x03)), 6);
+        vst1q_u8(luma_row + x, vorrq_u8(high_bits, vshrq_n_u8(samples.val[0], 2)));
+    }
+    y10_row_scalar(source_row + x * 2, luma_row + x, width - x);
+}
+
+/**
+ * vld3 splits 16 pixels into their three channels, the rounding narrowing shift adds the 128 of weighted_luma
+ */
+static void packed_24_row_neon(const uint8_t* source_row, uint8_t* luma_row, int width, uint8_t first_weight,
+                               uint8_t second_weight, uint8_t third_weight) {
+    const uint8x8_t first = vdup_n_u8(first_weight);
+    const uint8x8_t second = vdup_n_u8(second_weight);
+    const uint8x8_t third = vdup_n_u8(third_weight);
+    for (int x = 0; x + 16 <= width; x += 16) {
+        uint8x16x3_t pixels = vld3q_u8(source_row + x * 3);
+        uint16x8_t low = vmull_u8(vget_low_u8(pixels.val[0]), first);
+        low = vmlal_u8(low, vget_low_u8(pixels.val[1]), second);
+        low = vmlal_u8(low, vget_low_u8(pixels.val[2]), third);
+        uint16x8_t high = vmull_u8(vget_high_u8(pixels.val[0]), first);
+        high = vmlal_u8(high, vget_high_u8(pixels.val[1]), second);
+        high = vmlal_u8(high, vget_high_u8(pixels.val[2]), third);
+        vst1q_u8(luma_row + x, vcombine_u8(vrshrn_n_u16(low, 8), vrshrn_n_u16(high, 8)));
+    }
+}
+
+static void rgb24_row_neon(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    packed_24_row_neon(source_row, luma_row, width, RED_WEIGHT, GREEN_WEIGHT, BLUE_WEIGHT);
+    int x = width / 16 * 16;
+    rgb24_row_scalar(source_row + x * 3, luma_row + x, width - x);
+}
+
+static void bgr24_row_neon(const uint8_t* source_row, uint8_t* luma_row, int width) {
+    packed_24_row_neon(source_row, luma_row, width, BLUE_WEIGHT, GREEN_WEIGHT, RED_WEIGHT);
+    int x = width / 16 * 16;
+    bgr24_row_scalar(source_row + x * 3, luma_row + x, width - x);
+}
+
+/**
+ * Multiplies 4 stretched samples by the gain in 32 bits and keeps bits 8-23 of the products
+ */
+static uint16x4_t stretch_4_neon(uint16x4_t luma, uint16x4_t gains) {
+    return vshrn_n_u32(vmull_u16(luma, gains), 8);
+}
+
+static void stretch_row_neon(uint8_t* luma_row, int width, uint8_t low, uint16_t gain) {
+    const uint8x16_t lows = vdupq_n_u8(low);
+    const uint16x4_t gains = vdup_n_u16(gain);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t luma = vqsubq_u8(vld1q_u8(luma_row + x), lows);
+        uint16x8_t first = vmovl_u8(vget_low_u8(luma));
+        uint16x8_t second = vmovl_u8(vget_high_u8(luma));
+        first = vcombine_u16(stretch_4_neon(vget_low_u16(first), gains), stretch_4_neon(vget_high_u16(first), gains));
+        second = vcombine_u16(stretch_4_neon(vget_low_u16(second), gains),
+                              stretch_4_neon(vget_high_u16(second), gains));
+        vst1q_u8(luma_row + x, vcombine_u8(vqmovn_u16(first), vqmovn_u16(second)));
+    }
+    stretch_row_scalar(luma_row + x, width - x, low, gain);
+}
+#endif
+
+// SSE2 has no byte shuffle, so it converts 24-bit RGB with the scalar kernels and AVX2 reuses the SSSE3 ones
+static const struct luma_kernels kernel_table[SIMD_LEVEL_COUNT] = {
+    [SIMD_SCALAR] = { SIMD_SCALAR, "scalar", plane_row, yuyv_row_scalar, uyvy_row_scalar, y10_row_scalar,
+                      rgb24_row_scalar, bgr24_row_scalar, stretch_row_scalar },
+#if LUMA_KERNELS_X86
+    [SIMD_SSE2] = { SIMD_SSE2, "sse2", plane_row, yuyv_row_sse2, uyvy_row_sse2, y10_row_sse2, rgb24_row_scalar,
+                    bgr24_row_scalar, stretch_row_sse2 },
+    [SIMD_SSSE3] = { SIMD_SSSE3, "ssse3", plane_row, yuyv_row_ssse3, uyvy_row_ssse3, y10_row_sse2, rgb24_row_ssse3,
+                     bgr24_row_ssse3, stretch_row_sse2 },
+    [SIMD_AVX2] = { SIMD_AVX2, "avx2", plane_row, yuyv_row_avx2, uyvy_row_avx2, y10_row_avx2, rgb24_row_ssse3,
+                    bgr24_row_ssse3, stretch_row_avx2 },
+#endif
+#if LUMA_KERNELS_NEON
+    [SIMD_NEON] = { SIMD_NEON, "neon", plane_row, yuyv_row_neon, uyvy_row_neon, y10_row_neon, rgb24_row_neon,
+                    bgr24_row_neon, stretch_row_neon },
+#endif
+};
+
+static const struct luma_kernels* selected_kernels = NULL;
+
+static int is_simd_level_supported(enum simd_level level) {
+    switch (level) {
+        case SIMD_SCALAR:
+            return 1;
+#if LUMA_KERNELS_X86
+        case SIMD_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case SIMD_SSSE3:
+            return __builtin_cpu_supports("ssse3");
+        case SIMD_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+#if LUMA_KERNELS_NEON
+        case SIMD_NEON:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+enum simd_level detect_simd_level(void) {
+#if LUMA_KERNELS_X86
+    __builtin_cpu_init();
+#endif
+    for (int level = SIMD_LEVEL_COUNT - 1; level > SIMD_SCALAR; --level) {
+        if (is_simd_level_supported(level))
+            return level;
+    }
+    return SIMD_SCALAR;
+}
+
+const struct luma_kernels* get_luma_kernels(enum simd_level level) {
+    if (level < 0 || level >= SIMD_LEVEL_COUNT || kernel_table[level].name == NULL)
+        return NULL;
+
+#if LUMA_KERNELS_X86
+    __builtin_cpu_init();
+#endif
+    return is_simd_level_supported(level) ? &kernel_table[level] : NULL;
+}
+
+const struct luma_kernels* active_luma_kernels(void) {
+    if (selected_kernels == NULL)
+        selected_kernels = get_luma_kernels(detect_simd_level());
+    return selected_kernels;
+}
+
+int set_luma_kernels(enum simd_level level) {
+    const struct luma_kernels* kernels = get_luma_kernels(level);
+    if (kernels == NULL)
+        return -1;
+
+    selected_kernels = kernels;
+    return 0;
+}
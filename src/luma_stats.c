@@ -0,0 +1,141 @@
+#include <math.h>
+#include <string.h>
+
+#include "luma_stats.h"
+
+void luma_counts_reset(struct luma_counts* counts) {
+    memset(counts, 0, sizeof(*counts));
+}
+
+void luma_counts_add_row(struct luma_counts* counts, const uint8_t* luma_row, int width) {
+    const int step = LUMA_STATS_SAMPLE_STEP;
+    int x = 0;
+    for (; x + 3 * step < width; x += 4 * step) {
+        counts->histograms[0][luma_row[x]]++;
+        counts->histograms[1][luma_row[x + step]]++;
+        counts->histograms[2][luma_row[x + 2 * step]]++;
+        counts->histograms[3][luma_row[x + 3 * step]]++;
+    }
+    for (; x < width; x += step) {
+        counts->histograms[0][luma_row[x]]++;
+    }
+}
+
+void luma_stats_reset(struct luma_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+void luma_stats_merge(struct luma_stats* stats, const struct luma_counts* counts) {
+    for (int value = 0; value < 256; ++value) {
+        stats->histogram[value] += counts->histograms[0][value] + counts->histograms[1][value] +
+                                   counts->histograms[2][value] + counts->histograms[3][value];
+    }
+}
+
+void luma_stats_finish(struct luma_stats* stats) {
+    uint64_t sum = 0, square_sum = 0;
+    uint32_t sample_count = 0;
+    int min = -1, max = 0;
+    for (int value = 0; value < 256; ++value) {
+        uint32_t count = stats->histogram[value];
+        if (count == 0)
+            continue;
+
+        if (min == -1)
+            min = value;
+        max = value;
+        sample_count += count;
+        sum += (uint64_t) value * count;
+        square_sum += (uint64_t) value * value * count;
+    }
+
+    stats->sample_count = sample_count;
+    stats->min = min == -1 ? 0 : min;
+    stats->max = max;
+    if (sample_count == 0) {
+        stats->mean = 0;
+        stats->variance = 0;
+        return;
+    }
+
+    stats->mean = (double) sum / sample_count;
+    stats->variance = (double) square_sum / sample_count - stats->mean * stats->mean;
+    if (stats->variance < 0)
+        stats->variance = 0;
+}
+
+void compute_luma_stats(const struct image_u8* image, struct luma_stats* stats) {
+    struct luma_counts counts;
+    luma_counts_reset(&counts);
+    for (int y = 0; y < image->height; y += LUMA_STATS_SAMPLE_STEP) {
+        luma_counts_add_row(&counts, &image->buf[y * image->stride], image->width);
+    }
+
+    luma_stats_reset(stats);
+    luma_stats_merge(stats, &counts);
+    luma_stats_finish(stats);
+}
+
+// Stretches below this gain change the image too little to be worth a pass over every row
+#define MIN_CONTRAST_GAIN 1.1
+
+void contrast_stretch_from_stats(const struct luma_stats* stats, double clip_share, double max_gain,
+                                 struct contrast_stretch* stretch) {
+    stretch->enabled = false;
+    stretch->low = 0;
+    stretch->gain = 256;
+    for (int value = 0; value < 256; ++value) {
+        stretch->table[value] = value;
+    }
+    if (stats->sample_count == 0)
+        return;
+
+    uint32_t clipped_count = (uint32_t) (stats->sample_count * clip_share);
+    int low = 0, high = 255;
+    uint32_t count = 0;
+    while (low < 255 && count + stats->histogram[low] <= clipped_count) {
+        count += stats->histogram[low++];
+    }
+    count = 0;
+    while (high > low && count + stats->histogram[high] <= clipped_count) {
+        count += stats->histogram[high--];
+    }
+
+    max_gain = max_gain > 16 ? 16 : max_gain;
+    double gain = high > low ? 255.0 / (high - low) : max_gain;
+    gain = gain > max_gain ? max_gain : gain;
+    if (gain < MIN_CONTRAST_GAIN)
+        return;
+
+    stretch->enabled = true;
+    stretch->low = low;
+    stretch->gain = (uint16_t) ceil(gain * 256);
+    for (int value = 0; value < 256; ++value) {
+        uint32_t stretched = (uint32_t) (value > low ? value - low : 0) * stretch->gain >> 8;
+        stretch->table[value] = stretched > 255 ? 255 : stretched;
+    }
+}
+
+void contrast_stretch_unmap_histogram(const struct contrast_stretch* stretch, uint32_t histogram[256]) {
+    if (!stretch->enabled)
+        return;
+
+    // The stretch only maps several values onto one where it clips. Everything below low becomes 0, so low, the last
+    // of them, stands for 0, and the first value that reaches 255 stands for 255
+    int original[256];
+    for (int value = 0; value < 256; ++value) {
+        original[value] = -1;
+    }
+    for (int value = 0; value < 256; ++value) {
+        uint8_t stretched = stretch->table[value];
+        if (stretched == 0 || original[stretched] == -1)
+            original[stretched] = value;
+    }
+
+    uint32_t unmapped[256] = { 0 };
+    for (int value = 0; value < 256; ++value) {
+        if (histogram[value] > 0)
+            unmapped[original[value] != -1 ? original[value] : value] += histogram[value];
+    }
+    memcpy(histogram, unmapped, sizeof(unmapped));
+}
@@ -1,21 +1,170 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 
 #include "camera.h"
+#include "camera_controls.h"
 #include "helper.h"
 #include "apriltag_detection.h"
-
+#include "frame_conversion.h"
+#include "frame_broker.h"
+#include "capture_manager.h"
+#include "buffer_tuning.h"
+#include "capture_thread.h"
+#include "jpeg_luma.h"
+#include "image_pool.h"
+#include "lens_undistortion.h"
+
+// With more than one device every camera is captured by one capture manager sharing a single detector
+char* CAMERA_DEVICES[] = { "/dev/video0" };
+int CAMERA_COUNT = sizeof(CAMERA_DEVICES) / sizeof(CAMERA_DEVICES[0]);
 int FRAME_WIDTH = 800;
 int FRAME_HEIGHT = 600;
-int NUM_BUFFERS = 20;
+// Buffers requested at startup, the driver may grant a different number
+int NUM_BUFFERS = 4;
+// Grow or shrink the buffer count to the fewest buffers that keep the driver from dropping frames (mmap buffers only)
+int AUTO_TUNE_BUFFERS = 1;
+int MIN_BUFFERS = 2;
+int MAX_BUFFERS = 16;
+// Frames measured before the buffer count is reconsidered
+int BUFFER_TUNING_WINDOW = 90;
+// Factor the detector decimates the image by before searching for quads
+int QUAD_DECIMATE = 2;
+// Decimate while converting and hand the decimated image to the detector, which saves the detector's own decimation
+// pass. Tags are then also decoded on the decimated image instead of the full frame, so fewer small or distant tags
+// decode and corners are only as precise as the decimated pixels. The full frame is still converted for exposure
+// control, so leave this off unless quad search is the bottleneck and tags are large in the image
+int USE_FUSED_DECIMATION = 0;
+// Detect straight on the capture buffers when the camera delivers an 8-bit luma plane (GREY, NV12) instead of copying
+// it, the buffer is then only requeued once detection on it finished
+int USE_ZERO_COPY_LUMA = 1;
+// Frames whose luma values span fewer levels than this are blank (covered lens, lights off) and not searched for tags,
+// 0 searches every frame
+int MIN_FRAME_LUMA_RANGE = 8;
+// Stretch the luma range the previous frame used onto the full range while converting, which lifts tags out of dim
+// scenes. Only frames converted in row bands are stretched, not zero copy or software cropped ones
+int USE_CONTRAST_STRETCH = 1;
+// Share of the darkest and of the brightest pixels clipped by the stretch
+double CONTRAST_CLIP_SHARE = 0.01;
+// Largest stretch, more would mostly amplify sensor noise
+double MAX_CONTRAST_GAIN = 4;
+// Threads of the detector's worker pool, which also converts frames in row bands before detection. 0 uses every core
+int DETECTOR_THREADS = 0;
+// Dequeue and re-queue buffers on a capture thread so driver calls stay off the detection path (not with the frame
+// broker, which re-queues buffers from the main thread)
+int USE_CAPTURE_THREAD = 1;
+int MAX_FRAMES = 10000;
+int FRAME_TIMEOUT_MS = 1000;
+int FRAME_RATE = 30;
+// Capture MJPEG whenever the camera offers it, which fits higher resolutions and frame rates through USB2. Only the
+// luma of the frames is decoded
+int CAPTURE_MJPEG = 0;
+// Search MJPEG frames for quads at 1/8 scale, decoded from the DC coefficient of every JPEG block without an inverse
+// DCT. The cheapest way to turn an MJPEG frame into something to search, but tags must span far more pixels to be found
+int MJPEG_DC_QUAD_SEARCH = 0;
+// Number of processed frames between two frame rate reports
+int FPS_REPORT_INTERVAL = 300;
+// Only this part of the image is captured and searched for tags, a width of 0 uses the whole image
+struct region_of_interest REGION_OF_INTEREST = { 0 };
+// Capture into caller-owned USERPTR buffers carved from one frame arena instead of driver mmap buffers
+int USE_USERPTR_ARENA = 0;
+// Luma images created before capture starts, enough for the frames processed at once. Frames are converted into
+// images of a pool, which only grows past this if more frames are ever in flight
+int IMAGE_POOL_SIZE = 1;
+int USE_HUGEPAGES = 1;
+// Replace the camera's auto exposure with exposure capped to a motion blur budget and gain raised instead
+int USE_EXPOSURE_CONTROL = 1;
+double MAX_BLUR_PIXELS = 1.5;
+double MAX_TAG_SPEED_PIXELS_PER_SECOND = 1000;
+// Correct the corners and center of detected tags for lens distortion, which is what pose estimation needs. Only those
+// 5 points are corrected, from a table built at startup, instead of remapping every frame. The lens model comes from
+// calibrating the camera at FRAME_WIDTH x FRAME_HEIGHT without cropping (ex: with OpenCV's calibrateCamera)
+int USE_LENS_UNDISTORTION = 0;
+struct camera_intrinsics CAMERA_INTRINSICS = { .fx = 800, .fy = 800, .cx = 399.5, .cy = 299.5 };
+struct lens_distortion LENS_DISTORTION = { .k1 = 0, .k2 = 0, .p1 = 0, .p2 = 0, .k3 = 0 };
+// Pixels between the nodes of the undistortion table, its error grows with the square of this. 8 keeps it under a
+// twentieth of a pixel for a webcam lens with strong barrel distortion
+int UNDISTORTION_CELL_SIZE = 8;
+
+struct frame_processing_context {
+    struct buffer* buffers;
+    struct camera_format* camera_format;
+    luma_converter convert_to_luma;
+    // Set when luma_views and region_images are views of the capture buffers, nothing is converted then
+    bool zero_copy;
+    struct image_u8** luma_views;
+    int view_count;
+    // Without zero copy every frame is converted into an image acquired from the pool while the frame is processed
+    struct image_pool* image_pool;
+    // Set when the camera crops to REGION_OF_INTEREST itself
+    bool hardware_crop;
+    // Set when the camera couldn't crop, the region is then cut out during conversion
+    bool crop_in_software;
+    struct region_of_interest region_of_interest;
+    // One view of the region per capture buffer with zero copy, otherwise a single view of the pooled images
+    struct image_u8** region_images;
+    struct image_u8* region_view;
+    // Set when conversion also produces the decimated image the detector searches
+    struct image_u8* decimated_image;
+    int decimation;
+    // Set when decimated_image is decoded from the DC coefficients of MJPEG frames instead of converted
+    bool dc_quad_search;
+    // Statistics of the luma of the frame being processed
+    struct luma_stats luma_stats;
+    int blank_frames;
+    // Set when the corners of detected tags are corrected for lens distortion, it covers the uncropped frame
+    struct undistortion_table* undistortion;
+    // Built from the previous frame's statistics and applied while converting the current one
+    struct contrast_stretch contrast;
+    apriltag_detector_t* apriltag_detector;
+    int socket_fd;
+    struct sockaddr_in* socket_address;
+    int frame_count;
+    int max_frames;
+    int64_t total_latency_us;
+    int64_t max_latency_us;
+    int latency_samples;
+    struct frame_broker* frame_broker;
+    struct exposure_controller* exposure_controller;
+    double configured_fps;
+    struct frame report_start_frame;
+    int report_start_frame_count;
+    struct buffer_count_tuner* buffer_tuner;
+    struct capture_stats* capture_stats;
+    // Set by process_frame when the tuner wants a different buffer count, the capture loop is left to apply it
+    int requested_buffer_count;
+};
+
+struct multi_camera_context {
+    int socket_fd;
+    struct sockaddr_in* socket_address;
+    int frame_count;
+    int max_frames;
+};
 
 int setup_socket(struct sockaddr_in* socket_address, char* server_ip, uint16_t server_port);
+int run_capture_manager(int socket_fd, struct sockaddr_in* socket_address);
+enum capture_action report_detection(int camera_index, const struct frame* frame, int tag_id, void* user_data);
+enum capture_action process_frame(const struct frame* frame, void* user_data);
+void detect_and_report(struct frame_processing_context* context, const struct frame* frame);
+void handle_frame_broker_events(void* user_data);
+void report_frame_rate(struct frame_processing_context* context, const struct frame* frame);
+void correct_tag_corners(struct frame_processing_context* context, struct tag_corners* corners);
+int set_region_of_interest(struct frame_processing_context* context, const struct region_of_interest* region);
+int resize_capture_buffers(struct frame_processing_context* context, struct buffer_queue* buffer_queue,
+                           struct v4l2_requestbuffers** request_buffers);
+int64_t monotonic_now_us(void);
+int capture_and_process(struct buffer_queue* buffer_queue, const struct capture_options* capture_options,
+                        struct frame_processing_context* context, struct capture_stats* capture_stats);
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("Usage: %s <server address> <server port>\\n", argv[0]);
+    if (argc != 3 && argc != 4) {
+        printf("Usage: %s <server address> <server port> [frame broker socket path]\\n", argv[0]);
         return 1;
     }
 
@@ -25,110 +174,727 @@ int main(int argc, char *argv[]) {
     struct sockaddr_in socket_address;
     int socket_fd = setup_socket(&socket_address, server_address, server_port);
 
+    if (CAPTURE_MJPEG)
+        set_preferred_pixel_format(V4L2_PIX_FMT_MJPEG);
+
+    if (CAMERA_COUNT > 1) {
+        return run_capture_manager(socket_fd, &socket_address) == 0 ? 0 : EXIT_FAILURE;
+    }
 
-    int camera_fd = setup_camera("/dev/video0", FRAME_WIDTH, FRAME_HEIGHT);
+    struct camera_format camera_format;
+    int camera_fd = setup_camera(CAMERA_DEVICES[0], FRAME_WIDTH, FRAME_HEIGHT, &camera_format);
 
     if (camera_fd == -1) {
         perror("Error occurred while setting up camera");
         exit(EXIT_FAILURE);
     }
 
-    struct v4l2_requestbuffers* request_buffers = request_mmap_buffers(camera_fd, NUM_BUFFERS);
-
-    if (request_buffers == NULL) {
-        perror("Error while requesting mmap buffers");
+    luma_converter convert_to_luma = select_luma_converter(camera_format.pixelformat);
+    if (convert_to_luma == NULL) {
+        printf("No luma converter for the negotiated pixel format\n");
         exit(EXIT_FAILURE);
     }
 
-    printf("request_mmap_buffers returned %d buffers\n", request_buffers->count);
+    // The lens model only fits the resolution it was calibrated at, so check before cropping changes the format
+    struct undistortion_table* undistortion = NULL;
+    if (USE_LENS_UNDISTORTION) {
+        if (camera_format.width != (uint32_t) FRAME_WIDTH || camera_format.height != (uint32_t) FRAME_HEIGHT) {
+            printf("WARN: The lens was calibrated at %dx%d but the camera delivers %ux%u, tag corners are not "
+                   "corrected for distortion\n", FRAME_WIDTH, FRAME_HEIGHT, camera_format.width, camera_format.height);
+        } else {
+            undistortion = undistortion_table_create(&CAMERA_INTRINSICS, &LENS_DISTORTION, camera_format.width,
+                                                     camera_format.height, UNDISTORTION_CELL_SIZE);
+            if (undistortion == NULL)
+                printf("WARN: Unable to build the undistortion table, tag corners are not corrected for distortion\n");
+        }
+    }
+
+    bool crop_in_software = false;
+    if (REGION_OF_INTEREST.width > 0) {
+        crop_in_software = set_hardware_crop(camera_fd, &camera_format, &REGION_OF_INTEREST) == -1;
+    }
 
-    struct buffer* buffers = map_buffers(camera_fd, request_buffers);
+    struct v4l2_fract frame_interval = { 0 };
+    if (set_frame_rate(camera_fd, &camera_format, FRAME_RATE, &frame_interval) == -1) {
+        printf("WARN: Unable to set the frame rate, using the camera default\n");
+    }
+    double configured_fps = frame_interval_to_fps(frame_interval);
+    printf("Requested %d fps, camera is configured for %.2f fps\n", FRAME_RATE, configured_fps);
+
+    struct exposure_controller* exposure_controller = NULL;
+    if (USE_EXPOSURE_CONTROL) {
+        struct exposure_control_options exposure_options = {
+            .max_exposure_us = motion_blur_exposure_limit_us(MAX_BLUR_PIXELS, MAX_TAG_SPEED_PIXELS_PER_SECOND),
+            .target_luma = 110,
+            .tag_lock_frames = (uint32_t) (configured_fps > 0 ? configured_fps : FRAME_RATE),
+            .update_interval = 3
+        };
+        exposure_controller = exposure_controller_create(camera_fd, &exposure_options);
+        if (exposure_controller == NULL)
+            printf("WARN: Unable to control exposure, using the camera's auto exposure\n");
+    }
 
-    queue_buffers(camera_fd, request_buffers->count);
+    struct frame_arena* frame_arena = NULL;
+    struct v4l2_requestbuffers* request_buffers;
+    struct buffer* buffers;
+
+    if (USE_USERPTR_ARENA) {
+        request_buffers = request_userptr_buffers(camera_fd, NUM_BUFFERS, camera_format.buffer_type);
+        if (request_buffers == NULL) {
+            perror("Error while requesting userptr buffers");
+            exit(EXIT_FAILURE);
+        }
+
+        // Sized for the buffers the driver granted, which may be more than were requested
+        size_t image_length = (camera_format.width + FRAME_ARENA_ALIGNMENT) * camera_format.height;
+        frame_arena = frame_arena_create(request_buffers->count * userptr_buffer_size(&camera_format) +
+                                         IMAGE_POOL_SIZE * image_length, USE_HUGEPAGES);
+
+        if (frame_arena == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        printf("Frame arena of %zu bytes %s hugepages\n", frame_arena->size,
+               frame_arena->uses_hugepages ? "uses" : "does not use");
+
+        buffers = allocate_userptr_buffers(frame_arena, request_buffers, &camera_format);
+    } else {
+        request_buffers = request_mmap_buffers(camera_fd, NUM_BUFFERS, camera_format.buffer_type);
+        if (request_buffers == NULL) {
+            perror("Error while requesting mmap buffers");
+            exit(EXIT_FAILURE);
+        }
+
+        buffers = map_buffers(camera_fd, request_buffers);
+    }
+
+    if (buffers == NULL) {
+        printf("Unable to set up the capture buffers\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Using %d buffers\n", request_buffers->count);
+
+    struct buffer_queue buffer_queue = {
+        .fd = camera_fd,
+        .type = request_buffers->type,
+        .memory = request_buffers->memory,
+        .buffers = buffers,
+        .count = request_buffers->count,
+        .num_planes = camera_format.num_planes
+    };
+
+    int* dmabuf_fds = NULL;
+    struct frame_broker* frame_broker = NULL;
+    if (argc == 4) {
+        // Only driver-allocated mmap buffers can be exported as dmabufs
+        if (frame_arena == NULL)
+            dmabuf_fds = export_buffers(camera_fd, request_buffers);
+        if (dmabuf_fds != NULL)
+            frame_broker = frame_broker_create(argv[3], &buffer_queue, &camera_format, dmabuf_fds);
+
+        if (frame_broker == NULL)
+            printf("WARN: Unable to share frames through %s, continuing without the frame broker\n", argv[3]);
+    }
+
+    queue_buffers(&buffer_queue);
 
     printf("Starting camera stream\n");
-    if (start_stream(camera_fd) == -1) {
+    if (start_stream(camera_fd, camera_format.buffer_type) == -1) {
         perror("Error while starting camera stream");
         exit(EXIT_FAILURE);
     }
 
-    struct image_u8** grayscale_image_buffers = calloc(NUM_BUFFERS, sizeof(struct image_u8*));
-    for (int i = 0; i < NUM_BUFFERS; ++i) {
-        grayscale_image_buffers[i] = image_u8_create(FRAME_WIDTH, FRAME_HEIGHT);
+    int buffer_count = request_buffers->count;
+    bool zero_copy = USE_ZERO_COPY_LUMA && has_luma_plane(camera_format.pixelformat);
+    struct image_u8** luma_views = NULL;
+    if (zero_copy) {
+        luma_views = calloc(buffer_count, sizeof(struct image_u8*));
+        for (int i = 0; i < buffer_count; ++i) {
+            luma_views[i] = create_luma_view(&buffers[i], &camera_format, NULL);
+            if (luma_views[i] == NULL) {
+                printf("Unable to create the luma view of buffer %d\n", i);
+                exit(EXIT_FAILURE);
+            }
+        }
+        printf("Detecting on the capture buffers without copying them\n");
     }
 
     apriltag_family_t *apriltag_family = tag16h5_create();
     apriltag_detector_t *apriltag_detector = apriltag_detector_create();
     apriltag_detector_add_family(apriltag_detector, apriltag_family);
+    apriltag_detector->quad_decimate = QUAD_DECIMATE;
+    apriltag_detector->nthreads = DETECTOR_THREADS > 0 ? DETECTOR_THREADS : workerpool_get_nprocs();
+
+    struct image_u8* decimated_image = NULL;
+    int decimation = QUAD_DECIMATE;
+    bool dc_quad_search = MJPEG_DC_QUAD_SEARCH && camera_format.pixelformat == V4L2_PIX_FMT_MJPEG && !crop_in_software;
+    if (dc_quad_search) {
+        decimation = JPEG_BLOCK_SIZE;
+        decimated_image = image_u8_create(decimated_size(camera_format.width, decimation),
+                                          decimated_size(camera_format.height, decimation));
+        printf("Searching for quads in the 1/%d scale DC image of the MJPEG frames\n", decimation);
+    } else if (USE_FUSED_DECIMATION && !zero_copy && QUAD_DECIMATE >= 2 && QUAD_DECIMATE <= 4 &&
+               camera_format.pixelformat != V4L2_PIX_FMT_MJPEG) {
+        // Nothing is converted with zero copy, so there is no pass to decimate in and the detector decimates itself
+        decimated_image = image_u8_create(decimated_size(camera_format.width, decimation),
+                                          decimated_size(camera_format.height, decimation));
+    }
 
-    char* filename = (char*) malloc(sizeof(char) * 128);
-    const char* filename_format = "build/output_%d.ppm";
-    unsigned char udp_data[2] = { 0, 0};
+    // Nothing is converted at full resolution with zero copy or a DC image search, the pool then stays empty
+    struct image_pool* image_pool = image_pool_create(camera_format.width, camera_format.height,
+                                                      zero_copy || dc_quad_search ? 0 : IMAGE_POOL_SIZE, frame_arena);
+    if (image_pool == NULL) {
+        printf("Unable to create the luma images\n");
+        exit(EXIT_FAILURE);
+    }
 
-    for (int i = 0; i < 10000; ++i) {
-        int buffer_index = dequeue_buffer(camera_fd);
-        while (buffer_index == -1) {
-            printf("Received -1 response from de-queuing buffer\n");
-            usleep(100000);
-            buffer_index = dequeue_buffer(camera_fd);
-        }
+    struct frame_processing_context context = {
+        .buffers = buffers,
+        .camera_format = &camera_format,
+        .convert_to_luma = convert_to_luma,
+        .zero_copy = zero_copy,
+        .luma_views = luma_views,
+        .view_count = zero_copy ? buffer_count : 0,
+        .image_pool = image_pool,
+        .hardware_crop = REGION_OF_INTEREST.width > 0 && !crop_in_software,
+        .crop_in_software = false,
+        .region_images = NULL,
+        .region_view = NULL,
+        .decimated_image = decimated_image,
+        .decimation = decimation,
+        .dc_quad_search = dc_quad_search,
+        .blank_frames = 0,
+        .undistortion = undistortion,
+        .apriltag_detector = apriltag_detector,
+        .socket_fd = socket_fd,
+        .socket_address = &socket_address,
+        .frame_count = 0,
+        .max_frames = MAX_FRAMES,
+        .total_latency_us = 0,
+        .max_latency_us = 0,
+        .latency_samples = 0,
+        .frame_broker = frame_broker,
+        .exposure_controller = exposure_controller,
+        .configured_fps = configured_fps,
+        .report_start_frame_count = 0,
+        .buffer_tuner = NULL,
+        .capture_stats = NULL,
+        .requested_buffer_count = 0
+    };
+
+    if (crop_in_software && set_region_of_interest(&context, &REGION_OF_INTEREST) == -1) {
+        printf("WARN: Unable to crop to the region of interest, using the whole image\n");
+    }
 
-#if DEBUG
-        printf("Dequeued buffer with index: %d\n", buffer_index);
-#endif
-        prepare_frame_for_processing(&buffers[buffer_index], grayscale_image_buffers[buffer_index]);
-        snprintf(filename, sizeof(char) * 128, filename_format, i % 20);
+    struct capture_options capture_options = {
+        .timeout_ms = FRAME_TIMEOUT_MS,
+        .mode = CAPTURE_LATEST_FRAME,
+        // Compressed frames vary in size, so only raw formats can be checked for short frames
+        .min_bytesused = camera_format.pixelformat == V4L2_PIX_FMT_MJPEG ? 0 : camera_format.sizeimage,
+        .auxiliary_fd = frame_broker != NULL ? frame_broker_fd(frame_broker) : -1,
+        .auxiliary_handler = frame_broker != NULL ? handle_frame_broker_events : NULL
+    };
+    struct capture_stats capture_stats = { 0 };
+    context.capture_stats = &capture_stats;
+
+    // Resizing re-requests the buffers, which would invalidate arena carving and exported dmabufs
+    struct buffer_count_tuner buffer_tuner;
+    if (AUTO_TUNE_BUFFERS && frame_arena == NULL && frame_broker == NULL) {
+        double fps = configured_fps > 0 ? configured_fps : FRAME_RATE;
+        buffer_count_tuner_init(&buffer_tuner, 1e6 / fps, buffer_count, MIN_BUFFERS, MAX_BUFFERS,
+                                BUFFER_TUNING_WINDOW);
+        context.buffer_tuner = &buffer_tuner;
+    }
 
-#if DEBUG
-        write_grayscale_image_to_file(filename, grayscale_image_buffers[buffer_index]);
-#endif
+    int capture_result;
+    while ((capture_result = capture_and_process(&buffer_queue, &capture_options, &context, &capture_stats)) == 0 &&
+           context.requested_buffer_count > 0) {
+        if (resize_capture_buffers(&context, &buffer_queue, &request_buffers) == -1) {
+            printf("Unable to resize the capture buffers\n");
+            capture_result = -1;
+            break;
+        }
+    }
 
-        int detected_apriltag_id = detect_april_tag(
-        grayscale_image_buffers[buffer_index],
-        apriltag_detector
-        );
+    if (capture_result == -1) {
+        printf("Capture loop ended because of a device error\n");
+    }
 
-        if (detected_apriltag_id == -1) {
-            printf("No april tag detected\n");
-            udp_data[0] = 0;
-            udp_data[1] = 0;
-            sendto(socket_fd, udp_data, sizeof(udp_data), 0, (const struct sockaddr*) &socket_address, sizeof(socket_address));
+    printf("Processed %lu frames, skipped %lu stale frames, rejected %lu bad frames, driver dropped %lu frames\n",
+           capture_stats.frames_processed, capture_stats.frames_skipped,
+           capture_stats.frames_rejected, capture_stats.frames_dropped);
 
-        } else {
-            printf("Detected april tag with ID: %d\n", detected_apriltag_id);
-            udp_data[0] = detected_apriltag_id;
-            udp_data[1] = 1;
-            sendto(socket_fd, udp_data, sizeof(udp_data), 0, (const struct sockaddr*) &socket_address, sizeof(socket_address));
-        }
+    if (context.blank_frames > 0) {
+        printf("Skipped detection on %d blank frames\n", context.blank_frames);
+    }
 
-        while (requeue_buffer(camera_fd, buffer_index) == -1) {
-            printf("WARN: Unable to requeue buffer with index %d\n", buffer_index);
-            usleep(100000);
-        }
+    if (context.latency_samples > 0) {
+        printf("Capture to UDP latency: average %lld us, max %lld us\n",
+               (long long) (context.total_latency_us / context.latency_samples),
+               (long long) context.max_latency_us);
+    }
 
-#if DEBUG
-        printf("re-queued buffer with index %d\n", buffer_index);
-#endif
+    if (image_pool->image_count > 0) {
+        printf("Converted frames into %d pooled luma images, at most %d were in use at once\n",
+               image_pool->image_count, image_pool->high_water_mark);
+    }
 
-        usleep(50000);
+    if (buffer_queue.buffers == NULL) {
+        exit(EXIT_FAILURE);
     }
 
-    if (stop_stream(camera_fd) == -1) {
+    if (stop_stream(camera_fd, camera_format.buffer_type) == -1) {
         printf("Error while stopping camera stream");
         exit(EXIT_FAILURE);
     }
 
-    for (int i = 0; i < request_buffers->count; ++i) {
-        free(grayscale_image_buffers[i]);
+    set_region_of_interest(&context, NULL);
+    if (decimated_image != NULL)
+        image_u8_destroy(decimated_image);
+    if (exposure_controller != NULL)
+        exposure_controller_destroy(exposure_controller);
+    for (int i = 0; i < context.view_count; ++i) {
+        free(context.luma_views[i]);
+    }
+    free(context.luma_views);
+    image_pool_destroy(image_pool);
+    if (undistortion != NULL)
+        undistortion_table_destroy(undistortion);
+    if (frame_broker != NULL)
+        frame_broker_destroy(frame_broker);
+    if (dmabuf_fds != NULL)
+        close_exported_buffers(dmabuf_fds, request_buffers->count);
+    if (frame_arena != NULL) {
+        free(buffers);
+        frame_arena_destroy(frame_arena);
+    } else {
+        cleanup_buffers(buffer_queue.buffers, buffer_queue.count);
     }
-    free(grayscale_image_buffers);
-    cleanup_buffers(buffers, request_buffers->count);
     free(request_buffers);
     close(camera_fd);
 
     return 0;
 }
 
+enum capture_action process_frame(const struct frame* frame, void* user_data) {
+    struct frame_processing_context* context = (struct frame_processing_context*) user_data;
+
+    // Hand the buffer to the other local consumers first so they work on it while we detect
+    if (context->frame_broker != NULL)
+        frame_broker_publish(context->frame_broker, frame);
+
+    int64_t processing_start_us = monotonic_now_us();
+    detect_and_report(context, frame);
+    report_frame_rate(context, frame);
+
+    context->frame_count++;
+    bool is_last_frame = context->frame_count >= context->max_frames;
+
+    if (context->frame_broker != NULL) {
+        // The broker re-queues the buffer once every consumer returned it, even after the last frame
+        frame_broker_release(context->frame_broker, frame->index);
+        return is_last_frame ? CAPTURE_STOP_HOLD : CAPTURE_HOLD;
+    }
+
+    if (is_last_frame)
+        return CAPTURE_STOP;
+
+    if (context->buffer_tuner != NULL) {
+        int buffer_count = buffer_count_tuner_record(context->buffer_tuner, monotonic_now_us() - processing_start_us,
+                                                     context->capture_stats->frames_dropped);
+        if (buffer_count > 0) {
+            context->requested_buffer_count = buffer_count;
+            return CAPTURE_STOP;
+        }
+    }
+
+    return CAPTURE_CONTINUE;
+}
+
+static void read_capture_thread_stats(struct capture_thread* capture_thread, const struct capture_stats* start_stats,
+                                      struct capture_stats* capture_stats) {
+    struct capture_stats thread_stats;
+    capture_thread_get_stats(capture_thread, &thread_stats);
+    capture_stats->frames_processed = start_stats->frames_processed + thread_stats.frames_processed;
+    capture_stats->frames_skipped = start_stats->frames_skipped + thread_stats.frames_skipped;
+    capture_stats->frames_rejected = start_stats->frames_rejected + thread_stats.frames_rejected;
+    capture_stats->frames_dropped = start_stats->frames_dropped + thread_stats.frames_dropped;
+}
+
+/**
+ * Runs process_frame on every captured frame until it stops, on a capture thread if enabled. The counters keep
+ * accumulating across calls
+ */
+int capture_and_process(struct buffer_queue* buffer_queue, const struct capture_options* capture_options,
+                        struct frame_processing_context* context, struct capture_stats* capture_stats) {
+    if (!USE_CAPTURE_THREAD || context->frame_broker != NULL)
+        return capture_frames(buffer_queue, capture_options, process_frame, context, capture_stats);
+
+    struct capture_thread* capture_thread = capture_thread_start(buffer_queue, capture_options);
+    if (capture_thread == NULL)
+        return -1;
+
+    struct capture_stats start_stats = *capture_stats;
+    int result = 0;
+    while (true) {
+        struct frame frame;
+        int next_result = capture_thread_next_frame(capture_thread, &frame, capture_options->timeout_ms);
+        if (next_result == -EAGAIN)
+            continue;
+        if (next_result < 0) {
+            result = -1;
+            break;
+        }
+
+        read_capture_thread_stats(capture_thread, &start_stats, capture_stats);
+        enum capture_action action = process_frame(&frame, context);
+        capture_thread_release_frame(capture_thread, frame.index);
+        if (action == CAPTURE_STOP)
+            break;
+    }
+
+    read_capture_thread_stats(capture_thread, &start_stats, capture_stats);
+    capture_thread_stop(capture_thread);
+    return result;
+}
+
+int64_t monotonic_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Swaps the capture buffers for context->requested_buffer_count buffers along with the zero copy views of them.
+ * Only used with driver-allocated mmap buffers
+ */
+int resize_capture_buffers(struct frame_processing_context* context, struct buffer_queue* buffer_queue,
+                           struct v4l2_requestbuffers** request_buffers) {
+    int buffer_count = context->requested_buffer_count;
+    context->requested_buffer_count = 0;
+
+    bool crop_in_software = context->crop_in_software;
+    struct region_of_interest region = context->region_of_interest;
+    set_region_of_interest(context, NULL);
+    for (int i = 0; i < context->view_count; ++i) {
+        free(context->luma_views[i]);
+    }
+    free(context->luma_views);
+    context->luma_views = NULL;
+    context->view_count = 0;
+
+    struct v4l2_requestbuffers* new_request_buffers = resize_buffer_queue(buffer_queue, buffer_count);
+    if (new_request_buffers == NULL)
+        return -1;
+    free(*request_buffers);
+    *request_buffers = new_request_buffers;
+    printf("Switched from %d to %d buffers\n", context->buffer_tuner->count, new_request_buffers->count);
+
+    context->buffers = buffer_queue->buffers;
+    // Pooled images don't belong to any buffer, only the views follow the buffers
+    if (context->zero_copy) {
+        context->view_count = new_request_buffers->count;
+        context->luma_views = calloc(context->view_count, sizeof(struct image_u8*));
+        for (int i = 0; i < context->view_count; ++i) {
+            context->luma_views[i] = create_luma_view(&context->buffers[i], context->camera_format, NULL);
+            if (context->luma_views[i] == NULL)
+                return -1;
+        }
+    }
+    if (crop_in_software)
+        set_region_of_interest(context, &region);
+
+    // Drivers restart the sequence numbers with the stream, the jump must not be counted as drops
+    context->capture_stats->has_sequence = false;
+    context->report_start_frame_count = -1;
+    buffer_count_tuner_resized(context->buffer_tuner, new_request_buffers->count,
+                               context->capture_stats->frames_dropped);
+    return 0;
+}
+
+void handle_frame_broker_events(void* user_data) {
+    struct frame_processing_context* context = (struct frame_processing_context*) user_data;
+    frame_broker_handle_events(context->frame_broker);
+}
+
+void report_frame_rate(struct frame_processing_context* context, const struct frame* frame) {
+    // A negative start count marks a restarted stream whose sequence numbers can't be compared with the old ones
+    if (context->frame_count == 0 || context->report_start_frame_count < 0) {
+        context->report_start_frame = *frame;
+        context->report_start_frame_count = context->frame_count;
+        return;
+    }
+
+    int processed_frames = context->frame_count - context->report_start_frame_count;
+    if (processed_frames < FPS_REPORT_INTERVAL)
+        return;
+
+    // Driver timestamps and sequence numbers measure what the camera delivered, independent of our processing
+    struct frame* start = &context->report_start_frame;
+    double elapsed_seconds = (frame->timestamp.tv_sec - start->timestamp.tv_sec) +
+                             (frame->timestamp.tv_usec - start->timestamp.tv_usec) / 1e6;
+
+    if (elapsed_seconds > 0) {
+        double delivered_fps = (frame->sequence - start->sequence) / elapsed_seconds;
+        double processed_fps = processed_frames / elapsed_seconds;
+        printf("Frame rate [requested: %d, configured: %.2f, delivered: %.2f, processed: %.2f]%s\n",
+               FRAME_RATE, context->configured_fps, delivered_fps, processed_fps,
+               processed_fps < delivered_fps * 0.95 ? " - processing can't keep up" : "");
+    }
+
+    context->report_start_frame = *frame;
+    context->report_start_frame_count = context->frame_count;
+}
+
+/**
+ * Moves the corners of a tag from the searched image into the uncropped frame the lens was calibrated on and removes
+ * the lens distortion from them
+ */
+void correct_tag_corners(struct frame_processing_context* context, struct tag_corners* corners) {
+    uint32_t left = 0, top = 0;
+    if (context->crop_in_software) {
+        left = context->region_of_interest.left;
+        top = context->region_of_interest.top;
+    } else if (context->hardware_crop) {
+        left = REGION_OF_INTEREST.left;
+        top = REGION_OF_INTEREST.top;
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        corners->corners[i][0] += left;
+        corners->corners[i][1] += top;
+    }
+    corners->center[0] += left;
+    corners->center[1] += top;
+    undistort_tag_corners(context->undistortion, corners);
+}
+
+/**
+ * Switches software cropping to a new region between two frames, the stream keeps running.
+ * Passing NULL turns software cropping off
+ */
+int set_region_of_interest(struct frame_processing_context* context, const struct region_of_interest* region) {
+    if (context->region_images != NULL) {
+        for (int i = 0; i < context->view_count; ++i) {
+            free(context->region_images[i]);
+        }
+        free(context->region_images);
+        context->region_images = NULL;
+    }
+    free(context->region_view);
+    context->region_view = NULL;
+    context->crop_in_software = false;
+
+    if (region == NULL)
+        return 0;
+
+    if (region->left + region->width > context->camera_format->width ||
+        region->top + region->height > context->camera_format->height) {
+        return -1;
+    }
+
+    if (context->zero_copy) {
+        // With zero copy the region is a view into every capture buffer at the region's offset
+        context->region_images = calloc(context->view_count, sizeof(struct image_u8*));
+        for (int i = 0; i < context->view_count; ++i) {
+            context->region_images[i] = create_luma_view(&context->buffers[i], context->camera_format, region);
+        }
+    } else {
+        // Pooled images share their size and stride, so one view serves whichever of them a frame is converted into
+        struct image_u8* image = image_pool_acquire(context->image_pool);
+        if (image == NULL)
+            return -1;
+        context->region_view = create_image_view(image, region);
+        image_pool_release(context->image_pool, image);
+    }
+
+    context->region_of_interest = *region;
+    context->crop_in_software = true;
+    return 0;
+}
+
+void detect_and_report(struct frame_processing_context* context, const struct frame* frame) {
+    int buffer_index = frame->index;
+    struct image_u8* grayscale_image;
+    // Acquired for conversions and released once the frame no longer needs it
+    struct image_u8* pooled_image = NULL;
+    int conversion_result;
+
+    if (context->zero_copy) {
+        // The image is a view of the buffer, which stays dequeued until processing of the frame returns
+        grayscale_image = context->crop_in_software ? context->region_images[buffer_index]
+                                                    : context->luma_views[buffer_index];
+        conversion_result = 0;
+    } else if (context->crop_in_software) {
+        // The region is converted into the top left corner of the pooled image
+        pooled_image = image_pool_acquire(context->image_pool);
+        if (pooled_image == NULL)
+            return;
+        context->region_view->buf = pooled_image->buf;
+        grayscale_image = context->region_view;
+        conversion_result = convert_region_to_luma(context->convert_to_luma, context->buffers[buffer_index].start,
+                                                   frame->bytesused, context->camera_format,
+                                                   &context->region_of_interest, grayscale_image);
+    } else if (context->dc_quad_search) {
+        // The DC image is all there is of the frame, statistics and exposure work on it as well
+        grayscale_image = context->decimated_image;
+        conversion_result = convert_mjpeg_to_dc_luma(context->buffers[buffer_index].start, frame->bytesused,
+                                                     context->camera_format, grayscale_image);
+    } else {
+        // Without a decimated image this is a plain conversion, split across the detector's threads either way
+        pooled_image = image_pool_acquire(context->image_pool);
+        if (pooled_image == NULL)
+            return;
+        grayscale_image = pooled_image;
+        conversion_result = convert_to_luma_in_bands(detector_workerpool(context->apriltag_detector),
+                                                     context->convert_to_luma, context->buffers[buffer_index].start,
+                                                     frame->bytesused, context->camera_format, grayscale_image,
+                                                     context->decimated_image, context->decimation,
+                                                     &context->luma_stats, &context->contrast);
+    }
+    unsigned char udp_data[2] = { 0, 0 };
+
+#if DEBUG
+    printf("Dequeued buffer with index: %d, sequence: %u\n", buffer_index, frame->sequence);
+#endif
+    if (conversion_result == -1) {
+        image_pool_release(context->image_pool, pooled_image);
+        return;
+    }
+
+    // Only a banded conversion counts the frame while converting it, the other paths take a pass of their own
+    bool converted_in_bands = !context->zero_copy && !context->crop_in_software && !context->dc_quad_search;
+    if (!converted_in_bands)
+        compute_luma_stats(grayscale_image, &context->luma_stats);
+    const struct luma_stats* luma_stats = &context->luma_stats;
+    // The stretch only ran when this frame went through the banded conversion
+    const struct contrast_stretch* applied_contrast = converted_in_bands ? &context->contrast : NULL;
+
+#if DEBUG
+    printf("Luma min: %u, max: %u, mean: %.1f, standard deviation: %.1f\n", luma_stats->min, luma_stats->max,
+           luma_stats->mean, sqrt(luma_stats->variance));
+    if (applied_contrast != NULL && applied_contrast->enabled)
+        printf("Contrast stretched from %u with gain %.2f\n", applied_contrast->low, applied_contrast->gain / 256.0);
+    char filename[128];
+    snprintf(filename, sizeof(filename), "build/output_%d.ppm", context->frame_count % 20);
+    write_grayscale_image_to_file(filename, grayscale_image);
+#endif
+
+    struct region_of_interest tag_bounds;
+    struct tag_corners tag_corners;
+    // Corners are only worth reporting once they can be corrected
+    struct tag_corners* wanted_corners = context->undistortion != NULL ? &tag_corners : NULL;
+    int detected_apriltag_id;
+    if (luma_stats->max - luma_stats->min < MIN_FRAME_LUMA_RANGE) {
+        // Nothing to find in a frame without contrast, exposure control below still runs to bring the image back
+        detected_apriltag_id = -1;
+        context->blank_frames++;
+    } else if (context->decimated_image != NULL && !context->crop_in_software) {
+        detected_apriltag_id = detect_april_tag_in_decimated(context->decimated_image, context->decimation,
+                                                             context->camera_format->width,
+                                                             context->camera_format->height,
+                                                             context->apriltag_detector, &tag_bounds,
+                                                             wanted_corners);
+    } else {
+        detected_apriltag_id = detect_april_tag_with_bounds(grayscale_image, context->apriltag_detector, &tag_bounds,
+                                                            wanted_corners);
+    }
+    if (detected_apriltag_id != -1 && wanted_corners != NULL)
+        correct_tag_corners(context, wanted_corners);
+
+    if (context->exposure_controller != NULL) {
+        // Keep exposing for the tag while it is in view rather than for whatever surrounds it
+        if (detected_apriltag_id != -1) {
+            // The bounds are in full resolution coordinates, the DC image is all exposure control gets to sample
+            if (context->dc_quad_search) {
+                tag_bounds.left /= context->decimation;
+                tag_bounds.top /= context->decimation;
+                tag_bounds.width = decimated_size(tag_bounds.width, context->decimation);
+                tag_bounds.height = decimated_size(tag_bounds.height, context->decimation);
+            }
+            exposure_controller_lock_region(context->exposure_controller, &tag_bounds);
+        }
+        exposure_controller_update(context->exposure_controller, grayscale_image, luma_stats, applied_contrast);
+    }
+    // Nothing below looks at the image anymore, the next frame can have it
+    image_pool_release(context->image_pool, pooled_image);
+
+    // Statistics count the luma before the stretch, so the next stretch doesn't build on this one
+    if (USE_CONTRAST_STRETCH)
+        contrast_stretch_from_stats(luma_stats, CONTRAST_CLIP_SHARE, MAX_CONTRAST_GAIN, &context->contrast);
+
+    if (detected_apriltag_id == -1) {
+        printf("No april tag detected\n");
+        udp_data[0] = 0;
+        udp_data[1] = 0;
+    } else {
+        if (wanted_corners != NULL)
+            printf("Detected april tag with ID: %d centered at (%.1f, %.1f)\n", detected_apriltag_id,
+                   wanted_corners->center[0], wanted_corners->center[1]);
+        else
+            printf("Detected april tag with ID: %d\n", detected_apriltag_id);
+        udp_data[0] = detected_apriltag_id;
+        udp_data[1] = 1;
+    }
+    sendto(context->socket_fd, udp_data, sizeof(udp_data), 0,
+           (const struct sockaddr*) context->socket_address, sizeof(*context->socket_address));
+
+    int64_t latency_us = frame_age_us(frame);
+    if (latency_us >= 0) {
+        context->total_latency_us += latency_us;
+        context->latency_samples++;
+        if (latency_us > context->max_latency_us)
+            context->max_latency_us = latency_us;
+    }
+}
+
+int run_capture_manager(int socket_fd, struct sockaddr_in* socket_address) {
+    apriltag_family_t *apriltag_family = tag16h5_create();
+    apriltag_detector_t *apriltag_detector = apriltag_detector_create();
+    apriltag_detector_add_family(apriltag_detector, apriltag_family);
+    apriltag_detector->nthreads = workerpool_get_nprocs();
+
+    struct capture_manager* manager = capture_manager_create(CAMERA_DEVICES, CAMERA_COUNT, FRAME_WIDTH, FRAME_HEIGHT,
+                                                             FRAME_RATE, NUM_BUFFERS, apriltag_detector);
+    if (manager == NULL) {
+        apriltag_detector_destroy(apriltag_detector);
+        tag16h5_destroy(apriltag_family);
+        return -1;
+    }
+
+    struct multi_camera_context context = {
+        .socket_fd = socket_fd,
+        .socket_address = socket_address,
+        .frame_count = 0,
+        .max_frames = MAX_FRAMES
+    };
+
+    int result = capture_manager_run(manager, FRAME_TIMEOUT_MS, report_detection, &context);
+    capture_manager_print_stats(manager);
+
+    capture_manager_destroy(manager);
+    apriltag_detector_destroy(apriltag_detector);
+    tag16h5_destroy(apriltag_family);
+    return result;
+}
+
+enum capture_action report_detection(int camera_index, const struct frame* frame, int tag_id, void* user_data) {
+    struct multi_camera_context* context = (struct multi_camera_context*) user_data;
+
+    // Same layout as the single camera packet with the camera index appended
+    unsigned char udp_data[3] = { 0, 0, camera_index };
+    if (tag_id != -1) {
+        printf("Camera %d detected april tag with ID: %d\n", camera_index, tag_id);
+        udp_data[0] = tag_id;
+        udp_data[1] = 1;
+    }
+    sendto(context->socket_fd, udp_data, sizeof(udp_data), 0,
+           (const struct sockaddr*) context->socket_address, sizeof(*context->socket_address));
+
+    context->frame_count++;
+    return context->frame_count < context->max_frames ? CAPTURE_CONTINUE : CAPTURE_STOP;
+}
+
 int setup_socket(struct sockaddr_in* socket_address, char* server_ip, uint16_t server_port) {
     int socket_fd;
     if ((socket_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
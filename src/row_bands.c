@@ -0,0 +1,57 @@
+#include <stdlib.h>
+
+#include "row_bands.h"
+
+/**
+ * Arguments of one band task, workerpool tasks only get a single pointer
+ */
+struct row_band {
+    row_band_function function;
+    void* user_data;
+    int first_row;
+    int end_row;
+};
+
+static void run_row_band(void* p) {
+    struct row_band* band = p;
+    band->function(band->user_data, band->first_row, band->end_row);
+}
+
+int row_band_height(size_t bytes_per_row, int row_alignment) {
+    if (row_alignment < 1)
+        row_alignment = 1;
+
+    size_t rows = bytes_per_row == 0 ? ROW_BAND_CACHE_BYTES : ROW_BAND_CACHE_BYTES / bytes_per_row;
+    rows -= rows % row_alignment;
+    return rows < row_alignment ? row_alignment : (int) rows;
+}
+
+void run_in_row_bands(workerpool_t* wp, int height, int band_rows, row_band_function function, void* user_data) {
+    if (height <= 0)
+        return;
+
+    if (band_rows < 1)
+        band_rows = 1;
+
+    int band_count = (height + band_rows - 1) / band_rows;
+    if (wp == NULL || workerpool_get_nthreads(wp) <= 1 || band_count == 1) {
+        function(user_data, 0, height);
+        return;
+    }
+
+    struct row_band* bands = malloc(band_count * sizeof(*bands));
+    if (bands == NULL) {
+        function(user_data, 0, height);
+        return;
+    }
+
+    for (int i = 0; i < band_count; ++i) {
+        bands[i].function = function;
+        bands[i].user_data = user_data;
+        bands[i].first_row = i * band_rows;
+        bands[i].end_row = i == band_count - 1 ? height : (i + 1) * band_rows;
+        workerpool_add_task(wp, run_row_band, &bands[i]);
+    }
+    workerpool_run(wp);
+    free(bands);
+}
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_ring.h"
+
+struct spsc_ring* spsc_ring_create(size_t minimum_capacity, size_t element_size) {
+    size_t capacity = 2;
+    while (capacity < minimum_capacity) {
+        capacity *= 2;
+    }
+
+    struct spsc_ring* ring = aligned_alloc(SPSC_RING_CACHE_LINE, sizeof(struct spsc_ring));
+    if (ring == NULL)
+        return NULL;
+
+    ring->slots = malloc(capacity * element_size);
+    if (ring->slots == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->mask = capacity - 1;
+    ring->element_size = element_size;
+    return ring;
+}
+
+void spsc_ring_destroy(struct spsc_ring* ring) {
+    free(ring->slots);
+    free(ring);
+}
+
+bool spsc_ring_push(struct spsc_ring* ring, const void* element) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head > ring->mask)
+        return false;
+
+    memcpy(ring->slots + (tail & ring->mask) * ring->element_size, element, ring->element_size);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool spsc_ring_pop(struct spsc_ring* ring, void* element) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == tail)
+        return false;
+
+    memcpy(element, ring->slots + (head & ring->mask) * ring->element_size, ring->element_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool spsc_ring_is_empty(struct spsc_ring* ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) ==
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
@@ -1,6 +1,10 @@
+#include <string.h>
 #include "unity.h"
 #include "apriltag/common/image_types.h"
+#include "apriltag/common/image_u8.h"
 #include "apriltag_detection.h"
+#include "frame_conversion.h"
+#include "row_bands.h"
 
 void setUp() {
 
@@ -10,23 +14,247 @@ void tearDown() {
 
 }
 
-void test_process_frame_for_apriltags() {
+void test_convert_yuyv_to_luma() {
     struct image_u8* image = image_u8_create(60, 2);
-    struct buffer* buffer = (struct buffer*)  malloc(sizeof(struct buffer));
-    buffer->length = 60 * 2 * 2;
-    buffer->start = malloc(sizeof(uint8_t) * buffer->length);
-    uint8_t* yuyv_buffer = buffer->start;
-    for (int i = 0; i < buffer->length; i += 4) {
+    struct camera_format format = {
+        .pixelformat = V4L2_PIX_FMT_YUYV,
+        .width = 60,
+        .height = 2,
+        .bytesperline = 60 * 2,
+        .sizeimage = 60 * 2 * 2
+    };
+    uint8_t* yuyv_buffer = malloc(sizeof(uint8_t) * format.sizeimage);
+    for (int i = 0; i < format.sizeimage; i += 4) {
         yuyv_buffer[i] = 0x11;
         yuyv_buffer[i+1] = 0xBB;
         yuyv_buffer[i+2] = 0x22;
         yuyv_buffer[i+3] = 0xAA;
     }
-    process_frame_for_apriltags(buffer, image);
+
+    TEST_ASSERT_EQUAL_INT(0, convert_yuyv_to_luma(yuyv_buffer, format.sizeimage, &format, image));
+    for (int y = 0; y < image->height; ++y) {
+        for (int x = 0; x < image->width; x += 2) {
+            TEST_ASSERT_EQUAL_UINT8(0x11, image->buf[y * image->stride + x]);
+            TEST_ASSERT_EQUAL_UINT8(0x22, image->buf[y * image->stride + x + 1]);
+        }
+    }
+
+    free(yuyv_buffer);
+    image_u8_destroy(image);
+}
+
+void test_convert_region_to_luma() {
+    struct camera_format format = {
+        .pixelformat = V4L2_PIX_FMT_YUYV,
+        .width = 8,
+        .height = 4,
+        .bytesperline = 8 * 2,
+        .sizeimage = 8 * 4 * 2
+    };
+    uint8_t yuyv_buffer[8 * 4 * 2];
+    for (int y = 0; y < format.height; ++y) {
+        for (int x = 0; x < format.width; ++x) {
+            yuyv_buffer[y * format.bytesperline + x * 2] = y * 16 + x;
+            yuyv_buffer[y * format.bytesperline + x * 2 + 1] = 0x80;
+        }
+    }
+
+    struct image_u8* image = image_u8_create(format.width, format.height);
+    struct region_of_interest region = { .left = 3, .top = 1, .width = 4, .height = 2 };
+    struct image_u8* view = create_image_view(image, &region);
+
+    TEST_ASSERT_EQUAL_INT(0, convert_region_to_luma(convert_yuyv_to_luma, yuyv_buffer, format.sizeimage, &format,
+                                                    &region, view));
+    for (int y = 0; y < region.height; ++y) {
+        for (int x = 0; x < region.width; ++x) {
+            TEST_ASSERT_EQUAL_UINT8((region.top + y) * 16 + region.left + x, view->buf[y * view->stride + x]);
+        }
+    }
+
+    region.left = 6;
+    TEST_ASSERT_EQUAL_INT(-1, convert_region_to_luma(convert_yuyv_to_luma, yuyv_buffer, format.sizeimage, &format,
+                                                     &region, view));
+
+    free(view);
+    image_u8_destroy(image);
+}
+
+void test_convert_to_luma_and_decimate_matches_image_u8_decimate() {
+    // Odd sizes so the last decimated row and column come from partial blocks
+    struct camera_format format = {
+        .pixelformat = V4L2_PIX_FMT_UYVY,
+        .width = 67,
+        .height = 29,
+        .bytesperline = 67 * 2 + 10
+    };
+    format.sizeimage = format.bytesperline * format.height;
+    uint8_t* uyvy_buffer = malloc(format.sizeimage);
+    for (int i = 0; i < format.sizeimage; ++i) {
+        uyvy_buffer[i] = (uint8_t) (i * 13 + i / 7);
+    }
+
+    struct image_u8* image = image_u8_create(format.width, format.height);
+    for (int decimation = 2; decimation <= 4; ++decimation) {
+        struct image_u8* decimated = image_u8_create(decimated_size(format.width, decimation),
+                                                     decimated_size(format.height, decimation));
+        TEST_ASSERT_EQUAL_INT(0, convert_to_luma_and_decimate(convert_uyvy_to_luma, uyvy_buffer, format.sizeimage,
+                                                              &format, image, decimated, decimation));
+
+        struct image_u8* expected = image_u8_decimate(image, decimation);
+        TEST_ASSERT_EQUAL_INT(expected->width, decimated->width);
+        TEST_ASSERT_EQUAL_INT(expected->height, decimated->height);
+        for (int y = 0; y < expected->height; ++y) {
+            TEST_ASSERT_EQUAL_UINT8_ARRAY(&expected->buf[y * expected->stride], &decimated->buf[y * decimated->stride],
+                                          expected->width);
+        }
+
+        image_u8_destroy(expected);
+        image_u8_destroy(decimated);
+    }
+
+    for (int y = 0; y < format.height; ++y) {
+        for (int x = 0; x < format.width; ++x) {
+            TEST_ASSERT_EQUAL_UINT8(uyvy_buffer[y * format.bytesperline + x * 2 + 1], image->buf[y * image->stride + x]);
+        }
+    }
+
+    image_u8_destroy(image);
+    free(uyvy_buffer);
+}
+
+void test_convert_to_luma_in_bands_matches_single_thread() {
+    // Tall enough for several bands, the last one shorter than the others
+    struct camera_format format = {
+        .pixelformat = V4L2_PIX_FMT_YUYV,
+        .width = 67,
+        .height = 2501,
+        .bytesperline = 67 * 2 + 10
+    };
+    format.sizeimage = format.bytesperline * format.height;
+    uint8_t* yuyv_buffer = malloc(format.sizeimage);
+    for (int i = 0; i < format.sizeimage; ++i) {
+        yuyv_buffer[i] = (uint8_t) (i * 13 + i / 7);
+    }
+
+    struct image_u8* expected = image_u8_create(format.width, format.height);
+    struct image_u8* expected_decimated = image_u8_create(decimated_size(format.width, 3),
+                                                          decimated_size(format.height, 3));
+    TEST_ASSERT_EQUAL_INT(0, convert_to_luma_and_decimate(convert_yuyv_to_luma, yuyv_buffer, format.sizeimage,
+                                                          &format, expected, expected_decimated, 3));
+
+    struct image_u8* image = image_u8_create(format.width, format.height);
+    struct image_u8* decimated = image_u8_create(expected_decimated->width, expected_decimated->height);
+    TEST_ASSERT_TRUE(row_band_height(format.bytesperline + image->stride, 3) * 2 < format.height);
+
+    workerpool_t* wp = workerpool_create(4);
+    struct luma_stats stats;
+    TEST_ASSERT_EQUAL_INT(0, convert_to_luma_in_bands(wp, convert_yuyv_to_luma, yuyv_buffer, format.sizeimage, &format,
+                                                      image, decimated, 3, &stats, NULL));
+    for (int y = 0; y < format.height; ++y) {
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(&expected->buf[y * expected->stride], &image->buf[y * image->stride],
+                                      format.width);
+    }
+    for (int y = 0; y < decimated->height; ++y) {
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(&expected_decimated->buf[y * expected_decimated->stride],
+                                      &decimated->buf[y * decimated->stride], decimated->width);
+    }
+
+    // Every band's counts must have made it into the statistics
+    struct luma_stats expected_stats;
+    compute_luma_stats(expected, &expected_stats);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(expected_stats.histogram, stats.histogram, 256);
+    TEST_ASSERT_EQUAL_UINT32(decimated_size(format.width, LUMA_STATS_SAMPLE_STEP) *
+                             decimated_size(format.height, LUMA_STATS_SAMPLE_STEP), stats.sample_count);
+    TEST_ASSERT_EQUAL_UINT8(expected_stats.min, stats.min);
+    TEST_ASSERT_EQUAL_UINT8(expected_stats.max, stats.max);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-9, expected_stats.mean, stats.mean);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-9, expected_stats.variance, stats.variance);
+
+    // A stretched image is the converted one run through the stretch table, and the decimated image is sampled from
+    // the stretched rows while the statistics still count the luma as converted
+    struct contrast_stretch stretch;
+    contrast_stretch_from_stats(&expected_stats, 0.2, 4, &stretch);
+    TEST_ASSERT_TRUE(stretch.enabled);
+    TEST_ASSERT_EQUAL_INT(0, convert_to_luma_in_bands(wp, convert_yuyv_to_luma, yuyv_buffer, format.sizeimage, &format,
+                                                      image, decimated, 3, &stats, &stretch));
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(expected_stats.histogram, stats.histogram, 256);
+    for (int y = 0; y < format.height; ++y) {
+        for (int x = 0; x < format.width; ++x) {
+            TEST_ASSERT_EQUAL_UINT8(stretch.table[expected->buf[y * expected->stride + x]],
+                                    image->buf[y * image->stride + x]);
+        }
+    }
+    for (int y = 0; y < decimated->height; ++y) {
+        for (int x = 0; x < decimated->width; ++x) {
+            TEST_ASSERT_EQUAL_UINT8(stretch.table[expected_decimated->buf[y * expected_decimated->stride + x]],
+                                    decimated->buf[y * decimated->stride + x]);
+        }
+    }
+
+    // Without a decimated image only the full resolution image is converted
+    memset(image->buf, 0, image->stride * image->height);
+    TEST_ASSERT_EQUAL_INT(0, convert_to_luma_in_bands(wp, convert_yuyv_to_luma, yuyv_buffer, format.sizeimage, &format,
+                                                      image, NULL, 0, NULL, NULL));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected->buf, image->buf, expected->stride * expected->height);
+
+    workerpool_destroy(wp);
+    image_u8_destroy(decimated);
+    image_u8_destroy(image);
+    image_u8_destroy(expected_decimated);
+    image_u8_destroy(expected);
+    free(yuyv_buffer);
+}
+
+void test_create_luma_view_wraps_the_buffer_in_place() {
+    struct camera_format format = {
+        .pixelformat = V4L2_PIX_FMT_NV12,
+        .width = 10,
+        .height = 4,
+        .bytesperline = 16
+    };
+    format.sizeimage = format.bytesperline * format.height * 3 / 2;
+    uint8_t* nv12_buffer = malloc(format.sizeimage);
+    struct buffer buffer = { .start = nv12_buffer, .length = format.sizeimage, .num_planes = 1 };
+
+    struct image_u8* view = create_luma_view(&buffer, &format, NULL);
+    TEST_ASSERT_NOT_NULL(view);
+    TEST_ASSERT_EQUAL_PTR(nv12_buffer, view->buf);
+    TEST_ASSERT_EQUAL_INT(10, view->width);
+    TEST_ASSERT_EQUAL_INT(4, view->height);
+    TEST_ASSERT_EQUAL_INT(16, view->stride);
+    free(view);
+
+    struct region_of_interest region = { .left = 3, .top = 1, .width = 7, .height = 3 };
+    view = create_luma_view(&buffer, &format, &region);
+    TEST_ASSERT_NOT_NULL(view);
+    TEST_ASSERT_EQUAL_PTR(nv12_buffer + 16 + 3, view->buf);
+    TEST_ASSERT_EQUAL_INT(7, view->width);
+    TEST_ASSERT_EQUAL_INT(16, view->stride);
+    free(view);
+
+    region.width = 8;
+    TEST_ASSERT_NULL(create_luma_view(&buffer, &format, &region));
+
+    // The last row doesn't need its padding, anything shorter is a truncated frame
+    buffer.length = 16 * 3 + 10;
+    view = create_luma_view(&buffer, &format, NULL);
+    TEST_ASSERT_NOT_NULL(view);
+    free(view);
+    buffer.length--;
+    TEST_ASSERT_NULL(create_luma_view(&buffer, &format, NULL));
+
+    format.pixelformat = V4L2_PIX_FMT_YUYV;
+    buffer.length = format.sizeimage;
+    TEST_ASSERT_NULL(create_luma_view(&buffer, &format, NULL));
+    free(nv12_buffer);
 }
 
 int main(void) {
     UNITY_BEGIN();
-    RUN_TEST(test_process_frame_for_apriltags);
+    RUN_TEST(test_convert_yuyv_to_luma);
+    RUN_TEST(test_convert_region_to_luma);
+    RUN_TEST(test_convert_to_luma_and_decimate_matches_image_u8_decimate);
+    RUN_TEST(test_convert_to_luma_in_bands_matches_single_thread);
+    RUN_TEST(test_create_luma_view_wraps_the_buffer_in_place);
     return UNITY_END();
-}
\ No newline at end of file
+}
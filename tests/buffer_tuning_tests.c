@@ -0,0 +1,88 @@
+#include "unity.h"
+#include "buffer_tuning.h"
+
+// 30 fps
+#define FRAME_INTERVAL_US 33333.0
+#define WINDOW_FRAMES 10
+
+static struct buffer_count_tuner tuner;
+
+void setUp() {
+    buffer_count_tuner_init(&tuner, FRAME_INTERVAL_US, 4, 2, 16, WINDOW_FRAMES);
+}
+
+void tearDown() {}
+
+/**
+ * Records a window of frames that all took processing_us, the drops happen on the last frame
+ */
+static int record_window(int64_t processing_us, unsigned long* frames_dropped, unsigned long new_drops) {
+    for (int i = 0; i < WINDOW_FRAMES - 1; ++i) {
+        TEST_ASSERT_EQUAL_INT(0, buffer_count_tuner_record(&tuner, processing_us, *frames_dropped));
+    }
+    *frames_dropped += new_drops;
+    return buffer_count_tuner_record(&tuner, processing_us, *frames_dropped);
+}
+
+void test_buffer_count_for_processing_time() {
+    TEST_ASSERT_EQUAL_INT(2, buffer_count_for_processing_time(0, FRAME_INTERVAL_US));
+    TEST_ASSERT_EQUAL_INT(2, buffer_count_for_processing_time(20000, FRAME_INTERVAL_US));
+    TEST_ASSERT_EQUAL_INT(3, buffer_count_for_processing_time(40000, FRAME_INTERVAL_US));
+    TEST_ASSERT_EQUAL_INT(5, buffer_count_for_processing_time(130000, FRAME_INTERVAL_US));
+}
+
+void test_drops_grow_to_what_the_slowest_frame_needs() {
+    unsigned long frames_dropped = 0;
+    TEST_ASSERT_EQUAL_INT(5, record_window(20000, &frames_dropped, 1));
+    buffer_count_tuner_resized(&tuner, 5, frames_dropped);
+
+    // A slow frame that doesn't cause drops is no reason to grow
+    TEST_ASSERT_EQUAL_INT(0, record_window(130000, &frames_dropped, 0));
+    TEST_ASSERT_EQUAL_INT(7, record_window(190000, &frames_dropped, 2));
+}
+
+void test_clean_windows_shrink_one_buffer_at_a_time() {
+    unsigned long frames_dropped = 0;
+    TEST_ASSERT_EQUAL_INT(0, record_window(10000, &frames_dropped, 0));
+    TEST_ASSERT_EQUAL_INT(0, record_window(10000, &frames_dropped, 0));
+    TEST_ASSERT_EQUAL_INT(3, record_window(10000, &frames_dropped, 0));
+    buffer_count_tuner_resized(&tuner, 3, frames_dropped);
+
+    TEST_ASSERT_EQUAL_INT(0, record_window(10000, &frames_dropped, 0));
+    TEST_ASSERT_EQUAL_INT(0, record_window(10000, &frames_dropped, 0));
+    TEST_ASSERT_EQUAL_INT(2, record_window(10000, &frames_dropped, 0));
+    buffer_count_tuner_resized(&tuner, 2, frames_dropped);
+
+    TEST_ASSERT_EQUAL_INT(0, record_window(10000, &frames_dropped, 0));
+    TEST_ASSERT_EQUAL_INT(0, record_window(10000, &frames_dropped, 0));
+    TEST_ASSERT_EQUAL_INT(0, record_window(10000, &frames_dropped, 0));
+}
+
+void test_count_that_dropped_frames_is_not_used_again() {
+    unsigned long frames_dropped = 0;
+    buffer_count_tuner_resized(&tuner, 2, frames_dropped);
+    TEST_ASSERT_EQUAL_INT(3, record_window(10000, &frames_dropped, 1));
+    buffer_count_tuner_resized(&tuner, 3, frames_dropped);
+
+    for (int i = 0; i < 5; ++i) {
+        TEST_ASSERT_EQUAL_INT(0, record_window(10000, &frames_dropped, 0));
+    }
+    TEST_ASSERT_EQUAL_INT(3, tuner.min_count);
+}
+
+void test_count_stays_within_limits() {
+    unsigned long frames_dropped = 0;
+    TEST_ASSERT_EQUAL_INT(16, record_window(2000000, &frames_dropped, 5));
+    buffer_count_tuner_resized(&tuner, 16, frames_dropped);
+    TEST_ASSERT_EQUAL_INT(0, record_window(2000000, &frames_dropped, 5));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_buffer_count_for_processing_time);
+    RUN_TEST(test_drops_grow_to_what_the_slowest_frame_needs);
+    RUN_TEST(test_clean_windows_shrink_one_buffer_at_a_time);
+    RUN_TEST(test_count_that_dropped_frames_is_not_used_again);
+    RUN_TEST(test_count_stays_within_limits);
+    return UNITY_END();
+}
@@ -0,0 +1,166 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include "unity.h"
+#include "apriltag/common/image_u8.h"
+#include "camera_controls.h"
+#include "fake_v4l2.h"
+
+#define FAKE_DEVICE_PATH "/dev/video-fake"
+
+static int fd;
+static struct image_u8* image;
+static struct exposure_control_options options = {
+    .max_exposure_us = 2000,
+    .target_luma = 110,
+    .tag_lock_frames = 2,
+    .update_interval = 1
+};
+
+void setUp() {
+    struct fake_v4l2_config config;
+    fake_v4l2_default_config(&config);
+    config.device_path = FAKE_DEVICE_PATH;
+    fake_v4l2_configure(&config);
+
+    fd = open(FAKE_DEVICE_PATH, O_RDWR | O_NONBLOCK);
+    image = image_u8_create(64, 48);
+}
+
+void tearDown() {
+    image_u8_destroy(image);
+    close(fd);
+}
+
+static void fill_image(struct image_u8* target, const struct region_of_interest* region, uint8_t luma) {
+    for (uint32_t y = region->top; y < region->top + region->height; ++y) {
+        memset(target->buf + y * target->stride + region->left, luma, region->width);
+    }
+}
+
+static struct fake_v4l2_stats read_controls() {
+    struct fake_v4l2_stats stats;
+    fake_v4l2_get_stats(&stats);
+    return stats;
+}
+
+void test_motion_blur_exposure_limit() {
+    TEST_ASSERT_EQUAL_UINT32(2000, motion_blur_exposure_limit_us(1.5, 750));
+}
+
+void test_compute_luma_histogram() {
+    struct region_of_interest whole = { 0, 0, 64, 48 };
+    struct region_of_interest corner = { 60, 40, 10, 10 };
+    fill_image(image, &whole, 10);
+    fill_image(image, &(struct region_of_interest) { 60, 40, 4, 8 }, 200);
+
+    uint32_t histogram[256];
+    TEST_ASSERT_EQUAL_UINT32(64 * 48, compute_luma_histogram(image, NULL, 1, histogram));
+    TEST_ASSERT_EQUAL_UINT32(4 * 8, histogram[200]);
+
+    // The region is clipped to the image
+    TEST_ASSERT_EQUAL_UINT32(4 * 8, compute_luma_histogram(image, &corner, 1, histogram));
+    TEST_ASSERT_EQUAL_UINT32(4 * 8, histogram[200]);
+
+    TEST_ASSERT_EQUAL_UINT32(16 * 12, compute_luma_histogram(image, NULL, 4, histogram));
+}
+
+void test_create_switches_to_manual_exposure_within_blur_limit() {
+    struct exposure_controller* controller = exposure_controller_create(fd, &options);
+    TEST_ASSERT_NOT_NULL(controller);
+
+    struct fake_v4l2_stats controls = read_controls();
+    TEST_ASSERT_EQUAL_INT(V4L2_EXPOSURE_MANUAL, controls.exposure_auto);
+    TEST_ASSERT_EQUAL_INT(20, controls.exposure_absolute);
+
+    exposure_controller_destroy(controller);
+    TEST_ASSERT_EQUAL_INT(V4L2_EXPOSURE_APERTURE_PRIORITY, read_controls().exposure_auto);
+}
+
+void test_dark_scene_raises_gain_instead_of_exposure() {
+    struct exposure_controller* controller = exposure_controller_create(fd, &options);
+    fill_image(image, &(struct region_of_interest) { 0, 0, 64, 48 }, 20);
+
+    for (int i = 0; i < 5; ++i) {
+        TEST_ASSERT_EQUAL_INT(0, exposure_controller_update(controller, image, NULL, NULL));
+    }
+
+    struct fake_v4l2_stats controls = read_controls();
+    TEST_ASSERT_EQUAL_INT(20, controls.exposure_absolute);
+    TEST_ASSERT_TRUE(controls.gain > 100);
+    TEST_ASSERT_EQUAL_INT(controller->gain_value, controls.gain);
+    exposure_controller_destroy(controller);
+}
+
+void test_bright_scene_lowers_gain_before_exposure() {
+    struct exposure_controller* controller = exposure_controller_create(fd, &options);
+    fill_image(image, &(struct region_of_interest) { 0, 0, 64, 48 }, 20);
+    exposure_controller_update(controller, image, NULL, NULL);
+    int32_t raised_gain = read_controls().gain;
+    TEST_ASSERT_TRUE(raised_gain > 0);
+
+    fill_image(image, &(struct region_of_interest) { 0, 0, 64, 48 }, 180);
+    exposure_controller_update(controller, image, NULL, NULL);
+    struct fake_v4l2_stats controls = read_controls();
+    TEST_ASSERT_TRUE(controls.gain < raised_gain);
+    TEST_ASSERT_EQUAL_INT(20, controls.exposure_absolute);
+
+    for (int i = 0; i < 10; ++i) {
+        exposure_controller_update(controller, image, NULL, NULL);
+    }
+    controls = read_controls();
+    TEST_ASSERT_EQUAL_INT(0, controls.gain);
+    TEST_ASSERT_TRUE(controls.exposure_absolute < 20);
+    exposure_controller_destroy(controller);
+}
+
+void test_locked_tag_region_is_metered() {
+    struct exposure_controller* controller = exposure_controller_create(fd, &options);
+
+    // The whole image averages out to the target, only the tag is too dark
+    struct region_of_interest tag = { 8, 8, 16, 16 };
+    fill_image(image, &(struct region_of_interest) { 0, 0, 64, 24 }, 0);
+    fill_image(image, &(struct region_of_interest) { 0, 24, 64, 24 }, 220);
+    fill_image(image, &tag, 110);
+    TEST_ASSERT_EQUAL_INT(0, exposure_controller_update(controller, image, NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(0, read_controls().gain);
+
+    fill_image(image, &tag, 30);
+    exposure_controller_lock_region(controller, &tag);
+    exposure_controller_update(controller, image, NULL, NULL);
+    int32_t locked_gain = read_controls().gain;
+    TEST_ASSERT_TRUE(locked_gain > 0);
+
+    // After tag_lock_frames frames without a new detection the whole image is metered again
+    exposure_controller_update(controller, image, NULL, NULL);
+    int32_t last_locked_gain = read_controls().gain;
+    exposure_controller_update(controller, image, NULL, NULL);
+    TEST_ASSERT_EQUAL_INT(last_locked_gain, read_controls().gain);
+    exposure_controller_destroy(controller);
+}
+
+void test_frame_stats_are_metered_instead_of_sampling() {
+    struct exposure_controller* controller = exposure_controller_create(fd, &options);
+    fill_image(image, &(struct region_of_interest) { 0, 0, 64, 48 }, 110);
+
+    // The image is at the target, the statistics that came with it say the frame is dark
+    struct luma_stats stats;
+    luma_stats_reset(&stats);
+    stats.histogram[20] = 64 * 48;
+    luma_stats_finish(&stats);
+    TEST_ASSERT_EQUAL_INT(0, exposure_controller_update(controller, image, &stats, NULL));
+    TEST_ASSERT_TRUE(read_controls().gain > 0);
+    exposure_controller_destroy(controller);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_motion_blur_exposure_limit);
+    RUN_TEST(test_compute_luma_histogram);
+    RUN_TEST(test_create_switches_to_manual_exposure_within_blur_limit);
+    RUN_TEST(test_dark_scene_raises_gain_instead_of_exposure);
+    RUN_TEST(test_bright_scene_lowers_gain_before_exposure);
+    RUN_TEST(test_locked_tag_region_is_metered);
+    RUN_TEST(test_frame_stats_are_metered_instead_of_sampling);
+    return UNITY_END();
+}
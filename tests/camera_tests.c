@@ -0,0 +1,238 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "unity.h"
+#include "camera.h"
+#include "fake_camera.h"
+
+// Runs the capture path from setup_camera to stop_stream against the fake device of libfake_v4l2.so
+
+static struct fake_camera fake;
+
+void setUp() {
+    fake_camera_set_up(&fake);
+}
+
+void tearDown() {
+    fake_camera_tear_down(&fake);
+}
+
+struct frame_log {
+    int frame_count;
+    int max_frames;
+    struct frame frames[64];
+    uint32_t stamped_sequences[64];
+};
+
+static enum capture_action log_frame(const struct frame* frame, void* user_data) {
+    struct frame_log* log = user_data;
+    log->frames[log->frame_count] = *frame;
+    memcpy(&log->stamped_sequences[log->frame_count], fake.queue.buffers[frame->index].start, sizeof(uint32_t));
+    log->frame_count++;
+    return log->frame_count == log->max_frames ? CAPTURE_STOP : CAPTURE_CONTINUE;
+}
+
+static int capture(struct frame_log* log, int max_frames, enum capture_mode mode, struct capture_stats* stats) {
+    memset(log, 0, sizeof(*log));
+    log->max_frames = max_frames;
+    struct capture_options options = { .timeout_ms = 1000, .mode = mode, .min_bytesused = fake.format.sizeimage };
+    return capture_frames(&fake.queue, &options, log_frame, log, stats);
+}
+
+void test_setup_camera_negotiates_fake_format() {
+    fake.config.fps = 60;
+    fake_v4l2_configure(&fake.config);
+    int fd = setup_camera(FAKE_DEVICE_PATH, 800, 600, &fake.format);
+    TEST_ASSERT_TRUE(fd != -1);
+
+    TEST_ASSERT_EQUAL_UINT32(V4L2_PIX_FMT_YUYV, fake.format.pixelformat);
+    TEST_ASSERT_EQUAL_UINT32(64, fake.format.width);
+    TEST_ASSERT_EQUAL_UINT32(48, fake.format.height);
+    TEST_ASSERT_EQUAL_UINT32(64 * 2, fake.format.bytesperline);
+    TEST_ASSERT_EQUAL_UINT32(V4L2_BUF_TYPE_VIDEO_CAPTURE, fake.format.buffer_type);
+
+    struct v4l2_fract interval;
+    TEST_ASSERT_EQUAL_INT(0, set_frame_rate(fd, &fake.format, 30, &interval));
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 60.0, frame_interval_to_fps(interval));
+    close(fd);
+}
+
+void test_preferred_format_falls_back_when_not_offered() {
+    // The fake device only offers YUYV, so asking for MJPEG must still negotiate it
+    set_preferred_pixel_format(V4L2_PIX_FMT_MJPEG);
+    fake_v4l2_configure(&fake.config);
+    int fd = setup_camera(FAKE_DEVICE_PATH, fake.config.width, fake.config.height, &fake.format);
+    set_preferred_pixel_format(0);
+    TEST_ASSERT_TRUE(fd != -1);
+
+    TEST_ASSERT_EQUAL_UINT32(V4L2_PIX_FMT_YUYV, fake.format.pixelformat);
+    close(fd);
+}
+
+void test_capture_delivers_frames_in_sequence() {
+    fake_camera_open(&fake, 4);
+    TEST_ASSERT_EQUAL_UINT(4, fake.queue.count);
+
+    struct frame_log log;
+    struct capture_stats stats = { 0 };
+    TEST_ASSERT_EQUAL_INT(0, capture(&log, 20, CAPTURE_ALL_FRAMES, &stats));
+    TEST_ASSERT_EQUAL_INT(20, log.frame_count);
+    TEST_ASSERT_EQUAL_UINT(0, stats.frames_dropped);
+
+    for (int i = 0; i < log.frame_count; ++i) {
+        TEST_ASSERT_EQUAL_UINT32(i, log.frames[i].sequence);
+        TEST_ASSERT_EQUAL_UINT32(log.frames[i].sequence, log.stamped_sequences[i]);
+        TEST_ASSERT_EQUAL_UINT32(fake.format.sizeimage, log.frames[i].bytesused);
+        TEST_ASSERT_TRUE(frame_age_us(&log.frames[i]) >= 0);
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, stop_stream(fake.queue.fd, fake.format.buffer_type));
+    cleanup_buffers(fake.queue.buffers, fake.queue.count);
+    fake.queue.buffers = NULL;
+
+    struct fake_v4l2_stats fake_stats;
+    fake_v4l2_get_stats(&fake_stats);
+    TEST_ASSERT_EQUAL_INT(0, fake_stats.mapped_buffers);
+}
+
+void test_capture_counts_dropped_sequences() {
+    fake.config.drop_every = 4;
+    fake_camera_open(&fake, 4);
+
+    struct frame_log log;
+    struct capture_stats stats = { 0 };
+    TEST_ASSERT_EQUAL_INT(0, capture(&log, 12, CAPTURE_ALL_FRAMES, &stats));
+
+    struct fake_v4l2_stats fake_stats;
+    fake_v4l2_get_stats(&fake_stats);
+    TEST_ASSERT_TRUE(stats.frames_dropped >= 3);
+    TEST_ASSERT_TRUE(stats.frames_dropped <= fake_stats.frames_dropped);
+}
+
+void test_capture_rejects_error_frames() {
+    fake.config.error_every = 3;
+    fake_camera_open(&fake, 4);
+
+    struct frame_log log;
+    struct capture_stats stats = { 0 };
+    TEST_ASSERT_EQUAL_INT(0, capture(&log, 10, CAPTURE_ALL_FRAMES, &stats));
+
+    TEST_ASSERT_TRUE(stats.frames_rejected >= 4);
+    for (int i = 0; i < log.frame_count; ++i) {
+        TEST_ASSERT_FALSE(log.frames[i].flags & V4L2_BUF_FLAG_ERROR);
+    }
+}
+
+static enum capture_action stop_holding_frame(const struct frame* frame, void* user_data) {
+    *(uint32_t*) user_data = frame->index;
+    return CAPTURE_STOP_HOLD;
+}
+
+void test_stop_hold_leaves_the_buffer_to_the_handler() {
+    fake_camera_open(&fake, 4);
+
+    uint32_t held_index;
+    struct capture_options options = { .timeout_ms = 1000, .mode = CAPTURE_ALL_FRAMES, .min_bytesused = 0 };
+    struct capture_stats stats = { 0 };
+    TEST_ASSERT_EQUAL_INT(0, capture_frames(&fake.queue, &options, stop_holding_frame, &held_index, &stats));
+    TEST_ASSERT_EQUAL_UINT(1, stats.frames_processed);
+
+    // The driver refuses to queue a buffer twice, so this only succeeds if capture_frames left it dequeued
+    TEST_ASSERT_EQUAL_INT(0, requeue_buffer(&fake.queue, held_index));
+}
+
+void test_capture_absorbs_eagain_bursts() {
+    fake.config.eagain_burst = 3;
+    fake_camera_open(&fake, 4);
+
+    struct frame_log log;
+    struct capture_stats stats = { 0 };
+    TEST_ASSERT_EQUAL_INT(0, capture(&log, 10, CAPTURE_ALL_FRAMES, &stats));
+    TEST_ASSERT_EQUAL_INT(10, log.frame_count);
+
+    struct fake_v4l2_stats fake_stats;
+    fake_v4l2_get_stats(&fake_stats);
+    TEST_ASSERT_TRUE(fake_stats.eagain_returned >= 10 * 3);
+}
+
+void test_capture_with_jitter_keeps_timestamps_increasing() {
+    fake.config.fps = 200;
+    fake.config.jitter_us = 2000;
+    fake_camera_open(&fake, 4);
+
+    struct frame_log log;
+    TEST_ASSERT_EQUAL_INT(0, capture(&log, 10, CAPTURE_ALL_FRAMES, NULL));
+    for (int i = 1; i < log.frame_count; ++i) {
+        int64_t previous_us = log.frames[i - 1].timestamp.tv_sec * 1000000 + log.frames[i - 1].timestamp.tv_usec;
+        int64_t current_us = log.frames[i].timestamp.tv_sec * 1000000 + log.frames[i].timestamp.tv_usec;
+        TEST_ASSERT_TRUE(current_us > previous_us);
+    }
+}
+
+void test_latest_frame_mode_skips_stale_frames() {
+    fake.config.fps = 0;
+    fake_camera_open(&fake, 8);
+
+    struct frame_log log;
+    struct capture_stats stats = { 0 };
+    TEST_ASSERT_EQUAL_INT(0, capture(&log, 5, CAPTURE_LATEST_FRAME, &stats));
+    TEST_ASSERT_EQUAL_INT(5, log.frame_count);
+    // With fps 0 every buffer the application doesn't hold is completed by the time it looks again, so only the
+    // newest of each batch is handed over
+    TEST_ASSERT_EQUAL_UINT32(7, log.frames[0].sequence);
+    TEST_ASSERT_TRUE(stats.frames_skipped >= 5 * 5);
+    for (int i = 1; i < log.frame_count; ++i) {
+        TEST_ASSERT_TRUE(log.frames[i].sequence > log.frames[i - 1].sequence + 1);
+    }
+}
+
+void test_request_accepts_fewer_buffers_than_requested() {
+    fake.config.max_buffers = 2;
+    fake_v4l2_configure(&fake.config);
+    fake.queue.fd = setup_camera(FAKE_DEVICE_PATH, fake.config.width, fake.config.height, &fake.format);
+    TEST_ASSERT_TRUE(fake.queue.fd != -1);
+
+    fake.request_buffers = request_mmap_buffers(fake.queue.fd, 4, fake.format.buffer_type);
+    TEST_ASSERT_NOT_NULL(fake.request_buffers);
+    TEST_ASSERT_EQUAL_UINT32(2, fake.request_buffers->count);
+}
+
+void test_resize_buffer_queue_while_streaming() {
+    fake_camera_open(&fake, 4);
+
+    struct frame_log log;
+    TEST_ASSERT_EQUAL_INT(0, capture(&log, 3, CAPTURE_ALL_FRAMES, NULL));
+
+    struct v4l2_requestbuffers* resized_request = resize_buffer_queue(&fake.queue, 2);
+    TEST_ASSERT_NOT_NULL(resized_request);
+    free(fake.request_buffers);
+    fake.request_buffers = resized_request;
+    TEST_ASSERT_EQUAL_UINT(2, fake.queue.count);
+
+    struct fake_v4l2_stats fake_stats;
+    fake_v4l2_get_stats(&fake_stats);
+    TEST_ASSERT_EQUAL_INT(2, fake_stats.mapped_buffers);
+
+    TEST_ASSERT_EQUAL_INT(0, capture(&log, 5, CAPTURE_ALL_FRAMES, NULL));
+    TEST_ASSERT_EQUAL_INT(5, log.frame_count);
+    for (int i = 0; i < log.frame_count; ++i) {
+        TEST_ASSERT_TRUE(log.frames[i].index < 2);
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_setup_camera_negotiates_fake_format);
+    RUN_TEST(test_preferred_format_falls_back_when_not_offered);
+    RUN_TEST(test_capture_delivers_frames_in_sequence);
+    RUN_TEST(test_capture_counts_dropped_sequences);
+    RUN_TEST(test_capture_rejects_error_frames);
+    RUN_TEST(test_stop_hold_leaves_the_buffer_to_the_handler);
+    RUN_TEST(test_capture_absorbs_eagain_bursts);
+    RUN_TEST(test_capture_with_jitter_keeps_timestamps_increasing);
+    RUN_TEST(test_latest_frame_mode_skips_stale_frames);
+    RUN_TEST(test_request_accepts_fewer_buffers_than_requested);
+    RUN_TEST(test_resize_buffer_queue_while_streaming);
+    return UNITY_END();
+}
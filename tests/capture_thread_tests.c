@@ -0,0 +1,177 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include "unity.h"
+#include "camera.h"
+#include "capture_thread.h"
+#include "spsc_ring.h"
+#include "fake_camera.h"
+
+#define BUFFER_COUNT 4
+
+static struct fake_camera fake;
+
+void setUp() {
+    fake_camera_set_up(&fake);
+}
+
+void tearDown() {
+    fake_camera_tear_down(&fake);
+}
+
+static struct capture_thread* start_capture_thread(enum capture_mode mode) {
+    struct capture_options options = { .timeout_ms = 1000, .mode = mode, .min_bytesused = fake.format.sizeimage };
+    struct capture_thread* thread = capture_thread_start(&fake.queue, &options);
+    TEST_ASSERT_NOT_NULL(thread);
+    return thread;
+}
+
+void test_ring_wraps_and_reports_full() {
+    struct spsc_ring* ring = spsc_ring_create(3, sizeof(int));
+    int value;
+    TEST_ASSERT_FALSE(spsc_ring_pop(ring, &value));
+
+    // Capacity is rounded up to 4
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 4; ++i) {
+            int pushed = round * 4 + i;
+            TEST_ASSERT_TRUE(spsc_ring_push(ring, &pushed));
+        }
+        int extra = -1;
+        TEST_ASSERT_FALSE(spsc_ring_push(ring, &extra));
+
+        for (int i = 0; i < 4; ++i) {
+            TEST_ASSERT_TRUE(spsc_ring_pop(ring, &value));
+            TEST_ASSERT_EQUAL_INT(round * 4 + i, value);
+        }
+        TEST_ASSERT_TRUE(spsc_ring_is_empty(ring));
+    }
+    spsc_ring_destroy(ring);
+}
+
+#define STRESS_VALUES 200000
+
+static void* push_values(void* argument) {
+    struct spsc_ring* ring = argument;
+    for (uint32_t value = 0; value < STRESS_VALUES; ++value) {
+        while (!spsc_ring_push(ring, &value)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+void test_ring_keeps_order_across_threads() {
+    struct spsc_ring* ring = spsc_ring_create(8, sizeof(uint32_t));
+    pthread_t producer;
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&producer, NULL, push_values, ring));
+
+    uint32_t expected = 0;
+    while (expected < STRESS_VALUES) {
+        uint32_t value;
+        if (!spsc_ring_pop(ring, &value)) {
+            sched_yield();
+            continue;
+        }
+        if (value != expected)
+            break;
+        expected++;
+    }
+
+    pthread_join(producer, NULL);
+    TEST_ASSERT_EQUAL_UINT32(STRESS_VALUES, expected);
+    spsc_ring_destroy(ring);
+}
+
+void test_capture_thread_delivers_and_requeues_frames() {
+    fake_camera_open(&fake, BUFFER_COUNT);
+    struct capture_thread* thread = start_capture_thread(CAPTURE_ALL_FRAMES);
+
+    // More frames than buffers, so released buffers must make it back to the driver
+    for (uint32_t i = 0; i < 4 * BUFFER_COUNT; ++i) {
+        struct frame frame;
+        TEST_ASSERT_EQUAL_INT(0, capture_thread_next_frame(thread, &frame, 1000));
+        TEST_ASSERT_TRUE(frame.index < BUFFER_COUNT);
+
+        uint32_t stamped_sequence;
+        memcpy(&stamped_sequence, fake.queue.buffers[frame.index].start, sizeof(stamped_sequence));
+        TEST_ASSERT_EQUAL_UINT32(frame.sequence, stamped_sequence);
+        capture_thread_release_frame(thread, frame.index);
+    }
+
+    struct capture_stats stats;
+    capture_thread_get_stats(thread, &stats);
+    TEST_ASSERT_EQUAL_UINT(4 * BUFFER_COUNT, stats.frames_processed);
+    capture_thread_stop(thread);
+}
+
+void test_capture_thread_latest_mode_skips_stale_frames() {
+    fake.config.fps = 0;
+    fake_camera_open(&fake, BUFFER_COUNT);
+    struct capture_thread* thread = start_capture_thread(CAPTURE_LATEST_FRAME);
+
+    struct frame previous;
+    TEST_ASSERT_EQUAL_INT(0, capture_thread_next_frame(thread, &previous, 1000));
+    capture_thread_release_frame(thread, previous.index);
+    // Give the capture thread time to publish every buffer the fake completes
+    usleep(20000);
+
+    struct frame frame;
+    TEST_ASSERT_EQUAL_INT(0, capture_thread_next_frame(thread, &frame, 1000));
+    TEST_ASSERT_TRUE(frame.sequence > previous.sequence + 1);
+    capture_thread_release_frame(thread, frame.index);
+
+    struct capture_stats stats;
+    capture_thread_get_stats(thread, &stats);
+    TEST_ASSERT_TRUE(stats.frames_skipped > 0);
+    capture_thread_stop(thread);
+}
+
+void test_capture_thread_rejects_error_frames() {
+    fake.config.error_every = 2;
+    fake_camera_open(&fake, BUFFER_COUNT);
+    struct capture_thread* thread = start_capture_thread(CAPTURE_ALL_FRAMES);
+
+    for (int i = 0; i < 6; ++i) {
+        struct frame frame;
+        TEST_ASSERT_EQUAL_INT(0, capture_thread_next_frame(thread, &frame, 1000));
+        TEST_ASSERT_FALSE(frame.flags & V4L2_BUF_FLAG_ERROR);
+        capture_thread_release_frame(thread, frame.index);
+    }
+
+    struct capture_stats stats;
+    capture_thread_get_stats(thread, &stats);
+    TEST_ASSERT_TRUE(stats.frames_rejected >= 5);
+    capture_thread_stop(thread);
+}
+
+void test_capture_thread_times_out_while_every_buffer_is_held() {
+    fake_camera_open(&fake, BUFFER_COUNT);
+    struct capture_thread* thread = start_capture_thread(CAPTURE_ALL_FRAMES);
+
+    struct frame frames[BUFFER_COUNT];
+    for (int i = 0; i < BUFFER_COUNT; ++i) {
+        TEST_ASSERT_EQUAL_INT(0, capture_thread_next_frame(thread, &frames[i], 1000));
+    }
+
+    struct frame frame;
+    TEST_ASSERT_EQUAL_INT(-EAGAIN, capture_thread_next_frame(thread, &frame, 50));
+
+    capture_thread_release_frame(thread, frames[0].index);
+    TEST_ASSERT_EQUAL_INT(0, capture_thread_next_frame(thread, &frame, 1000));
+    TEST_ASSERT_EQUAL_INT(frames[0].index, frame.index);
+    capture_thread_stop(thread);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_ring_wraps_and_reports_full);
+    RUN_TEST(test_ring_keeps_order_across_threads);
+    RUN_TEST(test_capture_thread_delivers_and_requeues_frames);
+    RUN_TEST(test_capture_thread_latest_mode_skips_stale_frames);
+    RUN_TEST(test_capture_thread_rejects_error_frames);
+    RUN_TEST(test_capture_thread_times_out_while_every_buffer_is_held);
+    return UNITY_END();
+}
@@ -0,0 +1,44 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "unity.h"
+#include "fake_camera.h"
+
+void fake_camera_set_up(struct fake_camera* camera) {
+    fake_v4l2_default_config(&camera->config);
+    camera->config.device_path = FAKE_DEVICE_PATH;
+    camera->config.width = 64;
+    camera->config.height = 48;
+    camera->config.fps = 500;
+    camera->request_buffers = NULL;
+    memset(&camera->queue, 0, sizeof(camera->queue));
+    camera->queue.fd = -1;
+}
+
+void fake_camera_tear_down(struct fake_camera* camera) {
+    if (camera->queue.buffers != NULL)
+        cleanup_buffers(camera->queue.buffers, camera->queue.count);
+    free(camera->request_buffers);
+    if (camera->queue.fd != -1)
+        close(camera->queue.fd);
+}
+
+void fake_camera_open(struct fake_camera* camera, int buffer_count) {
+    fake_v4l2_configure(&camera->config);
+    struct buffer_queue* queue = &camera->queue;
+    queue->fd = setup_camera(FAKE_DEVICE_PATH, camera->config.width, camera->config.height, &camera->format);
+    TEST_ASSERT_TRUE(queue->fd != -1);
+
+    camera->request_buffers = request_mmap_buffers(queue->fd, buffer_count, camera->format.buffer_type);
+    TEST_ASSERT_NOT_NULL(camera->request_buffers);
+
+    queue->type = camera->request_buffers->type;
+    queue->memory = camera->request_buffers->memory;
+    queue->buffers = map_buffers(queue->fd, camera->request_buffers);
+    queue->count = camera->request_buffers->count;
+    queue->num_planes = camera->format.num_planes;
+    TEST_ASSERT_NOT_NULL(queue->buffers);
+
+    queue_buffers(queue);
+    TEST_ASSERT_EQUAL_INT(0, start_stream(queue->fd, camera->format.buffer_type));
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "camera.h"
+#include "fake_v4l2.h"
+
+#define FAKE_DEVICE_PATH "/dev/video-fake"
+
+/**
+ * Test fixture of a camera streaming from the fake device: a small, fast fake is configured before every test, which
+ * may change the config before it opens the camera, and whatever the test opened is released after it.
+ *
+ * config - Configuration the fake device is opened with
+ * format - Format setup_camera negotiated
+ * request_buffers - The mmap buffers granted to the queue, NULL until the camera is opened
+ * queue - The camera's buffer queue, its fd is -1 while the camera is closed
+ */
+struct fake_camera {
+    struct fake_v4l2_config config;
+    struct camera_format format;
+    struct v4l2_requestbuffers* request_buffers;
+    struct buffer_queue queue;
+};
+
+/**
+ * Resets the fixture to a 64x48 fake at 500 fps with nothing opened, for setUp
+ * @param camera - The fixture
+ */
+void fake_camera_set_up(struct fake_camera* camera);
+
+/**
+ * Releases the buffers and closes the camera if the test opened them, for tearDown
+ * @param camera - The fixture
+ */
+void fake_camera_tear_down(struct fake_camera* camera);
+
+/**
+ * Sets up the fake camera with the fixture's config, queues buffer_count mmap buffers and starts streaming. Fails the
+ * test if any step fails
+ * @param camera - The fixture
+ * @param buffer_count - Number of buffers to request, the fake may grant fewer (see max_buffers)
+ */
+void fake_camera_open(struct fake_camera* camera, int buffer_count);
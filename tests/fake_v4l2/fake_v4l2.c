@@ -0,0 +1,744 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <linux/version.h>
+#include <linux/videodev2.h>
+
+#include "fake_v4l2.h"
+
+#define FAKE_V4L2_MAX_BUFFERS 32
+#define FAKE_V4L2_MAX_MAPPINGS (FAKE_V4L2_MAX_BUFFERS * 4)
+
+enum fake_buffer_state {
+    BUFFER_DEQUEUED,
+    BUFFER_QUEUED,
+    BUFFER_DONE
+};
+
+struct fake_buffer {
+    enum fake_buffer_state state;
+    uint32_t sequence;
+    struct timeval timestamp;
+    uint32_t flags;
+};
+
+/**
+ * First in, first out list of buffer indices
+ */
+struct index_fifo {
+    uint32_t indices[FAKE_V4L2_MAX_BUFFERS];
+    uint32_t head;
+    uint32_t count;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct fake_v4l2_config config;
+    struct fake_v4l2_stats stats;
+
+    // The eventfd handed out as the device descriptor, -1 while the device is closed
+    int fd;
+    bool nonblocking;
+    bool readable;
+
+    uint32_t bytesperline;
+    uint32_t sizeimage;
+    int memfd;
+    uint8_t* memory;
+    size_t buffer_stride;
+    struct fake_buffer buffers[FAKE_V4L2_MAX_BUFFERS];
+    uint32_t buffer_count;
+    struct index_fifo queued;
+    struct index_fifo done;
+    void* mappings[FAKE_V4L2_MAX_MAPPINGS];
+
+    bool streaming;
+    bool has_producer;
+    pthread_t producer;
+    uint32_t sequence;
+    uint64_t frame_number;
+    uint32_t pending_eagain;
+    unsigned int random_state;
+} device = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+    .memfd = -1
+};
+
+/**
+ * Controls of the fake device, the values live in device.stats
+ */
+static const struct v4l2_queryctrl fake_controls[] = {
+    {
+        .id = V4L2_CID_EXPOSURE_AUTO, .type = V4L2_CTRL_TYPE_MENU, .name = "Auto Exposure",
+        .minimum = 0, .maximum = 3, .step = 1, .default_value = V4L2_EXPOSURE_APERTURE_PRIORITY
+    },
+    {
+        .id = V4L2_CID_EXPOSURE_ABSOLUTE, .type = V4L2_CTRL_TYPE_INTEGER, .name = "Exposure Time, Absolute",
+        .minimum = 1, .maximum = 5000, .step = 1, .default_value = 156
+    },
+    {
+        .id = V4L2_CID_GAIN, .type = V4L2_CTRL_TYPE_INTEGER, .name = "Gain",
+        .minimum = 0, .maximum = 255, .step = 1, .default_value = 0
+    }
+};
+
+static int32_t* control_value(uint32_t id) {
+    switch (id) {
+        case V4L2_CID_EXPOSURE_AUTO:
+            return &device.stats.exposure_auto;
+        case V4L2_CID_EXPOSURE_ABSOLUTE:
+            return &device.stats.exposure_absolute;
+        case V4L2_CID_GAIN:
+            return &device.stats.gain;
+        default:
+            return NULL;
+    }
+}
+
+static const struct v4l2_queryctrl* find_control(uint32_t id) {
+    for (size_t i = 0; i < sizeof(fake_controls) / sizeof(fake_controls[0]); ++i) {
+        if (fake_controls[i].id == id)
+            return &fake_controls[i];
+    }
+    return NULL;
+}
+
+/**
+ * VIDIOC_G_EXT_CTRLS and VIDIOC_S_EXT_CTRLS, integer values are clamped like the kernel control framework does
+ */
+static int access_controls(struct v4l2_ext_controls* controls, bool set) {
+    for (uint32_t i = 0; i < controls->count; ++i) {
+        if (find_control(controls->controls[i].id) == NULL) {
+            controls->error_idx = i;
+            return EINVAL;
+        }
+    }
+
+    for (uint32_t i = 0; i < controls->count; ++i) {
+        struct v4l2_ext_control* control = &controls->controls[i];
+        const struct v4l2_queryctrl* range = find_control(control->id);
+        if (!set) {
+            control->value = *control_value(control->id);
+            continue;
+        }
+
+        if (control->value < range->minimum)
+            control->value = range->minimum;
+        if (control->value > range->maximum)
+            control->value = range->maximum;
+        *control_value(control->id) = control->value;
+    }
+    return 0;
+}
+
+static int (*real_open)(const char*, int, ...);
+static int (*real_close)(int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static void* (*real_mmap)(void*, size_t, int, int, int, off_t);
+static int (*real_munmap)(void*, size_t);
+
+void fake_v4l2_default_config(struct fake_v4l2_config* config) {
+    *config = (struct fake_v4l2_config) {
+        .device_path = "/dev/video-fake",
+        .pixelformat = V4L2_PIX_FMT_YUYV,
+        .width = 640,
+        .height = 480,
+        .fps = 30,
+        .max_buffers = FAKE_V4L2_MAX_BUFFERS
+    };
+}
+
+static uint32_t environment_value(const char* name, uint32_t default_value) {
+    const char* value = getenv(name);
+    return value != NULL ? (uint32_t) strtoul(value, NULL, 10) : default_value;
+}
+
+__attribute__((constructor))
+static void fake_v4l2_init(void) {
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+    real_mmap = dlsym(RTLD_NEXT, "mmap");
+    real_munmap = dlsym(RTLD_NEXT, "munmap");
+
+    // Deadlines of the producer thread are CLOCK_MONOTONIC times like the frame timestamps
+    pthread_condattr_t condition_attributes;
+    pthread_condattr_init(&condition_attributes);
+    pthread_condattr_setclock(&condition_attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&device.changed, &condition_attributes);
+    pthread_condattr_destroy(&condition_attributes);
+
+    struct fake_v4l2_config config;
+    fake_v4l2_default_config(&config);
+    if (getenv("FAKE_V4L2_DEVICE") != NULL)
+        config.device_path = getenv("FAKE_V4L2_DEVICE");
+    const char* fourcc = getenv("FAKE_V4L2_FORMAT");
+    if (fourcc != NULL && strlen(fourcc) == 4)
+        config.pixelformat = v4l2_fourcc(fourcc[0], fourcc[1], fourcc[2], fourcc[3]);
+    if (getenv("FAKE_V4L2_FPS") != NULL)
+        config.fps = atof(getenv("FAKE_V4L2_FPS"));
+    config.width = environment_value("FAKE_V4L2_WIDTH", config.width);
+    config.height = environment_value("FAKE_V4L2_HEIGHT", config.height);
+    config.jitter_us = environment_value("FAKE_V4L2_JITTER_US", config.jitter_us);
+    config.drop_every = environment_value("FAKE_V4L2_DROP_EVERY", config.drop_every);
+    config.eagain_burst = environment_value("FAKE_V4L2_EAGAIN_BURST", config.eagain_burst);
+    config.error_every = environment_value("FAKE_V4L2_ERROR_EVERY", config.error_every);
+    config.max_buffers = environment_value("FAKE_V4L2_MAX_BUFFERS", config.max_buffers);
+    device.config = config;
+}
+
+void fake_v4l2_configure(const struct fake_v4l2_config* config) {
+    pthread_mutex_lock(&device.lock);
+    device.config = *config;
+    pthread_mutex_unlock(&device.lock);
+}
+
+void fake_v4l2_get_stats(struct fake_v4l2_stats* stats) {
+    pthread_mutex_lock(&device.lock);
+    *stats = device.stats;
+    pthread_mutex_unlock(&device.lock);
+}
+
+static bool is_fake_fd(int fd) {
+    return fd >= 0 && fd == device.fd;
+}
+
+static void fifo_push(struct index_fifo* fifo, uint32_t index) {
+    fifo->indices[(fifo->head + fifo->count) % FAKE_V4L2_MAX_BUFFERS] = index;
+    fifo->count++;
+}
+
+static uint32_t fifo_pop(struct index_fifo* fifo) {
+    uint32_t index = fifo->indices[fifo->head];
+    fifo->head = (fifo->head + 1) % FAKE_V4L2_MAX_BUFFERS;
+    fifo->count--;
+    return index;
+}
+
+static int64_t monotonic_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Makes the eventfd readable exactly while a VIDIOC_DQBUF has something to do. With fps 0 that includes queued
+ * buffers, which are completed by the next VIDIOC_DQBUF
+ */
+static void update_readiness(void) {
+    bool readable = device.done.count > 0 ||
+                    (device.config.fps == 0 && device.streaming && device.queued.count > 0);
+    if (readable == device.readable)
+        return;
+
+    uint64_t value = 1;
+    if (readable) {
+        write(device.fd, &value, sizeof(value));
+    } else {
+        read(device.fd, &value, sizeof(value));
+    }
+    device.readable = readable;
+}
+
+/**
+ * One frame period of the sensor: either drops the frame or completes the oldest queued buffer
+ */
+static void complete_frame(int64_t timestamp_ns) {
+    device.frame_number++;
+
+    bool dropped = device.config.drop_every > 0 && device.frame_number % device.config.drop_every == 0;
+    if (dropped || device.queued.count == 0) {
+        device.sequence++;
+        device.stats.frames_dropped++;
+        return;
+    }
+
+    uint32_t index = fifo_pop(&device.queued);
+    struct fake_buffer* buffer = &device.buffers[index];
+    buffer->state = BUFFER_DONE;
+    buffer->sequence = device.sequence++;
+    buffer->timestamp.tv_sec = timestamp_ns / 1000000000;
+    buffer->timestamp.tv_usec = (timestamp_ns % 1000000000) / 1000;
+    buffer->flags = V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_DONE | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+
+    device.stats.frames_delivered++;
+    if (device.config.error_every > 0 && device.stats.frames_delivered % device.config.error_every == 0) {
+        buffer->flags |= V4L2_BUF_FLAG_ERROR;
+        device.stats.error_frames++;
+    }
+
+    // Lets tests check that the mapping they read is the buffer that was dequeued
+    memcpy(device.memory + index * device.buffer_stride, &buffer->sequence, sizeof(buffer->sequence));
+
+    fifo_push(&device.done, index);
+    update_readiness();
+    pthread_cond_broadcast(&device.changed);
+}
+
+static void* produce_frames(void* argument) {
+    pthread_mutex_lock(&device.lock);
+
+    int64_t period_ns = (int64_t) (1e9 / device.config.fps);
+    int64_t next_due_ns = monotonic_now_ns() + period_ns;
+
+    while (device.streaming) {
+        int64_t due_ns = next_due_ns;
+        if (device.config.jitter_us > 0) {
+            int64_t jitter_ns = (int64_t) device.config.jitter_us * 1000;
+            due_ns += rand_r(&device.random_state) % (2 * jitter_ns + 1) - jitter_ns;
+        }
+
+        struct timespec deadline = { .tv_sec = due_ns / 1000000000, .tv_nsec = due_ns % 1000000000 };
+        while (device.streaming && monotonic_now_ns() < due_ns) {
+            pthread_cond_timedwait(&device.changed, &device.lock, &deadline);
+        }
+        if (!device.streaming)
+            break;
+
+        complete_frame(due_ns);
+        next_due_ns += period_ns;
+    }
+
+    pthread_mutex_unlock(&device.lock);
+    return NULL;
+}
+
+static void release_buffers(void) {
+    if (device.memory != NULL)
+        real_munmap(device.memory, device.buffer_stride * device.buffer_count);
+    if (device.memfd != -1)
+        real_close(device.memfd);
+
+    device.memory = NULL;
+    device.memfd = -1;
+    device.buffer_count = 0;
+}
+
+static void fill_format(struct v4l2_pix_format* pix) {
+    uint32_t bytes_per_pixel = device.config.pixelformat == V4L2_PIX_FMT_GREY ? 1 : 2;
+    memset(pix, 0, sizeof(*pix));
+    pix->pixelformat = device.config.pixelformat;
+    pix->width = device.config.width;
+    pix->height = device.config.height;
+    pix->field = V4L2_FIELD_NONE;
+    pix->bytesperline = device.config.width * bytes_per_pixel;
+    pix->sizeimage = pix->bytesperline * device.config.height;
+    pix->colorspace = V4L2_COLORSPACE_SRGB;
+}
+
+static int request_buffers(struct v4l2_requestbuffers* request) {
+    if (request->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || request->memory != V4L2_MEMORY_MMAP)
+        return EINVAL;
+    if (device.streaming)
+        return EBUSY;
+
+    release_buffers();
+    memset(request->reserved, 0, sizeof(request->reserved));
+    request->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP;
+    if (request->count == 0)
+        return 0;
+
+    uint32_t count = request->count;
+    if (count > device.config.max_buffers)
+        count = device.config.max_buffers;
+    if (count > FAKE_V4L2_MAX_BUFFERS)
+        count = FAKE_V4L2_MAX_BUFFERS;
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    device.buffer_stride = (device.sizeimage + page_size - 1) / page_size * page_size;
+    device.memfd = memfd_create("fake_v4l2", MFD_CLOEXEC);
+    if (device.memfd == -1 || ftruncate(device.memfd, device.buffer_stride * count) == -1) {
+        release_buffers();
+        return ENOMEM;
+    }
+
+    device.memory = real_mmap(NULL, device.buffer_stride * count, PROT_READ | PROT_WRITE, MAP_SHARED, device.memfd, 0);
+    if (device.memory == MAP_FAILED) {
+        device.memory = NULL;
+        release_buffers();
+        return ENOMEM;
+    }
+
+    // A gradient so converters and the detector have something other than zeros to work on
+    for (size_t i = 0; i < device.buffer_stride * count; ++i) {
+        device.memory[i] = (uint8_t) (i % device.bytesperline);
+    }
+
+    device.buffer_count = count;
+    memset(device.buffers, 0, sizeof(device.buffers));
+    request->count = count;
+    return 0;
+}
+
+static void describe_buffer(uint32_t index, struct v4l2_buffer* buffer) {
+    struct fake_buffer* fake_buffer = &device.buffers[index];
+    buffer->index = index;
+    buffer->memory = V4L2_MEMORY_MMAP;
+    buffer->field = V4L2_FIELD_NONE;
+    buffer->m.offset = index * device.buffer_stride;
+    buffer->length = device.sizeimage;
+    buffer->bytesused = fake_buffer->state == BUFFER_DEQUEUED ? 0 : device.sizeimage;
+    buffer->flags = V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    if (fake_buffer->state == BUFFER_QUEUED)
+        buffer->flags |= V4L2_BUF_FLAG_QUEUED;
+}
+
+static int dequeue(struct v4l2_buffer* buffer) {
+    if (buffer->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || buffer->memory != V4L2_MEMORY_MMAP || !device.streaming)
+        return EINVAL;
+
+    if (device.done.count == 0 && device.config.fps == 0) {
+        int64_t now_ns = monotonic_now_ns();
+        while (device.queued.count > 0) {
+            complete_frame(now_ns);
+        }
+        // Completing the batch is what a real device would have signalled readiness for, the caller comes back
+        // through poll like it would after a wakeup
+        if (device.nonblocking) {
+            device.stats.eagain_returned++;
+            return EAGAIN;
+        }
+    }
+
+    while (device.done.count == 0) {
+        if (device.nonblocking) {
+            device.stats.eagain_returned++;
+            return EAGAIN;
+        }
+        pthread_cond_wait(&device.changed, &device.lock);
+        if (!device.streaming)
+            return EINVAL;
+    }
+
+    // Spurious failures come while a frame is ready, so every frame is handed out only after its whole burst
+    if (device.pending_eagain > 0) {
+        device.pending_eagain--;
+        device.stats.eagain_returned++;
+        return EAGAIN;
+    }
+    device.pending_eagain = device.config.eagain_burst;
+
+    uint32_t index = fifo_pop(&device.done);
+    struct fake_buffer* fake_buffer = &device.buffers[index];
+    fake_buffer->state = BUFFER_DEQUEUED;
+    update_readiness();
+
+    describe_buffer(index, buffer);
+    buffer->bytesused = device.sizeimage;
+    buffer->flags = fake_buffer->flags;
+    buffer->timestamp = fake_buffer->timestamp;
+    buffer->sequence = fake_buffer->sequence;
+    return 0;
+}
+
+static int start_streaming(void) {
+    if (device.buffer_count == 0)
+        return EINVAL;
+    if (device.streaming)
+        return 0;
+
+    device.streaming = true;
+    device.sequence = 0;
+    device.frame_number = 0;
+    device.pending_eagain = device.config.eagain_burst;
+    device.random_state = 1;
+
+    if (device.config.fps > 0) {
+        if (pthread_create(&device.producer, NULL, produce_frames, NULL) != 0) {
+            device.streaming = false;
+            return ENOMEM;
+        }
+        device.has_producer = true;
+    }
+
+    update_readiness();
+    return 0;
+}
+
+/**
+ * Stops the producer thread and returns every buffer to the application, must be called with the lock held
+ */
+static void stop_streaming(void) {
+    device.streaming = false;
+    pthread_cond_broadcast(&device.changed);
+
+    if (device.has_producer) {
+        pthread_mutex_unlock(&device.lock);
+        pthread_join(device.producer, NULL);
+        pthread_mutex_lock(&device.lock);
+        device.has_producer = false;
+    }
+
+    for (uint32_t i = 0; i < device.buffer_count; ++i) {
+        device.buffers[i].state = BUFFER_DEQUEUED;
+    }
+    device.queued.count = 0;
+    device.done.count = 0;
+    update_readiness();
+}
+
+static int handle_ioctl(unsigned long request, void* argument) {
+    switch (request) {
+        case VIDIOC_QUERYCAP: {
+            struct v4l2_capability* capability = argument;
+            memset(capability, 0, sizeof(*capability));
+            strcpy((char*) capability->driver, "fake_v4l2");
+            strcpy((char*) capability->card, "Fake V4L2 camera");
+            strcpy((char*) capability->bus_info, "platform:fake_v4l2");
+            capability->version = KERNEL_VERSION(6, 0, 0);
+            capability->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+            capability->capabilities = capability->device_caps | V4L2_CAP_DEVICE_CAPS;
+            return 0;
+        }
+        case VIDIOC_ENUM_FMT: {
+            struct v4l2_fmtdesc* description = argument;
+            if (description->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || description->index != 0)
+                return EINVAL;
+            description->flags = 0;
+            description->pixelformat = device.config.pixelformat;
+            snprintf((char*) description->description, sizeof(description->description), "Fake %.4s",
+                     (char*) &device.config.pixelformat);
+            return 0;
+        }
+        case VIDIOC_ENUM_FRAMESIZES: {
+            struct v4l2_frmsizeenum* frame_size = argument;
+            if (frame_size->index != 0 || frame_size->pixel_format != device.config.pixelformat)
+                return EINVAL;
+            frame_size->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+            frame_size->discrete.width = device.config.width;
+            frame_size->discrete.height = device.config.height;
+            return 0;
+        }
+        case VIDIOC_ENUM_FRAMEINTERVALS: {
+            struct v4l2_frmivalenum* frame_interval = argument;
+            if (frame_interval->index != 0 || device.config.fps <= 0 ||
+                frame_interval->pixel_format != device.config.pixelformat ||
+                frame_interval->width != device.config.width || frame_interval->height != device.config.height)
+                return EINVAL;
+            frame_interval->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+            frame_interval->discrete.numerator = 1000;
+            frame_interval->discrete.denominator = (uint32_t) (device.config.fps * 1000 + 0.5);
+            return 0;
+        }
+        case VIDIOC_TRY_FMT:
+        case VIDIOC_S_FMT:
+        case VIDIOC_G_FMT: {
+            struct v4l2_format* format = argument;
+            if (format->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+                return EINVAL;
+            if (request == VIDIOC_S_FMT && device.buffer_count > 0)
+                return EBUSY;
+            // Only one format and size exist, so whatever was asked for is adjusted to it
+            fill_format(&format->fmt.pix);
+            return 0;
+        }
+        case VIDIOC_G_PARM:
+        case VIDIOC_S_PARM: {
+            struct v4l2_streamparm* parameters = argument;
+            if (parameters->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+                return EINVAL;
+            struct v4l2_fract* interval = &parameters->parm.capture.timeperframe;
+            if (request == VIDIOC_S_PARM) {
+                if (device.streaming)
+                    return EBUSY;
+                if (interval->numerator > 0 && interval->denominator > 0)
+                    device.config.fps = (double) interval->denominator / interval->numerator;
+            }
+            memset(&parameters->parm.capture, 0, sizeof(parameters->parm.capture));
+            parameters->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+            if (device.config.fps > 0) {
+                interval->numerator = 1000;
+                interval->denominator = (uint32_t) (device.config.fps * 1000 + 0.5);
+            }
+            return 0;
+        }
+        case VIDIOC_REQBUFS:
+            return request_buffers(argument);
+        case VIDIOC_QUERYBUF: {
+            struct v4l2_buffer* buffer = argument;
+            if (buffer->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || buffer->index >= device.buffer_count)
+                return EINVAL;
+            describe_buffer(buffer->index, buffer);
+            return 0;
+        }
+        case VIDIOC_QBUF: {
+            struct v4l2_buffer* buffer = argument;
+            if (buffer->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || buffer->memory != V4L2_MEMORY_MMAP ||
+                buffer->index >= device.buffer_count || device.buffers[buffer->index].state != BUFFER_DEQUEUED)
+                return EINVAL;
+            device.buffers[buffer->index].state = BUFFER_QUEUED;
+            fifo_push(&device.queued, buffer->index);
+            describe_buffer(buffer->index, buffer);
+            update_readiness();
+            pthread_cond_broadcast(&device.changed);
+            return 0;
+        }
+        case VIDIOC_DQBUF:
+            return dequeue(argument);
+        case VIDIOC_QUERYCTRL: {
+            struct v4l2_queryctrl* query = argument;
+            const struct v4l2_queryctrl* control = find_control(query->id);
+            if (control == NULL)
+                return EINVAL;
+            *query = *control;
+            return 0;
+        }
+        case VIDIOC_G_EXT_CTRLS:
+        case VIDIOC_S_EXT_CTRLS:
+            return access_controls(argument, request == VIDIOC_S_EXT_CTRLS);
+        case VIDIOC_STREAMON:
+            if (*(int*) argument != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+                return EINVAL;
+            return start_streaming();
+        case VIDIOC_STREAMOFF:
+            if (*(int*) argument != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+                return EINVAL;
+            stop_streaming();
+            return 0;
+        default:
+            // Selection, dmabuf export and everything else are not implemented
+            return ENOTTY;
+    }
+}
+
+static int open_fake_device(int flags) {
+    pthread_mutex_lock(&device.lock);
+    if (device.fd != -1) {
+        pthread_mutex_unlock(&device.lock);
+        errno = EBUSY;
+        return -1;
+    }
+
+    int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd == -1) {
+        pthread_mutex_unlock(&device.lock);
+        return -1;
+    }
+
+    device.fd = fd;
+    device.nonblocking = flags & O_NONBLOCK;
+    device.readable = false;
+    memset(&device.stats, 0, sizeof(device.stats));
+    for (size_t i = 0; i < sizeof(fake_controls) / sizeof(fake_controls[0]); ++i) {
+        *control_value(fake_controls[i].id) = fake_controls[i].default_value;
+    }
+    memset(device.mappings, 0, sizeof(device.mappings));
+    memset(&device.queued, 0, sizeof(device.queued));
+    memset(&device.done, 0, sizeof(device.done));
+
+    struct v4l2_pix_format pix;
+    fill_format(&pix);
+    device.bytesperline = pix.bytesperline;
+    device.sizeimage = pix.sizeimage;
+
+    pthread_mutex_unlock(&device.lock);
+    return fd;
+}
+
+int open(const char* path, int flags, ...) {
+    if (device.config.device_path != NULL && strcmp(path, device.config.device_path) == 0)
+        return open_fake_device(flags);
+
+    va_list arguments;
+    va_start(arguments, flags);
+    mode_t mode = (flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE ? va_arg(arguments, mode_t) : 0;
+    va_end(arguments);
+    return real_open(path, flags, mode);
+}
+
+int open64(const char* path, int flags, ...) {
+    va_list arguments;
+    va_start(arguments, flags);
+    mode_t mode = (flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE ? va_arg(arguments, mode_t) : 0;
+    va_end(arguments);
+    return open(path, flags, mode);
+}
+
+int close(int fd) {
+    if (!is_fake_fd(fd))
+        return real_close(fd);
+
+    pthread_mutex_lock(&device.lock);
+    if (device.streaming)
+        stop_streaming();
+    release_buffers();
+    device.fd = -1;
+    pthread_mutex_unlock(&device.lock);
+    return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...) {
+    va_list arguments;
+    va_start(arguments, request);
+    void* argument = va_arg(arguments, void*);
+    va_end(arguments);
+
+    if (!is_fake_fd(fd))
+        return real_ioctl(fd, request, argument);
+
+    pthread_mutex_lock(&device.lock);
+    int error = handle_ioctl(request, argument);
+    pthread_mutex_unlock(&device.lock);
+
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+void* mmap(void* address, size_t length, int protection, int flags, int fd, off_t offset) {
+    if (!is_fake_fd(fd))
+        return real_mmap(address, length, protection, flags, fd, offset);
+
+    pthread_mutex_lock(&device.lock);
+    void* mapping = MAP_FAILED;
+    if (device.buffer_count > 0 && offset % device.buffer_stride == 0 &&
+        offset / device.buffer_stride < device.buffer_count && length <= device.buffer_stride) {
+        mapping = real_mmap(address, length, protection, flags, device.memfd, offset);
+    }
+
+    if (mapping == MAP_FAILED) {
+        errno = EINVAL;
+    } else {
+        for (int i = 0; i < FAKE_V4L2_MAX_MAPPINGS; ++i) {
+            if (device.mappings[i] == NULL) {
+                device.mappings[i] = mapping;
+                device.stats.mapped_buffers++;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&device.lock);
+    return mapping;
+}
+
+void* mmap64(void* address, size_t length, int protection, int flags, int fd, off64_t offset) {
+    return mmap(address, length, protection, flags, fd, offset);
+}
+
+int munmap(void* address, size_t length) {
+    pthread_mutex_lock(&device.lock);
+    for (int i = 0; i < FAKE_V4L2_MAX_MAPPINGS; ++i) {
+        if (address != NULL && device.mappings[i] == address) {
+            device.mappings[i] = NULL;
+            device.stats.mapped_buffers--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&device.lock);
+    return real_munmap(address, length);
+}
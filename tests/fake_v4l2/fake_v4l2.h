@@ -0,0 +1,82 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * A fake V4L2 capture device for running the capture path without hardware. Built as libfake_v4l2.so, it replaces
+ * open, close, ioctl, mmap and munmap. Calls on the virtual device node are served by the fake, every other file
+ * goes to libc untouched.
+ *
+ * Link it into a test (ahead of libc) and call fake_v4l2_configure, or LD_PRELOAD it into any binary and configure
+ * it with the FAKE_V4L2_* environment variables named next to each field below.
+ *
+ * The device is single-planar and supports mmap streaming of one pixel format at one frame size. Its buffers live in
+ * a memfd. The descriptor handed to the application is an eventfd that is readable while completed buffers are
+ * waiting, so poll, select and epoll work on it unmodified. Frames complete on a background thread at the
+ * configured frame rate. It also has the exposure controls of a typical webcam (V4L2_CID_EXPOSURE_AUTO,
+ * V4L2_CID_EXPOSURE_ABSOLUTE and V4L2_CID_GAIN), whose values are stored but don't change the frames.
+ */
+
+/**
+ * device_path - Path of the virtual node (FAKE_V4L2_DEVICE, default /dev/video-fake)
+ * pixelformat - V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_GREY (FAKE_V4L2_FORMAT as a fourcc, default YUYV)
+ * width, height - The only frame size offered (FAKE_V4L2_WIDTH, FAKE_V4L2_HEIGHT, default 640x480)
+ * fps - Frame rate, 0 completes every queued buffer as soon as the application runs out of completed ones
+ *       (FAKE_V4L2_FPS, default 30)
+ * jitter_us - Every frame completes up to this many microseconds early or late (FAKE_V4L2_JITTER_US)
+ * drop_every - Every nth frame is dropped by the driver, leaving a gap in the sequence numbers (FAKE_V4L2_DROP_EVERY)
+ * eagain_burst - Every frame is only dequeued after n VIDIOC_DQBUF calls failed with EAGAIN even though the frame was
+ *                ready, like spurious wakeups (FAKE_V4L2_EAGAIN_BURST)
+ * error_every - Every nth delivered frame carries V4L2_BUF_FLAG_ERROR (FAKE_V4L2_ERROR_EVERY)
+ * max_buffers - VIDIOC_REQBUFS grants at most this many buffers (FAKE_V4L2_MAX_BUFFERS, default 32)
+ * A value of 0 disables jitter_us, drop_every, eagain_burst and error_every
+ */
+struct fake_v4l2_config {
+    const char* device_path;
+    uint32_t pixelformat;
+    uint32_t width;
+    uint32_t height;
+    double fps;
+    uint32_t jitter_us;
+    uint32_t drop_every;
+    uint32_t eagain_burst;
+    uint32_t error_every;
+    uint32_t max_buffers;
+};
+
+/**
+ * Counters of the fake device, reset whenever the device is opened
+ * frames_delivered - Buffers completed and handed to the application
+ * frames_dropped - Frames dropped through drop_every or because no buffer was queued
+ * error_frames - Delivered frames flagged with V4L2_BUF_FLAG_ERROR
+ * eagain_returned - VIDIOC_DQBUF calls that failed with EAGAIN
+ * mapped_buffers - Buffer mappings that are currently not unmapped
+ * exposure_auto, exposure_absolute, gain - Current values of the exposure controls
+ */
+struct fake_v4l2_stats {
+    unsigned long frames_delivered;
+    unsigned long frames_dropped;
+    unsigned long error_frames;
+    unsigned long eagain_returned;
+    int mapped_buffers;
+    int32_t exposure_auto;
+    int32_t exposure_absolute;
+    int32_t gain;
+};
+
+/**
+ * Fills a config with the defaults (the environment is not consulted)
+ * @param config - The config to fill
+ */
+void fake_v4l2_default_config(struct fake_v4l2_config* config);
+
+/**
+ * Replaces the configuration, takes effect the next time the device is opened
+ * @param config - The new configuration, device_path must stay valid
+ */
+void fake_v4l2_configure(const struct fake_v4l2_config* config);
+
+/**
+ * Reads the counters of the fake device
+ * @param stats - Filled with the current counters
+ */
+void fake_v4l2_get_stats(struct fake_v4l2_stats* stats);
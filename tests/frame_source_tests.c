@@ -0,0 +1,159 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "unity.h"
+#include "frame_source.h"
+
+static char recording_path[64];
+
+static struct camera_format recording_format = {
+    .pixelformat = V4L2_PIX_FMT_YUYV,
+    .width = 4,
+    .height = 2,
+    .bytesperline = 4 * 2,
+    .sizeimage = 4 * 2 * 2,
+    .buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+    .num_planes = 1
+};
+
+void setUp() {
+
+}
+
+void tearDown() {
+
+}
+
+/**
+ * Writes frame_count frames where every byte of frame i is i, plus a trailing partial frame
+ */
+static void write_recording(int frame_count) {
+    strcpy(recording_path, "/tmp/frame_source_tests_XXXXXX");
+    int fd = mkstemp(recording_path);
+    for (int i = 0; i < frame_count; ++i) {
+        uint8_t frame[4 * 2 * 2];
+        memset(frame, i, sizeof(frame));
+        write(fd, frame, sizeof(frame));
+    }
+    write(fd, "partial", 7);
+    close(fd);
+}
+
+void test_raw_recording_replays_every_frame_once() {
+    write_recording(3);
+    struct replay_options options = { .pacing = REPLAY_AS_FAST_AS_POSSIBLE };
+    struct frame_source* source = frame_source_open_raw_recording(recording_path, &recording_format, &options);
+    TEST_ASSERT_NOT_NULL(source);
+    TEST_ASSERT_EQUAL_UINT(3, source->frame_count);
+
+    TEST_ASSERT_EQUAL_INT(0, frame_source_start(source));
+    struct source_frame frame;
+    for (int i = 0; i < 3; ++i) {
+        TEST_ASSERT_EQUAL_INT(0, frame_source_next_frame(source, 0, &frame));
+        TEST_ASSERT_EQUAL_INT(i, frame.frame.index);
+        TEST_ASSERT_EQUAL_UINT32(i, frame.frame.sequence);
+        TEST_ASSERT_EQUAL_UINT32(recording_format.sizeimage, frame.frame.bytesused);
+        TEST_ASSERT_EQUAL_UINT8(i, frame.data[0]);
+        TEST_ASSERT_EQUAL_UINT8(i, frame.data[recording_format.sizeimage - 1]);
+        TEST_ASSERT_TRUE(frame_age_us(&frame.frame) >= 0);
+        TEST_ASSERT_EQUAL_INT(0, frame_source_release_frame(source, &frame));
+    }
+    TEST_ASSERT_EQUAL_INT(-ENODATA, frame_source_next_frame(source, 0, &frame));
+
+    frame_source_stop(source);
+    frame_source_close(source);
+    unlink(recording_path);
+}
+
+void test_raw_recording_loops() {
+    write_recording(2);
+    struct replay_options options = { .pacing = REPLAY_AS_FAST_AS_POSSIBLE, .loop = true };
+    struct frame_source* source = frame_source_open_raw_recording(recording_path, &recording_format, &options);
+    TEST_ASSERT_NOT_NULL(source);
+
+    frame_source_start(source);
+    struct source_frame frame;
+    for (int i = 0; i < 5; ++i) {
+        TEST_ASSERT_EQUAL_INT(0, frame_source_next_frame(source, 0, &frame));
+        TEST_ASSERT_EQUAL_INT(i % 2, frame.frame.index);
+        TEST_ASSERT_EQUAL_UINT32(i, frame.frame.sequence);
+    }
+
+    frame_source_close(source);
+    unlink(recording_path);
+}
+
+void test_raw_recording_realtime_pacing() {
+    write_recording(3);
+    struct replay_options options = { .pacing = REPLAY_REALTIME, .fps = 50 };
+    struct frame_source* source = frame_source_open_raw_recording(recording_path, &recording_format, &options);
+    TEST_ASSERT_NOT_NULL(source);
+
+    frame_source_start(source);
+    struct source_frame frame;
+    TEST_ASSERT_EQUAL_INT(0, frame_source_next_frame(source, 0, &frame));
+    // The second frame is due 20ms after the start, so a 1ms timeout expires first
+    TEST_ASSERT_EQUAL_INT(-EAGAIN, frame_source_next_frame(source, 1, &frame));
+    TEST_ASSERT_EQUAL_INT(0, frame_source_next_frame(source, -1, &frame));
+    TEST_ASSERT_EQUAL_INT(1, frame.frame.index);
+    TEST_ASSERT_EQUAL_INT(0, frame_source_next_frame(source, -1, &frame));
+    TEST_ASSERT_EQUAL_INT(2, frame.frame.index);
+    // Frames are stamped with the time they became due, not with the time they were handed out
+    TEST_ASSERT_TRUE(frame_age_us(&frame.frame) < 20000);
+
+    frame_source_close(source);
+    unlink(recording_path);
+}
+
+void test_pgm_directory_loads_images_in_name_order() {
+    char directory_path[] = "/tmp/frame_source_tests_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(directory_path));
+
+    const char* names[] = { "b.pgm", "a.pgm", "notes.txt" };
+    for (int i = 0; i < 3; ++i) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", directory_path, names[i]);
+        FILE* file = fopen(path, "wb");
+        fprintf(file, "P5\n3 2\n255\n");
+        for (int p = 0; p < 6; ++p) {
+            fputc(i * 10 + p, file);
+        }
+        fclose(file);
+    }
+
+    struct replay_options options = { .pacing = REPLAY_AS_FAST_AS_POSSIBLE };
+    struct frame_source* source = frame_source_open_pgm_directory(directory_path, &options);
+    TEST_ASSERT_NOT_NULL(source);
+    TEST_ASSERT_EQUAL_UINT(2, source->frame_count);
+    TEST_ASSERT_EQUAL_UINT32(V4L2_PIX_FMT_GREY, source->format.pixelformat);
+    TEST_ASSERT_EQUAL_UINT32(3, source->format.width);
+    TEST_ASSERT_EQUAL_UINT32(2, source->format.height);
+
+    frame_source_start(source);
+    struct source_frame frame;
+    TEST_ASSERT_EQUAL_INT(0, frame_source_next_frame(source, 0, &frame));
+    TEST_ASSERT_EQUAL_UINT8(10, frame.data[0]);
+    TEST_ASSERT_EQUAL_UINT8(15, frame.data[source->format.bytesperline + 2]);
+    TEST_ASSERT_EQUAL_INT(0, frame_source_next_frame(source, 0, &frame));
+    TEST_ASSERT_EQUAL_UINT8(0, frame.data[0]);
+    TEST_ASSERT_EQUAL_INT(-ENODATA, frame_source_next_frame(source, 0, &frame));
+    frame_source_close(source);
+
+    for (int i = 0; i < 3; ++i) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", directory_path, names[i]);
+        unlink(path);
+    }
+    rmdir(directory_path);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_raw_recording_replays_every_frame_once);
+    RUN_TEST(test_raw_recording_loops);
+    RUN_TEST(test_raw_recording_realtime_pacing);
+    RUN_TEST(test_pgm_directory_loads_images_in_name_order);
+    return UNITY_END();
+}
@@ -0,0 +1,92 @@
+#include <stdint.h>
+#include "unity.h"
+#include "image_pool.h"
+
+#define WIDTH 100
+#define HEIGHT 30
+
+static struct image_pool* pool;
+
+void setUp() {
+    pool = image_pool_create(WIDTH, HEIGHT, 1, NULL);
+    TEST_ASSERT_NOT_NULL(pool);
+}
+
+void tearDown() {
+    image_pool_destroy(pool);
+}
+
+void test_images_are_aligned() {
+    struct image_u8* image = image_pool_acquire(pool);
+    TEST_ASSERT_EQUAL_INT(WIDTH, image->width);
+    TEST_ASSERT_EQUAL_INT(HEIGHT, image->height);
+    TEST_ASSERT_EQUAL_INT(128, image->stride);
+    TEST_ASSERT_EQUAL_INT(0, (uintptr_t) image->buf % FRAME_ARENA_ALIGNMENT);
+    image_pool_release(pool, image);
+}
+
+void test_released_images_are_reused() {
+    struct image_u8* image = image_pool_acquire(pool);
+    image_pool_release(pool, image);
+
+    // One frame after the other never needs more than the image created up front
+    for (int i = 0; i < 10; ++i) {
+        struct image_u8* next = image_pool_acquire(pool);
+        TEST_ASSERT_EQUAL_PTR(image, next);
+        image_pool_release(pool, next);
+    }
+    TEST_ASSERT_EQUAL_INT(1, pool->image_count);
+    TEST_ASSERT_EQUAL_INT(1, pool->high_water_mark);
+}
+
+void test_pool_grows_to_the_frames_in_flight() {
+    struct image_u8* images[6];
+    for (int i = 0; i < 6; ++i) {
+        images[i] = image_pool_acquire(pool);
+        TEST_ASSERT_NOT_NULL(images[i]);
+    }
+    for (int i = 0; i < 6; ++i) {
+        image_pool_release(pool, images[i]);
+    }
+    TEST_ASSERT_EQUAL_INT(6, pool->image_count);
+    TEST_ASSERT_EQUAL_INT(0, pool->acquired_count);
+
+    // Fewer frames in flight afterwards keep the mark and don't create images
+    for (int i = 0; i < 3; ++i) {
+        images[i] = image_pool_acquire(pool);
+    }
+    for (int i = 0; i < 3; ++i) {
+        image_pool_release(pool, images[i]);
+    }
+    TEST_ASSERT_EQUAL_INT(6, pool->image_count);
+    TEST_ASSERT_EQUAL_INT(6, pool->high_water_mark);
+}
+
+void test_arena_pixels_fall_back_to_the_heap() {
+    // Leave room for exactly one image
+    struct frame_arena* arena = frame_arena_create(128 * HEIGHT, false);
+    size_t image_offset = arena->size - 128 * HEIGHT;
+    TEST_ASSERT_NOT_NULL(frame_arena_alloc(arena, image_offset, FRAME_ARENA_ALIGNMENT));
+    struct image_pool* arena_pool = image_pool_create(WIDTH, HEIGHT, 1, arena);
+    TEST_ASSERT_NOT_NULL(arena_pool);
+
+    struct image_u8* first = image_pool_acquire(arena_pool);
+    struct image_u8* second = image_pool_acquire(arena_pool);
+    TEST_ASSERT_EQUAL_PTR(arena->base + image_offset, first->buf);
+    TEST_ASSERT_TRUE(second->buf < arena->base || second->buf >= arena->base + arena->size);
+    TEST_ASSERT_EQUAL_INT(0, (uintptr_t) second->buf % FRAME_ARENA_ALIGNMENT);
+
+    image_pool_release(arena_pool, first);
+    image_pool_release(arena_pool, second);
+    image_pool_destroy(arena_pool);
+    frame_arena_destroy(arena);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_images_are_aligned);
+    RUN_TEST(test_released_images_are_reused);
+    RUN_TEST(test_pool_grows_to_the_frames_in_flight);
+    RUN_TEST(test_arena_pixels_fall_back_to_the_heap);
+    return UNITY_END();
+}
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "apriltag/common/image_u8.h"
+#include "apriltag/common/pjpeg.h"
+#include "frame_conversion.h"
+#include "jpeg_luma.h"
+
+#define WIDTH 40
+#define HEIGHT 20
+#define SQUARE_SIZE 5
+
+// A 40x20 MJPEG frame like a UVC camera sends it: 4:2:2 sampling, restart markers every 2 MCUs and no Huffman tables.
+// Its luma is a checkerboard of 5x5 pixel squares, dark in the top left corner, with color in both kinds of square
+static const uint8_t CHECKERBOARD_JPEG[] = {
+    0xff, 0xd8, 0xff, 0xe0, 0x00, 0x10, 0x4a, 0x46, 0x49, 0x46, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01,
+    0x00, 0x01, 0x00, 0x00, 0xff, 0xdb, 0x00, 0x43, 0x00, 0x08, 0x06, 0x06, 0x07, 0x06, 0x05, 0x08,
+    0x07, 0x07, 0x07, 0x09, 0x09, 0x08, 0x0a, 0x0c, 0x14, 0x0d, 0x0c, 0x0b, 0x0b, 0x0c, 0x19, 0x12,
+    0x13, 0x0f, 0x14, 0x1d, 0x1a, 0x1f, 0x1e, 0x1d, 0x1a, 0x1c, 0x1c, 0x20, 0x24, 0x2e, 0x27, 0x20,
+    0x22, 0x2c, 0x23, 0x1c, 0x1c, 0x28, 0x37, 0x29, 0x2c, 0x30, 0x31, 0x34, 0x34, 0x34, 0x1f, 0x27,
+    0x39, 0x3d, 0x38, 0x32, 0x3c, 0x2e, 0x33, 0x34, 0x32, 0xff, 0xdb, 0x00, 0x43, 0x01, 0x09, 0x09,
+    0x09, 0x0c, 0x0b, 0x0c, 0x18, 0x0d, 0x0d, 0x18, 0x32, 0x21, 0x1c, 0x21, 0x32, 0x32, 0x32, 0x32,
+    0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32,
+    0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32,
+    0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0xff, 0xc0,
+    0x00, 0x11, 0x08, 0x00, 0x14, 0x00, 0x28, 0x03, 0x01, 0x21, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11,
+    0x01, 0xff, 0xdd, 0x00, 0x04, 0x00, 0x02, 0xff, 0xda, 0x00, 0x0c, 0x03, 0x01, 0x00, 0x02, 0x11,
+    0x03, 0x11, 0x00, 0x3f, 0x00, 0x8b, 0x45, 0xd1, 0x6e, 0x7e, 0x13, 0xde, 0x3e, 0xbd, 0xaf, 0x3c,
+    0x57, 0x36, 0xb7, 0x11, 0x9b, 0x34, 0x4b, 0x12, 0x5d, 0xc3, 0xb1, 0x0e, 0x09, 0x0e, 0x14, 0x63,
+    0x11, 0x9e, 0xfe, 0x9c, 0x51, 0x73, 0xa2, 0xdc, 0xeb, 0xfa, 0xf2, 0xfc, 0x47, 0xb5, 0x78, 0x93,
+    0x47, 0x8e, 0x44, 0xbc, 0x30, 0x4a, 0x48, 0xb8, 0xd9, 0x6f, 0x80, 0xe3, 0x68, 0x05, 0x72, 0x7c,
+    0xb6, 0xc7, 0xcd, 0xdc, 0x64, 0x8a, 0xe8, 0xf6, 0xa9, 0xc9, 0xd7, 0xe9, 0x25, 0xcb, 0xe7, 0x7f,
+    0xf2, 0x34, 0xe4, 0x69, 0x7b, 0x3e, 0xab, 0x52, 0x6d, 0x77, 0xfe, 0x2f, 0x07, 0xd9, 0xff, 0x00,
+    0xe1, 0x1f, 0xff, 0x00, 0x46, 0xfe, 0xcb, 0xdd, 0xe7, 0xff, 0x00, 0x68, 0x7c, 0x9b, 0xbc, 0xdc,
+    0x6d, 0xdb, 0xb3, 0x76, 0x7f, 0xd5, 0xb6, 0x73, 0x8e, 0xa3, 0xad, 0x4b, 0x73, 0xad, 0x5b, 0x6b,
+    0xfa, 0x0a, 0xfc, 0x38, 0xb5, 0x49, 0x53, 0x58, 0x8e, 0x34, 0xb3, 0x33, 0xca, 0x00, 0xb7, 0xdf,
+    0x6f, 0x82, 0xe7, 0x70, 0x25, 0xb0, 0x7c, 0xb6, 0xc7, 0xcb, 0xdc, 0x64, 0x0a, 0x95, 0x17, 0x15,
+    0x1a, 0x6f, 0x7a, 0x7a, 0xbf, 0xcf, 0x41, 0xde, 0xed, 0xcb, 0xf9, 0xb4, 0x5f, 0x91, 0xff, 0xd0,
+    0x9b, 0x45, 0xd6, 0xad, 0xbe, 0x13, 0xd9, 0xbe, 0x83, 0xaf, 0x24, 0xb7, 0x37, 0x57, 0x12, 0x1b,
+    0xc4, 0x7b, 0x10, 0x1d, 0x02, 0x30, 0x08, 0x01, 0x2e, 0x54, 0xe7, 0x31, 0x9e, 0xde, 0x9c, 0xd1,
+    0x57, 0x3c, 0x1c, 0xf1, 0x12, 0x75, 0x62, 0xd5, 0x99, 0xbc, 0x6b, 0xc6, 0x92, 0xe4, 0x7b, 0xa2,
+    0xa6, 0x8b, 0x73, 0xaa, 0xeb, 0xf7, 0x8f, 0x6b, 0xf1, 0x1d, 0x65, 0x8b, 0x47, 0x48, 0xcc, 0x90,
+    0xb5, 0xf4, 0x5f, 0x63, 0x4f, 0x3c, 0x10, 0x14, 0x07, 0x01, 0x32, 0x76, 0x99, 0x3e, 0x5c, 0xfa,
+    0x9c, 0x71, 0x45, 0xcd, 0xce, 0xab, 0x69, 0xaf, 0x2e, 0x8d, 0xa3, 0x2c, 0xad, 0xe0, 0x46, 0x91,
+    0x23, 0x79, 0x22, 0x8b, 0xcc, 0xb7, 0xf2, 0x1f, 0x1e, 0x79, 0xf3, 0xf0, 0x48, 0x19, 0x69, 0x32,
+    0xdb, 0xbe, 0x5e, 0x79, 0x18, 0xe3, 0x5e, 0x58, 0x73, 0x38, 0x2f, 0x81, 0x2b, 0xae, 0xdc, 0xde,
+    0xbd, 0xfc, 0x88, 0xbc, 0xad, 0xcc, 0xfe, 0x2e, 0xbe, 0x87, 0xff, 0xd1, 0x5d, 0x77, 0xfe, 0x29,
+    0xdf, 0xb3, 0xff, 0x00, 0xc2, 0xb2, 0xfd, 0xef, 0x9f, 0xbb, 0xfb, 0x43, 0xfb, 0x3f, 0xfd, 0x37,
+    0x1b, 0x71, 0xe5, 0xee, 0xce, 0xfd, 0x9d, 0x64, 0xc7, 0x4c, 0xf3, 0xd7, 0x1c, 0x4b, 0x73, 0x6d,
+    0xa5, 0x5a, 0x68, 0x2b, 0xac, 0xe8, 0xcd, 0x13, 0x78, 0xed, 0xa3, 0x49, 0x1e, 0x38, 0xa5, 0xf3,
+    0x2e, 0x3c, 0xf7, 0xc7, 0x9e, 0x3c, 0x8c, 0x90, 0x0e, 0x1a, 0x4c, 0xae, 0xdf, 0x97, 0x9e, 0x06,
+    0x38, 0xd9, 0x39, 0x35, 0x16, 0xfe, 0x27, 0xf1, 0x7a, 0x79, 0xf6, 0xd3, 0xae, 0x86, 0xba, 0x5d,
+    0xa5, 0xb2, 0xdb, 0xd7, 0xf5, 0x0d, 0x16, 0xdb, 0x4a, 0xd7, 0xec, 0xde, 0xeb, 0xe2, 0x3b, 0x45,
+    0x16, 0xb0, 0x92, 0x18, 0xe1, 0x5b, 0xe9, 0x7e, 0xc6, 0xfe, 0x40, 0x00, 0xa9, 0x08, 0x0a, 0x64,
+    0x6e, 0x32, 0x7c, 0xd8, 0xf5, 0x19, 0xe2, 0x8a, 0x89, 0xd4, 0xc4, 0x42, 0x4e, 0x34, 0x6f, 0xcb,
+    0xd3, 0x4b, 0xfe, 0x25, 0x46, 0x34, 0xa4, 0xaf, 0x53, 0x7f, 0x53, 0xff, 0xd2, 0xd8, 0xf8, 0xd5,
+    0xff, 0x00, 0x22, 0x75, 0x9f, 0xfd, 0x84, 0x13, 0xff, 0x00, 0x45, 0xc9, 0x47, 0x86, 0xbf, 0xe4,
+    0x84, 0x4f, 0xff, 0x00, 0x60, 0xfb, 0xdf, 0xfd, 0x0a, 0x5a, 0x71, 0xff, 0x00, 0x76, 0x87, 0xf8,
+    0x8e, 0x87, 0xfc, 0x69, 0x7a, 0x19, 0x1f, 0x03, 0x7f, 0xe6, 0x3d, 0xff, 0x00, 0x6e, 0xff, 0x00,
+    0xfb, 0x52, 0xb1, 0xfc, 0x35, 0xff, 0x00, 0x25, 0xde, 0x7f, 0xfb, 0x08, 0x5e, 0xff, 0x00, 0xe8,
+    0x32, 0xd7, 0x44, 0xff, 0x00, 0x8b, 0x5b, 0xfc, 0x3f, 0xa1, 0x94, 0x7e, 0x0a, 0x7e, 0xbf, 0xa9,
+    0xff, 0xd3, 0xc8, 0xf8, 0xd5, 0xff, 0x00, 0x23, 0x8d, 0x9f, 0xfd, 0x83, 0xd3, 0xff, 0x00, 0x46,
+    0x49, 0x45, 0x7a, 0x98, 0x4f, 0xe0, 0x47, 0xd0, 0xce, 0xbf, 0xf1, 0x19, 0xff, 0xd9
+};
+
+static struct image_u8* luma_image;
+static struct image_u8* dc_image;
+
+void setUp() {
+    luma_image = image_u8_create(WIDTH, HEIGHT);
+    dc_image = image_u8_create(decimated_size(WIDTH, JPEG_BLOCK_SIZE), decimated_size(HEIGHT, JPEG_BLOCK_SIZE));
+}
+
+void tearDown() {
+    image_u8_destroy(dc_image);
+    image_u8_destroy(luma_image);
+}
+
+void test_dc_image_holds_the_mean_of_every_block() {
+    TEST_ASSERT_EQUAL_INT(0, decode_jpeg_dc_luma(CHECKERBOARD_JPEG, sizeof(CHECKERBOARD_JPEG), dc_image));
+
+    // Every pixel is the mean of the block pjpeg decodes, up to the rounding of its inverse DCT
+    int error = 0;
+    pjpeg_t* jpeg = pjpeg_create_from_buffer((uint8_t*) CHECKERBOARD_JPEG, sizeof(CHECKERBOARD_JPEG), PJPEG_MJPEG,
+                                             &error);
+    TEST_ASSERT_NOT_NULL(jpeg);
+    struct image_u8* expected = pjpeg_to_u8_baseline(jpeg);
+    pjpeg_destroy(jpeg);
+    for (int block_y = 0; block_y < HEIGHT / JPEG_BLOCK_SIZE; ++block_y) {
+        for (int block_x = 0; block_x < WIDTH / JPEG_BLOCK_SIZE; ++block_x) {
+            int sum = 0;
+            for (int y = 0; y < JPEG_BLOCK_SIZE; ++y) {
+                for (int x = 0; x < JPEG_BLOCK_SIZE; ++x) {
+                    sum += expected->buf[(block_y * JPEG_BLOCK_SIZE + y) * expected->stride +
+                                         block_x * JPEG_BLOCK_SIZE + x];
+                }
+            }
+            TEST_ASSERT_INT_WITHIN(1, sum / 64, dc_image->buf[block_y * dc_image->stride + block_x]);
+        }
+    }
+    image_u8_destroy(expected);
+}
+
+void test_rejects_frames_it_cannot_decode() {
+    TEST_ASSERT_EQUAL_INT(-1, decode_jpeg_dc_luma(CHECKERBOARD_JPEG, sizeof(CHECKERBOARD_JPEG) / 2, dc_image));
+    TEST_ASSERT_EQUAL_INT(-1, decode_jpeg_dc_luma(&CHECKERBOARD_JPEG[2], sizeof(CHECKERBOARD_JPEG) - 2, dc_image));
+
+    struct image_u8* wrong_size = image_u8_create(dc_image->width, dc_image->height + 1);
+    TEST_ASSERT_EQUAL_INT(-1, decode_jpeg_dc_luma(CHECKERBOARD_JPEG, sizeof(CHECKERBOARD_JPEG), wrong_size));
+    image_u8_destroy(wrong_size);
+
+    // The same frame header announcing a progressive JPEG
+    uint8_t progressive[sizeof(CHECKERBOARD_JPEG)];
+    memcpy(progressive, CHECKERBOARD_JPEG, sizeof(progressive));
+    for (int i = 0; i + 1 < sizeof(progressive); ++i) {
+        if (progressive[i] == 0xff && progressive[i + 1] == 0xc0) {
+            progressive[i + 1] = 0xc2;
+            break;
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(JPEG_LUMA_UNSUPPORTED, decode_jpeg_dc_luma(progressive, sizeof(progressive), dc_image));
+}
+
+void test_mjpeg_converters_decode_frames() {
+    struct camera_format format = {
+        .pixelformat = V4L2_PIX_FMT_MJPEG,
+        .width = WIDTH,
+        .height = HEIGHT,
+        .sizeimage = WIDTH * HEIGHT * 2
+    };
+    luma_converter convert = select_luma_converter(V4L2_PIX_FMT_MJPEG);
+    TEST_ASSERT_EQUAL_PTR(convert_mjpeg_to_luma, convert);
+    TEST_ASSERT_EQUAL_INT(0, convert(CHECKERBOARD_JPEG, sizeof(CHECKERBOARD_JPEG), &format, luma_image));
+    TEST_ASSERT_EQUAL_INT(0, convert_mjpeg_to_dc_luma(CHECKERBOARD_JPEG, sizeof(CHECKERBOARD_JPEG), &format,
+                                                      dc_image));
+    TEST_ASSERT_EQUAL_INT(-1, convert_mjpeg_to_dc_luma(CHECKERBOARD_JPEG, sizeof(CHECKERBOARD_JPEG), &format,
+                                                       luma_image));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_dc_image_holds_the_mean_of_every_block);
+    RUN_TEST(test_rejects_frames_it_cannot_decode);
+    RUN_TEST(test_mjpeg_converters_decode_frames);
+    return UNITY_END();
+}
@@ -0,0 +1,110 @@
+#include <math.h>
+#include "unity.h"
+#include "lens_undistortion.h"
+
+#define WIDTH 800
+#define HEIGHT 600
+#define CELL_SIZE 8
+
+// A typical webcam lens, barrel distortion moves the image corners by tens of pixels
+static const struct camera_intrinsics intrinsics = { .fx = 620, .fy = 615, .cx = 402.3, .cy = 297.8 };
+static const struct lens_distortion distortion = { .k1 = -0.28, .k2 = 0.09, .p1 = 0.0012, .p2 = -0.0007, .k3 = -0.01 };
+
+static struct undistortion_table* table;
+
+void setUp() {
+    table = undistortion_table_create(&intrinsics, &distortion, WIDTH, HEIGHT, CELL_SIZE);
+    TEST_ASSERT_NOT_NULL(table);
+}
+
+void tearDown() {
+    undistortion_table_destroy(table);
+}
+
+/**
+ * Where the lens images an undistorted point, the forward model the table inverts
+ */
+static void distort_point(double x, double y, double* distorted_x, double* distorted_y) {
+    double ideal_x = (x - intrinsics.cx) / intrinsics.fx;
+    double ideal_y = (y - intrinsics.cy) / intrinsics.fy;
+    double r2 = ideal_x * ideal_x + ideal_y * ideal_y;
+    double radial = 1 + distortion.k1 * r2 + distortion.k2 * r2 * r2 + distortion.k3 * r2 * r2 * r2;
+    double lens_x = ideal_x * radial + 2 * distortion.p1 * ideal_x * ideal_y +
+                    distortion.p2 * (r2 + 2 * ideal_x * ideal_x);
+    double lens_y = ideal_y * radial + distortion.p1 * (r2 + 2 * ideal_y * ideal_y) +
+                    2 * distortion.p2 * ideal_x * ideal_y;
+    *distorted_x = lens_x * intrinsics.fx + intrinsics.cx;
+    *distorted_y = lens_y * intrinsics.fy + intrinsics.cy;
+}
+
+void test_exact_undistortion_inverts_the_lens() {
+    for (double y = 0; y < HEIGHT; y += 37) {
+        for (double x = 0; x < WIDTH; x += 41) {
+            double distorted_x, distorted_y, undistorted_x, undistorted_y;
+            distort_point(x, y, &distorted_x, &distorted_y);
+            undistort_point_exact(&intrinsics, &distortion, distorted_x, distorted_y, &undistorted_x, &undistorted_y);
+            TEST_ASSERT_DOUBLE_WITHIN(0.001, x, undistorted_x);
+            TEST_ASSERT_DOUBLE_WITHIN(0.001, y, undistorted_y);
+        }
+    }
+}
+
+void test_table_matches_exact_undistortion() {
+    double max_error = 0;
+    // Off the grid nodes, across the whole image including the last pixels
+    for (double y = 0.3; y < HEIGHT; y += 7.7) {
+        for (double x = 0.6; x < WIDTH; x += 9.1) {
+            double exact_x, exact_y, table_x, table_y;
+            undistort_point_exact(&intrinsics, &distortion, x, y, &exact_x, &exact_y);
+            undistort_point(table, x, y, &table_x, &table_y);
+            max_error = fmax(max_error, hypot(table_x - exact_x, table_y - exact_y));
+        }
+    }
+    TEST_ASSERT_DOUBLE_WITHIN(0.05, 0, max_error);
+}
+
+void test_table_without_distortion_is_the_identity() {
+    struct lens_distortion no_distortion = { 0 };
+    struct undistortion_table* identity = undistortion_table_create(&intrinsics, &no_distortion, 100, 50, 32);
+    TEST_ASSERT_NOT_NULL(identity);
+    TEST_ASSERT_EQUAL_INT(5, identity->columns);
+    TEST_ASSERT_EQUAL_INT(3, identity->rows);
+
+    // The last pixel and points past the edge are extrapolated from the edge cells
+    double points[][2] = { { 0, 0 }, { 12.25, 40.5 }, { 99, 49 }, { 99.9, 49.9 }, { -3, 55 } };
+    for (int i = 0; i < sizeof(points) / sizeof(points[0]); ++i) {
+        double x, y;
+        undistort_point(identity, points[i][0], points[i][1], &x, &y);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-4, points[i][0], x);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-4, points[i][1], y);
+    }
+    undistortion_table_destroy(identity);
+}
+
+void test_tag_corners_are_undistorted() {
+    // A square tag seen through the lens near the top left corner of the image, where distortion is strongest
+    double ideal[5][2] = { { 60, 110 }, { 140, 110 }, { 140, 30 }, { 60, 30 }, { 100, 70 } };
+    struct tag_corners corners;
+    for (int i = 0; i < 4; ++i) {
+        distort_point(ideal[i][0], ideal[i][1], &corners.corners[i][0], &corners.corners[i][1]);
+    }
+    distort_point(ideal[4][0], ideal[4][1], &corners.center[0], &corners.center[1]);
+    TEST_ASSERT_TRUE(hypot(corners.corners[3][0] - ideal[3][0], corners.corners[3][1] - ideal[3][1]) > 10);
+
+    undistort_tag_corners(table, &corners);
+    for (int i = 0; i < 4; ++i) {
+        TEST_ASSERT_DOUBLE_WITHIN(0.05, ideal[i][0], corners.corners[i][0]);
+        TEST_ASSERT_DOUBLE_WITHIN(0.05, ideal[i][1], corners.corners[i][1]);
+    }
+    TEST_ASSERT_DOUBLE_WITHIN(0.05, ideal[4][0], corners.center[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(0.05, ideal[4][1], corners.center[1]);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_exact_undistortion_inverts_the_lens);
+    RUN_TEST(test_table_matches_exact_undistortion);
+    RUN_TEST(test_table_without_distortion_is_the_identity);
+    RUN_TEST(test_tag_corners_are_undistorted);
+    return UNITY_END();
+}
@@ -0,0 +1,236 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "apriltag/common/image_u8.h"
+#include "frame_conversion.h"
+#include "luma_kernels.h"
+
+// Widths below, at and across every vector size, including odd ones that leave a scalar tail
+#define MAX_WIDTH 200
+#define CANARY 0xA5
+
+// Room for the widest source pixels (RGB24)
+static uint8_t source_row[MAX_WIDTH * 3];
+
+void setUp() {
+    srand(1);
+    for (int i = 0; i < sizeof(source_row); ++i) {
+        source_row[i] = (uint8_t) rand();
+    }
+}
+
+void tearDown() {
+    set_luma_kernels(detect_simd_level());
+}
+
+/**
+ * Runs a kernel into a buffer followed by canary bytes and checks it against the scalar reference
+ */
+static void check_kernel(luma_row_kernel kernel, luma_row_kernel reference, const char* name) {
+    uint8_t expected[MAX_WIDTH];
+    uint8_t actual[MAX_WIDTH + 32];
+
+    for (int width = 1; width <= MAX_WIDTH; ++width) {
+        reference(source_row, expected, width);
+        memset(actual, CANARY, sizeof(actual));
+        kernel(source_row, actual, width);
+
+        TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(expected, actual, width, name);
+        for (int x = width; x < sizeof(actual); ++x) {
+            TEST_ASSERT_EQUAL_UINT8_MESSAGE(CANARY, actual[x], name);
+        }
+    }
+}
+
+void test_every_supported_level_matches_the_scalar_reference() {
+    const struct luma_kernels* scalar = get_luma_kernels(SIMD_SCALAR);
+    TEST_ASSERT_NOT_NULL(scalar);
+
+    for (int level = SIMD_SCALAR; level < SIMD_LEVEL_COUNT; ++level) {
+        const struct luma_kernels* kernels = get_luma_kernels(level);
+        if (kernels == NULL)
+            continue;
+
+        check_kernel(kernels->plane_row, scalar->plane_row, kernels->name);
+        check_kernel(kernels->yuyv_row, scalar->yuyv_row, kernels->name);
+        check_kernel(kernels->uyvy_row, scalar->uyvy_row, kernels->name);
+        check_kernel(kernels->y10_row, scalar->y10_row, kernels->name);
+        check_kernel(kernels->rgb24_row, scalar->rgb24_row, kernels->name);
+        check_kernel(kernels->bgr24_row, scalar->bgr24_row, kernels->name);
+    }
+}
+
+void test_every_supported_level_stretches_like_the_scalar_reference() {
+    const struct luma_kernels* scalar = get_luma_kernels(SIMD_SCALAR);
+    // No stretch, a small one, the largest contrast_stretch_from_stats builds and one that clips most values
+    const struct { uint8_t low; uint16_t gain; } stretches[] = { { 0, 256 }, { 30, 300 }, { 16, 4096 }, { 200, 1024 } };
+    uint8_t expected[MAX_WIDTH];
+    uint8_t actual[MAX_WIDTH + 32];
+
+    for (int level = SIMD_SCALAR; level < SIMD_LEVEL_COUNT; ++level) {
+        const struct luma_kernels* kernels = get_luma_kernels(level);
+        if (kernels == NULL)
+            continue;
+
+        for (int i = 0; i < sizeof(stretches) / sizeof(stretches[0]); ++i) {
+            for (int width = 1; width <= MAX_WIDTH; ++width) {
+                memcpy(expected, source_row, width);
+                scalar->stretch_row(expected, width, stretches[i].low, stretches[i].gain);
+                memset(actual, CANARY, sizeof(actual));
+                memcpy(actual, source_row, width);
+                kernels->stretch_row(actual, width, stretches[i].low, stretches[i].gain);
+
+                TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(expected, actual, width, kernels->name);
+                for (int x = width; x < sizeof(actual); ++x) {
+                    TEST_ASSERT_EQUAL_UINT8_MESSAGE(CANARY, actual[x], kernels->name);
+                }
+            }
+        }
+    }
+
+    uint8_t row[4] = { 10, 30, 100, 255 };
+    scalar->stretch_row(row, 4, 30, 512);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(((uint8_t[]) { 0, 0, 140, 255 }), row, 4);
+}
+
+void test_scalar_reference_picks_the_luma_bytes() {
+    const struct luma_kernels* scalar = get_luma_kernels(SIMD_SCALAR);
+    const uint8_t yuyv[8] = { 10, 128, 20, 129, 30, 130, 40, 131 };
+    uint8_t luma[4];
+
+    scalar->yuyv_row(yuyv, luma, 4);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(((uint8_t[]) { 10, 20, 30, 40 }), luma, 4);
+    scalar->uyvy_row(yuyv, luma, 4);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(((uint8_t[]) { 128, 129, 130, 131 }), luma, 4);
+
+    // 0x3ff, 0x000, 0x155 and 0x2aa with junk in the unused top bits
+    const uint8_t y10[8] = { 0xff, 0x03, 0x00, 0xfc, 0x55, 0x01, 0xaa, 0x02 };
+    scalar->y10_row(y10, luma, 4);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(((uint8_t[]) { 255, 0, 0x55, 0xaa }), luma, 4);
+
+    const uint8_t rgb[12] = { 255, 255, 255, 255, 0, 0, 0, 255, 0, 0, 0, 255 };
+    scalar->rgb24_row(rgb, luma, 4);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(((uint8_t[]) { 255, 77, 149, 29 }), luma, 4);
+    scalar->bgr24_row(rgb, luma, 4);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(((uint8_t[]) { 255, 29, 149, 77 }), luma, 4);
+}
+
+void test_detected_level_is_active_and_supported() {
+    enum simd_level level = detect_simd_level();
+    TEST_ASSERT_NOT_NULL(get_luma_kernels(level));
+    TEST_ASSERT_EQUAL_INT(level, active_luma_kernels()->level);
+    TEST_ASSERT_EQUAL_INT(-1, set_luma_kernels(SIMD_LEVEL_COUNT));
+}
+
+void test_converter_honors_bytesperline_with_every_level() {
+    // 70 pixels leave a tail for every vector width, the padding bytes must never show up in the image
+    struct camera_format format = {
+        .pixelformat = V4L2_PIX_FMT_YUYV,
+        .width = 70,
+        .height = 3,
+        .bytesperline = 70 * 2 + 24,
+    };
+    format.sizeimage = format.bytesperline * format.height;
+    uint8_t* frame = malloc(format.sizeimage);
+    for (int i = 0; i < format.sizeimage; ++i) {
+        frame[i] = (i % format.bytesperline) >= format.width * 2 ? 0xff : (uint8_t) (i / 2);
+    }
+
+    struct image_u8* image = image_u8_create(format.width, format.height);
+    for (int level = SIMD_SCALAR; level < SIMD_LEVEL_COUNT; ++level) {
+        if (set_luma_kernels(level) == -1)
+            continue;
+
+        TEST_ASSERT_EQUAL_INT(0, convert_yuyv_to_luma(frame, format.sizeimage, &format, image));
+        for (int y = 0; y < format.height; ++y) {
+            for (int x = 0; x < format.width; ++x) {
+                TEST_ASSERT_EQUAL_UINT8(frame[y * format.bytesperline + x * 2], image->buf[y * image->stride + x]);
+            }
+        }
+    }
+
+    image_u8_destroy(image);
+    free(frame);
+}
+
+/**
+ * Luma of pixel x of a source row, written straight from the format definitions as the reference for the converters
+ */
+static uint8_t reference_luma(uint32_t pixelformat, const uint8_t* row, int x) {
+    switch (pixelformat) {
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_YVYU:
+            return row[x * 2];
+        case V4L2_PIX_FMT_UYVY:
+        case V4L2_PIX_FMT_VYUY:
+        case V4L2_PIX_FMT_Y16:
+            return row[x * 2 + 1];
+        case V4L2_PIX_FMT_Y10:
+            return (((row[x * 2 + 1] & 0x03) << 8) | row[x * 2]) >> 2;
+        case V4L2_PIX_FMT_RGB24:
+            return (uint8_t) lround(0.299 * row[x * 3] + 0.587 * row[x * 3 + 1] + 0.114 * row[x * 3 + 2]);
+        case V4L2_PIX_FMT_BGR24:
+            return (uint8_t) lround(0.299 * row[x * 3 + 2] + 0.587 * row[x * 3 + 1] + 0.114 * row[x * 3]);
+        default:
+            return row[x];
+    }
+}
+
+void test_every_format_matches_the_reference_with_every_level() {
+    const struct { uint32_t pixelformat; int bytes_per_pixel; } formats[] = {
+        { V4L2_PIX_FMT_GREY, 1 }, { V4L2_PIX_FMT_NV12, 1 }, { V4L2_PIX_FMT_NV21, 1 },
+        { V4L2_PIX_FMT_YUYV, 2 }, { V4L2_PIX_FMT_YVYU, 2 }, { V4L2_PIX_FMT_UYVY, 2 }, { V4L2_PIX_FMT_VYUY, 2 },
+        { V4L2_PIX_FMT_Y10, 2 }, { V4L2_PIX_FMT_Y16, 2 }, { V4L2_PIX_FMT_RGB24, 3 }, { V4L2_PIX_FMT_BGR24, 3 },
+    };
+
+    for (int i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+        // 70 pixels leave a tail for every vector width and the rows are padded on both sides of the conversion
+        struct camera_format format = {
+            .pixelformat = formats[i].pixelformat,
+            .width = 70,
+            .height = 5,
+            .bytesperline = 70 * formats[i].bytes_per_pixel + 24,
+        };
+        format.sizeimage = format.bytesperline * format.height;
+        uint8_t* frame = malloc(format.sizeimage);
+        for (int j = 0; j < format.sizeimage; ++j) {
+            frame[j] = (uint8_t) rand();
+        }
+
+        luma_converter convert = select_luma_converter(format.pixelformat);
+        TEST_ASSERT_NOT_NULL(convert);
+        struct image_u8* image = image_u8_create(format.width, format.height);
+        for (int level = SIMD_SCALAR; level < SIMD_LEVEL_COUNT; ++level) {
+            if (set_luma_kernels(level) == -1)
+                continue;
+
+            memset(image->buf, CANARY, image->stride * image->height);
+            TEST_ASSERT_EQUAL_INT(0, convert(frame, format.sizeimage, &format, image));
+            for (int y = 0; y < format.height; ++y) {
+                const uint8_t* row = &frame[y * format.bytesperline];
+                for (int x = 0; x < format.width; ++x) {
+                    TEST_ASSERT_INT_WITHIN(formats[i].bytes_per_pixel == 3 ? 1 : 0,
+                                           reference_luma(format.pixelformat, row, x), image->buf[y * image->stride + x]);
+                }
+                for (int x = format.width; x < image->stride; ++x) {
+                    TEST_ASSERT_EQUAL_UINT8(CANARY, image->buf[y * image->stride + x]);
+                }
+            }
+        }
+
+        image_u8_destroy(image);
+        free(frame);
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_every_supported_level_matches_the_scalar_reference);
+    RUN_TEST(test_every_supported_level_stretches_like_the_scalar_reference);
+    RUN_TEST(test_scalar_reference_picks_the_luma_bytes);
+    RUN_TEST(test_detected_level_is_active_and_supported);
+    RUN_TEST(test_converter_honors_bytesperline_with_every_level);
+    RUN_TEST(test_every_format_matches_the_reference_with_every_level);
+    return UNITY_END();
+}
@@ -0,0 +1,94 @@
+#include <string.h>
+#include "unity.h"
+#include "apriltag/common/image_u8.h"
+#include "luma_stats.h"
+
+static struct image_u8* image;
+
+void setUp() {
+    image = image_u8_create(64, 48);
+}
+
+void tearDown() {
+    image_u8_destroy(image);
+}
+
+static void fill_image(int left, int top, int width, int height, uint8_t luma) {
+    for (int y = top; y < top + height; ++y) {
+        memset(image->buf + y * image->stride + left, luma, width);
+    }
+}
+
+void test_compute_luma_stats() {
+    // Half the image at 10, a quarter at 50 and a quarter at 90
+    fill_image(0, 0, 64, 24, 10);
+    fill_image(0, 24, 32, 24, 50);
+    fill_image(32, 24, 32, 24, 90);
+
+    struct luma_stats stats;
+    compute_luma_stats(image, &stats);
+    // Every 4th pixel of every 4th row is sampled
+    TEST_ASSERT_EQUAL_UINT32(16 * 12, stats.sample_count);
+    TEST_ASSERT_EQUAL_UINT32(16 * 6, stats.histogram[10]);
+    TEST_ASSERT_EQUAL_UINT32(8 * 6, stats.histogram[50]);
+    TEST_ASSERT_EQUAL_UINT32(8 * 6, stats.histogram[90]);
+    TEST_ASSERT_EQUAL_UINT8(10, stats.min);
+    TEST_ASSERT_EQUAL_UINT8(90, stats.max);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-9, 40, stats.mean);
+    // (2 * 30^2 + 10^2 + 50^2) / 4
+    TEST_ASSERT_DOUBLE_WITHIN(1e-9, 1100, stats.variance);
+}
+
+void test_contrast_stretch_maps_the_used_range_onto_the_full_range() {
+    // A dim frame, half at 40 and half at 100 with a few outliers that are clipped
+    struct luma_stats stats;
+    luma_stats_reset(&stats);
+    stats.histogram[40] = 1000;
+    stats.histogram[100] = 1000;
+    stats.histogram[5] = 5;
+    stats.histogram[250] = 5;
+    luma_stats_finish(&stats);
+
+    struct contrast_stretch stretch;
+    contrast_stretch_from_stats(&stats, 0.01, 16, &stretch);
+    TEST_ASSERT_TRUE(stretch.enabled);
+    TEST_ASSERT_EQUAL_UINT8(40, stretch.low);
+    TEST_ASSERT_EQUAL_UINT8(0, stretch.table[5]);
+    TEST_ASSERT_EQUAL_UINT8(0, stretch.table[40]);
+    TEST_ASSERT_EQUAL_UINT8(255, stretch.table[100]);
+    TEST_ASSERT_EQUAL_UINT8(255, stretch.table[250]);
+    for (int value = 1; value < 256; ++value) {
+        TEST_ASSERT_TRUE(stretch.table[value] >= stretch.table[value - 1]);
+    }
+
+    // The gain is capped, 255 / 60 is more than 4
+    contrast_stretch_from_stats(&stats, 0.01, 4, &stretch);
+    TEST_ASSERT_EQUAL_UINT(4 * 256, stretch.gain);
+    TEST_ASSERT_EQUAL_UINT8(240, stretch.table[100]);
+
+    // Metering the stretched luma sees the original values again, the dark outliers were clipped onto low
+    uint32_t histogram[256] = { 0 };
+    for (int value = 0; value < 256; ++value) {
+        histogram[stretch.table[value]] += stats.histogram[value];
+    }
+    contrast_stretch_unmap_histogram(&stretch, histogram);
+    TEST_ASSERT_EQUAL_UINT32(1005, histogram[40]);
+    TEST_ASSERT_EQUAL_UINT32(1000, histogram[100]);
+    // Clipped values can't be told apart, the bright outliers land on 104, the first value stretched to 255
+    TEST_ASSERT_EQUAL_UINT32(5, histogram[104]);
+
+    // A frame that already spans the range is left alone
+    stats.histogram[0] = 100;
+    stats.histogram[255] = 100;
+    luma_stats_finish(&stats);
+    contrast_stretch_from_stats(&stats, 0.01, 16, &stretch);
+    TEST_ASSERT_FALSE(stretch.enabled);
+    TEST_ASSERT_EQUAL_UINT8(200, stretch.table[200]);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_compute_luma_stats);
+    RUN_TEST(test_contrast_stretch_maps_the_used_range_onto_the_full_range);
+    return UNITY_END();
+}